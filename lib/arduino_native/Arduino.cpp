@@ -0,0 +1,16 @@
+#include "Arduino.h"
+
+#include <stdarg.h>
+
+NativeSerial Serial;
+
+size_t NativeSerial::printf(const char* format, ...) {
+    if (!enabled) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n > 0 ? (size_t)n : 0;
+}
@@ -0,0 +1,52 @@
+#ifndef ARDUINO_NATIVE_H
+#define ARDUINO_NATIVE_H
+
+// Минимальная замена Arduino.h для нативной (Linux) сборки.
+// Только то, чем пользуются модули хранилища (NvsUtils, DeviceSettingsUtils):
+// String поверх std::string и Serial, печатающий в stdout.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+
+class String {
+public:
+    String() {}
+    String(const char* s) : value(s ? s : "") {}
+    String(char c) : value(1, c) {}
+
+    size_t length() const { return value.size(); }
+    const char* c_str() const { return value.c_str(); }
+    char operator[](size_t index) const { return index < value.size() ? value[index] : '\0'; }
+
+    String& operator+=(const String& s) { value += s.value; return *this; }
+    String& operator+=(const char* s) { if (s) value += s; return *this; }
+    String& operator+=(char c) { value += c; return *this; }
+
+    bool operator==(const String& s) const { return value == s.value; }
+    bool operator==(const char* s) const { return value == (s ? s : ""); }
+    bool operator!=(const String& s) const { return value != s.value; }
+
+private:
+    std::string value;
+};
+
+class NativeSerial {
+public:
+    // В тестах вывод модулей мешает отчёту Unity: печать включается явно
+    bool enabled = false;
+
+    size_t print(const char* s) { return enabled ? (size_t)fputs(s, stdout) : 0; }
+    size_t print(const String& s) { return print(s.c_str()); }
+    size_t println(const char* s = "") { size_t n = print(s); return n + print("\n"); }
+    size_t println(const String& s) { return println(s.c_str()); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern NativeSerial Serial;
+
+#endif // ARDUINO_NATIVE_H
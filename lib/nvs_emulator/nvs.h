@@ -0,0 +1,4 @@
+#pragma once
+
+// Заглушка заголовка ESP-IDF для нативной сборки: всё объявлено в эмуляторе NVS.
+#include "nvs_emulator.h"
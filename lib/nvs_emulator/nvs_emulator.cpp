@@ -0,0 +1,802 @@
+#include "nvs_emulator.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <chrono>
+
+// Модель раздела NVS:
+// - раздел состоит из страниц, страница - из 32-байтных записей (слотов);
+// - элемент занимает 1 слот (числа) или 1 + ceil(len/32) слотов (строки и блобы);
+// - перезапись ключа = запись нового элемента + пометка старого стёртым;
+// - одна пустая страница всегда держится в резерве для сборки мусора;
+// - пространства имён хранятся как элементы U8 в пространстве 0, как в ESP-IDF.
+//
+// В отличие от ESP-IDF, nvs_set_* не пишет во флеш сразу: изменения копятся в handle
+// и записываются в nvs_commit. Незакоммиченные изменения теряются при nvs_close.
+// Это строже, чем реальное поведение, и позволяет ловить пропущенные commit,
+// а также моделировать потерю питания посреди записи набора ключей.
+
+namespace {
+
+    const size_t ENTRY_SIZE = 32;
+    const size_t MAX_STR_SIZE = 4000;
+    const uint8_t NS_INDEX_NONE = 0;
+
+    enum class PageState : uint8_t {
+        Empty,
+        Active,
+        Full
+    };
+
+    struct Item {
+        uint8_t nsIndex;
+        nvs_type_t type;
+        std::string key;
+        std::vector<uint8_t> data;
+        uint8_t span;
+        uint32_t seq;       // Порядковый номер записи, для восстановления дубликатов
+        bool crcValid;
+        bool erased;
+    };
+
+    struct Page {
+        PageState state = PageState::Empty;
+        uint32_t eraseCount = 0;
+        int usedSlots = 0;
+        int erasedSlots = 0;
+        std::vector<Item> items;
+    };
+
+    struct PendingOp {
+        enum Kind { Set, Erase, EraseAll } kind;
+        std::string key;
+        nvs_type_t type;
+        std::vector<uint8_t> data;
+    };
+
+    struct Handle {
+        uint8_t nsIndex;
+        bool readOnly;
+        std::vector<PendingOp> pending;
+    };
+
+    struct IteratorState {
+        std::vector<nvs_entry_info_t> entries;
+        size_t position;
+    };
+
+    NvsEmuConfig config;
+    NvsEmuStats stats = {};
+    std::vector<Page> pages;
+    std::map<nvs_handle_t, Handle> handles;
+    nvs_handle_t nextHandle = 1;
+    uint32_t nextSeq = 1;
+    int activePage = -1;
+    bool initialized = false;
+    bool poweredOff = false;
+    bool faultInitNoFreePages = false;
+    bool faultInitNewVersion = false;
+    bool faultCommitNoSpace = false;
+    int64_t powerLossCountdown = -1;   // -1: потеря питания не запланирована
+    bool inCommit = false;
+    uint32_t commitAccumUs = 0;
+
+    bool flashReady() {
+        if (pages.empty()) {
+            nvsEmuReset();
+        }
+        return true;
+    }
+
+    void advance(uint32_t us) {
+        stats.totalUs += us;
+        commitAccumUs += us;
+        if (config.realTime && us > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(us));
+        }
+    }
+
+    // Возвращает false, если на этой операции пропало питание
+    bool flashOp(uint32_t us) {
+        advance(us);
+        if (inCommit && powerLossCountdown >= 0) {
+            if (powerLossCountdown == 0) {
+                poweredOff = true;
+                initialized = false;
+                powerLossCountdown = -1;
+                return false;
+            }
+            powerLossCountdown--;
+        }
+        return true;
+    }
+
+    uint8_t spanFor(nvs_type_t type, size_t size) {
+        if (type == NVS_TYPE_STR || type == NVS_TYPE_BLOB) {
+            return (uint8_t)(1 + (size + ENTRY_SIZE - 1) / ENTRY_SIZE);
+        }
+        return 1;
+    }
+
+    bool keyValid(const char* key) {
+        return key != nullptr && key[0] != '\0';
+    }
+
+    Item* findItem(uint8_t nsIndex, const std::string& key, int* pageOut = nullptr) {
+        Item* found = nullptr;
+        int foundPage = -1;
+        for (size_t p = 0; p < pages.size(); p++) {
+            if (pages[p].state == PageState::Empty) continue;
+            advance(config.entryReadUs);   // Поиск по хеш-списку страницы
+            stats.entryReads++;
+            for (auto& item : pages[p].items) {
+                if (item.erased || !item.crcValid) continue;
+                if (item.nsIndex != nsIndex || item.key != key) continue;
+                // При дубликатах (после сбоя) актуален элемент с большим seq
+                if (found == nullptr || item.seq > found->seq) {
+                    found = &item;
+                    foundPage = (int)p;
+                }
+            }
+        }
+        if (pageOut) *pageOut = foundPage;
+        return found;
+    }
+
+    int countEmptyPages() {
+        int count = 0;
+        for (auto& page : pages) {
+            if (page.state == PageState::Empty) count++;
+        }
+        return count;
+    }
+
+    int takeEmptyPage() {
+        for (size_t p = 0; p < pages.size(); p++) {
+            if (pages[p].state == PageState::Empty) {
+                pages[p].state = PageState::Active;
+                return (int)p;
+            }
+        }
+        return -1;
+    }
+
+    void erasePage(int p) {
+        pages[p].items.clear();
+        pages[p].usedSlots = 0;
+        pages[p].erasedSlots = 0;
+        pages[p].state = PageState::Empty;
+        pages[p].eraseCount++;
+        stats.pageErases++;
+        advance(config.pageEraseUs);
+    }
+
+    bool markErased(Item& item, int p) {
+        if (!flashOp(config.entryEraseUs)) return false;
+        item.erased = true;
+        pages[p].erasedSlots += item.span;
+        stats.entryErases++;
+        return true;
+    }
+
+    // Сборка мусора: переносим живые элементы страницы с наибольшим числом
+    // стёртых слотов на резервную пустую страницу и стираем исходную.
+    bool collectGarbage() {
+        int victim = -1;
+        int bestErased = 0;
+        for (size_t p = 0; p < pages.size(); p++) {
+            if (pages[p].state != PageState::Full) continue;
+            if (pages[p].erasedSlots > bestErased) {
+                bestErased = pages[p].erasedSlots;
+                victim = (int)p;
+            }
+        }
+        if (victim < 0) return false;
+
+        int target = takeEmptyPage();
+        if (target < 0) return false;
+        stats.gcRuns++;
+
+        for (auto& item : pages[victim].items) {
+            if (item.erased || !item.crcValid) continue;
+            pages[target].items.push_back(item);
+            pages[target].usedSlots += item.span;
+            stats.entryWrites += item.span;
+            advance(config.entryWriteUs * item.span);
+        }
+        erasePage(victim);
+        activePage = target;
+        return true;
+    }
+
+    esp_err_t allocateSlots(uint8_t span) {
+        if (span > config.entriesPerPage) return ESP_ERR_NVS_VALUE_TOO_LONG;
+
+        for (int attempt = 0; attempt <= (int)pages.size(); attempt++) {
+            if (activePage >= 0 &&
+                pages[activePage].usedSlots + span <= config.entriesPerPage) {
+                return ESP_OK;
+            }
+            if (activePage >= 0) {
+                pages[activePage].state = PageState::Full;
+                activePage = -1;
+            }
+            // Последняя пустая страница зарезервирована под сборку мусора
+            if (countEmptyPages() > 1) {
+                activePage = takeEmptyPage();
+                continue;
+            }
+            if (!collectGarbage()) {
+                return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+            }
+        }
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    esp_err_t writeItem(uint8_t nsIndex, const std::string& key, nvs_type_t type,
+                        const std::vector<uint8_t>& data) {
+        int oldPage = -1;
+        Item* old = findItem(nsIndex, key, &oldPage);
+        if (old && old->type == type && old->data == data) {
+            stats.skippedWrites++;
+            return ESP_OK;
+        }
+        uint32_t oldSeq = old ? old->seq : 0;
+
+        uint8_t span = spanFor(type, data.size());
+        esp_err_t err = allocateSlots(span);
+        if (err != ESP_OK) return err;
+
+        Item item;
+        item.nsIndex = nsIndex;
+        item.type = type;
+        item.key = key;
+        item.data = data;
+        item.span = span;
+        item.seq = nextSeq++;
+        item.crcValid = true;
+        item.erased = false;
+
+        for (uint8_t i = 0; i < span; i++) {
+            stats.entryWrites++;
+            if (!flashOp(config.entryWriteUs)) {
+                // Питание пропало посреди записи элемента: он остаётся недописанным
+                item.crcValid = false;
+                pages[activePage].items.push_back(item);
+                pages[activePage].usedSlots += span;
+                return ESP_ERR_NVS_INVALID_STATE;
+            }
+        }
+        pages[activePage].items.push_back(item);
+        pages[activePage].usedSlots += span;
+
+        // Сборка мусора могла перенести старый элемент - ищем его заново по seq
+        if (oldSeq != 0) {
+            for (size_t p = 0; p < pages.size(); p++) {
+                for (auto& it : pages[p].items) {
+                    if (it.seq == oldSeq && !it.erased) {
+                        if (!markErased(it, (int)p)) return ESP_ERR_NVS_INVALID_STATE;
+                    }
+                }
+            }
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t eraseItem(uint8_t nsIndex, const std::string& key) {
+        int page = -1;
+        Item* item = findItem(nsIndex, key, &page);
+        if (!item) return ESP_ERR_NVS_NOT_FOUND;
+        return markErased(*item, page) ? ESP_OK : ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    // Восстановление после перезагрузки: стираем недописанные элементы
+    // и оставляем только самую свежую копию каждого ключа.
+    void recover() {
+        for (size_t p = 0; p < pages.size(); p++) {
+            for (auto& item : pages[p].items) {
+                if (item.erased) continue;
+                if (!item.crcValid) {
+                    item.erased = true;
+                    pages[p].erasedSlots += item.span;
+                    continue;
+                }
+                Item* newest = findItem(item.nsIndex, item.key);
+                if (newest && newest != &item && newest->seq > item.seq) {
+                    item.erased = true;
+                    pages[p].erasedSlots += item.span;
+                }
+            }
+        }
+        activePage = -1;
+        for (size_t p = 0; p < pages.size(); p++) {
+            if (pages[p].state == PageState::Active) {
+                activePage = (int)p;
+            }
+        }
+    }
+
+    int findNamespace(const char* name) {
+        Item* item = findItem(NS_INDEX_NONE, name);
+        if (!item || item->data.empty()) return -1;
+        return item->data[0];
+    }
+
+    std::string namespaceName(uint8_t index) {
+        for (auto& page : pages) {
+            for (auto& item : page.items) {
+                if (item.erased || !item.crcValid) continue;
+                if (item.nsIndex == NS_INDEX_NONE && !item.data.empty() && item.data[0] == index) {
+                    return item.key;
+                }
+            }
+        }
+        return "";
+    }
+
+    int createNamespace(const char* name) {
+        bool used[256] = {false};
+        for (auto& page : pages) {
+            for (auto& item : page.items) {
+                if (item.erased || !item.crcValid) continue;
+                if (item.nsIndex == NS_INDEX_NONE && !item.data.empty()) used[item.data[0]] = true;
+            }
+        }
+        for (int i = 1; i < 255; i++) {
+            if (!used[i]) {
+                std::vector<uint8_t> data(1, (uint8_t)i);
+                if (writeItem(NS_INDEX_NONE, name, NVS_TYPE_U8, data) != ESP_OK) return -1;
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    Handle* getHandle(nvs_handle_t handle) {
+        auto it = handles.find(handle);
+        return it == handles.end() ? nullptr : &it->second;
+    }
+
+    esp_err_t setValue(nvs_handle_t handle, const char* key, nvs_type_t type,
+                       const void* value, size_t size) {
+        if (poweredOff || !initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+        Handle* h = getHandle(handle);
+        if (!h) return ESP_ERR_NVS_INVALID_HANDLE;
+        if (h->readOnly) return ESP_ERR_NVS_READ_ONLY;
+        if (!keyValid(key)) return ESP_ERR_NVS_INVALID_NAME;
+        if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) return ESP_ERR_NVS_KEY_TOO_LONG;
+        if (size > MAX_STR_SIZE) return ESP_ERR_NVS_VALUE_TOO_LONG;
+
+        PendingOp op;
+        op.kind = PendingOp::Set;
+        op.key = key;
+        op.type = type;
+        op.data.assign((const uint8_t*)value, (const uint8_t*)value + size);
+        h->pending.push_back(op);
+        return ESP_OK;
+    }
+
+    // Ищет значение сначала в незакоммиченных изменениях handle, затем во флеше
+    esp_err_t lookup(nvs_handle_t handle, const char* key, nvs_type_t type,
+                     const std::vector<uint8_t>** out) {
+        if (poweredOff || !initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+        Handle* h = getHandle(handle);
+        if (!h) return ESP_ERR_NVS_INVALID_HANDLE;
+        if (!keyValid(key)) return ESP_ERR_NVS_INVALID_NAME;
+        if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) return ESP_ERR_NVS_KEY_TOO_LONG;
+
+        for (auto it = h->pending.rbegin(); it != h->pending.rend(); ++it) {
+            if (it->kind == PendingOp::EraseAll) return ESP_ERR_NVS_NOT_FOUND;
+            if (it->key != key) continue;
+            if (it->kind == PendingOp::Erase) return ESP_ERR_NVS_NOT_FOUND;
+            if (it->type != type) return ESP_ERR_NVS_NOT_FOUND;
+            *out = &it->data;
+            return ESP_OK;
+        }
+
+        Item* item = findItem(h->nsIndex, key);
+        if (!item || item->type != type) return ESP_ERR_NVS_NOT_FOUND;
+        stats.entryReads += item->span;
+        advance(config.entryReadUs * item->span);
+        *out = &item->data;
+        return ESP_OK;
+    }
+
+    template<typename T>
+    esp_err_t getValue(nvs_handle_t handle, const char* key, nvs_type_t type, T* out) {
+        const std::vector<uint8_t>* data = nullptr;
+        esp_err_t err = lookup(handle, key, type, &data);
+        if (err != ESP_OK) return err;
+        if (out) memcpy(out, data->data(), sizeof(T));
+        return ESP_OK;
+    }
+
+    esp_err_t getVariable(nvs_handle_t handle, const char* key, nvs_type_t type,
+                          void* out, size_t* length) {
+        if (!length) return ESP_ERR_INVALID_ARG;
+        const std::vector<uint8_t>* data = nullptr;
+        esp_err_t err = lookup(handle, key, type, &data);
+        if (err != ESP_OK) return err;
+        if (out == nullptr) {
+            *length = data->size();
+            return ESP_OK;
+        }
+        if (*length < data->size()) {
+            *length = data->size();
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        memcpy(out, data->data(), data->size());
+        *length = data->size();
+        return ESP_OK;
+    }
+
+} // namespace
+
+struct nvs_opaque_iterator_t {
+    IteratorState state;
+};
+
+// --- nvs_flash.h ---
+
+esp_err_t nvs_flash_init() {
+    flashReady();
+    if (faultInitNoFreePages) {
+        faultInitNoFreePages = false;
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    if (faultInitNewVersion) {
+        faultInitNewVersion = false;
+        return ESP_ERR_NVS_NEW_VERSION_FOUND;
+    }
+    if (initialized) return ESP_OK;
+
+    poweredOff = false;
+    handles.clear();
+    recover();
+    if (activePage < 0) {
+        // Нужна пустая страница под активную и ещё одна в резерве
+        if (countEmptyPages() < 2) return ESP_ERR_NVS_NO_FREE_PAGES;
+        activePage = takeEmptyPage();
+    }
+    initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_deinit() {
+    if (!initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+    initialized = false;
+    handles.clear();
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase() {
+    flashReady();
+    initialized = false;
+    poweredOff = false;
+    handles.clear();
+    for (size_t p = 0; p < pages.size(); p++) {
+        erasePage((int)p);
+    }
+    activePage = -1;
+    return ESP_OK;
+}
+
+// --- nvs.h ---
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    if (poweredOff || !initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+    if (!name || !out_handle) return ESP_ERR_INVALID_ARG;
+    if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE) return ESP_ERR_NVS_KEY_TOO_LONG;
+
+    int nsIndex = findNamespace(name);
+    if (nsIndex < 0) {
+        if (open_mode == NVS_READONLY) return ESP_ERR_NVS_NOT_FOUND;
+        nsIndex = createNamespace(name);
+        if (nsIndex < 0) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    Handle h;
+    h.nsIndex = (uint8_t)nsIndex;
+    h.readOnly = (open_mode == NVS_READONLY);
+    *out_handle = nextHandle++;
+    handles[*out_handle] = h;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    handles.erase(handle);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    if (poweredOff || !initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+    Handle* h = getHandle(handle);
+    if (!h) return ESP_ERR_NVS_INVALID_HANDLE;
+
+    stats.commits++;
+    if (faultCommitNoSpace) {
+        faultCommitNoSpace = false;
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    commitAccumUs = 0;
+    advance(config.commitOverheadUs);
+    inCommit = true;
+
+    esp_err_t result = ESP_OK;
+    std::vector<PendingOp> ops;
+    ops.swap(h->pending);
+    uint8_t nsIndex = h->nsIndex;
+
+    for (auto& op : ops) {
+        esp_err_t err = ESP_OK;
+        if (op.kind == PendingOp::Set) {
+            err = writeItem(nsIndex, op.key, op.type, op.data);
+        } else if (op.kind == PendingOp::Erase) {
+            err = eraseItem(nsIndex, op.key);
+            if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+        } else {
+            for (size_t p = 0; p < pages.size() && err == ESP_OK; p++) {
+                for (auto& item : pages[p].items) {
+                    if (item.erased || item.nsIndex != nsIndex) continue;
+                    if (!markErased(item, (int)p)) {
+                        err = ESP_ERR_NVS_INVALID_STATE;
+                        break;
+                    }
+                }
+            }
+        }
+        if (poweredOff) {
+            result = ESP_ERR_NVS_INVALID_STATE;
+            break;
+        }
+        if (err != ESP_OK && result == ESP_OK) {
+            result = err;
+        }
+    }
+
+    inCommit = false;
+    stats.lastCommitUs = commitAccumUs;
+    if (commitAccumUs > stats.maxCommitUs) stats.maxCommitUs = commitAccumUs;
+    return result;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    if (poweredOff || !initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+    Handle* h = getHandle(handle);
+    if (!h) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (h->readOnly) return ESP_ERR_NVS_READ_ONLY;
+    if (!keyValid(key)) return ESP_ERR_NVS_INVALID_NAME;
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) return ESP_ERR_NVS_KEY_TOO_LONG;
+
+    // Как и ESP-IDF, сообщаем об отсутствии ключа сразу
+    bool exists = false;
+    bool decided = false;
+    for (auto it = h->pending.rbegin(); it != h->pending.rend() && !decided; ++it) {
+        if (it->kind == PendingOp::EraseAll) {
+            decided = true;
+        } else if (it->key == key) {
+            exists = (it->kind == PendingOp::Set);
+            decided = true;
+        }
+    }
+    if (!decided) {
+        exists = findItem(h->nsIndex, key) != nullptr;
+    }
+    if (!exists) return ESP_ERR_NVS_NOT_FOUND;
+
+    PendingOp op;
+    op.kind = PendingOp::Erase;
+    op.key = key;
+    op.type = NVS_TYPE_ANY;
+    h->pending.push_back(op);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    if (poweredOff || !initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+    Handle* h = getHandle(handle);
+    if (!h) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (h->readOnly) return ESP_ERR_NVS_READ_ONLY;
+
+    h->pending.clear();
+    PendingOp op;
+    op.kind = PendingOp::EraseAll;
+    op.type = NVS_TYPE_ANY;
+    h->pending.push_back(op);
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_i8(nvs_handle_t h, const char* key, int8_t v)     { return setValue(h, key, NVS_TYPE_I8, &v, sizeof(v)); }
+esp_err_t nvs_set_u8(nvs_handle_t h, const char* key, uint8_t v)    { return setValue(h, key, NVS_TYPE_U8, &v, sizeof(v)); }
+esp_err_t nvs_set_i16(nvs_handle_t h, const char* key, int16_t v)   { return setValue(h, key, NVS_TYPE_I16, &v, sizeof(v)); }
+esp_err_t nvs_set_u16(nvs_handle_t h, const char* key, uint16_t v)  { return setValue(h, key, NVS_TYPE_U16, &v, sizeof(v)); }
+esp_err_t nvs_set_i32(nvs_handle_t h, const char* key, int32_t v)   { return setValue(h, key, NVS_TYPE_I32, &v, sizeof(v)); }
+esp_err_t nvs_set_u32(nvs_handle_t h, const char* key, uint32_t v)  { return setValue(h, key, NVS_TYPE_U32, &v, sizeof(v)); }
+esp_err_t nvs_set_i64(nvs_handle_t h, const char* key, int64_t v)   { return setValue(h, key, NVS_TYPE_I64, &v, sizeof(v)); }
+esp_err_t nvs_set_u64(nvs_handle_t h, const char* key, uint64_t v)  { return setValue(h, key, NVS_TYPE_U64, &v, sizeof(v)); }
+
+esp_err_t nvs_set_str(nvs_handle_t h, const char* key, const char* value) {
+    if (!value) return ESP_ERR_INVALID_ARG;
+    return setValue(h, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t h, const char* key, const void* value, size_t length) {
+    if (!value && length > 0) return ESP_ERR_INVALID_ARG;
+    return setValue(h, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_i8(nvs_handle_t h, const char* key, int8_t* out)     { return getValue(h, key, NVS_TYPE_I8, out); }
+esp_err_t nvs_get_u8(nvs_handle_t h, const char* key, uint8_t* out)    { return getValue(h, key, NVS_TYPE_U8, out); }
+esp_err_t nvs_get_i16(nvs_handle_t h, const char* key, int16_t* out)   { return getValue(h, key, NVS_TYPE_I16, out); }
+esp_err_t nvs_get_u16(nvs_handle_t h, const char* key, uint16_t* out)  { return getValue(h, key, NVS_TYPE_U16, out); }
+esp_err_t nvs_get_i32(nvs_handle_t h, const char* key, int32_t* out)   { return getValue(h, key, NVS_TYPE_I32, out); }
+esp_err_t nvs_get_u32(nvs_handle_t h, const char* key, uint32_t* out)  { return getValue(h, key, NVS_TYPE_U32, out); }
+esp_err_t nvs_get_i64(nvs_handle_t h, const char* key, int64_t* out)   { return getValue(h, key, NVS_TYPE_I64, out); }
+esp_err_t nvs_get_u64(nvs_handle_t h, const char* key, uint64_t* out)  { return getValue(h, key, NVS_TYPE_U64, out); }
+
+esp_err_t nvs_get_str(nvs_handle_t h, const char* key, char* out, size_t* length) {
+    return getVariable(h, key, NVS_TYPE_STR, out, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t h, const char* key, void* out, size_t* length) {
+    return getVariable(h, key, NVS_TYPE_BLOB, out, length);
+}
+
+esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats) {
+    (void)part_name;
+    if (!nvs_stats) return ESP_ERR_INVALID_ARG;
+    if (poweredOff || !initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+
+    size_t used = 0;
+    size_t namespaces = 0;
+    for (auto& page : pages) {
+        for (auto& item : page.items) {
+            if (item.erased || !item.crcValid) continue;
+            used += item.span;
+            if (item.nsIndex == NS_INDEX_NONE) namespaces++;
+        }
+    }
+    nvs_stats->total_entries = pages.size() * config.entriesPerPage;
+    nvs_stats->used_entries = used;
+    nvs_stats->free_entries = nvs_stats->total_entries - used;
+    nvs_stats->namespace_count = namespaces;
+    return ESP_OK;
+}
+
+nvs_iterator_t nvs_entry_find(const char* part_name, const char* namespace_name, nvs_type_t type) {
+    (void)part_name;
+    if (poweredOff || !initialized) return nullptr;
+
+    int nsFilter = -1;
+    if (namespace_name) {
+        nsFilter = findNamespace(namespace_name);
+        if (nsFilter < 0) return nullptr;
+    }
+
+    nvs_opaque_iterator_t* it = new nvs_opaque_iterator_t();
+    it->state.position = 0;
+    for (auto& page : pages) {
+        for (auto& item : page.items) {
+            if (item.erased || !item.crcValid || item.nsIndex == NS_INDEX_NONE) continue;
+            if (nsFilter >= 0 && item.nsIndex != nsFilter) continue;
+            if (type != NVS_TYPE_ANY && item.type != type) continue;
+            nvs_entry_info_t info = {};
+            strncpy(info.namespace_name, namespaceName(item.nsIndex).c_str(), NVS_KEY_NAME_MAX_SIZE - 1);
+            strncpy(info.key, item.key.c_str(), NVS_KEY_NAME_MAX_SIZE - 1);
+            info.type = item.type;
+            it->state.entries.push_back(info);
+        }
+    }
+    if (it->state.entries.empty()) {
+        delete it;
+        return nullptr;
+    }
+    return it;
+}
+
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator) {
+    if (!iterator) return nullptr;
+    iterator->state.position++;
+    if (iterator->state.position >= iterator->state.entries.size()) {
+        delete iterator;
+        return nullptr;
+    }
+    return iterator;
+}
+
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t* out_info) {
+    if (!iterator || !out_info) return;
+    *out_info = iterator->state.entries[iterator->state.position];
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator) {
+    delete iterator;
+}
+
+// --- Управление эмулятором ---
+
+void nvsEmuReset(const NvsEmuConfig& cfg) {
+    config = cfg;
+    if (config.pageCount < 2) config.pageCount = 2;
+    pages.assign(config.pageCount, Page());
+    handles.clear();
+    stats = NvsEmuStats();
+    nextHandle = 1;
+    nextSeq = 1;
+    activePage = -1;
+    initialized = false;
+    poweredOff = false;
+    faultInitNoFreePages = false;
+    faultInitNewVersion = false;
+    faultCommitNoSpace = false;
+    powerLossCountdown = -1;
+    inCommit = false;
+}
+
+void nvsEmuInjectFault(NvsEmuFault fault) {
+    flashReady();
+    switch (fault) {
+        case NvsEmuFault::InitNoFreePages: faultInitNoFreePages = true; break;
+        case NvsEmuFault::InitNewVersion:  faultInitNewVersion = true; break;
+        case NvsEmuFault::CommitNoSpace:   faultCommitNoSpace = true; break;
+    }
+}
+
+void nvsEmuSchedulePowerLoss(uint32_t writesBeforeLoss) {
+    flashReady();
+    powerLossCountdown = writesBeforeLoss;
+}
+
+bool nvsEmuCorruptEntry(const char* namespace_name, const char* key) {
+    flashReady();
+    int nsIndex = findNamespace(namespace_name);
+    if (nsIndex < 0) return false;
+    Item* item = findItem((uint8_t)nsIndex, key);
+    if (!item) return false;
+    item->crcValid = false;
+    return true;
+}
+
+bool nvsEmuIsPoweredOff() {
+    return poweredOff;
+}
+
+const NvsEmuStats& nvsEmuGetStats() {
+    return stats;
+}
+
+void nvsEmuResetStats() {
+    stats = NvsEmuStats();
+}
+
+uint32_t nvsEmuPageEraseCount(int page) {
+    flashReady();
+    if (page < 0 || page >= (int)pages.size()) return 0;
+    return pages[page].eraseCount;
+}
+
+void nvsEmuDump() {
+    flashReady();
+    printf("=== NVS emulator ===\n");
+    for (size_t p = 0; p < pages.size(); p++) {
+        const char* state = pages[p].state == PageState::Empty ? "EMPTY" :
+                            pages[p].state == PageState::Active ? "ACTIVE" : "FULL";
+        printf("Page %u: %-6s used=%d erased=%d erases=%u%s\n",
+               (unsigned)p, state, pages[p].usedSlots, pages[p].erasedSlots,
+               pages[p].eraseCount, (int)p == activePage ? " <- active" : "");
+        for (auto& item : pages[p].items) {
+            printf("    [%3u] ns=%u key=%-15s type=0x%02x span=%u%s%s\n",
+                   item.seq, item.nsIndex, item.key.c_str(), item.type, item.span,
+                   item.erased ? " erased" : "", item.crcValid ? "" : " BAD_CRC");
+        }
+    }
+    printf("Writes=%u erases=%u reads=%u page_erases=%u commits=%u skipped=%u gc=%u\n",
+           stats.entryWrites, stats.entryErases, stats.entryReads, stats.pageErases,
+           stats.commits, stats.skippedWrites, stats.gcRuns);
+    printf("Commit latency: last=%u us, max=%u us, total flash time=%llu us\n",
+           stats.lastCommitUs, stats.maxCommitUs, (unsigned long long)stats.totalUs);
+}
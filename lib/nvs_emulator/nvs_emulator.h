@@ -0,0 +1,200 @@
+#ifndef NVS_EMULATOR_H
+#define NVS_EMULATOR_H
+
+// Эмулятор NVS для нативной (Linux) сборки.
+// Повторяет подмножество API ESP-IDF 4.4 (nvs.h / nvs_flash.h), которое использует прошивка,
+// и моделирует раскладку страниц, задержки записи/стирания и износ флеш-памяти.
+// Позволяет внедрять сбои: ESP_ERR_NVS_NO_FREE_PAGES при инициализации,
+// потерю питания посреди commit и повреждённые записи.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// --- Коды ошибок (значения совпадают с esp_err.h / nvs.h) ---
+typedef int esp_err_t;
+
+#define ESP_OK                          0
+#define ESP_FAIL                        -1
+#define ESP_ERR_NO_MEM                  0x101
+#define ESP_ERR_INVALID_ARG             0x102
+#define ESP_ERR_INVALID_STATE           0x103
+#define ESP_ERR_NOT_SUPPORTED           0x106
+
+#define ESP_ERR_NVS_BASE                0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED     (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND           (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH       (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY           (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE    (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_NAME        (ESP_ERR_NVS_BASE + 0x06)
+#define ESP_ERR_NVS_INVALID_HANDLE      (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_REMOVE_FAILED       (ESP_ERR_NVS_BASE + 0x08)
+#define ESP_ERR_NVS_KEY_TOO_LONG        (ESP_ERR_NVS_BASE + 0x09)
+#define ESP_ERR_NVS_PAGE_FULL           (ESP_ERR_NVS_BASE + 0x0a)
+#define ESP_ERR_NVS_INVALID_STATE       (ESP_ERR_NVS_BASE + 0x0b)
+#define ESP_ERR_NVS_INVALID_LENGTH      (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES       (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_VALUE_TOO_LONG      (ESP_ERR_NVS_BASE + 0x0e)
+#define ESP_ERR_NVS_PART_NOT_FOUND      (ESP_ERR_NVS_BASE + 0x0f)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   (ESP_ERR_NVS_BASE + 0x10)
+
+#define NVS_DEFAULT_PART_NAME           "nvs"
+#define NVS_KEY_NAME_MAX_SIZE           16   // Включая завершающий ноль
+
+// --- Типы API NVS ---
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+typedef enum {
+    NVS_TYPE_U8   = 0x01,
+    NVS_TYPE_I8   = 0x11,
+    NVS_TYPE_U16  = 0x02,
+    NVS_TYPE_I16  = 0x12,
+    NVS_TYPE_U32  = 0x04,
+    NVS_TYPE_I32  = 0x14,
+    NVS_TYPE_U64  = 0x08,
+    NVS_TYPE_I64  = 0x18,
+    NVS_TYPE_STR  = 0x21,
+    NVS_TYPE_BLOB = 0x42,
+    NVS_TYPE_ANY  = 0xff
+} nvs_type_t;
+
+typedef struct {
+    char namespace_name[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+} nvs_entry_info_t;
+
+typedef struct {
+    size_t used_entries;
+    size_t free_entries;
+    size_t total_entries;
+    size_t namespace_count;
+} nvs_stats_t;
+
+typedef struct nvs_opaque_iterator_t* nvs_iterator_t;
+
+// --- nvs_flash.h ---
+esp_err_t nvs_flash_init();
+esp_err_t nvs_flash_deinit();
+esp_err_t nvs_flash_erase();
+
+// --- nvs.h ---
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_commit(nvs_handle_t handle);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key);
+esp_err_t nvs_erase_all(nvs_handle_t handle);
+
+esp_err_t nvs_set_i8(nvs_handle_t handle, const char* key, int8_t value);
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value);
+esp_err_t nvs_set_i16(nvs_handle_t handle, const char* key, int16_t value);
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char* key, uint16_t value);
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value);
+esp_err_t nvs_set_i64(nvs_handle_t handle, const char* key, int64_t value);
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char* key, uint64_t value);
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length);
+
+esp_err_t nvs_get_i8(nvs_handle_t handle, const char* key, int8_t* out_value);
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out_value);
+esp_err_t nvs_get_i16(nvs_handle_t handle, const char* key, int16_t* out_value);
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char* key, uint16_t* out_value);
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out_value);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value);
+esp_err_t nvs_get_i64(nvs_handle_t handle, const char* key, int64_t* out_value);
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char* key, uint64_t* out_value);
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length);
+
+esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats);
+
+nvs_iterator_t nvs_entry_find(const char* part_name, const char* namespace_name, nvs_type_t type);
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator);
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t* out_info);
+void nvs_release_iterator(nvs_iterator_t iterator);
+
+// --- Управление эмулятором ---
+
+// Параметры модели флеш-памяти. Времена - в микросекундах виртуального времени.
+struct NvsEmuConfig {
+    int pageCount = 5;               // Страниц в разделе (раздел nvs 0x5000 = 5 страниц по 4 КБ)
+    int entriesPerPage = 126;        // Записей по 32 байта на страницу (как в ESP-IDF)
+    uint32_t entryWriteUs = 45;      // Запись одной 32-байтной записи
+    uint32_t entryEraseUs = 15;      // Пометка записи как стёртой (перезапись битовой карты)
+    uint32_t entryReadUs = 4;        // Чтение одной записи при поиске
+    uint32_t pageEraseUs = 30000;    // Стирание сектора 4 КБ
+    uint32_t commitOverheadUs = 10;  // Накладные расходы commit без записей
+    bool realTime = false;           // Дополнительно спать реальное время (для бенчмарков)
+};
+
+// Счётчики модели. Сбрасываются nvsEmuResetStats().
+struct NvsEmuStats {
+    uint32_t entryWrites;            // Записано 32-байтных записей
+    uint32_t entryErases;            // Помечено стёртыми
+    uint32_t entryReads;             // Прочитано при поиске
+    uint32_t pageErases;             // Стёрто страниц (всего)
+    uint32_t commits;                // Вызовов nvs_commit
+    uint32_t skippedWrites;          // set с тем же значением (запись не выполнялась)
+    uint32_t gcRuns;                 // Запусков сборки мусора
+    uint32_t lastCommitUs;           // Задержка последнего commit
+    uint32_t maxCommitUs;            // Максимальная задержка commit
+    uint64_t totalUs;                // Суммарное виртуальное время операций с флешем
+};
+
+// Сбои, которые можно внедрить
+enum class NvsEmuFault {
+    InitNoFreePages,    // Следующий nvs_flash_init вернёт ESP_ERR_NVS_NO_FREE_PAGES
+    InitNewVersion,     // Следующий nvs_flash_init вернёт ESP_ERR_NVS_NEW_VERSION_FOUND
+    CommitNoSpace       // Следующий nvs_commit вернёт ESP_ERR_NVS_NOT_ENOUGH_SPACE
+};
+
+/**
+ * @brief Полностью сбрасывает эмулятор: "новая" флеш-память с заданной геометрией.
+ * Счётчики износа страниц тоже обнуляются.
+ */
+void nvsEmuReset(const NvsEmuConfig& config = NvsEmuConfig());
+
+/**
+ * @brief Внедряет одноразовый сбой.
+ */
+void nvsEmuInjectFault(NvsEmuFault fault);
+
+/**
+ * @brief Планирует потерю питания после writesBeforeLoss записей флеша внутри nvs_commit.
+ * Запись, на которой пропало питание, остаётся недописанной (с неверным CRC).
+ * До следующего nvs_flash_init все вызовы возвращают ESP_ERR_NVS_NOT_INITIALIZED.
+ */
+void nvsEmuSchedulePowerLoss(uint32_t writesBeforeLoss);
+
+/**
+ * @brief Портит CRC сохранённой записи. Чтение ключа вернёт ESP_ERR_NVS_NOT_FOUND,
+ * при следующей инициализации запись будет стёрта.
+ * @return true, если запись найдена.
+ */
+bool nvsEmuCorruptEntry(const char* namespace_name, const char* key);
+
+/**
+ * @brief Возвращает true, если эмулятор "выключен" после потери питания.
+ */
+bool nvsEmuIsPoweredOff();
+
+const NvsEmuStats& nvsEmuGetStats();
+void nvsEmuResetStats();
+
+/**
+ * @brief Количество стираний страницы (для оценки износа).
+ */
+uint32_t nvsEmuPageEraseCount(int page);
+
+/**
+ * @brief Печатает раскладку страниц и счётчики в stdout.
+ */
+void nvsEmuDump();
+
+#endif // NVS_EMULATOR_H
@@ -0,0 +1,191 @@
+#include "AdvScheduler.h"
+#include <NimBLEDevice.h>
+
+namespace {
+    struct TierConfig {
+        const char* name;
+        uint16_t minItvl;      // 0.625 мс; для направленной рекламы не используется
+        uint16_t maxItvl;
+        uint32_t durationMs;   // 0 - без ограничения
+    };
+
+    const TierConfig TIERS[ADV_TIER_COUNT] = {
+        { "directed",    0,    0, ADV_DIRECTED_BURST_MS },
+        { "fast",       32,   48, 30000 },    // 20-30 мс, 30 с
+        { "medium",    668,  700, 300000 },   // 417.5-437.5 мс, 5 мин
+        { "slow",     2056, 2100, 0 },        // 1285-1312.5 мс, без ограничения
+    };
+
+    const float DIRECTED_EVENT_MS = 3.75f;          // High duty cycle: событие каждые <= 3.75 мс
+    const unsigned long START_RETRY_MS = 1000;
+
+    NimBLEAdvertising* adv = nullptr;
+    NimBLEAddress directedHosts[ADV_MAX_DIRECTED_HOSTS];
+    int directedCount = 0;
+    int directedIndex = 0;      // Хост текущего всплеска направленной рекламы
+    bool connectWhitelistOnly = false;
+
+    AdvTier tier = ADV_TIER_OFF;
+    bool tierStarted = false;
+    unsigned long tierStartTime = 0;
+    unsigned long lastStartAttempt = 0;
+
+    uint32_t tierTimeMs[ADV_TIER_COUNT] = {};
+    uint32_t tierStarts[ADV_TIER_COUNT] = {};
+    float tierChargeMas[ADV_TIER_COUNT] = {};
+    uint32_t scheduleStarts = 0;
+    uint32_t connectsInTier[ADV_TIER_COUNT] = {};
+    const char* lastReason = "none";
+
+    float eventsPerSecond(AdvTier t) {
+        if (t == ADV_TIER_DIRECTED) {
+            return 1000.0f / DIRECTED_EVENT_MS;
+        }
+        // Контроллер выбирает интервал из диапазона; считаем по середине
+        float itvlMs = (TIERS[t].minItvl + TIERS[t].maxItvl) / 2.0f * 0.625f;
+        return 1000.0f / itvlMs;
+    }
+
+    void closeTier(unsigned long now) {
+        if (tier >= ADV_TIER_COUNT || !tierStarted) {
+            return;
+        }
+        uint32_t elapsed = now - tierStartTime;
+        tierTimeMs[tier] += elapsed;
+        tierChargeMas[tier] += elapsed / 1000.0f * eventsPerSecond(tier) * ADV_EVENT_UC / 1000.0f;
+        tierStarted = false;
+    }
+
+    bool startTier(AdvTier t) {
+        unsigned long now = millis();
+        closeTier(now);
+        tier = t;
+        lastStartAttempt = now;
+        if (adv->isAdvertising()) {
+            adv->stop();
+        }
+
+        bool started;
+        if (t == ADV_TIER_DIRECTED) {
+            adv->setConnectableMode(BLE_GAP_CONN_MODE_DIR);
+            adv->setScanFilter(false, false);
+            started = adv->start(TIERS[t].durationMs, &directedHosts[directedIndex]);
+        } else {
+            adv->setConnectableMode(BLE_GAP_CONN_MODE_UND);
+            adv->setScanFilter(false, connectWhitelistOnly);
+            adv->setMinInterval(TIERS[t].minItvl);
+            adv->setMaxInterval(TIERS[t].maxItvl);
+            started = adv->start(TIERS[t].durationMs);
+        }
+
+        if (started) {
+            tierStarted = true;
+            tierStartTime = now;
+            tierStarts[t]++;
+        }
+        if (t == ADV_TIER_DIRECTED) {
+            Serial.printf("Advertising tier %s to %s: %s\n", TIERS[t].name,
+                directedHosts[directedIndex].toString().c_str(), started ? "started" : "failed");
+        } else {
+            Serial.printf("Advertising tier %s%s: %s\n", TIERS[t].name,
+                connectWhitelistOnly ? " (whitelist)" : "", started ? "started" : "failed");
+        }
+        return started;
+    }
+} // namespace
+
+void advSchedulerBegin(NimBLEAdvertising* advertising) {
+    adv = advertising;
+}
+
+void advSchedulerStart(const NimBLEAddress* hosts, int hostCount, bool whitelistOnly, const char* reason) {
+    if (!adv) {
+        return;
+    }
+    directedCount = hostCount < ADV_MAX_DIRECTED_HOSTS ? hostCount : ADV_MAX_DIRECTED_HOSTS;
+    for (int i = 0; i < directedCount; i++) {
+        directedHosts[i] = hosts[i];
+    }
+    directedIndex = 0;
+    connectWhitelistOnly = whitelistOnly;
+    lastReason = reason;
+    scheduleStarts++;
+    Serial.printf("Advertising schedule restarted (%s)\n", reason);
+
+    // Без сопряжённого хоста направленную рекламу пропускаем
+    if (directedCount == 0 || !startTier(ADV_TIER_DIRECTED)) {
+        startTier(ADV_TIER_FAST);
+    }
+}
+
+void advSchedulerStop() {
+    if (tier < ADV_TIER_COUNT) {
+        if (tierStarted) {
+            connectsInTier[tier]++;
+        }
+        closeTier(millis());
+    }
+    tier = ADV_TIER_OFF;
+    if (adv && adv->isAdvertising()) {
+        adv->stop();
+    }
+}
+
+void advSchedulerUpdate() {
+    if (!adv || tier >= ADV_TIER_COUNT) {
+        return;
+    }
+    if (tierStarted && adv->isAdvertising()) {
+        return;
+    }
+
+    unsigned long now = millis();
+    if (!tierStarted) {
+        // Запуск не удался - повторяем ту же ступень не чаще START_RETRY_MS
+        if (now - lastStartAttempt >= START_RETRY_MS) {
+            startTier(tier);
+        }
+        return;
+    }
+
+    // Всплеск направленной рекламы отработал - следующий хост в очереди
+    if (tier == ADV_TIER_DIRECTED && directedIndex + 1 < directedCount) {
+        directedIndex++;
+        startTier(ADV_TIER_DIRECTED);
+        return;
+    }
+    // Ступень отработала своё время; последняя ступень не ограничена и перезапускается
+    AdvTier next = (tier + 1 < ADV_TIER_COUNT) ? (AdvTier)(tier + 1) : ADV_TIER_SLOW;
+    startTier(next);
+}
+
+AdvTier advSchedulerTier() {
+    return tier;
+}
+
+const char* advTierName(AdvTier t) {
+    return t < ADV_TIER_COUNT ? TIERS[t].name : "off";
+}
+
+void printAdvSchedulerStats() {
+    unsigned long now = millis();
+    Serial.println("\n=== Advertising Scheduler ===");
+    Serial.printf("Tier: %s, for %lu ms, schedule starts: %lu (last: %s)\n",
+        advTierName(tier), tierStarted ? now - tierStartTime : 0UL,
+        (unsigned long)scheduleStarts, lastReason);
+    for (int i = 0; i < directedCount; i++) {
+        Serial.printf("Directed target %d: %s%s\n", i + 1, directedHosts[i].toString().c_str(),
+            tier == ADV_TIER_DIRECTED && i == directedIndex ? " (now)" : "");
+    }
+    Serial.printf("Undirected connections: %s\n", connectWhitelistOnly ? "whitelist only" : "any central");
+    for (int i = 0; i < ADV_TIER_COUNT; i++) {
+        uint32_t timeMs = tierTimeMs[i] + ((i == tier && tierStarted) ? now - tierStartTime : 0);
+        float chargeMas = tierChargeMas[i] +
+            ((i == tier && tierStarted) ? (now - tierStartTime) / 1000.0f * eventsPerSecond((AdvTier)i) * ADV_EVENT_UC / 1000.0f : 0.0f);
+        float timeS = timeMs / 1000.0f;
+        Serial.printf("%-8s: %lu starts, %lu connects, %.1f s, %.3f mA avg, %.2f mAh\n",
+            TIERS[i].name, (unsigned long)tierStarts[i], (unsigned long)connectsInTier[i],
+            timeS, timeS > 0 ? chargeMas / timeS : 0.0f, chargeMas / 3600.0f);
+    }
+    Serial.println("=== End Advertising Scheduler ===\n");
+}
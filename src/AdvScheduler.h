@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Arduino.h>
+
+class NimBLEAdvertising;
+class NimBLEAddress;
+
+// Планировщик рекламы при отсутствии соединения.
+// Ступени: короткие всплески направленной рекламы по очереди на каждый сопряжённый хост,
+// затем обычная реклама со ступенчато растущим интервалом до медленной (~1.3 с),
+// на которой устройство может оставаться часами, пока хоста нет рядом.
+// Обычная реклама может принимать подключения только от хостов из белого списка
+// контроллера, тогда чужие центральные устройства не занимают соединение.
+// Каждая ступень запускается с ограниченной длительностью; когда NimBLE её завершает,
+// планировщик переходит на следующую. Нажатие кнопки или реклама хоста в эфире
+// возвращают на первую ступень.
+//
+// Интервалы - из рекомендаций Apple для аксессуаров (20 мс первые 30 с, далее 417.5 и 1285 мс).
+
+#ifndef ADV_DIRECTED_BURST_MS
+#define ADV_DIRECTED_BURST_MS 1280    // Максимум для high duty cycle направленной рекламы
+#endif
+#ifndef ADV_MAX_DIRECTED_HOSTS
+#define ADV_MAX_DIRECTED_HOSTS 4      // Хостов в очереди направленной рекламы
+#endif
+#ifndef ADV_EVENT_UC
+#define ADV_EVENT_UC 40.0f            // Заряд одного рекламного события (3 канала), мкКл (модель)
+#endif
+
+enum AdvTier : uint8_t {
+    ADV_TIER_DIRECTED = 0,
+    ADV_TIER_FAST,
+    ADV_TIER_MEDIUM,
+    ADV_TIER_SLOW,
+    ADV_TIER_COUNT,
+    ADV_TIER_OFF = ADV_TIER_COUNT   // Соединение установлено, реклама не нужна
+};
+
+/**
+ * @brief Запоминает объект рекламы. Данные рекламы настраиваются вызывающей стороной заранее.
+ */
+void advSchedulerBegin(NimBLEAdvertising* advertising);
+
+/**
+ * @brief Запускает расписание с первой ступени.
+ * @param hosts Сопряжённые хосты для направленной рекламы, по всплеску на каждый в этом порядке
+ * @param hostCount Число хостов; 0 - сразу обычная реклама
+ * @param whitelistOnly Обычная реклама принимает подключения только от белого списка
+ * @param reason Причина для журнала ("boot", "disconnect", "button", "host seen")
+ */
+void advSchedulerStart(const NimBLEAddress* hosts, int hostCount, bool whitelistOnly, const char* reason);
+
+/**
+ * @brief Соединение установлено: реклама остановлена, учёт времени ступени закрыт.
+ */
+void advSchedulerStop();
+
+/**
+ * @brief Вызывается из loop(): переход на следующую ступень, когда текущая закончилась.
+ */
+void advSchedulerUpdate();
+
+AdvTier advSchedulerTier();
+const char* advTierName(AdvTier tier);
+
+void printAdvSchedulerStats();
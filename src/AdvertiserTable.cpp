@@ -0,0 +1,163 @@
+#include "AdvertiserTable.h"
+#include <freertos/FreeRTOS.h>
+
+static_assert((ADV_TABLE_CAPACITY & (ADV_TABLE_CAPACITY - 1)) == 0, "ADV_TABLE_CAPACITY must be a power of two");
+static_assert(ADV_TABLE_MAX_LOAD < ADV_TABLE_CAPACITY, "ADV_TABLE_MAX_LOAD must leave free slots for probing");
+
+namespace {
+    const uint64_t KEY_USED = 1ULL << 48;   // Адрес 48-битный: старший бит отличает занятую ячейку
+    const uint64_t ADDRESS_MASK = KEY_USED - 1;
+
+    struct Slot {
+        uint64_t key;            // 0 - ячейка свободна
+        AdvertiserRecord record;
+    };
+
+    Slot slots[ADV_TABLE_CAPACITY] = {};
+    int used = 0;
+    portMUX_TYPE tableLock = portMUX_INITIALIZER_UNLOCKED;
+
+    uint32_t inserts = 0;
+    uint32_t updates = 0;
+    uint32_t agedOut = 0;
+    uint32_t evicted = 0;
+    int maxUsed = 0;
+    int maxProbe = 0;
+
+    inline uint64_t makeKey(uint64_t address) {
+        return (address & ADDRESS_MASK) | KEY_USED;
+    }
+
+    // Хеш Фибоначчи: младшие байты адреса у одного производителя часто близки
+    inline int home(uint64_t key) {
+        return (int)((key * 0x9E3779B97F4A7C15ULL) >> 40) & (ADV_TABLE_CAPACITY - 1);
+    }
+
+    // Ячейка с ключом или свободная ячейка, где он должен быть
+    int probe(uint64_t key) {
+        int i = home(key);
+        int distance = 0;
+        while (slots[i].key != 0 && slots[i].key != key) {
+            i = (i + 1) & (ADV_TABLE_CAPACITY - 1);
+            distance++;
+        }
+        if (distance > maxProbe) maxProbe = distance;
+        return i;
+    }
+
+    // Удаление со сдвигом назад: цепочки пробирования остаются без "надгробий"
+    void removeAt(int i) {
+        int hole = i;
+        int j = i;
+        while (true) {
+            j = (j + 1) & (ADV_TABLE_CAPACITY - 1);
+            if (slots[j].key == 0) {
+                break;
+            }
+            int h = home(slots[j].key);
+            // Запись из j можно перенести в дыру, если её домашняя ячейка не лежит в (hole, j]
+            bool movable = hole <= j ? (h <= hole || h > j) : (h <= hole && h > j);
+            if (movable) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole].key = 0;
+        used--;
+    }
+
+    void evictOldest() {
+        int oldest = -1;
+        for (int i = 0; i < ADV_TABLE_CAPACITY; i++) {
+            if (slots[i].key != 0 && (oldest < 0 || (long)(slots[i].record.lastSeenMs - slots[oldest].record.lastSeenMs) < 0)) {
+                oldest = i;
+            }
+        }
+        if (oldest >= 0) {
+            removeAt(oldest);
+            evicted++;
+        }
+    }
+} // namespace
+
+void advertiserTableRecord(uint64_t address, int8_t rssi) {
+    uint64_t key = makeKey(address);
+    unsigned long now = millis();
+    portENTER_CRITICAL(&tableLock);
+    int i = probe(key);
+    if (slots[i].key == 0) {
+        if (used >= ADV_TABLE_MAX_LOAD) {
+            evictOldest();
+            i = probe(key);
+        }
+        slots[i].key = key;
+        slots[i].record.count = 0;
+        used++;
+        inserts++;
+        if (used > maxUsed) maxUsed = used;
+    } else {
+        updates++;
+    }
+    AdvertiserRecord& r = slots[i].record;
+    r.rssi = rssi;
+    r.count++;
+    r.lastSeenMs = now;
+    portEXIT_CRITICAL(&tableLock);
+}
+
+bool advertiserTableLookup(uint64_t address, AdvertiserRecord& record) {
+    uint64_t key = makeKey(address);
+    bool found = false;
+    portENTER_CRITICAL(&tableLock);
+    int i = probe(key);
+    if (slots[i].key == key) {
+        record = slots[i].record;
+        found = millis() - record.lastSeenMs <= ADV_TABLE_MAX_AGE_MS;
+    }
+    portEXIT_CRITICAL(&tableLock);
+    return found;
+}
+
+void advertiserTableExpire() {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&tableLock);
+    // Сдвиг назад может перенести ещё не проверенную запись в текущую ячейку - проверяем её снова
+    for (int i = 0; i < ADV_TABLE_CAPACITY; ) {
+        if (slots[i].key != 0 && now - slots[i].record.lastSeenMs > ADV_TABLE_MAX_AGE_MS) {
+            removeAt(i);
+            agedOut++;
+        } else {
+            i++;
+        }
+    }
+    portEXIT_CRITICAL(&tableLock);
+}
+
+void printAdvertiserTableStats() {
+    portENTER_CRITICAL(&tableLock);
+    int count = used;
+    int probeMax = maxProbe;
+    int usedMax = maxUsed;
+    portEXIT_CRITICAL(&tableLock);
+
+    Serial.println("\n=== Advertiser Table ===");
+    Serial.printf("Entries: %d/%d (max %d), table %u bytes, longest probe %d\n",
+        count, ADV_TABLE_CAPACITY, usedMax, (unsigned)sizeof(slots), probeMax);
+    Serial.printf("Inserts: %lu, updates: %lu, aged out: %lu, evicted when full: %lu\n",
+        (unsigned long)inserts, (unsigned long)updates, (unsigned long)agedOut, (unsigned long)evicted);
+    unsigned long now = millis();
+    for (int i = 0; i < ADV_TABLE_CAPACITY; i++) {
+        portENTER_CRITICAL(&tableLock);
+        Slot slot = slots[i];
+        portEXIT_CRITICAL(&tableLock);
+        if (slot.key == 0) {
+            continue;
+        }
+        uint64_t a = slot.key & ADDRESS_MASK;
+        Serial.printf("  %02x:%02x:%02x:%02x:%02x:%02x  RSSI %4d  reports %6lu  %5.1f s ago\n",
+            (unsigned)(a >> 40) & 0xff, (unsigned)(a >> 32) & 0xff, (unsigned)(a >> 24) & 0xff,
+            (unsigned)(a >> 16) & 0xff, (unsigned)(a >> 8) & 0xff, (unsigned)a & 0xff,
+            slot.record.rssi, (unsigned long)slot.record.count, (now - slot.record.lastSeenMs) / 1000.0f);
+    }
+    Serial.println("=== End Advertiser Table ===\n");
+}
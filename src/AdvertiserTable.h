@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Таблица рекламодателей, замеченных сканированием.
+// Результаты сканирования в объекте NimBLEScan не хранятся: колбэк сканирования записывает
+// каждый отчёт сюда. Таблица фиксированного размера с открытой адресацией (линейное
+// пробирование) по 48-битному адресу: поиск и запись без выделения памяти и без строк.
+// Запись хранит последний RSSI, число отчётов и время последнего отчёта. Записи старше
+// ADV_TABLE_MAX_AGE_MS удаляются; если таблица заполнена, новый адрес вытесняет самую старую.
+// Запись идёт из задачи стека NimBLE, чтение - из других задач, поэтому доступ под спинлоком.
+
+#ifndef ADV_TABLE_CAPACITY
+#define ADV_TABLE_CAPACITY 32          // Степень двойки
+#endif
+#ifndef ADV_TABLE_MAX_LOAD
+#define ADV_TABLE_MAX_LOAD 24          // Больше записей - вытеснение самой старой
+#endif
+#ifndef ADV_TABLE_MAX_AGE_MS
+#define ADV_TABLE_MAX_AGE_MS 30000     // Запись без новых отчётов дольше - удаляется
+#endif
+
+struct AdvertiserRecord {
+    int8_t rssi;                 // RSSI последнего отчёта, dBm
+    uint32_t count;              // Отчётов с момента появления записи
+    unsigned long lastSeenMs;    // millis() последнего отчёта
+};
+
+/**
+ * @brief Отчёт о рекламе (из колбэка сканирования).
+ * @param address 48-битный адрес (uint64_t из NimBLEAddress)
+ */
+void advertiserTableRecord(uint64_t address, int8_t rssi);
+
+/**
+ * @brief Последний отчёт рекламодателя. false - адреса нет или запись устарела.
+ */
+bool advertiserTableLookup(uint64_t address, AdvertiserRecord& record);
+
+/**
+ * @brief Удаляет записи старше ADV_TABLE_MAX_AGE_MS.
+ */
+void advertiserTableExpire();
+
+void printAdvertiserTableStats();
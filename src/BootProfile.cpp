@@ -0,0 +1,61 @@
+#include "BootProfile.h"
+#include <esp_timer.h>
+
+namespace {
+    struct BootStage {
+        const char* name;
+        int64_t timeUs;
+        // Имя задачи, в которой отмечен этап (main / параллельная). Копия, а не handle:
+        // параллельная задача к моменту вывода уже удалена
+        char task[configMAX_TASK_NAME_LEN];
+    };
+
+    BootStage stages[BOOT_PROFILE_MAX_STAGES];
+    size_t stageCount = 0;
+    portMUX_TYPE stagesMux = portMUX_INITIALIZER_UNLOCKED;
+} // namespace
+
+void bootMark(const char* stage) {
+    int64_t now = esp_timer_get_time();
+    const char* task = pcTaskGetName(NULL);
+    portENTER_CRITICAL(&stagesMux);
+    if (stageCount < BOOT_PROFILE_MAX_STAGES) {
+        stages[stageCount].name = stage;
+        stages[stageCount].timeUs = now;
+        strlcpy(stages[stageCount].task, task, sizeof(stages[stageCount].task));
+        stageCount++;
+    }
+    portEXIT_CRITICAL(&stagesMux);
+}
+
+void printBootProfile() {
+    Serial.println("\n=== Boot Profile ===");
+    Serial.printf("%-20s %10s %10s  %s\n", "Stage", "Delta ms", "Total ms", "Task");
+
+    // Delta считаем относительно предыдущего этапа той же задачи,
+    // иначе параллельные этапы дают бессмысленные интервалы
+    for (size_t i = 0; i < stageCount; i++) {
+        int64_t prevUs = 0;
+        for (size_t j = i; j > 0; j--) {
+            if (strcmp(stages[j - 1].task, stages[i].task) == 0) {
+                prevUs = stages[j - 1].timeUs;
+                break;
+            }
+        }
+        Serial.printf("%-20s %10.1f %10.1f  %s\n",
+            stages[i].name,
+            (stages[i].timeUs - prevUs) / 1000.0f,
+            stages[i].timeUs / 1000.0f,
+            stages[i].task);
+    }
+    Serial.println("=== End Boot Profile ===\n");
+}
+
+uint32_t bootStageMs(const char* stage) {
+    for (size_t i = 0; i < stageCount; i++) {
+        if (strcmp(stages[i].name, stage) == 0) {
+            return (uint32_t)(stages[i].timeUs / 1000);
+        }
+    }
+    return 0;
+}
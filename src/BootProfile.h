@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Профиль загрузки: метки времени по этапам setup().
+// Время берётся из esp_timer (мкс с момента старта приложения),
+// поэтому в разбивку не попадает работа загрузчика ROM/2nd stage.
+
+#define BOOT_PROFILE_MAX_STAGES 16
+
+/**
+ * @brief Отмечает завершение этапа загрузки.
+ * @param stage Имя этапа. Хранится только указатель, поэтому передавайте строковый литерал.
+ * Безопасно вызывать из другой задачи FreeRTOS (используется критическая секция).
+ */
+void bootMark(const char* stage);
+
+/**
+ * @brief Выводит в Serial разбивку времени загрузки: длительность каждого этапа и время от старта.
+ */
+void printBootProfile();
+
+/**
+ * @brief Время от старта приложения до отмеченного этапа, мс.
+ * @return 0, если этап ещё не отмечен.
+ */
+uint32_t bootStageMs(const char* stage);
@@ -0,0 +1,453 @@
+#include "ConnParamPolicy.h"
+#include <NimBLEDevice.h>
+#include <freertos/semphr.h>
+
+namespace {
+    struct ConnParams {
+        uint16_t minItvl;    // 1.25 мс
+        uint16_t maxItvl;
+        uint16_t latency;    // Пропускаемые события
+        uint16_t timeout;    // 10 мс
+    };
+
+    // Для CONN_PARAM_HOST запросов не бывает, строка только для единообразия индексов.
+    // Timeout - нижняя граница, запрос может удлинить его до окна решения о блокировке
+    const ConnParams PARAMS[CONN_PARAM_SETTING_COUNT] = {
+        {  0,  0, 0,   0 },  // HOST
+        { 36, 48, 4, 400 },  // IDLE: 45-60 мс, latency 4 (до 300 мс без данных), 4 с
+        { 12, 24, 0, 300 },  // ACTIVE: 15-30 мс, 3 с
+        {  9, 12, 0, 300 },  // HID: 11.25-15 мс, 3 с
+    };
+
+    const char* const SETTING_NAMES[CONN_PARAM_SETTING_COUNT] = { "host", "idle", "active", "hid" };
+
+    const unsigned long REJECT_BACKOFF_MS = 30000;  // Отклонённую настройку не запрашиваем повторно
+    const int LOG_SIZE = 16;
+
+    // Остальные соединения: интервал выбирает хост, политика только удлиняет supervision timeout
+    struct TimeoutGuard {
+        bool used;
+        uint16_t connHandle;
+        unsigned long retryAt;    // Не запрашивать раньше
+        uint32_t requests;
+        uint16_t timeout;         // Фактический по последней проверке, 10 мс
+    };
+
+    struct SettingStats {
+        uint32_t timeMs;
+        float chargeMas;          // Модель: события соединения * заряд события
+        uint32_t requests;
+        uint32_t accepted;
+        uint32_t rejected;
+        uint32_t applyMsTotal;
+        uint32_t hidReports;
+        uint32_t notifyUsTotal;
+        uint32_t deliveryUsTotal; // Ожидаемая задержка доставки: один интервал соединения
+    };
+
+    struct LogEntry {
+        unsigned long timeMs;
+        ConnParamSetting setting;
+        bool accepted;
+        uint16_t itvl;
+        uint16_t latency;
+        uint16_t timeout;
+        uint16_t applyMs;
+        int rc;
+    };
+
+    bool linkUp = false;
+    uint16_t connHandle = BLE_HS_CONN_HANDLE_NONE;
+    uint32_t lockWindowMs = 0;
+
+    ConnParamSetting appliedSetting = CONN_PARAM_HOST;
+    ConnParamSetting requestedSetting = CONN_PARAM_HOST;
+    bool requestPending = false;
+    unsigned long requestTime = 0;
+    unsigned long lastRequestTime = 0;
+    unsigned long hidHoldUntil = 0;
+    unsigned long rejectedUntil[CONN_PARAM_SETTING_COUNT] = {};
+    // Хост принял интервал, но сократил timeout: повторный запрос того же timeout не раньше
+    unsigned long timeoutRetryAt = 0;
+
+    // Фактические параметры соединения по последнему опросу
+    uint16_t actualItvl = 0;
+    uint16_t actualLatency = 0;
+    uint16_t actualTimeout = 0;
+    unsigned long accountedUntil = 0;
+
+    SettingStats stats[CONN_PARAM_SETTING_COUNT] = {};
+    LogEntry logEntries[LOG_SIZE] = {};
+    TimeoutGuard guards[CONN_PARAM_MAX_LINKS] = {};
+    int logCount = 0;
+    int logIndex = 0;
+    ConnLatencyHistogram latencyHistogram = {};
+
+    // Политику вызывают задача опроса RSSI (настройка по состоянию) и задача HID
+    StaticSemaphore_t policyMutexBuffer;
+    SemaphoreHandle_t policyMutex = xSemaphoreCreateMutexStatic(&policyMutexBuffer);
+
+    class PolicyLock {
+    public:
+        PolicyLock() { xSemaphoreTake(policyMutex, portMAX_DELAY); }
+        ~PolicyLock() { xSemaphoreGive(policyMutex); }
+    };
+
+    bool readActualParams() {
+        struct ble_gap_conn_desc desc;
+        if (ble_gap_conn_find(connHandle, &desc) != 0) {
+            return false;
+        }
+        actualItvl = desc.conn_itvl;
+        actualLatency = desc.conn_latency;
+        actualTimeout = desc.supervision_timeout;
+        return true;
+    }
+
+    // Время с прошлого учёта относим к действующей настройке с фактическими параметрами
+    void accountTime(unsigned long now) {
+        if (!linkUp) {
+            return;
+        }
+        uint32_t elapsed = now - accountedUntil;
+        accountedUntil = now;
+        SettingStats& s = stats[appliedSetting];
+        s.timeMs += elapsed;
+        if (actualItvl > 0) {
+            // Без данных для отправки периферия просыпается раз в (latency + 1) интервалов
+            float eventsPerS = 1000.0f / (actualItvl * 1.25f * (actualLatency + 1));
+            s.chargeMas += elapsed / 1000.0f * eventsPerS * CONN_PARAM_EVENT_UC / 1000.0f;
+        }
+    }
+
+    void addLog(ConnParamSetting setting, bool accepted, uint16_t applyMs, int rc) {
+        LogEntry& e = logEntries[logIndex];
+        e.timeMs = millis();
+        e.setting = setting;
+        e.accepted = accepted;
+        e.itvl = actualItvl;
+        e.latency = actualLatency;
+        e.timeout = actualTimeout;
+        e.applyMs = applyMs;
+        e.rc = rc;
+        logIndex = (logIndex + 1) % LOG_SIZE;
+        if (logCount < LOG_SIZE) logCount++;
+
+        Serial.printf("Conn params %s -> %s: %s in %u ms (interval %.2f ms, latency %u, timeout %u ms, rc %d)\n",
+            SETTING_NAMES[appliedSetting], SETTING_NAMES[setting],
+            accepted ? "accepted" : "rejected", applyMs,
+            actualItvl * 1.25f, actualLatency, actualTimeout * 10, rc);
+    }
+
+    // Timeout настройки, 10 мс: не короче окна блокировки с запасом, но в пределах рекомендаций
+    uint16_t timeoutFor(ConnParamSetting setting) {
+        uint32_t timeout = PARAMS[setting].timeout;
+        uint32_t lockTimeout = (lockWindowMs + CONN_PARAM_LOCK_MARGIN_MS + 9) / 10;
+        if (lockTimeout > timeout) timeout = lockTimeout;
+        if (timeout > CONN_PARAM_MAX_TIMEOUT_MS / 10) timeout = CONN_PARAM_MAX_TIMEOUT_MS / 10;
+        return (uint16_t)timeout;
+    }
+
+    bool matches(ConnParamSetting setting) {
+        const ConnParams& p = PARAMS[setting];
+        return actualItvl >= p.minItvl && actualItvl <= p.maxItvl && actualLatency == p.latency;
+    }
+
+    void request(ConnParamSetting setting, unsigned long now) {
+        const ConnParams& p = PARAMS[setting];
+        struct ble_gap_upd_params params = {};
+        params.itvl_min = p.minItvl;
+        params.itvl_max = p.maxItvl;
+        params.latency = p.latency;
+        params.supervision_timeout = timeoutFor(setting);
+
+        lastRequestTime = now;
+        stats[setting].requests++;
+        int rc = ble_gap_update_params(connHandle, &params);
+        if (rc != 0) {
+            // Контроллер не принял запрос (например, предыдущая процедура ещё идёт)
+            stats[setting].rejected++;
+            addLog(setting, false, 0, rc);
+            return;
+        }
+        requestedSetting = setting;
+        requestPending = true;
+        requestTime = now;
+    }
+
+    void checkPending(unsigned long now) {
+        if (!requestPending || !readActualParams()) {
+            return;
+        }
+        uint32_t waited = now - requestTime;
+        if (matches(requestedSetting)) {
+            accountTime(now);
+            stats[requestedSetting].accepted++;
+            stats[requestedSetting].applyMsTotal += waited;
+            addLog(requestedSetting, true, waited, 0);
+            appliedSetting = requestedSetting;
+            requestPending = false;
+            timeoutRetryAt = actualTimeout < timeoutFor(appliedSetting) ? now + REJECT_BACKOFF_MS : 0;
+        } else if (waited > CONN_PARAM_APPLY_TIMEOUT_MS) {
+            // Хост отказал или выбрал свои параметры; они остаются у действующей настройки
+            stats[requestedSetting].rejected++;
+            rejectedUntil[requestedSetting] = now + REJECT_BACKOFF_MS;
+            addLog(requestedSetting, false, waited, 0);
+            requestPending = false;
+        }
+    }
+
+    TimeoutGuard* guardFor(uint16_t handle, unsigned long now) {
+        TimeoutGuard* free = nullptr;
+        for (int i = 0; i < CONN_PARAM_MAX_LINKS; i++) {
+            if (guards[i].used && guards[i].connHandle == handle) {
+                return &guards[i];
+            }
+            if (!free && !guards[i].used) {
+                free = &guards[i];
+            }
+        }
+        if (!free) {
+            return nullptr;
+        }
+        free->used = true;
+        free->connHandle = handle;
+        // Первый запрос не раньше, чем хост завершит свои процедуры после подключения
+        free->retryAt = now + CONN_PARAM_MIN_REQUEST_GAP_MS;
+        free->requests = 0;
+        free->timeout = 0;
+        return free;
+    }
+} // namespace
+
+void connParamPolicyReset(uint16_t handle) {
+    PolicyLock lock;
+    connHandle = handle;
+    linkUp = true;
+    appliedSetting = CONN_PARAM_HOST;
+    requestPending = false;
+    hidHoldUntil = 0;
+    timeoutRetryAt = 0;
+    for (int i = 0; i < CONN_PARAM_SETTING_COUNT; i++) {
+        rejectedUntil[i] = 0;
+    }
+    unsigned long now = millis();
+    accountedUntil = now;
+    // Первый запрос не раньше, чем хост завершит свои процедуры после подключения
+    lastRequestTime = now;
+    readActualParams();
+}
+
+void connParamPolicyDisconnected() {
+    PolicyLock lock;
+    accountTime(millis());
+    linkUp = false;
+    requestPending = false;
+    connHandle = BLE_HS_CONN_HANDLE_NONE;
+}
+
+void connParamPolicyUpdate(ConnParamSetting stateSetting) {
+    PolicyLock lock;
+    if (!linkUp) {
+        return;
+    }
+    unsigned long now = millis();
+    accountTime(now);
+
+    if (requestPending) {
+        checkPending(now);
+        return;
+    }
+
+    ConnParamSetting wanted = (long)(hidHoldUntil - now) > 0 ? CONN_PARAM_HID : stateSetting;
+    if (wanted == CONN_PARAM_HOST) {
+        return;
+    }
+    if (wanted == appliedSetting) {
+        // matches() не сравнивает timeout: окно блокировки могло вырасти со сменой профиля
+        // питания, тогда та же настройка запрашивается ещё раз с новым timeout
+        if (!readActualParams() || actualTimeout >= timeoutFor(wanted) || (long)(timeoutRetryAt - now) > 0) {
+            return;
+        }
+    }
+    if (now - lastRequestTime < CONN_PARAM_MIN_REQUEST_GAP_MS || (long)(rejectedUntil[wanted] - now) > 0) {
+        return;
+    }
+    request(wanted, now);
+}
+
+void connParamPolicyGuardTimeout(uint16_t handle) {
+    PolicyLock lock;
+    if (handle == BLE_HS_CONN_HANDLE_NONE || (linkUp && handle == connHandle)) {
+        return;
+    }
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(handle, &desc) != 0) {
+        return;
+    }
+    unsigned long now = millis();
+    TimeoutGuard* guard = guardFor(handle, now);
+    if (!guard) {
+        return;
+    }
+    guard->timeout = desc.supervision_timeout;
+    // Интервал и latency хоста сохраняются; timeout не короче окна блокировки
+    // и больше interval * (latency + 1) * 3
+    uint32_t timeout = timeoutFor(CONN_PARAM_HOST);
+    uint32_t minTimeout = (desc.conn_itvl * 125u * (desc.conn_latency + 1u) * 3u + 999u) / 1000u + 1u;
+    if (minTimeout > timeout) timeout = minTimeout;
+    if (timeout > CONN_PARAM_MAX_TIMEOUT_MS / 10) timeout = CONN_PARAM_MAX_TIMEOUT_MS / 10;
+    if (desc.supervision_timeout >= timeout || (long)(guard->retryAt - now) > 0) {
+        return;
+    }
+
+    struct ble_gap_upd_params params = {};
+    params.itvl_min = desc.conn_itvl;
+    params.itvl_max = desc.conn_itvl;
+    params.latency = desc.conn_latency;
+    params.supervision_timeout = (uint16_t)timeout;
+    int rc = ble_gap_update_params(handle, &params);
+    guard->requests++;
+    // Хост может оставить свой timeout: следующий запрос не раньше, чем через паузу отказа
+    guard->retryAt = now + (rc == 0 ? REJECT_BACKOFF_MS : CONN_PARAM_MIN_REQUEST_GAP_MS);
+    Serial.printf("Conn params handle %u: timeout %u -> %lu ms requested (rc %d)\n",
+        handle, desc.supervision_timeout * 10, (unsigned long)timeout * 10, rc);
+}
+
+void connParamPolicyLinkClosed(uint16_t handle) {
+    PolicyLock lock;
+    for (int i = 0; i < CONN_PARAM_MAX_LINKS; i++) {
+        if (guards[i].used && guards[i].connHandle == handle) {
+            guards[i].used = false;
+        }
+    }
+}
+
+void connParamPolicySetLockWindow(uint32_t windowMs) {
+    PolicyLock lock;
+    lockWindowMs = windowMs;
+}
+
+void connParamPolicyBeginHid(uint16_t handle) {
+    xSemaphoreTake(policyMutex, portMAX_DELAY);
+    unsigned long now = millis();
+    if (!linkUp || handle != connHandle) {
+        xSemaphoreGive(policyMutex);
+        return;
+    }
+    hidHoldUntil = now + CONN_PARAM_HID_HOLD_MS;
+    if (appliedSetting == CONN_PARAM_HID || (long)(rejectedUntil[CONN_PARAM_HID] - now) > 0) {
+        xSemaphoreGive(policyMutex);
+        return;
+    }
+
+    accountTime(now);
+    if (!requestPending) {
+        request(CONN_PARAM_HID, now);
+    }
+    // Ждём короткий интервал (или завершения уже идущей процедуры), но недолго:
+    // при длинном интервале HID-отчёт всё равно уйдёт в ближайшем событии.
+    // На время ожидания политика открыта для задачи опроса
+    while (requestPending && millis() - now < CONN_PARAM_HID_WAIT_MS) {
+        xSemaphoreGive(policyMutex);
+        delay(5);
+        xSemaphoreTake(policyMutex, portMAX_DELAY);
+        checkPending(millis());
+    }
+    xSemaphoreGive(policyMutex);
+}
+
+void connParamPolicyHidReport(uint32_t notifyUs) {
+    PolicyLock lock;
+    if (!linkUp) {
+        return;
+    }
+    hidHoldUntil = millis() + CONN_PARAM_HID_HOLD_MS;
+    SettingStats& s = stats[appliedSetting];
+    s.hidReports++;
+    s.notifyUsTotal += notifyUs;
+    // Периферия с данными не пропускает события, поэтому отчёт уходит в течение одного интервала
+    uint32_t deliveryUs = actualItvl * 1250u;
+    s.deliveryUsTotal += deliveryUs;
+
+    uint32_t latencyUs = notifyUs + deliveryUs;
+    int bucket = 0;
+    while (bucket < CONN_LATENCY_BUCKETS - 1 && latencyUs >= CONN_LATENCY_BUCKET_MS[bucket] * 1000u) {
+        bucket++;
+    }
+    latencyHistogram.counts[bucket]++;
+    if (latencyUs > latencyHistogram.maxUs) latencyHistogram.maxUs = latencyUs;
+}
+
+void connParamPolicyLatencyHistogram(ConnLatencyHistogram& out) {
+    PolicyLock lock;
+    out = latencyHistogram;
+}
+
+uint16_t connParamPolicyInterval() {
+    return linkUp ? actualItvl : 0;
+}
+
+const char* connParamSettingName(ConnParamSetting setting) {
+    return setting < CONN_PARAM_SETTING_COUNT ? SETTING_NAMES[setting] : "unknown";
+}
+
+void printConnParamStats() {
+    PolicyLock lock;
+    accountTime(millis());
+    if (linkUp) {
+        readActualParams();
+    }
+
+    Serial.println("\n=== Connection Parameters ===");
+    if (linkUp) {
+        Serial.printf("Now: %s, interval %.2f ms, latency %u, timeout %u ms%s\n",
+            SETTING_NAMES[appliedSetting], actualItvl * 1.25f, actualLatency, actualTimeout * 10,
+            requestPending ? " (request pending)" : "");
+    } else {
+        Serial.println("Not connected");
+    }
+    Serial.printf("Lock decision window %lu ms, requested supervision timeout %u ms",
+        (unsigned long)lockWindowMs, timeoutFor(CONN_PARAM_ACTIVE) * 10);
+    if (linkUp && actualTimeout * 10u < lockWindowMs) {
+        Serial.print(" (current timeout is shorter: link may drop before lock)");
+    }
+    Serial.println();
+    for (int i = 0; i < CONN_PARAM_MAX_LINKS; i++) {
+        const TimeoutGuard& g = guards[i];
+        if (g.used) {
+            Serial.printf("Other link handle %u: timeout %u ms, timeout requests %lu\n",
+                g.connHandle, g.timeout * 10, (unsigned long)g.requests);
+        }
+    }
+    for (int i = 0; i < CONN_PARAM_SETTING_COUNT; i++) {
+        const SettingStats& s = stats[i];
+        float timeS = s.timeMs / 1000.0f;
+        Serial.printf("%-6s: %.1f s, radio %.3f mA, requests %lu (ok %lu, rejected %lu, avg apply %lu ms)\n",
+            SETTING_NAMES[i], timeS, timeS > 0 ? s.chargeMas / timeS : 0.0f,
+            (unsigned long)s.requests, (unsigned long)s.accepted, (unsigned long)s.rejected,
+            (unsigned long)(s.accepted ? s.applyMsTotal / s.accepted : 0));
+        if (s.hidReports > 0) {
+            Serial.printf("        HID: %lu reports, notify %lu us, expected delivery %.1f ms\n",
+                (unsigned long)s.hidReports, (unsigned long)(s.notifyUsTotal / s.hidReports),
+                s.deliveryUsTotal / 1000.0f / s.hidReports);
+        }
+    }
+    Serial.print("HID latency ms:");
+    for (int i = 0; i < CONN_LATENCY_BUCKETS; i++) {
+        if (i < CONN_LATENCY_BUCKETS - 1) {
+            Serial.printf(" <%u:%lu", CONN_LATENCY_BUCKET_MS[i], (unsigned long)latencyHistogram.counts[i]);
+        } else {
+            Serial.printf(" >=%u:%lu", CONN_LATENCY_BUCKET_MS[i - 1], (unsigned long)latencyHistogram.counts[i]);
+        }
+    }
+    Serial.printf(", max %.1f\n", latencyHistogram.maxUs / 1000.0f);
+    Serial.println("Recent renegotiations:");
+    for (int i = 0; i < logCount; i++) {
+        const LogEntry& e = logEntries[(logIndex - logCount + i + LOG_SIZE) % LOG_SIZE];
+        Serial.printf("  %8lu ms %-6s %-8s %u ms -> %.2f ms/%u/%u ms rc=%d\n",
+            e.timeMs, SETTING_NAMES[e.setting], e.accepted ? "accepted" : "rejected", e.applyMs,
+            e.itvl * 1.25f, e.latency, e.timeout * 10, e.rc);
+    }
+    Serial.println("=== End Connection Parameters ===\n");
+}
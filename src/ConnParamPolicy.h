@@ -0,0 +1,124 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Политика параметров соединения BLE.
+// Пока пользователь сидит у компьютера, соединение держится на длинном интервале
+// с slave latency (периферия пропускает события, когда ей нечего отправить).
+// При удалении/приближении и перед HID-последовательностями запрашивается короткий интервал.
+// Изменение запрашивается через ble_gap_update_params(); результат определяется опросом
+// фактических параметров соединения, так как событие GAP до loop() не доходит.
+//
+// Значения выбраны в пределах рекомендаций Apple для HID-периферии:
+// интервал >= 11.25 мс, interval_max * (latency + 1) <= 2 с,
+// supervision timeout > interval_max * (latency + 1) * 3 и <= 6 с.
+//
+// Supervision timeout запрашивается не короче окна решения о блокировке (задаёт вызывающий
+// код по периоду опроса RSSI): когда пользователь уходит и пакеты начинают теряться,
+// соединение не должно быть разорвано раньше, чем решение о блокировке успеет сработать
+// и Win+L дойдёт в одном из уцелевших событий соединения.
+// Интервал политика ведёт у одного соединения, а timeout проверяет у каждого подключённого хоста.
+
+#ifndef CONN_PARAM_APPLY_TIMEOUT_MS
+#define CONN_PARAM_APPLY_TIMEOUT_MS 5000   // Сколько ждать применения запроса, затем считаем отказом
+#endif
+#ifndef CONN_PARAM_MIN_REQUEST_GAP_MS
+#define CONN_PARAM_MIN_REQUEST_GAP_MS 2000 // Не чаще одного запроса (кроме подготовки к HID)
+#endif
+#ifndef CONN_PARAM_HID_HOLD_MS
+#define CONN_PARAM_HID_HOLD_MS 3000        // Сколько держать короткий интервал после HID-отчёта
+#endif
+#ifndef CONN_PARAM_HID_WAIT_MS
+#define CONN_PARAM_HID_WAIT_MS 150         // Максимальное ожидание короткого интервала перед HID
+#endif
+#ifndef CONN_PARAM_MAX_TIMEOUT_MS
+#define CONN_PARAM_MAX_TIMEOUT_MS 6000     // Верхняя граница supervision timeout (рекомендации Apple)
+#endif
+#ifndef CONN_PARAM_LOCK_MARGIN_MS
+#define CONN_PARAM_LOCK_MARGIN_MS 1000     // Запас timeout сверх окна решения о блокировке
+#endif
+#ifndef CONN_PARAM_MAX_LINKS
+#define CONN_PARAM_MAX_LINKS 4             // Соединений, у которых проверяется supervision timeout
+#endif
+#ifndef CONN_PARAM_EVENT_UC
+#define CONN_PARAM_EVENT_UC 25.0f          // Заряд одного события соединения, мкКл (модель)
+#endif
+
+// Гистограмма задержки HID-отчёта (вызов notify + один интервал соединения):
+// верхние границы корзин в мс, последняя корзина - всё, что дольше
+#define CONN_LATENCY_BUCKETS 6
+constexpr uint16_t CONN_LATENCY_BUCKET_MS[CONN_LATENCY_BUCKETS - 1] = { 10, 20, 40, 80, 160 };
+
+struct ConnLatencyHistogram {
+    uint32_t counts[CONN_LATENCY_BUCKETS];
+    uint32_t maxUs;
+};
+
+enum ConnParamSetting : uint8_t {
+    CONN_PARAM_HOST = 0,   // Параметры, выбранные хостом при подключении
+    CONN_PARAM_IDLE,       // Пользователь у компьютера или компьютер заблокирован
+    CONN_PARAM_ACTIVE,     // Удаление / приближение
+    CONN_PARAM_HID,        // Отправка HID-последовательности
+    CONN_PARAM_SETTING_COUNT
+};
+
+/**
+ * @brief Новое соединение: сбрасывает политику и запоминает параметры хоста.
+ */
+void connParamPolicyReset(uint16_t connHandle);
+
+/**
+ * @brief Соединение разорвано; статистика сохраняется.
+ */
+void connParamPolicyDisconnected();
+
+/**
+ * @brief Вызывается из loop(): желаемая настройка по состоянию автомата,
+ * проверка результата отправленного запроса.
+ */
+void connParamPolicyUpdate(ConnParamSetting stateSetting);
+
+/**
+ * @brief Соединение, которое политика не ведёт: если его supervision timeout короче окна
+ * блокировки, запрашивает длинный timeout с интервалом и latency, выбранными хостом.
+ * Повторный запрос не чаще раза в 30 с. Вызывается из loop() для каждого подключённого хоста.
+ */
+void connParamPolicyGuardTimeout(uint16_t connHandle);
+
+/**
+ * @brief Соединение разорвано: забывает проверку timeout для этого handle.
+ */
+void connParamPolicyLinkClosed(uint16_t connHandle);
+
+/**
+ * @brief Окно решения о блокировке: от первого отсчёта RSSI ниже порога до отправки Win+L.
+ * Новые запросы параметров несут supervision timeout не короче окна плюс запас; если окно
+ * выросло, действующая настройка запрашивается повторно.
+ */
+void connParamPolicySetLockWindow(uint32_t lockWindowMs);
+
+/**
+ * @brief Перед HID-последовательностью: запрашивает короткий интервал и ждёт его
+ * не дольше CONN_PARAM_HID_WAIT_MS. Политика ведёт одно соединение: для остальных
+ * хостов вызов ничего не делает.
+ */
+void connParamPolicyBeginHid(uint16_t connHandle);
+
+/**
+ * @brief Учитывает отправленный HID-отчёт: время вызова notify и текущий интервал.
+ */
+void connParamPolicyHidReport(uint32_t notifyUs);
+
+/**
+ * @brief Фактический интервал соединения по последнему опросу, 1.25 мс; 0 - соединения нет.
+ */
+uint16_t connParamPolicyInterval();
+
+/**
+ * @brief Копия гистограммы задержки HID-отчётов за всё время работы.
+ */
+void connParamPolicyLatencyHistogram(ConnLatencyHistogram& out);
+
+const char* connParamSettingName(ConnParamSetting setting);
+
+void printConnParamStats();
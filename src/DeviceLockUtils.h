@@ -1,19 +1,19 @@
 #pragma once
 
-#include <Arduino.h> // Для String и bool
+#include <Arduino.h> // Для bool
 
 /**
  * @brief Сохраняет состояние блокировки для указанного устройства
- * 
- * @param deviceAddress MAC-адрес устройства
+ *
+ * @param deviceAddress MAC-адрес устройства (или его короткий ключ)
  * @param locked true - устройство заблокировано, false - разблокировано
  */
-static void saveDeviceLockState(const String& deviceAddress, bool locked);
+void saveDeviceLockState(const char* deviceAddress, bool locked);
 
 /**
  * @brief Загружает состояние блокировки для указанного устройства
- * 
- * @param deviceAddress MAC-адрес устройства
+ *
+ * @param deviceAddress MAC-адрес устройства (или его короткий ключ)
  * @return bool true - устройство было заблокировано, false - разблокировано или ключ не найден
  */
-static bool loadDeviceLockState(const String& deviceAddress); 
\ No newline at end of file
+bool loadDeviceLockState(const char* deviceAddress);
@@ -11,28 +11,16 @@ namespace {
         0x5E, 0x8D, 0x1B, 0xF4, 0x6A, 0x2C, 0x9E, 0x0B,
         0x7D, 0x4F, 0xA3, 0xE5, 0x8C, 0x1D, 0xB6, 0x3F
     };
+
+    // Пароль до 31 символа в hex-виде + завершающий ноль
+    const size_t MAX_ENCRYPTED_PASSWORD_SIZE = 64;
 } // namespace
 
 // Реализация функции cleanMacAddress
 String cleanMacAddress(const char* macAddress) {
-    if (!macAddress || strlen(macAddress) == 0) {
-        return "";
-    }
-
-    // Убираем двоеточия и преобразуем в верхний регистр
-    String result = "";
-    for (size_t i = 0; macAddress[i] != '\0'; i++) {
-        if (macAddress[i] != ':') {
-            result += (char)toupper(macAddress[i]);
-        }
-    }
-    
-    // Берем последние 6 символов
-    if (result.length() > 6) {
-        result = result.substring(result.length() - 6);
-    }
-    
-    return result;
+    ShortKeyBuffer shortKey;
+    makeShortKey(macAddress, shortKey);
+    return String(shortKey);
 }
 
 // Проверка формата пароля
@@ -116,44 +104,140 @@ String decryptPassword(const String& encrypted) {
 // Сюда будем добавлять реализации других функций
 
 /*
- * Новая реализация функции getDevicePasswordFromNVS без использования переменной serialOutputEnabled.
+ * Чтение пароля через общий handle nvsHandle, без открытия пространства имён на каждый вызов.
  */
 String getDevicePasswordFromNVS(const String& shortKey) {
     if (shortKey.length() == 0) {
         return "";
     }
 
-    nvs_handle_t nvsHandle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvsHandle);
-    if (err != ESP_OK) {
+    NvsKeyBuffer passwordKey;
+    makeDeviceKey(DeviceKey::Password, shortKey.c_str(), passwordKey);
+
+    char buffer[MAX_ENCRYPTED_PASSWORD_SIZE];
+    size_t length = sizeof(buffer);
+    if (nvs_get_str(nvsHandle, passwordKey, buffer, &length) != ESP_OK) {
         return "";
     }
 
-    String passwordKey = "pwd_" + shortKey;
-    size_t required_size = 0;
-    err = nvs_get_str(nvsHandle, passwordKey.c_str(), NULL, &required_size);
+    return decryptPassword(String(buffer));
+}
+
+DeviceSettings getDeviceSettings(const char* deviceAddress) {
+    DeviceSettings settings;
+
+    NvsKeyBuffer key;
+    makeDeviceKey(DeviceKey::Password, deviceAddress, key);
+    char pwd[MAX_ENCRYPTED_PASSWORD_SIZE] = {0};
+    size_t length = sizeof(pwd);
+    if (nvs_get_str(nvsHandle, key, pwd, &length) == ESP_OK) {
+        settings.password = String(pwd);
+    }
+
+    loadDeviceThresholds(deviceAddress, settings.lockRssi, settings.unlockRssi);
+    return settings;
+}
+
+void loadDeviceThresholds(const char* deviceAddress, int& lockRssi, int& unlockRssi) {
+    NvsKeyBuffer key;
+    int32_t value;
+
+    makeDeviceKey(DeviceKey::UnlockRssi, deviceAddress, key);
+    if (nvs_get_i32(nvsHandle, key, &value) == ESP_OK) {
+        unlockRssi = value;
+    }
+
+    makeDeviceKey(DeviceKey::LockRssi, deviceAddress, key);
+    if (nvs_get_i32(nvsHandle, key, &value) == ESP_OK) {
+        lockRssi = value;
+    }
+}
+
+void saveDeviceSettings(const char* deviceAddress, const DeviceSettings& settings) {
+    Serial.println("\n=== Saving Device Settings ===");
+    Serial.printf("Device address: %s\n", deviceAddress);
+
+    NvsKeyBuffer pwdKey;
+    NvsKeyBuffer unlockKey;
+    NvsKeyBuffer lockKey;
+    makeDeviceKey(DeviceKey::Password, deviceAddress, pwdKey);
+    makeDeviceKey(DeviceKey::UnlockRssi, deviceAddress, unlockKey);
+    makeDeviceKey(DeviceKey::LockRssi, deviceAddress, lockKey);
+
+    Serial.printf("Password key: %s\n", pwdKey);
+    Serial.printf("Unlock key: %s\n", unlockKey);
+    Serial.printf("Lock key: %s\n", lockKey);
+
+    // nvs_set_str заменяет строку любой длины; стирание ключа перед записью оставило бы
+    // устройство без пароля при потере питания между двумя операциями commit
+    esp_err_t err = nvs_set_str(nvsHandle, pwdKey, settings.password.c_str());
     if (err != ESP_OK) {
-        nvs_close(nvsHandle);
-        return "";
+        Serial.printf("Error saving password: %d\n", err);
+        return;
     }
 
-    char* buffer = (char*)malloc(required_size);
-    if (buffer == NULL) {
-        nvs_close(nvsHandle);
-        return "";
+    err = nvs_set_i32(nvsHandle, unlockKey, settings.unlockRssi);
+    if (err != ESP_OK) {
+        Serial.printf("Error saving unlock RSSI: %d\n", err);
     }
 
-    err = nvs_get_str(nvsHandle, passwordKey.c_str(), buffer, &required_size);
+    err = nvs_set_i32(nvsHandle, lockKey, settings.lockRssi);
     if (err != ESP_OK) {
-        free(buffer);
-        nvs_close(nvsHandle);
-        return "";
+        Serial.printf("Error saving lock RSSI: %d\n", err);
     }
 
-    String encryptedPassword = String(buffer);
-    free(buffer);
-    nvs_close(nvsHandle);
+    // Один commit на все изменения
+    err = nvs_commit(nvsHandle);
+    if (err != ESP_OK) {
+        Serial.printf("Error committing settings: %d\n", err);
+    } else {
+        Serial.println("Settings saved successfully");
+    }
+    Serial.println("=== End Saving Settings ===\n");
+}
 
-    String password = decryptPassword(encryptedPassword);
-    return password;
-} 
\ No newline at end of file
+bool saveHostConnected(const char* deviceAddress, const char* defaultPassword) {
+    bool changed = false;
+    bool passwordSaved = false;
+    if (!hasDevicePassword(deviceAddress)) {
+        NvsKeyBuffer pwdKey;
+        makeDeviceKey(DeviceKey::Password, deviceAddress, pwdKey);
+        esp_err_t err = nvs_set_str(nvsHandle, pwdKey, encryptPassword(defaultPassword).c_str());
+        if (err != ESP_OK) {
+            Serial.printf("Error saving default password: %d\n", err);
+        } else {
+            Serial.printf("No password for %s, default password saved\n", deviceAddress);
+            changed = passwordSaved = true;
+        }
+    }
+
+    char lastAddr[32];
+    if (!loadLastAddress(lastAddr, sizeof(lastAddr)) || strcasecmp(lastAddr, deviceAddress) != 0) {
+        esp_err_t err = nvs_set_str(nvsHandle, StorageKeys::LAST_ADDR, deviceAddress);
+        if (err != ESP_OK) {
+            Serial.printf("Error saving last address: %d\n", err);
+        } else {
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        esp_err_t err = nvs_commit(nvsHandle);
+        if (err != ESP_OK) {
+            Serial.printf("Error committing host connection: %d\n", err);
+            return false;
+        }
+    }
+    return passwordSaved;
+}
+
+bool hasDevicePassword(const char* deviceAddress) {
+    if (!deviceAddress || deviceAddress[0] == '\0') {
+        return false;
+    }
+    NvsKeyBuffer key;
+    makeDeviceKey(DeviceKey::Password, deviceAddress, key);
+    size_t length = 0;
+    // Запрос только длины: строка не копируется
+    return nvs_get_str(nvsHandle, key, NULL, &length) == ESP_OK && length > 1;
+}
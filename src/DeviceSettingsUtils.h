@@ -2,6 +2,17 @@
 
 #include <Arduino.h> // Для String
 
+// Значения порогов RSSI по умолчанию
+#define DEFAULT_LOCK_RSSI -60    // Порог RSSI для блокировки по умолчанию
+#define DEFAULT_UNLOCK_RSSI -45  // Порог RSSI для разблокировки по умолчанию
+
+// Структура для хранения настроек устройства
+struct DeviceSettings {
+    int unlockRssi = DEFAULT_UNLOCK_RSSI; // Минимальный RSSI для разблокировки
+    int lockRssi = DEFAULT_LOCK_RSSI;     // RSSI для блокировки
+    String password;                      // Пароль (зашифрованный)
+};
+
 /**
  * @brief Очищает MAC-адрес, оставляя только последние 6 символов (3 октета).
  * 
@@ -50,4 +61,45 @@ String decryptPassword(const String& encrypted);
  */
 String getDevicePasswordFromNVS(const String& shortKey);
 
+/**
+ * @brief Загружает настройки устройства из NVS. Отсутствующие значения заменяются значениями по умолчанию.
+ *
+ * @param deviceAddress MAC-адрес устройства или его короткий ключ.
+ */
+DeviceSettings getDeviceSettings(const char* deviceAddress);
+
+inline DeviceSettings getDeviceSettings(const String& deviceAddress) {
+    return getDeviceSettings(deviceAddress.c_str());
+}
+
+/**
+ * @brief Сохраняет пароль и пороги устройства. Адрес последнего устройства не меняется:
+ * его записывают saveHostConnected() и отключение хоста.
+ */
+void saveDeviceSettings(const char* deviceAddress, const DeviceSettings& settings);
+
+inline void saveDeviceSettings(const String& deviceAddress, const DeviceSettings& settings) {
+    saveDeviceSettings(deviceAddress.c_str(), settings);
+}
+
+/**
+ * @brief Сопряжённый хост подключился: запоминает его как последнее устройство (по нему при холодном
+ * старте загружаются пороги и состояние блокировки), а хосту без пароля записывает пароль по умолчанию.
+ * Всё одним commit; если адрес уже записан и пароль есть, NVS не изменяется.
+ * @return true, если записан пароль по умолчанию.
+ */
+bool saveHostConnected(const char* deviceAddress, const char* defaultPassword);
+
+/**
+ * @brief Проверяет наличие пароля для устройства без чтения самой строки.
+ * Не создаёт временных String, подходит для вызова на каждом кадре.
+ */
+bool hasDevicePassword(const char* deviceAddress);
+
+/**
+ * @brief Читает пороги RSSI устройства в переданные переменные (без пароля и без String).
+ * Отсутствующие значения не изменяются.
+ */
+void loadDeviceThresholds(const char* deviceAddress, int& lockRssi, int& unlockRssi);
+
 // Сюда будем добавлять объявления других функций по мере переноса 
\ No newline at end of file
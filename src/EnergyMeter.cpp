@@ -0,0 +1,142 @@
+#include "EnergyMeter.h"
+#include <esp_timer.h>
+
+namespace {
+    EnergyModel model = {
+        // N12   N9    N6    N3    N0    P3    P6    P9
+        { 1.6f, 1.8f, 2.0f, 2.3f, 2.7f, 3.2f, 3.8f, 4.5f },
+        95.0f,      // scanRxMa
+        45.0f,      // backlightFullMa
+        6.0f,       // panelOnMa
+        22.0f,      // cpuMaAt80
+        0.12f,      // cpuMaPerMhz: 240 МГц ~ 41 мА
+        2.0f,       // cpuLightSleepMa
+        0.02f,      // hidReportMas
+        200.0f      // batteryMah
+    };
+
+    EnergySample lastSample = {};
+    bool haveSample = false;
+    int64_t lastUpdateUs = 0;
+    int64_t startUs = 0;
+
+    double componentMas[ENERGY_COMPONENT_COUNT] = {};  // Накопленный заряд, мА*с
+    float lastComponentMa[ENERGY_COMPONENT_COUNT] = {};
+    uint32_t hidReports = 0;
+
+    void sampleCurrents(const EnergySample& s, float* ma) {
+        int level = (int)s.txPower;
+        if (level < 0) level = 0;
+        if (level > 7) level = 7;
+        ma[ENERGY_RADIO_TX] = s.connected ? model.radioTxMa[level] : model.radioTxMa[level] * 0.5f;
+
+        float scanDuty = (s.scanning && s.scanInterval > 0) ? (float)s.scanWindow / s.scanInterval : 0.0f;
+        ma[ENERGY_SCAN] = model.scanRxMa * scanDuty;
+
+        ma[ENERGY_DISPLAY] = s.displayOn ? model.panelOnMa + model.backlightFullMa * s.brightness / 255.0f : 0.0f;
+
+        if (s.lightSleep) {
+            ma[ENERGY_CPU] = model.cpuLightSleepMa;
+        } else {
+            float extraMhz = s.cpuMhz > 80 ? (float)(s.cpuMhz - 80) : 0.0f;
+            ma[ENERGY_CPU] = model.cpuMaAt80 + model.cpuMaPerMhz * extraMhz;
+        }
+
+        ma[ENERGY_HID] = 0.0f;  // Учитывается по событиям, а не по времени
+    }
+} // namespace
+
+const char* energyComponentName(EnergyComponent component) {
+    switch (component) {
+        case ENERGY_RADIO_TX: return "Radio TX";
+        case ENERGY_SCAN:     return "Scan RX";
+        case ENERGY_DISPLAY:  return "Display";
+        case ENERGY_CPU:      return "CPU";
+        case ENERGY_HID:      return "HID";
+        default:              return "?";
+    }
+}
+
+void energyMeterSetModel(const EnergyModel& newModel) {
+    model = newModel;
+}
+
+const EnergyModel& energyMeterModel() {
+    return model;
+}
+
+void energyMeterUpdate(const EnergySample& sample) {
+    int64_t now = esp_timer_get_time();
+    if (!haveSample) {
+        startUs = now;
+    } else {
+        // Предыдущее состояние действовало весь интервал до этого вызова
+        double dt = (now - lastUpdateUs) / 1e6;
+        for (int i = 0; i < ENERGY_COMPONENT_COUNT; i++) {
+            componentMas[i] += lastComponentMa[i] * dt;
+        }
+    }
+    lastSample = sample;
+    sampleCurrents(lastSample, lastComponentMa);
+    lastUpdateUs = now;
+    haveSample = true;
+}
+
+void energyMeterAddHidReports(uint32_t reports) {
+    hidReports += reports;
+    componentMas[ENERGY_HID] += reports * model.hidReportMas;
+}
+
+void energyMeterReport(EnergyReport& report, float batteryPercent) {
+    int64_t now = esp_timer_get_time();
+    double pendingS = haveSample ? (now - lastUpdateUs) / 1e6 : 0.0;
+    double elapsedS = haveSample ? (now - startUs) / 1e6 : 0.0;
+
+    report.totalMah = 0;
+    report.currentMa = 0;
+    for (int i = 0; i < ENERGY_COMPONENT_COUNT; i++) {
+        double mas = componentMas[i] + lastComponentMa[i] * pendingS;
+        report.componentMah[i] = (float)(mas / 3600.0);
+        report.componentMa[i] = lastComponentMa[i];
+        report.totalMah += report.componentMah[i];
+        report.currentMa += lastComponentMa[i];
+    }
+    report.elapsedHours = (float)(elapsedS / 3600.0);
+    report.averageMa = elapsedS > 0 ? (float)(report.totalMah / report.elapsedHours) : 0.0f;
+    report.hidReports = hidReports;
+
+    float remainingMah = model.batteryMah * batteryPercent / 100.0f;
+    // Прогноз по среднему току: текущий ток скачет вместе с состоянием
+    float basisMa = report.averageMa > 0 ? report.averageMa : report.currentMa;
+    report.projectedHours = basisMa > 0 ? remainingMah / basisMa : 0.0f;
+}
+
+void energyMeterReset() {
+    for (int i = 0; i < ENERGY_COMPONENT_COUNT; i++) {
+        componentMas[i] = 0;
+    }
+    hidReports = 0;
+    startUs = lastUpdateUs = esp_timer_get_time();
+}
+
+void printEnergyReport(float batteryPercent) {
+    EnergyReport report;
+    energyMeterReport(report, batteryPercent);
+
+    Serial.println("\n=== Energy Report ===");
+    Serial.printf("Accounted time: %.2f h\n", report.elapsedHours);
+    Serial.printf("%-10s %10s %10s %7s\n", "Component", "mAh", "now mA", "share");
+    for (int i = 0; i < ENERGY_COMPONENT_COUNT; i++) {
+        Serial.printf("%-10s %10.3f %10.2f %6.1f%%\n",
+            energyComponentName((EnergyComponent)i),
+            report.componentMah[i],
+            report.componentMa[i],
+            report.totalMah > 0 ? report.componentMah[i] * 100.0f / report.totalMah : 0.0f);
+    }
+    Serial.printf("Total: %.3f mAh, average %.2f mA, now %.2f mA\n",
+        report.totalMah, report.averageMa, report.currentMa);
+    Serial.printf("HID reports: %lu\n", (unsigned long)report.hidReports);
+    Serial.printf("Battery %.0f%% of %.0f mAh -> projected runtime %.1f h\n",
+        batteryPercent, model.batteryMah, report.projectedHours);
+    Serial.println("=== End Energy Report ===\n");
+}
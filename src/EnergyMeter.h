@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_bt.h>  // esp_power_level_t
+
+// Учёт энергии по компонентам. loop() периодически передаёт текущее состояние
+// (мощность передатчика, сканирование, яркость, частота CPU), счётчик интегрирует
+// ток модели по времени и оценивает расход в мАч и оставшееся время работы.
+
+enum EnergyComponent {
+    ENERGY_RADIO_TX,    // Соединение BLE, зависит от мощности передатчика
+    ENERGY_SCAN,        // Приём во время сканирования (окно / интервал)
+    ENERGY_DISPLAY,     // Подсветка и панель
+    ENERGY_CPU,         // Процессор, зависит от частоты и light sleep
+    ENERGY_HID,         // Пакеты HID-отчётов
+    ENERGY_COMPONENT_COUNT
+};
+
+/**
+ * @brief Модель тока, мА. Значения по умолчанию - оценка для M5StickC Plus2,
+ * их можно заменить измеренными через energyMeterSetModel().
+ */
+struct EnergyModel {
+    float radioTxMa[8];         // Средний ток соединения по уровням ESP_PWR_LVL_N12..ESP_PWR_LVL_P9
+    float scanRxMa;             // Ток приёмника при 100% окна сканирования
+    float backlightFullMa;      // Подсветка при яркости 255
+    float panelOnMa;            // Панель включена (без подсветки)
+    float cpuMaAt80;            // CPU на 80 МГц
+    float cpuMaPerMhz;          // Прирост тока на каждый МГц выше 80
+    float cpuLightSleepMa;      // Light sleep
+    float hidReportMas;         // Заряд на один HID-отчёт, мА*с
+    float batteryMah;           // Ёмкость аккумулятора
+};
+
+/**
+ * @brief Состояние потребителей на момент измерения.
+ */
+struct EnergySample {
+    bool connected;
+    esp_power_level_t txPower;
+    bool scanning;
+    uint16_t scanInterval;      // В единицах 0.625 мс
+    uint16_t scanWindow;
+    uint8_t brightness;         // 0..255
+    bool displayOn;
+    uint32_t cpuMhz;
+    bool lightSleep;
+};
+
+struct EnergyReport {
+    float componentMah[ENERGY_COMPONENT_COUNT];
+    float componentMa[ENERGY_COMPONENT_COUNT];  // Текущий ток по последнему измерению
+    float totalMah;
+    float averageMa;            // Средний ток за всё время учёта
+    float currentMa;            // Ток по последнему измерению
+    float elapsedHours;
+    float projectedHours;       // Оставшееся время работы при текущем токе
+    uint32_t hidReports;
+};
+
+const char* energyComponentName(EnergyComponent component);
+
+/**
+ * @brief Заменяет модель тока. Накопленные значения сохраняются.
+ */
+void energyMeterSetModel(const EnergyModel& model);
+const EnergyModel& energyMeterModel();
+
+/**
+ * @brief Добавляет интервал с предыдущего вызова по предыдущему состоянию и запоминает новое.
+ */
+void energyMeterUpdate(const EnergySample& sample);
+
+/**
+ * @brief Учитывает отправленные HID-отчёты (нажатия, блокировка, ввод пароля).
+ */
+void energyMeterAddHidReports(uint32_t reports);
+
+/**
+ * @brief Заполняет отчёт. batteryPercent - текущий заряд для прогноза времени работы.
+ */
+void energyMeterReport(EnergyReport& report, float batteryPercent);
+
+void energyMeterReset();
+
+/**
+ * @brief Выводит отчёт в Serial (команда power).
+ */
+void printEnergyReport(float batteryPercent);
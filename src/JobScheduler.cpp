@@ -0,0 +1,241 @@
+#include "JobScheduler.h"
+
+namespace {
+    const int8_t NO_JOB = -1;
+
+    struct Job {
+        const char* name;
+        JobFunction fn;
+        uint32_t periodMs;
+        uint32_t deadline;      // millis() следующего запуска
+        int8_t slot;            // Ячейка колеса, NO_JOB - не в колесе (выполняется)
+        int8_t next;            // Следующая задача в той же ячейке
+
+        uint32_t runs;
+        uint32_t overruns;      // Запуск не уложился в период: следующий дедлайн уже прошёл
+        uint32_t skipped;       // Пропущенные из-за этого запуски
+        uint32_t maxLateMs;     // Джиттер: опоздание старта относительно дедлайна
+        uint64_t sumLateMs;
+        uint32_t maxRunUs;
+        uint64_t sumRunUs;
+    };
+
+    Job jobs[JOB_MAX_JOBS];
+    int jobCount = 0;
+
+    int8_t wheel[JOB_WHEEL_SLOTS];
+    bool wheelReady = false;
+    uint16_t wheelSlot = 0;      // Ячейка текущего тика
+    uint32_t wheelMs = 0;        // Начало текущего тика
+
+    uint32_t passes = 0;         // Вызовы jobSchedulerRun()
+    uint32_t idlePasses = 0;     // Из них без единого запуска
+    unsigned long statsSince = 0;
+
+    void initWheel() {
+        for (int i = 0; i < JOB_WHEEL_SLOTS; i++) {
+            wheel[i] = NO_JOB;
+        }
+        wheelMs = millis();
+        wheelMs -= wheelMs % JOB_WHEEL_TICK_MS;
+        wheelSlot = 0;
+        statsSince = millis();
+        wheelReady = true;
+    }
+
+    void insert(int id) {
+        Job& j = jobs[id];
+        int32_t ahead = (int32_t)(j.deadline - wheelMs);
+        // Просроченные задачи - в текущую ячейку, они выполнятся при ближайшем проходе
+        uint16_t slot = ahead <= 0 ? wheelSlot
+            : (wheelSlot + (uint32_t)ahead / JOB_WHEEL_TICK_MS) % JOB_WHEEL_SLOTS;
+        j.slot = slot;
+        j.next = wheel[slot];
+        wheel[slot] = id;
+    }
+
+    void unlink(int id) {
+        Job& j = jobs[id];
+        if (j.slot == NO_JOB) {
+            return;
+        }
+        int8_t* link = &wheel[j.slot];
+        while (*link != NO_JOB) {
+            if (*link == id) {
+                *link = j.next;
+                break;
+            }
+            link = &jobs[*link].next;
+        }
+        j.slot = NO_JOB;
+        j.next = NO_JOB;
+    }
+
+    void runJob(int id) {
+        Job& j = jobs[id];
+        unsigned long start = millis();
+        uint32_t late = start - j.deadline;
+        uint32_t startUs = micros();
+        j.fn();
+        uint32_t runUs = micros() - startUs;
+
+        j.runs++;
+        j.sumLateMs += late;
+        if (late > j.maxLateMs) j.maxLateMs = late;
+        j.sumRunUs += runUs;
+        if (runUs > j.maxRunUs) j.maxRunUs = runUs;
+
+        // Следующий дедлайн - по сетке периода от предыдущего, чтобы не копить дрейф
+        unsigned long end = millis();
+        uint32_t next = j.deadline + j.periodMs;
+        if ((int32_t)(next - end) <= 0) {
+            uint32_t missed = (end - j.deadline) / j.periodMs;
+            j.overruns++;
+            j.skipped += missed;
+            next = j.deadline + (missed + 1) * j.periodMs;
+        }
+        j.deadline = next;
+    }
+} // namespace
+
+int jobAdd(const char* name, JobFunction fn, uint32_t periodMs, uint32_t firstDelayMs) {
+    if (!wheelReady) {
+        initWheel();
+    }
+    if (jobCount >= JOB_MAX_JOBS || !fn) {
+        return -1;
+    }
+    int id = jobCount++;
+    Job& j = jobs[id];
+    j = Job{};
+    j.name = name;
+    j.fn = fn;
+    j.periodMs = periodMs > 0 ? periodMs : 1;
+    j.deadline = millis() + firstDelayMs;
+    j.slot = NO_JOB;
+    j.next = NO_JOB;
+    insert(id);
+    return id;
+}
+
+void jobSetPeriod(int id, uint32_t periodMs) {
+    if (id < 0 || id >= jobCount || periodMs == 0 || jobs[id].periodMs == periodMs) {
+        return;
+    }
+    Job& j = jobs[id];
+    j.periodMs = periodMs;
+    uint32_t latest = millis() + periodMs;
+    if (j.slot != NO_JOB && (int32_t)(j.deadline - latest) > 0) {
+        unlink(id);
+        j.deadline = latest;
+        insert(id);
+    }
+}
+
+void jobRunSoon(int id) {
+    if (id < 0 || id >= jobCount || jobs[id].slot == NO_JOB) {
+        return;
+    }
+    unlink(id);
+    jobs[id].deadline = millis();
+    insert(id);
+}
+
+void jobSchedulerRun() {
+    if (!wheelReady) {
+        return;
+    }
+    unsigned long now = millis();
+    passes++;
+
+    // Обходим ячейки всех тиков с прошлого прохода (не больше одного оборота)
+    uint32_t ticks = (now - wheelMs) / JOB_WHEEL_TICK_MS;
+    uint32_t visit = ticks + 1 < JOB_WHEEL_SLOTS ? ticks + 1 : JOB_WHEEL_SLOTS;
+    int8_t due[JOB_MAX_JOBS];
+    int dueCount = 0;
+    for (uint32_t i = 0; i < visit; i++) {
+        int8_t* link = &wheel[(wheelSlot + i) % JOB_WHEEL_SLOTS];
+        while (*link != NO_JOB) {
+            Job& j = jobs[*link];
+            if ((int32_t)(j.deadline - now) <= 0) {
+                // Задача следующего оборота осталась бы на месте; эта - срок наступил
+                int8_t id = *link;
+                *link = j.next;
+                j.slot = NO_JOB;
+                j.next = NO_JOB;
+                due[dueCount++] = id;
+            } else {
+                link = &j.next;
+            }
+        }
+    }
+    wheelSlot = (wheelSlot + ticks) % JOB_WHEEL_SLOTS;
+    wheelMs += ticks * JOB_WHEEL_TICK_MS;
+
+    if (dueCount == 0) {
+        idlePasses++;
+        return;
+    }
+    for (int i = 0; i < dueCount; i++) {
+        runJob(due[i]);
+        insert(due[i]);
+    }
+}
+
+uint32_t jobSchedulerMsUntilNext() {
+    if (!wheelReady) {
+        return 1;
+    }
+    unsigned long now = millis();
+    // Первая непустая (для текущего оборота) ячейка содержит ближайший дедлайн
+    for (uint32_t i = 0; i < JOB_WHEEL_SLOTS; i++) {
+        uint32_t windowEnd = wheelMs + (i + 1) * JOB_WHEEL_TICK_MS;
+        int8_t id = wheel[(wheelSlot + i) % JOB_WHEEL_SLOTS];
+        bool found = false;
+        uint32_t best = 0;
+        for (; id != NO_JOB; id = jobs[id].next) {
+            uint32_t d = jobs[id].deadline;
+            if ((int32_t)(d - windowEnd) < 0 && (!found || (int32_t)(d - best) < 0)) {
+                found = true;
+                best = d;
+            }
+        }
+        if (found) {
+            int32_t wait = (int32_t)(best - now);
+            return wait > 0 ? wait : 0;
+        }
+    }
+    int32_t wait = (int32_t)(wheelMs + JOB_WHEEL_SLOTS * JOB_WHEEL_TICK_MS - now);
+    return wait > 0 ? wait : 0;
+}
+
+void jobStatsReset() {
+    for (int i = 0; i < jobCount; i++) {
+        Job& j = jobs[i];
+        j.runs = j.overruns = j.skipped = 0;
+        j.maxLateMs = j.maxRunUs = 0;
+        j.sumLateMs = j.sumRunUs = 0;
+    }
+    passes = idlePasses = 0;
+    statsSince = millis();
+}
+
+void printJobStats() {
+    float seconds = (millis() - statsSince) / 1000.0f;
+    Serial.println("\n=== Job Scheduler ===");
+    Serial.printf("Wheel: %d slots x %d ms, %d jobs\n", JOB_WHEEL_SLOTS, JOB_WHEEL_TICK_MS, jobCount);
+    Serial.printf("Passes: %lu (%.1f/s), idle: %lu\n", (unsigned long)passes,
+        seconds > 0 ? passes / seconds : 0.0f, (unsigned long)idlePasses);
+    Serial.println("Job            Period    Runs   Late avg/max ms   Run avg/max us   Overruns  Skipped");
+    for (int i = 0; i < jobCount; i++) {
+        const Job& j = jobs[i];
+        float avgLate = j.runs ? (float)j.sumLateMs / j.runs : 0;
+        float avgRun = j.runs ? (float)j.sumRunUs / j.runs : 0;
+        Serial.printf("%-12s %6lu ms %7lu   %6.1f / %-6lu   %6.0f / %-7lu %8lu %8lu\n",
+            j.name, (unsigned long)j.periodMs, (unsigned long)j.runs,
+            avgLate, (unsigned long)j.maxLateMs, avgRun, (unsigned long)j.maxRunUs,
+            (unsigned long)j.overruns, (unsigned long)j.skipped);
+    }
+    Serial.printf("Next deadline in %lu ms\n", (unsigned long)jobSchedulerMsUntilNext());
+    Serial.println("=== End Job Scheduler ===\n");
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Кооперативный планировщик периодических задач loop() на колесе таймеров.
+// Колесо из JOB_WHEEL_SLOTS ячеек по JOB_WHEEL_TICK_MS; задача лежит в ячейке своего дедлайна,
+// задачи следующих оборотов пропускаются по абсолютному дедлайну. Срабатывание - O(задач в ячейке),
+// поиск ближайшего дедлайна для простоя - не больше одного оборота колеса.
+//
+// Дедлайн следующего запуска = предыдущий дедлайн + период (без накопления дрейфа).
+// Если задача опоздала больше чем на период, пропущенные запуски не догоняются.
+//
+// Статистика на задачу: запуски, время выполнения, опоздание старта относительно дедлайна
+// (джиттер) и перерасходы - выполнение дольше периода или пропущенные запуски.
+
+#ifndef JOB_MAX_JOBS
+#define JOB_MAX_JOBS 16
+#endif
+#ifndef JOB_WHEEL_SLOTS
+#define JOB_WHEEL_SLOTS 64
+#endif
+#ifndef JOB_WHEEL_TICK_MS
+#define JOB_WHEEL_TICK_MS 10
+#endif
+
+typedef void (*JobFunction)();
+
+/**
+ * @brief Регистрирует периодическую задачу.
+ * @param firstDelayMs Задержка первого запуска от текущего момента
+ * @return Идентификатор задачи или -1, если таблица заполнена
+ */
+int jobAdd(const char* name, JobFunction fn, uint32_t periodMs, uint32_t firstDelayMs = 0);
+
+/**
+ * @brief Меняет период. Следующий запуск - не позже чем через новый период.
+ */
+void jobSetPeriod(int id, uint32_t periodMs);
+
+/**
+ * @brief Запускает задачу при ближайшем вызове jobSchedulerRun(), не меняя её период.
+ */
+void jobRunSoon(int id);
+
+/**
+ * @brief Выполняет все задачи, чей дедлайн наступил.
+ */
+void jobSchedulerRun();
+
+/**
+ * @brief Сколько можно простаивать до ближайшего дедлайна, мс (не больше одного оборота колеса).
+ */
+uint32_t jobSchedulerMsUntilNext();
+
+/**
+ * @brief Сбрасывает статистику всех задач.
+ */
+void jobStatsReset();
+
+void printJobStats();
@@ -6,11 +6,19 @@
 // Определяем и инициализируем переменные здесь
 // (Убираем static и анонимное пространство имен)
 nvs_handle_t nvsHandle; // Определение будет найдено линковщиком
-const char* NVS_NAMESPACE = "m5kb_v1";
-const char* KEY_IS_LOCKED = "is_locked";
+const char* NVS_NAMESPACE = StorageKeys::NAMESPACE;
+const char* KEY_IS_LOCKED = StorageKeys::IS_LOCKED;
+
+namespace {
+    bool nvsOpened = false;
+} // namespace
 
 // Функция для инициализации NVS и установки начальных значений
 void initializeNvs() {
+    if (nvsOpened) {
+        return;  // Handle уже открыт и переиспользуется
+    }
+
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         Serial.println("Erasing NVS flash...");
@@ -27,6 +35,7 @@ void initializeNvs() {
         if (ret != ESP_OK) {
             Serial.printf("Error opening NVS handle: %d\n", ret);
         } else {
+            nvsOpened = true;
             Serial.println("Storage initialized successfully");
             // Проверяем есть ли начальные значения, если нужно
             int8_t isLockedCheck;
@@ -34,6 +43,7 @@ void initializeNvs() {
              if (checkErr == ESP_ERR_NVS_NOT_FOUND) {
                  // Устанавливаем начальное значение (разблокировано)
                  nvs_set_i8(nvsHandle, KEY_IS_LOCKED, 0);
+                 nvs_set_str(nvsHandle, StorageKeys::LAST_ADDR, "");
                  nvs_commit(nvsHandle);
                  Serial.println("Initial lock state set to UNLOCKED");
              }
@@ -41,6 +51,25 @@ void initializeNvs() {
     }
 }
 
+void resetNvs() {
+    if (nvsOpened) {
+        nvs_close(nvsHandle);
+        nvsOpened = false;
+    }
+    nvs_flash_erase();
+    initializeNvs();
+}
+
+void eraseAllSettings() {
+    esp_err_t err = nvs_erase_all(nvsHandle);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvsHandle);
+    }
+    if (err != ESP_OK) {
+        Serial.printf("Error erasing settings: %d\n", err);
+    }
+}
+
 // Функция для сохранения глобального состояния блокировки
 void saveGlobalLockState(bool locked) {
     esp_err_t err = nvs_set_i8(nvsHandle, KEY_IS_LOCKED, locked ? 1 : 0);
@@ -63,4 +92,71 @@ bool loadGlobalLockState() {
     }
     // Если ключ не найден, считаем, что разблокировано
     return (err == ESP_OK && locked != 0);
-} 
\ No newline at end of file
+}
+
+uint8_t loadDisplayColorDepth(uint8_t defaultDepth) {
+    uint8_t depth = 0;
+    if (nvs_get_u8(nvsHandle, StorageKeys::UI_DEPTH, &depth) != ESP_OK) {
+        return defaultDepth;
+    }
+    return depth;
+}
+
+void saveDisplayColorDepth(uint8_t depth) {
+    esp_err_t err = nvs_set_u8(nvsHandle, StorageKeys::UI_DEPTH, depth);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvsHandle);
+    }
+    if (err != ESP_OK) {
+        Serial.printf("Error saving display color depth: %d\n", err);
+    }
+}
+
+void makeShortKey(const char* macAddress, ShortKeyBuffer& out) {
+    out[0] = '\0';
+    if (!macAddress) {
+        return;
+    }
+
+    // Идём с конца строки и берём последние SHORT_KEY_LEN символов без двоеточий
+    char tail[SHORT_KEY_LEN];
+    size_t count = 0;
+    for (size_t i = strlen(macAddress); i > 0 && count < SHORT_KEY_LEN; i--) {
+        char c = macAddress[i - 1];
+        if (c == ':') continue;
+        tail[SHORT_KEY_LEN - 1 - count] = (char)toupper(c);
+        count++;
+    }
+    memcpy(out, tail + SHORT_KEY_LEN - count, count);
+    out[count] = '\0';
+}
+
+void makeDeviceKey(DeviceKey kind, const char* deviceAddress, NvsKeyBuffer& out) {
+    const char* prefix = deviceKeyPrefix(kind);
+    size_t prefixLen = strlen(prefix);
+    memcpy(out, prefix, prefixLen);
+
+    ShortKeyBuffer shortKey;
+    makeShortKey(deviceAddress, shortKey);
+    // Длина префикса + короткого ключа проверена static_assert в StorageKeys.h
+    strcpy(out + prefixLen, shortKey);
+}
+
+bool loadLastAddress(char* out, size_t outSize) {
+    size_t length = outSize;
+    if (nvs_get_str(nvsHandle, StorageKeys::LAST_ADDR, out, &length) != ESP_OK) {
+        out[0] = '\0';
+        return false;
+    }
+    return out[0] != '\0';
+}
+
+void saveLastAddress(const char* deviceAddress) {
+    esp_err_t err = nvs_set_str(nvsHandle, StorageKeys::LAST_ADDR, deviceAddress);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvsHandle);
+    }
+    if (err != ESP_OK) {
+        Serial.printf("Error saving last address: %d\n", err);
+    }
+}
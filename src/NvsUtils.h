@@ -2,8 +2,10 @@
 
 #include <Arduino.h> // Для bool
 #include <nvs.h>       // Добавляем для nvs_handle_t
+#include "StorageKeys.h"
 
-// Объявляем переменные как extern, чтобы они были видны в main.cpp
+// Единственный handle пространства имён NVS_NAMESPACE. Открывается в initializeNvs()
+// и остаётся открытым всё время работы; модули не открывают собственных handle.
 extern nvs_handle_t nvsHandle;
 extern const char* NVS_NAMESPACE;
 extern const char* KEY_IS_LOCKED;
@@ -15,6 +17,16 @@ extern const char* KEY_IS_LOCKED;
  */
 void initializeNvs();
 
+/**
+ * @brief Полностью стирает раздел NVS и заново открывает хранилище.
+ */
+void resetNvs();
+
+/**
+ * @brief Стирает все ключи пространства имён одним commit.
+ */
+void eraseAllSettings();
+
 /**
  * @brief Сохраняет глобальное состояние блокировки в NVS.
  * @param locked true, если заблокировано, false, если разблокировано.
@@ -25,4 +37,35 @@ void saveGlobalLockState(bool locked);
  * @brief Загружает глобальное состояние блокировки из NVS.
  * @return true, если заблокировано, false, если разблокировано или ключ не найден.
  */
-bool loadGlobalLockState(); 
\ No newline at end of file
+bool loadGlobalLockState();
+
+/**
+ * @brief Собирает короткий ключ устройства (последние 6 hex-символов MAC в верхнем регистре)
+ * в буфер на стеке, без выделения памяти.
+ */
+void makeShortKey(const char* macAddress, ShortKeyBuffer& out);
+
+/**
+ * @brief Собирает ключ NVS для устройства: префикс из схемы + короткий ключ.
+ * Работает и с полным MAC-адресом, и с уже готовым коротким ключом.
+ */
+void makeDeviceKey(DeviceKey kind, const char* deviceAddress, NvsKeyBuffer& out);
+
+/**
+ * @brief Читает адрес последнего устройства.
+ * @return true, если адрес сохранён и не пуст.
+ */
+bool loadLastAddress(char* out, size_t outSize);
+
+/**
+ * @brief Сохраняет адрес последнего устройства и фиксирует изменения.
+ */
+void saveLastAddress(const char* deviceAddress);
+
+/**
+ * @brief Глубина цвета буферов экрана, выбранная командой `ui depth`.
+ * @return Сохранённое значение или defaultDepth, если настройка не задана.
+ */
+uint8_t loadDisplayColorDepth(uint8_t defaultDepth);
+void saveDisplayColorDepth(uint8_t depth);
+
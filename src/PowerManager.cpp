@@ -0,0 +1,153 @@
+#include "PowerManager.h"
+#include <M5Unified.h>
+
+PowerManager powerManager;
+
+namespace {
+    // Сканирование: интервал/окно в единицах 0.625 мс.
+    // Частота CPU не ниже 80 МГц - минимум для работы BLE-контроллера.
+    const PowerProfile PROFILES[POWER_PROFILE_COUNT] = {
+        // id, name, TX floor/ceiling, scan RSSI/search, brightness normal/dim/near, CPU, RSSI, display
+        { POWER_PROFILE_USB, "USB",
+          ESP_PWR_LVL_N12, ESP_PWR_LVL_P9, 40, 20, 320, 16, 50, 20, 20, 240, 500, 100 },
+        { POWER_PROFILE_BATTERY, "Battery",
+          ESP_PWR_LVL_N12, ESP_PWR_LVL_P6, 80, 16, 320, 16, 50, 20, 0, 160, 500, 200 },
+        { POWER_PROFILE_LOW_BATTERY, "Low battery",
+          ESP_PWR_LVL_N12, ESP_PWR_LVL_P3, 160, 16, 640, 16, 30, 10, 0, 80, 1000, 500 },
+    };
+} // namespace
+
+PowerManager::PowerManager()
+    : active(&PROFILES[POWER_PROFILE_USB]),
+      pending(POWER_PROFILE_USB),
+      pendingCount(0),
+      profileSwitches(0),
+      usbPowered(true),
+      charging(false),
+      batteryPercent(100),
+      batteryMv(0),
+      vbusMv(-1),
+      sourceMethod("none"),
+      trendStartMv(0),
+      trendStartMs(0),
+      trendUsb(false) {}
+
+void PowerManager::readPmic() {
+    batteryPercent = M5.Power.getBatteryLevel();
+    batteryMv = M5.Power.getBatteryVoltage();
+    vbusMv = M5.Power.getVBUSVoltage();
+
+    auto chargeState = M5.Power.isCharging();
+    charging = (chargeState == m5::Power_Class::is_charging);
+
+    if (vbusMv >= 0) {
+        usbPowered = vbusMv >= POWER_VBUS_PRESENT_MV;
+        sourceMethod = "VBUS";
+    } else if (chargeState != m5::Power_Class::charge_unknown) {
+        // PMIC не измеряет VBUS - судим по контроллеру заряда
+        usbPowered = (chargeState == m5::Power_Class::is_charging);
+        sourceMethod = "charger";
+    } else {
+        // Ни VBUS, ни состояния заряда: "неизвестно" - не USB, пока напряжение не начнёт расти
+        usbPowered = voltageTrendUsb();
+        sourceMethod = "voltage trend";
+    }
+}
+
+// Напряжение сравнивается с началом окна: рост - заряд от USB, падение - работа от батареи.
+// Полностью заряженная батарея на USB и батарея под малой нагрузкой меняются мало - решение
+// остаётся прежним
+bool PowerManager::voltageTrendUsb() {
+    uint32_t now = millis();
+    if (batteryMv <= 0) {
+        return trendUsb;
+    }
+    if (trendStartMs == 0) {
+        trendStartMs = now;
+        trendStartMv = batteryMv;
+        return trendUsb;
+    }
+    if (now - trendStartMs < POWER_TREND_WINDOW_MS) {
+        return trendUsb;
+    }
+    int delta = batteryMv - trendStartMv;
+    if (delta >= POWER_TREND_MV) {
+        trendUsb = true;
+    } else if (delta <= -POWER_TREND_MV) {
+        trendUsb = false;
+    }
+    trendStartMs = now;
+    trendStartMv = batteryMv;
+    return trendUsb;
+}
+
+PowerProfileId PowerManager::selectProfile() const {
+    if (usbPowered) {
+        return POWER_PROFILE_USB;
+    }
+    bool wasLow = profile().id == POWER_PROFILE_LOW_BATTERY;
+    int threshold = wasLow ? POWER_LOW_BATTERY_EXIT_PERCENT : POWER_LOW_BATTERY_PERCENT;
+    if (batteryPercent >= 0 && batteryPercent < threshold) {
+        return POWER_PROFILE_LOW_BATTERY;
+    }
+    return POWER_PROFILE_BATTERY;
+}
+
+void PowerManager::begin() {
+    readPmic();
+    pending = selectProfile();
+    pendingCount = 0;
+    active.store(&PROFILES[pending], std::memory_order_release);
+}
+
+bool PowerManager::update() {
+    readPmic();
+    PowerProfileId wanted = selectProfile();
+    if (wanted == profile().id) {
+        pendingCount = 0;
+        return false;
+    }
+
+    // Защита от дребезга при подключении кабеля: профиль меняем после нескольких опросов подряд
+    if (wanted != pending) {
+        pending = wanted;
+        pendingCount = 0;
+    }
+    if (++pendingCount < POWER_SOURCE_CONFIRM_SAMPLES) {
+        return false;
+    }
+
+    pendingCount = 0;
+    profileSwitches++;
+    active.store(&PROFILES[wanted], std::memory_order_release);
+    return true;
+}
+
+uint8_t PowerManager::brightnessFor(esp_power_level_t txPower) const {
+    const PowerProfile& p = profile();
+    switch (txPower) {
+        case ESP_PWR_LVL_N12:
+            return p.brightnessNear;
+        case ESP_PWR_LVL_N9:
+        case ESP_PWR_LVL_N6:
+            return p.brightnessDim;
+        default:
+            return p.brightnessNormal;
+    }
+}
+
+void PowerManager::printStatus() const {
+    const PowerProfile& p = profile();
+    Serial.println("\n=== Power Manager ===");
+    Serial.printf("Source: %s (by %s), charging: %s\n", usbPowered ? "USB" : "Battery", sourceMethod,
+        charging ? "yes" : "no");
+    Serial.printf("Battery: %d%%, %d mV, VBUS: %d mV\n", batteryPercent, batteryMv, vbusMv);
+    Serial.printf("Profile: %s (switches: %lu)\n", p.name, (unsigned long)profileSwitches);
+    Serial.printf("TX power: %d..%d, CPU: %lu MHz\n", p.txFloor, p.txCeiling, (unsigned long)p.cpuFreqMhz);
+    Serial.printf("Scan: %u/%u RSSI, %u/%u host search (x0.625 ms)\n",
+        p.scanInterval, p.scanWindow, p.scanIntervalSearch, p.scanWindowSearch);
+    Serial.printf("Brightness: %u/%u/%u, RSSI every %lu ms, display every %lu ms\n",
+        p.brightnessNormal, p.brightnessDim, p.brightnessNear,
+        (unsigned long)p.rssiSampleMs, (unsigned long)p.displayUpdateMs);
+    Serial.println("=== End Power Manager ===\n");
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_bt.h>  // esp_power_level_t
+#include <atomic>
+
+// Управление питанием по источнику: USB, батарея, разряженная батарея.
+// Источник определяется по PMIC через M5Unified (напряжение VBUS и состояние заряда),
+// а не по просадкам напряжения батареи. Если PMIC не измеряет VBUS и не знает состояния заряда
+// (StickC Plus2: VBUS -1, charge_unknown), источник определяется по тренду напряжения батареи:
+// рост за окно - заряд от USB, падение - батарея, без заметного изменения решение сохраняется. Все зависящие от питания параметры собраны
+// в таблицу профилей; смена профиля - одна атомарная замена указателя на строку таблицы,
+// поэтому потребители никогда не видят смесь параметров двух профилей.
+
+#ifndef POWER_LOW_BATTERY_PERCENT
+#define POWER_LOW_BATTERY_PERCENT 20     // Ниже - профиль разряженной батареи
+#endif
+#ifndef POWER_LOW_BATTERY_EXIT_PERCENT
+#define POWER_LOW_BATTERY_EXIT_PERCENT 25  // Гистерезис выхода из профиля разряженной батареи
+#endif
+#ifndef POWER_VBUS_PRESENT_MV
+#define POWER_VBUS_PRESENT_MV 4000       // VBUS выше этого значения - питание от USB
+#endif
+#ifndef POWER_TREND_WINDOW_MS
+#define POWER_TREND_WINDOW_MS 120000     // Окно тренда напряжения батареи
+#endif
+#ifndef POWER_TREND_MV
+#define POWER_TREND_MV 15                // Изменение напряжения за окно, которое считается трендом
+#endif
+#ifndef POWER_SOURCE_CONFIRM_SAMPLES
+#define POWER_SOURCE_CONFIRM_SAMPLES 2   // Сколько одинаковых опросов подряд нужно для смены профиля
+#endif
+
+enum PowerProfileId : uint8_t {
+    POWER_PROFILE_USB = 0,
+    POWER_PROFILE_BATTERY,
+    POWER_PROFILE_LOW_BATTERY,
+    POWER_PROFILE_COUNT
+};
+
+/**
+ * @brief Параметры, зависящие от источника питания. Строка неизменяемой таблицы.
+ */
+struct PowerProfile {
+    PowerProfileId id;
+    const char* name;
+    esp_power_level_t txFloor;         // Границы регулятора мощности передатчика
+    esp_power_level_t txCeiling;
+    uint16_t scanInterval;             // Сканирование для RSSI при соединении, 0.625 мс
+    uint16_t scanWindow;
+    uint16_t scanIntervalSearch;       // Фоновый поиск рекламы хоста без соединения
+    uint16_t scanWindowSearch;
+    uint8_t brightnessNormal;          // Яркость при высокой мощности передатчика
+    uint8_t brightnessDim;             // Яркость при пониженной мощности
+    uint8_t brightnessNear;            // Яркость при минимальной мощности (пользователь рядом)
+    uint32_t cpuFreqMhz;               // Максимальная частота CPU
+    uint32_t rssiSampleMs;             // Период опроса RSSI и принятия решений
+    uint32_t displayUpdateMs;          // Период перерисовки экрана
+};
+
+/**
+ * @brief Опрашивает PMIC и выбирает профиль питания.
+ */
+class PowerManager {
+public:
+    PowerManager();
+
+    /**
+     * @brief Первый опрос PMIC и выбор профиля без подтверждения. Вызывать после M5.begin().
+     */
+    void begin();
+
+    /**
+     * @brief Периодический опрос PMIC.
+     * @return true, если профиль сменился и его нужно применить.
+     */
+    bool update();
+
+    /**
+     * @brief Текущий профиль. Ссылка остаётся действительной: таблица статическая.
+     */
+    const PowerProfile& profile() const { return *active.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Яркость экрана для текущего профиля и уровня мощности передатчика.
+     */
+    uint8_t brightnessFor(esp_power_level_t txPower) const;
+
+    bool isUsbPowered() const { return usbPowered; }
+    bool isCharging() const { return charging; }
+    int batteryLevel() const { return batteryPercent; }
+    int batteryVoltageMv() const { return batteryMv; }
+    int vbusVoltageMv() const { return vbusMv; }
+
+    void printStatus() const;
+
+private:
+    PowerProfileId selectProfile() const;
+    void readPmic();
+    bool voltageTrendUsb();
+
+    std::atomic<const PowerProfile*> active;
+    PowerProfileId pending;
+    uint8_t pendingCount;
+    uint32_t profileSwitches;
+
+    bool usbPowered;
+    bool charging;
+    int batteryPercent;
+    int batteryMv;
+    int vbusMv;
+    const char* sourceMethod;          // Чем определён источник: VBUS, контроллер заряда или тренд
+    int trendStartMv;
+    uint32_t trendStartMs;
+    bool trendUsb;
+};
+
+extern PowerManager powerManager;
@@ -0,0 +1,324 @@
+#include "PowerMode.h"
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_idf_version.h>
+#include <driver/gpio.h>
+#include <freertos/semphr.h>
+
+namespace {
+#if ESP_IDF_VERSION_MAJOR >= 5
+    typedef esp_pm_config_t PmConfig;
+#else
+    typedef esp_pm_config_esp32_t PmConfig;
+#endif
+
+    bool pmConfigured = false;
+    bool lightSleepSupported = false;
+    bool lightSleepEnabled = false;
+    int maxFreqMhz = 240;
+    int minFreqMhz = 80;
+
+    // Учёт времени: всё время в режиме сна и время, когда loop() был занят
+    TaskHandle_t loopTask = nullptr;
+    int64_t loopStartUs = 0;
+    int64_t sleepModeSinceUs = 0;
+    int64_t sleepModeTotalUs = 0;
+    int64_t sleepModeBusyUs = 0;
+    int64_t activeModeTotalUs = 0;
+    int64_t activeModeSinceUs = 0;
+    uint32_t sleepModeEntries = 0;
+
+    // DFS: блокировки esp_pm по причинам повышения частоты
+    const char* const BOOST_NAMES[POWER_BOOST_COUNT] = { "state", "hid", "render", "serial" };
+    esp_pm_lock_handle_t boostLocks[POWER_BOOST_COUNT] = {};
+    uint16_t boostDepth[POWER_BOOST_COUNT] = {};
+    uint32_t boostAcquired[POWER_BOOST_COUNT] = {};
+    int boostTotal = 0;
+    bool stateBoost = false;
+    bool dfsReady = false;  // До initPowerMode() частота не меняется, чтобы не замедлять загрузку
+    portMUX_TYPE boostMux = portMUX_INITIALIZER_UNLOCKED;
+    int64_t boostReleasedUs = 0;  // Когда отпущено последнее повышение (под boostMux)
+
+    // Без esp_pm частоту меняют задачи опроса, HID, UI и консоли. setCpuFrequencyMhz нельзя
+    // вызывать в критической секции, поэтому переключения идут по одному под мьютексом
+    StaticSemaphore_t freqMutexBuffer;
+    SemaphoreHandle_t freqMutex = xSemaphoreCreateMutexStatic(&freqMutexBuffer);
+
+    // Время на повышенной и базовой частоте
+    int64_t boostSinceUs = 0;
+    int64_t boostedTotalUs = 0;
+    int64_t freqStatsSinceUs = 0;
+
+    // Задержка итерации loop() отдельно для базовой и повышенной частоты
+    struct LoopStats {
+        uint32_t count;
+        int64_t totalUs;
+        int64_t maxUs;
+    };
+    LoopStats loopStats[2] = {};
+    bool loopStartBoosted = false;
+
+    // Без esp_pm частоту переключаем сами: максимум при любом повышении, минимум - через
+    // POWER_FALLBACK_HOLD_MS после последнего. Счётчик читается под мьютексом частоты, поэтому
+    // последнее переключение всегда видит последнее изменение счётчика
+    void applyFallbackFreq() {
+        if (!dfsReady || pmConfigured) {
+            return;
+        }
+        xSemaphoreTake(freqMutex, portMAX_DELAY);
+        portENTER_CRITICAL(&boostMux);
+        bool boosted = boostTotal > 0;
+        int64_t releasedUs = boostReleasedUs;
+        portEXIT_CRITICAL(&boostMux);
+
+        uint32_t target = maxFreqMhz;
+        if (!boosted && esp_timer_get_time() - releasedUs >= POWER_FALLBACK_HOLD_MS * 1000LL) {
+            target = minFreqMhz;
+        }
+        if (getCpuFrequencyMhz() != target) {
+            setCpuFrequencyMhz(target);
+        }
+        xSemaphoreGive(freqMutex);
+    }
+
+    int64_t boostedUs(int64_t now) {
+        return boostedTotalUs + (boostTotal > 0 ? now - boostSinceUs : 0);
+    }
+
+    esp_err_t applyPmConfig(bool lightSleep) {
+        PmConfig config = {};
+        config.max_freq_mhz = maxFreqMhz;
+        config.min_freq_mhz = minFreqMhz;
+        config.light_sleep_enable = lightSleep;
+        return esp_pm_configure(&config);
+    }
+
+    int64_t sleepModeUs(int64_t now) {
+        return sleepModeTotalUs + (lightSleepEnabled ? now - sleepModeSinceUs : 0);
+    }
+
+    int64_t activeModeUs(int64_t now) {
+        return activeModeTotalUs + (lightSleepEnabled ? 0 : now - activeModeSinceUs);
+    }
+} // namespace
+
+void initPowerMode() {
+    maxFreqMhz = getCpuFrequencyMhz();
+    activeModeSinceUs = esp_timer_get_time();
+    freqStatsSinceUs = activeModeSinceUs;
+
+    // Пробный запуск light sleep показывает, поддерживает ли его сборка SDK
+    esp_err_t err = applyPmConfig(true);
+    lightSleepSupported = (err == ESP_OK);
+    err = applyPmConfig(false);
+    pmConfigured = (err == ESP_OK);
+
+    // Кнопки активны низким уровнем; пробуждение из light sleep по уровню GPIO
+    gpio_wakeup_enable((gpio_num_t)POWER_WAKE_GPIO_BTN_A, GPIO_INTR_LOW_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)POWER_WAKE_GPIO_BTN_B, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+
+    if (pmConfigured) {
+        for (int i = 0; i < POWER_BOOST_COUNT; i++) {
+            esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, BOOST_NAMES[i], &boostLocks[i]);
+            // Повышения, захваченные до инициализации, переносим на блокировки
+            for (int depth = 0; depth < boostDepth[i]; depth++) {
+                esp_pm_lock_acquire(boostLocks[i]);
+            }
+        }
+    }
+    dfsReady = true;
+    applyFallbackFreq();
+
+    Serial.printf("Power mode: esp_pm %s, light sleep %s, CPU %d-%d MHz\n",
+        pmConfigured ? "configured" : "unavailable",
+        lightSleepSupported ? "supported" : "not supported by SDK config",
+        minFreqMhz, maxFreqMhz);
+}
+
+void setPowerModeMaxFreq(int maxMhz) {
+    if (maxMhz < minFreqMhz) {
+        maxMhz = minFreqMhz;
+    }
+    if (maxMhz == maxFreqMhz) {
+        return;
+    }
+    maxFreqMhz = maxMhz;
+    if (pmConfigured) {
+        applyPmConfig(lightSleepEnabled && lightSleepSupported);
+    } else {
+        applyFallbackFreq();
+    }
+}
+
+void powerBoostAcquire(PowerBoostReason reason) {
+    bool first;
+    portENTER_CRITICAL(&boostMux);
+    first = (boostTotal++ == 0);
+    boostDepth[reason]++;
+    boostAcquired[reason]++;
+    if (first) {
+        boostSinceUs = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&boostMux);
+
+    if (boostLocks[reason]) {
+        esp_pm_lock_acquire(boostLocks[reason]);
+    } else if (first) {
+        applyFallbackFreq();
+    }
+}
+
+void powerBoostRelease(PowerBoostReason reason) {
+    bool last;
+    portENTER_CRITICAL(&boostMux);
+    if (boostDepth[reason] == 0) {
+        portEXIT_CRITICAL(&boostMux);
+        return;
+    }
+    boostDepth[reason]--;
+    last = (--boostTotal == 0);
+    if (last) {
+        boostReleasedUs = esp_timer_get_time();
+        boostedTotalUs += boostReleasedUs - boostSinceUs;
+    }
+    portEXIT_CRITICAL(&boostMux);
+
+    // Без esp_pm частота снижается позже, в powerModeIdle()
+    if (boostLocks[reason]) {
+        esp_pm_lock_release(boostLocks[reason]);
+    }
+}
+
+void powerModeSetStateBoost(bool active) {
+    if (active == stateBoost) {
+        return;
+    }
+    stateBoost = active;
+    if (active) {
+        powerBoostAcquire(POWER_BOOST_STATE);
+    } else {
+        powerBoostRelease(POWER_BOOST_STATE);
+    }
+}
+
+bool setLightSleepEnabled(bool enabled) {
+    if (enabled == lightSleepEnabled) {
+        return true;
+    }
+
+    int64_t now = esp_timer_get_time();
+    // Учёт ведём даже без поддержки light sleep: бюджет показывает ожидаемый выигрыш
+    if (enabled) {
+        activeModeTotalUs += now - activeModeSinceUs;
+        sleepModeSinceUs = now;
+        sleepModeEntries++;
+    } else {
+        sleepModeTotalUs += now - sleepModeSinceUs;
+        activeModeSinceUs = now;
+    }
+    lightSleepEnabled = enabled;
+
+    if (!lightSleepSupported) {
+        return false;
+    }
+    return applyPmConfig(enabled) == ESP_OK;
+}
+
+bool isLightSleepEnabled() {
+    return lightSleepEnabled;
+}
+
+bool isLightSleepSupported() {
+    return lightSleepSupported;
+}
+
+void powerModeLoopStart() {
+    loopTask = xTaskGetCurrentTaskHandle();
+    loopStartUs = esp_timer_get_time();
+    loopStartBoosted = boostTotal > 0;
+}
+
+void powerModeIdle(uint32_t idleMs) {
+    if (loopStartUs != 0) {
+        int64_t busyUs = esp_timer_get_time() - loopStartUs;
+        if (lightSleepEnabled) {
+            sleepModeBusyUs += busyUs;
+        }
+        LoopStats& stats = loopStats[loopStartBoosted ? 1 : 0];
+        stats.count++;
+        stats.totalUs += busyUs;
+        if (busyUs > stats.maxUs) stats.maxUs = busyUs;
+    }
+    // Без esp_pm: снижение частоты после паузы в повышениях
+    applyFallbackFreq();
+    // Ожидание уведомления, а не активное ожидание: простой задачи позволяет tickless idle усыпить чип
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idleMs > 0 ? idleMs : 1));
+}
+
+void powerModeWake() {
+    TaskHandle_t task = loopTask;
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void printPowerBudget() {
+    int64_t now = esp_timer_get_time();
+    float sleepModeS = sleepModeUs(now) / 1e6f;
+    float activeModeS = activeModeUs(now) / 1e6f;
+    float awakeDuty = sleepModeUs(now) > 0 ? (float)sleepModeBusyUs / sleepModeUs(now) : 0.0f;
+
+    // Ток в режиме сна: доля бодрствования на активном токе, остальное - light sleep
+    float sleepModeMa = awakeDuty * POWER_MODEL_ACTIVE_MA + (1.0f - awakeDuty) * POWER_MODEL_LIGHT_SLEEP_MA;
+    float hoursAwake = POWER_MODEL_BATTERY_MAH / POWER_MODEL_ACTIVE_MA;
+    float hoursSleep = POWER_MODEL_BATTERY_MAH / sleepModeMa;
+
+    Serial.println("\n=== Power Budget (LOCKED idle) ===");
+    Serial.printf("Light sleep: %s, %s\n",
+        lightSleepSupported ? "supported" : "NOT supported (estimate only)",
+        lightSleepEnabled ? "active now" : "inactive now");
+    Serial.printf("Time in active mode: %.1f s, in sleep mode: %.1f s (%lu entries)\n",
+        activeModeS, sleepModeS, (unsigned long)sleepModeEntries);
+    Serial.printf("CPU awake duty in sleep mode: %.2f%%\n", awakeDuty * 100.0f);
+    Serial.printf("Model: active %.1f mA, light sleep %.1f mA, battery %.0f mAh\n",
+        POWER_MODEL_ACTIVE_MA, POWER_MODEL_LIGHT_SLEEP_MA, POWER_MODEL_BATTERY_MAH);
+    Serial.printf("Locked idle current: %.1f mA without sleep -> %.1f mA with sleep\n",
+        POWER_MODEL_ACTIVE_MA, sleepModeMa);
+    Serial.printf("Expected runtime while locked: %.1f h -> %.1f h (x%.1f)\n",
+        hoursAwake, hoursSleep, hoursSleep / hoursAwake);
+    Serial.println("=== End Power Budget ===\n");
+}
+
+void printCpuFreqReport() {
+    int64_t now = esp_timer_get_time();
+    float totalS = (now - freqStatsSinceUs) / 1e6f;
+    float boostedShare = totalS > 0 ? boostedUs(now) / 1e6f / totalS : 0.0f;
+
+    // Модель: ток CPU пропорционален частоте. Сравниваем с постоянной работой на максимуме
+    float maxMa = maxFreqMhz * POWER_MODEL_MA_PER_MHZ;
+    float dfsMa = boostedShare * maxMa + (1.0f - boostedShare) * minFreqMhz * POWER_MODEL_MA_PER_MHZ;
+
+    Serial.println("\n=== CPU Frequency ===");
+    Serial.printf("Mode: %s, now %lu MHz, range %d-%d MHz\n",
+        pmConfigured ? "esp_pm DFS" : "direct (no CONFIG_PM_ENABLE)",
+        (unsigned long)getCpuFrequencyMhz(), minFreqMhz, maxFreqMhz);
+    if (!pmConfigured) {
+        Serial.printf("Max held %u ms after the last boost\n", (unsigned)POWER_FALLBACK_HOLD_MS);
+    }
+    Serial.printf("Time at max: %.1f%% of %.1f s\n", boostedShare * 100.0f, totalS);
+    for (int i = 0; i < POWER_BOOST_COUNT; i++) {
+        Serial.printf("  boost %-6s: %lu acquisitions, held now: %u\n",
+            BOOST_NAMES[i], (unsigned long)boostAcquired[i], boostDepth[i]);
+    }
+    const char* loopNames[2] = { "base", "boosted" };
+    for (int i = 0; i < 2; i++) {
+        const LoopStats& stats = loopStats[i];
+        Serial.printf("Loop busy time (%s): avg %lu us, max %lu us, %lu iterations\n", loopNames[i],
+            (unsigned long)(stats.count ? stats.totalUs / stats.count : 0),
+            (unsigned long)stats.maxUs, (unsigned long)stats.count);
+    }
+    Serial.printf("CPU current (model): %.1f mA at fixed max -> %.1f mA with DFS\n", maxMa, dfsMa);
+    Serial.println("=== End CPU Frequency ===\n");
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Режим пониженного потребления: автоматический light sleep (esp_pm) и modem sleep BLE.
+// Включается из loop(), когда компьютер заблокирован и рядом никого нет.
+// Пробуждение: события соединения BLE (контроллер), кнопки (GPIO) и таймеры FreeRTOS
+// (tickless idle просыпается к ближайшему таймауту задачи).
+
+// Кнопки M5StickC Plus2, используемые как источник пробуждения
+#ifndef POWER_WAKE_GPIO_BTN_A
+#define POWER_WAKE_GPIO_BTN_A 37
+#endif
+#ifndef POWER_WAKE_GPIO_BTN_B
+#define POWER_WAKE_GPIO_BTN_B 39
+#endif
+
+// Модель тока для отчёта о бюджете, мА (экран выключен)
+#ifndef POWER_MODEL_ACTIVE_MA
+#define POWER_MODEL_ACTIVE_MA 42.0f       // CPU работает, радио в modem sleep между событиями
+#endif
+#ifndef POWER_MODEL_LIGHT_SLEEP_MA
+#define POWER_MODEL_LIGHT_SLEEP_MA 2.5f   // Light sleep с XTAL для BLE и событиями соединения
+#endif
+#ifndef POWER_MODEL_BATTERY_MAH
+#define POWER_MODEL_BATTERY_MAH 200.0f    // Аккумулятор M5StickC Plus2
+#endif
+#ifndef POWER_MODEL_MA_PER_MHZ
+#define POWER_MODEL_MA_PER_MHZ 0.11f      // Прирост тока CPU на МГц (оценка по datasheet ESP32)
+#endif
+
+// Динамическая частота CPU (DFS). Базовая частота - минимальная (80 МГц, ниже не даёт BLE),
+// максимальная - из профиля питания. Повышение держат блокировки esp_pm по причинам:
+// HID-пакеты, отрисовка, объёмный обмен по Serial и состояния, где важна реакция.
+// Без CONFIG_PM_ENABLE частота переключается напрямую через setCpuFrequencyMhz: повышается сразу,
+// а снижается не раньше POWER_FALLBACK_HOLD_MS после последнего повышения (проверка в powerModeIdle),
+// чтобы частые короткие повышения (кадры экрана) не переключали частоту каждый раз.
+#ifndef POWER_FALLBACK_HOLD_MS
+#define POWER_FALLBACK_HOLD_MS 1000
+#endif
+enum PowerBoostReason : uint8_t {
+    POWER_BOOST_STATE = 0,   // MOVING_AWAY / APPROACHING - решение о блокировке
+    POWER_BOOST_HID,
+    POWER_BOOST_RENDER,
+    POWER_BOOST_SERIAL,
+    POWER_BOOST_COUNT
+};
+
+/**
+ * @brief Настраивает esp_pm и пробуждение от кнопок. Вызывать после инициализации BLE.
+ */
+void initPowerMode();
+
+/**
+ * @brief Меняет максимальную частоту CPU (профиль питания). При настроенном esp_pm
+ * частота задаётся через него, иначе напрямую.
+ */
+void setPowerModeMaxFreq(int maxMhz);
+
+/**
+ * @brief Захватывает/отпускает повышение частоты. Вызовы с одной причиной могут вкладываться.
+ */
+void powerBoostAcquire(PowerBoostReason reason);
+void powerBoostRelease(PowerBoostReason reason);
+
+/**
+ * @brief Повышение частоты на время жизни объекта.
+ */
+class PowerBoostGuard {
+public:
+    explicit PowerBoostGuard(PowerBoostReason reason) : reason(reason) { powerBoostAcquire(reason); }
+    ~PowerBoostGuard() { powerBoostRelease(reason); }
+    PowerBoostGuard(const PowerBoostGuard&) = delete;
+    PowerBoostGuard& operator=(const PowerBoostGuard&) = delete;
+private:
+    PowerBoostReason reason;
+};
+
+/**
+ * @brief Повышение частоты по состоянию автомата; повторные вызовы с тем же значением ничего не делают.
+ */
+void powerModeSetStateBoost(bool active);
+
+/**
+ * @brief Выводит в Serial распределение времени по частотам, задержку итерации loop() и оценку тока CPU.
+ */
+void printCpuFreqReport();
+
+/**
+ * @brief Разрешает или запрещает автоматический light sleep.
+ * @return true, если режим установлен (false - не поддерживается конфигурацией SDK).
+ */
+bool setLightSleepEnabled(bool enabled);
+
+bool isLightSleepEnabled();
+
+/**
+ * @brief Поддерживает ли сборка автоматический light sleep (CONFIG_PM_ENABLE и tickless idle).
+ */
+bool isLightSleepSupported();
+
+/**
+ * @brief Отмечает начало итерации loop() для учёта занятости процессора.
+ */
+void powerModeLoopStart();
+
+/**
+ * @brief Пауза в конце итерации loop(). В режиме сна задача простаивает и FreeRTOS
+ * может перевести чип в light sleep до следующего таймаута. Пауза прерывается powerModeWake().
+ */
+void powerModeIdle(uint32_t idleMs);
+
+/**
+ * @brief Прерывает паузу loop() из другой задачи (например, событие соединения из стека BLE).
+ */
+void powerModeWake();
+
+/**
+ * @brief Выводит в Serial бюджет: доля бодрствования в режиме сна, средний ток и ожидаемое время работы.
+ */
+void printPowerBudget();
@@ -0,0 +1,262 @@
+#include "Provisioning.h"
+#include "NvsUtils.h"
+#include "PowerMode.h"
+#include <nvs.h>
+
+namespace {
+    // Буфер кадра общий для экспорта и импорта: команды выполняются только из задачи консоли
+    uint8_t frameBuffer[PROV_MAX_FRAME];
+
+    // Приём кадра импорта между опросами консоли
+    struct ImportState {
+        bool active;
+        size_t received;
+        size_t expected;
+        unsigned long lastByteTime;
+    };
+    ImportState importState = {};
+
+    // Короткий ключ из имени ключа NVS вида <префикс устройства><короткий ключ>
+    bool extractShortKey(const char* nvsKey, ShortKeyBuffer& shortKey) {
+        for (size_t kind = 0; kind < (size_t)DeviceKey::Count; kind++) {
+            const char* prefix = deviceKeyPrefix((DeviceKey)kind);
+            size_t prefixLen = strlen(prefix);
+            if (strncmp(nvsKey, prefix, prefixLen) == 0 && strlen(nvsKey + prefixLen) == SHORT_KEY_LEN) {
+                strcpy(shortKey, nvsKey + prefixLen);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int collectDevices(ShortKeyBuffer* devices, int maxDevices, bool& truncated) {
+        int count = 0;
+        truncated = false;
+        nvs_iterator_t it = nvs_entry_find("nvs", NVS_NAMESPACE, NVS_TYPE_ANY);
+        while (it != NULL) {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+
+            ShortKeyBuffer shortKey;
+            if (extractShortKey(info.key, shortKey)) {
+                bool known = false;
+                for (int i = 0; i < count && !known; i++) {
+                    known = strcmp(devices[i], shortKey) == 0;
+                }
+                if (!known && count < maxDevices) {
+                    strcpy(devices[count++], shortKey);
+                } else if (!known) {
+                    truncated = true;
+                }
+            }
+            it = nvs_entry_next(it);
+        }
+        nvs_release_iterator(it);
+        return count;
+    }
+
+    int8_t clampRssi(int32_t value) {
+        return (int8_t)(value < -127 ? -127 : (value > 0 ? 0 : value));
+    }
+
+    void finishImport() {
+        importState.active = false;
+        powerBoostRelease(POWER_BOOST_SERIAL);
+    }
+} // namespace
+
+size_t buildSettingsExport(uint8_t* frame, size_t capacity, bool& truncated) {
+    ProvWriter writer(frame, capacity);
+
+    char lastAddr[32];
+    if (loadLastAddress(lastAddr, sizeof(lastAddr))) {
+        writer.addString(PROV_TAG_LAST_ADDR, lastAddr);
+    }
+
+    ShortKeyBuffer devices[PROV_MAX_DEVICES];
+    int deviceCount = collectDevices(devices, PROV_MAX_DEVICES, truncated);
+
+    for (int i = 0; i < deviceCount; i++) {
+        writer.add(PROV_TAG_DEVICE, devices[i], SHORT_KEY_LEN);
+
+        NvsKeyBuffer key;
+        int32_t rssi;
+        makeDeviceKey(DeviceKey::UnlockRssi, devices[i], key);
+        if (nvs_get_i32(nvsHandle, key, &rssi) == ESP_OK) {
+            writer.addI8(PROV_TAG_UNLOCK_RSSI, clampRssi(rssi));
+        }
+        makeDeviceKey(DeviceKey::LockRssi, devices[i], key);
+        if (nvs_get_i32(nvsHandle, key, &rssi) == ESP_OK) {
+            writer.addI8(PROV_TAG_LOCK_RSSI, clampRssi(rssi));
+        }
+
+        makeDeviceKey(DeviceKey::Password, devices[i], key);
+        char password[64];
+        size_t length = sizeof(password);
+        if (nvs_get_str(nvsHandle, key, password, &length) == ESP_OK && password[0] != '\0') {
+            writer.addString(PROV_TAG_PASSWORD, password);
+        }
+
+        makeDeviceKey(DeviceKey::LockState, devices[i], key);
+        int8_t locked;
+        if (nvs_get_i8(nvsHandle, key, &locked) == ESP_OK) {
+            writer.addU8(PROV_TAG_LOCK_STATE, locked ? 1 : 0);
+        }
+    }
+
+    return writer.finish();
+}
+
+ProvStatus applySettingsImport(const uint8_t* frame, size_t frameLen, int& devicesImported) {
+    devicesImported = 0;
+    ProvStatus status = provValidate(frame, frameLen);
+    if (status != PROV_OK) {
+        return status;
+    }
+
+    ProvReader reader(frame);
+    uint8_t tag;
+    const uint8_t* value;
+    uint8_t valueLen;
+    ShortKeyBuffer device = "";
+    NvsKeyBuffer key;
+    char text[64];
+    esp_err_t err = ESP_OK;
+
+    while (reader.next(tag, value, valueLen) && err == ESP_OK) {
+        switch (tag) {
+            case PROV_TAG_LAST_ADDR:
+                if (valueLen < sizeof(text)) {
+                    memcpy(text, value, valueLen);
+                    text[valueLen] = '\0';
+                    err = nvs_set_str(nvsHandle, StorageKeys::LAST_ADDR, text);
+                }
+                break;
+            case PROV_TAG_DEVICE:
+                if (valueLen == SHORT_KEY_LEN) {
+                    memcpy(device, value, SHORT_KEY_LEN);
+                    device[SHORT_KEY_LEN] = '\0';
+                    devicesImported++;
+                } else {
+                    device[0] = '\0';  // Атрибуты такого устройства пропускаем
+                }
+                break;
+            case PROV_TAG_UNLOCK_RSSI:
+            case PROV_TAG_LOCK_RSSI:
+                if (device[0] != '\0' && valueLen == 1) {
+                    int8_t rssi = (int8_t)value[0];
+                    if (!provRssiValid(rssi)) {
+                        Serial.printf("Import: %s RSSI %d of %s out of range, skipped\n",
+                            tag == PROV_TAG_UNLOCK_RSSI ? "unlock" : "lock", rssi, device);
+                        break;
+                    }
+                    makeDeviceKey(tag == PROV_TAG_UNLOCK_RSSI ? DeviceKey::UnlockRssi : DeviceKey::LockRssi, device, key);
+                    err = nvs_set_i32(nvsHandle, key, rssi);
+                }
+                break;
+            case PROV_TAG_PASSWORD:
+                if (device[0] != '\0' && valueLen < sizeof(text)) {
+                    memcpy(text, value, valueLen);
+                    text[valueLen] = '\0';
+                    makeDeviceKey(DeviceKey::Password, device, key);
+                    err = nvs_set_str(nvsHandle, key, text);
+                }
+                break;
+            case PROV_TAG_LOCK_STATE:
+                if (device[0] != '\0' && valueLen == 1) {
+                    makeDeviceKey(DeviceKey::LockState, device, key);
+                    err = nvs_set_i8(nvsHandle, key, value[0] ? 1 : 0);
+                }
+                break;
+            default:
+                break;  // Запись из более новой версии утилиты
+        }
+    }
+
+    if (err == ESP_OK) {
+        err = nvs_commit(nvsHandle);
+    }
+    if (err != ESP_OK) {
+        Serial.printf("Error writing imported settings: %d\n", err);
+        return PROV_ERR_STORAGE;
+    }
+    return PROV_OK;
+}
+
+void exportSettingsToSerial() {
+    PowerBoostGuard boost(POWER_BOOST_SERIAL);
+    bool truncated = false;
+    size_t frameLen = buildSettingsExport(frameBuffer, sizeof(frameBuffer), truncated);
+    if (frameLen == 0) {
+        Serial.println("EXPORT ERROR: settings do not fit into one frame");
+        return;
+    }
+    if (truncated) {
+        Serial.printf("EXPORT WARNING: more than %d devices in NVS, only the first %d are exported\n",
+            PROV_MAX_DEVICES, PROV_MAX_DEVICES);
+    }
+    Serial.printf("EXPORT %u\n", (unsigned)frameLen);
+    Serial.write(frameBuffer, frameLen);
+    Serial.flush();
+    Serial.println();
+}
+
+void importSettingsBegin() {
+    if (!importState.active) {
+        powerBoostAcquire(POWER_BOOST_SERIAL);
+    }
+    // Сначала заголовок, из него узнаём длину payload, затем остаток кадра
+    importState = { true, 0, PROV_HEADER_SIZE, millis() };
+    Serial.printf("READY %u\n", (unsigned)sizeof(frameBuffer));
+}
+
+bool importSettingsReceiving() {
+    return importState.active;
+}
+
+bool importSettingsPoll() {
+    if (!importState.active) {
+        return false;
+    }
+    while (importState.received < importState.expected && Serial.available()) {
+        uint8_t c = (uint8_t)Serial.read();
+        importState.lastByteTime = millis();
+        // Остаток перевода строки после команды ("\r\n"): кадр начинается с PROV_MAGIC
+        if (importState.received == 0 && (c == '\r' || c == '\n')) {
+            continue;
+        }
+        frameBuffer[importState.received++] = c;
+        if (importState.received == PROV_HEADER_SIZE) {
+            if (memcmp(frameBuffer, PROV_MAGIC, 4) != 0) {
+                Serial.printf("IMPORT ERROR: %s\n", provStatusName(PROV_ERR_MAGIC));
+                finishImport();
+                return false;
+            }
+            size_t payloadLen = provPayloadLength(frameBuffer);
+            if (payloadLen > PROV_MAX_PAYLOAD) {
+                Serial.printf("IMPORT ERROR: %s\n", provStatusName(PROV_ERR_LENGTH));
+                finishImport();
+                return false;
+            }
+            importState.expected = PROV_HEADER_SIZE + payloadLen + PROV_CRC_SIZE;
+        }
+    }
+    if (importState.received < importState.expected) {
+        if (millis() - importState.lastByteTime > PROV_IMPORT_TIMEOUT_MS) {
+            Serial.printf("IMPORT ERROR: timeout after %u of %u bytes\n",
+                (unsigned)importState.received, (unsigned)importState.expected);
+            finishImport();
+        }
+        return false;
+    }
+
+    int devices = 0;
+    ProvStatus status = applySettingsImport(frameBuffer, importState.received, devices);
+    finishImport();
+    if (status != PROV_OK) {
+        Serial.printf("IMPORT ERROR: %s\n", provStatusName(status));
+        return false;
+    }
+    Serial.printf("IMPORT OK: %d devices\n", devices);
+    return true;
+}
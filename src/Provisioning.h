@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Arduino.h>
+#include "ProvisioningFormat.h"
+
+// Экспорт и импорт реестра устройств одним пакетом (формат в ProvisioningFormat.h).
+// Пароли передаются в том же зашифрованном виде, в каком лежат в NVS.
+
+#define PROV_MAX_DEVICES 16          // Сколько устройств может попасть в один пакет
+#define PROV_IMPORT_TIMEOUT_MS 5000  // Пауза в приёме, после которой импорт прерывается
+#define PROV_IMPORT_POLL_MS 2        // Период опроса Serial во время приёма: RX-буфер UART не переполняется
+
+/**
+ * @brief Собирает пакет со всеми устройствами из NVS.
+ * @param truncated true, если устройств больше PROV_MAX_DEVICES и в пакет попали не все
+ * @return Размер кадра или 0, если данные не поместились в буфер.
+ */
+size_t buildSettingsExport(uint8_t* frame, size_t capacity, bool& truncated);
+
+/**
+ * @brief Проверяет пакет и записывает его в NVS одним commit.
+ * @param devicesImported Число импортированных устройств
+ * @return PROV_OK или код ошибки; если кадр не прошёл проверку, NVS не изменяется.
+ */
+ProvStatus applySettingsImport(const uint8_t* frame, size_t frameLen, int& devicesImported);
+
+/**
+ * @brief Команда export: пишет в Serial строку "EXPORT <size>" и затем двоичный кадр.
+ * Если в пакет попали не все устройства, перед ним выводится строка "EXPORT WARNING: ...".
+ */
+void exportSettingsToSerial();
+
+/**
+ * @brief Команда import: пишет "READY <max>" и начинает приём кадра из Serial.
+ * Кадр принимается по частям в importSettingsPoll(), консоль при этом не блокируется.
+ */
+void importSettingsBegin();
+
+/**
+ * @brief Идёт приём кадра: байты Serial принадлежат кадру, а не консоли.
+ */
+bool importSettingsReceiving();
+
+/**
+ * @brief Забирает из Serial уже пришедшие байты кадра, не дожидаясь остальных.
+ * Принятый целиком кадр применяется; ошибка или пауза дольше PROV_IMPORT_TIMEOUT_MS прерывает приём.
+ * @return true, если в этом вызове настройки импортированы.
+ */
+bool importSettingsPoll();
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Формат пакета настроек для команд export/import.
+// Заголовок общий для прошивки и утилиты tools/provision, поэтому здесь
+// нет зависимостей от Arduino/ESP-IDF.
+//
+// Кадр (все числа little-endian):
+//   magic "M5KP" | version u8 | flags u8 | payloadLen u16 | payload | crc32 u32
+// CRC32 (полином 0xEDB88320) считается по заголовку и payload.
+//
+// Payload - последовательность записей TLV: type u8 | len u8 | value[len].
+// Атрибуты устройства следуют за PROV_TAG_DEVICE до следующего PROV_TAG_DEVICE.
+// Неизвестные типы пропускаются, что позволяет расширять формат без смены версии.
+
+#define PROV_MAGIC "M5KP"
+#define PROV_VERSION 1
+#define PROV_HEADER_SIZE 8
+#define PROV_CRC_SIZE 4
+#define PROV_MAX_PAYLOAD 2048
+#define PROV_MAX_FRAME (PROV_HEADER_SIZE + PROV_MAX_PAYLOAD + PROV_CRC_SIZE)
+#define PROV_SHORT_KEY_LEN 6
+#define PROV_RSSI_MIN -127  // Допустимые пороги RSSI, dBm: положительный порог не даст разблокировать хост
+#define PROV_RSSI_MAX 0
+
+enum ProvTag : uint8_t {
+    PROV_TAG_LAST_ADDR   = 0x01,  // Строка: адрес последнего устройства
+    PROV_TAG_DEVICE      = 0x10,  // 6 символов: короткий ключ устройства, начало записи
+    PROV_TAG_UNLOCK_RSSI = 0x11,  // int8: порог разблокировки
+    PROV_TAG_LOCK_RSSI   = 0x12,  // int8: порог блокировки
+    PROV_TAG_PASSWORD    = 0x13,  // Строка: пароль в зашифрованном (hex) виде, как в NVS
+    PROV_TAG_LOCK_STATE  = 0x14   // u8: состояние блокировки
+};
+
+inline bool provRssiValid(long value) {
+    return value >= PROV_RSSI_MIN && value <= PROV_RSSI_MAX;
+}
+
+inline uint32_t provCrc32(const uint8_t* data, size_t len, uint32_t crc = 0) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Собирает кадр в буфере вызывающей стороны, без выделения памяти.
+ */
+class ProvWriter {
+public:
+    ProvWriter(uint8_t* buffer, size_t capacity)
+        : buf(buffer), cap(capacity), len(PROV_HEADER_SIZE), overflow(capacity < PROV_HEADER_SIZE + PROV_CRC_SIZE) {}
+
+    void add(ProvTag tag, const void* value, size_t valueLen) {
+        if (valueLen > 255 || len + 2 + valueLen + PROV_CRC_SIZE > cap ||
+            len + 2 + valueLen - PROV_HEADER_SIZE > PROV_MAX_PAYLOAD) {
+            overflow = true;
+            return;
+        }
+        buf[len++] = tag;
+        buf[len++] = (uint8_t)valueLen;
+        memcpy(buf + len, value, valueLen);
+        len += valueLen;
+    }
+
+    void addString(ProvTag tag, const char* value) { add(tag, value, strlen(value)); }
+    void addI8(ProvTag tag, int8_t value) { add(tag, &value, 1); }
+    void addU8(ProvTag tag, uint8_t value) { add(tag, &value, 1); }
+
+    /**
+     * @brief Заполняет заголовок и CRC.
+     * @return Размер кадра или 0, если данные не поместились в буфер.
+     */
+    size_t finish() {
+        if (overflow) {
+            return 0;
+        }
+        size_t payloadLen = len - PROV_HEADER_SIZE;
+        memcpy(buf, PROV_MAGIC, 4);
+        buf[4] = PROV_VERSION;
+        buf[5] = 0;
+        buf[6] = (uint8_t)(payloadLen & 0xFF);
+        buf[7] = (uint8_t)(payloadLen >> 8);
+        uint32_t crc = provCrc32(buf, len);
+        for (int i = 0; i < 4; i++) {
+            buf[len + i] = (uint8_t)(crc >> (8 * i));
+        }
+        return len + PROV_CRC_SIZE;
+    }
+
+private:
+    uint8_t* buf;
+    size_t cap;
+    size_t len;
+    bool overflow;
+};
+
+enum ProvStatus {
+    PROV_OK = 0,
+    PROV_ERR_SHORT,      // Кадр обрезан
+    PROV_ERR_MAGIC,      // Не наш формат
+    PROV_ERR_VERSION,    // Неподдерживаемая версия
+    PROV_ERR_LENGTH,     // Длина payload не совпадает с размером кадра
+    PROV_ERR_CRC,        // Контрольная сумма не совпала
+    PROV_ERR_TLV,        // Запись TLV выходит за границы payload
+    PROV_ERR_STORAGE     // Кадр корректен, но устройство не смогло его сохранить
+};
+
+inline const char* provStatusName(ProvStatus status) {
+    switch (status) {
+        case PROV_OK:          return "OK";
+        case PROV_ERR_SHORT:   return "frame truncated";
+        case PROV_ERR_MAGIC:   return "bad magic";
+        case PROV_ERR_VERSION: return "unsupported version";
+        case PROV_ERR_LENGTH:  return "length mismatch";
+        case PROV_ERR_CRC:     return "CRC mismatch";
+        case PROV_ERR_TLV:     return "malformed record";
+        case PROV_ERR_STORAGE: return "storage write failed";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Длина payload из заголовка (для чтения кадра из потока по частям).
+ */
+inline size_t provPayloadLength(const uint8_t* header) {
+    return (size_t)header[6] | ((size_t)header[7] << 8);
+}
+
+/**
+ * @brief Проверяет кадр целиком: заголовок, длину, CRC и границы всех записей TLV.
+ * Применять данные можно только после успешной проверки.
+ */
+inline ProvStatus provValidate(const uint8_t* frame, size_t frameLen) {
+    if (frameLen < PROV_HEADER_SIZE + PROV_CRC_SIZE) {
+        return PROV_ERR_SHORT;
+    }
+    if (memcmp(frame, PROV_MAGIC, 4) != 0) {
+        return PROV_ERR_MAGIC;
+    }
+    if (frame[4] != PROV_VERSION) {
+        return PROV_ERR_VERSION;
+    }
+    size_t payloadLen = provPayloadLength(frame);
+    if (payloadLen > PROV_MAX_PAYLOAD || PROV_HEADER_SIZE + payloadLen + PROV_CRC_SIZE != frameLen) {
+        return PROV_ERR_LENGTH;
+    }
+    size_t crcPos = PROV_HEADER_SIZE + payloadLen;
+    uint32_t stored = (uint32_t)frame[crcPos] | ((uint32_t)frame[crcPos + 1] << 8) |
+                      ((uint32_t)frame[crcPos + 2] << 16) | ((uint32_t)frame[crcPos + 3] << 24);
+    if (provCrc32(frame, crcPos) != stored) {
+        return PROV_ERR_CRC;
+    }
+    for (size_t pos = PROV_HEADER_SIZE; pos < crcPos; ) {
+        if (pos + 2 > crcPos || pos + 2 + frame[pos + 1] > crcPos) {
+            return PROV_ERR_TLV;
+        }
+        pos += 2 + frame[pos + 1];
+    }
+    return PROV_OK;
+}
+
+/**
+ * @brief Последовательно выдаёт записи TLV проверенного кадра.
+ */
+class ProvReader {
+public:
+    ProvReader(const uint8_t* frame)
+        : buf(frame), pos(PROV_HEADER_SIZE), end(PROV_HEADER_SIZE + provPayloadLength(frame)) {}
+
+    bool next(uint8_t& tag, const uint8_t*& value, uint8_t& valueLen) {
+        if (pos + 2 > end) {
+            return false;
+        }
+        tag = buf[pos];
+        valueLen = buf[pos + 1];
+        value = buf + pos + 2;
+        pos += 2 + valueLen;
+        return pos <= end;
+    }
+
+private:
+    const uint8_t* buf;
+    size_t pos;
+    size_t end;
+};
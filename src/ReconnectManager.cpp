@@ -0,0 +1,351 @@
+#include "ReconnectManager.h"
+#include "AdvScheduler.h"
+#include "AdvertiserTable.h"
+#include "ScanScheduler.h"
+#include <NimBLEDevice.h>
+
+namespace {
+    const unsigned long HOST_SEEN_CHECK_MS = 1000;
+
+    struct HostTiming {
+        uint64_t address;            // 0 - запись свободна
+        uint16_t connHandle;
+        bool pending;                // Ждёт переподключения
+        bool fromBoot;               // Отсчёт от загрузки, иначе от разрыва
+        unsigned long sinceMs;
+        unsigned long connectMs;
+        unsigned long encryptMs;     // 0 - соединение ещё не зашифровано
+        unsigned long hidReadyMs;    // 0 - хост ещё не подписан на HID-отчёты
+
+        // Переподключения (хост был рядом) и фазы каждого соединения
+        uint32_t samples;
+        uint32_t withinTarget;
+        uint32_t absent;
+        uint32_t lastMs;
+        uint32_t bestMs;
+        uint32_t worstMs;
+        uint32_t totalMs;
+        uint32_t connections;
+        uint32_t encryptTotalMs;     // От соединения до шифрования
+        uint32_t readyTotalMs;       // От соединения до готовности HID
+    };
+
+    // Соединение, хост которого ещё не опознан как сопряжённый: до шифрования адрес может быть
+    // RPA или адресом чужого устройства, запись учёта по нему не создаётся
+    struct PendingLink {
+        bool used;
+        uint16_t connHandle;
+        unsigned long connectMs;
+        unsigned long hidReadyMs;
+    };
+
+    HostTiming timings[RECONNECT_MAX_HOSTS] = {};
+    PendingLink links[RECONNECT_MAX_HOSTS] = {};
+    uint64_t lastHost = 0;
+    unsigned long lastSeenCheck = 0;
+
+    bool isBonded(uint64_t address) {
+        if (address == 0) {
+            return false;
+        }
+        for (int i = NimBLEDevice::getNumBonds() - 1; i >= 0; i--) {
+            if ((uint64_t)NimBLEDevice::getBondedAddress(i) == address) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    PendingLink* linkFor(uint16_t connHandle, bool create) {
+        PendingLink* free = nullptr;
+        for (int i = 0; i < RECONNECT_MAX_HOSTS; i++) {
+            if (links[i].used && links[i].connHandle == connHandle) {
+                return &links[i];
+            }
+            if (!free && !links[i].used) {
+                free = &links[i];
+            }
+        }
+        if (!create || !free) {
+            return nullptr;
+        }
+        *free = PendingLink{ true, connHandle, 0, 0 };
+        return free;
+    }
+
+    HostTiming* timingFor(uint64_t address, bool create) {
+        HostTiming* free = nullptr;
+        for (int i = 0; i < RECONNECT_MAX_HOSTS; i++) {
+            if (timings[i].address == address) {
+                return &timings[i];
+            }
+            if (!free && timings[i].address == 0) {
+                free = &timings[i];
+            }
+        }
+        if (!create || !free) {
+            return nullptr;
+        }
+        free->address = address;
+        free->connHandle = BLE_HS_CONN_HANDLE_NONE;
+        return free;
+    }
+
+    HostTiming* timingForHandle(uint16_t connHandle) {
+        if (connHandle == BLE_HS_CONN_HANDLE_NONE) {
+            return nullptr;
+        }
+        for (int i = 0; i < RECONNECT_MAX_HOSTS; i++) {
+            if (timings[i].address != 0 && timings[i].connHandle == connHandle) {
+                return &timings[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // Соединение ищется по идентификационному адресу, поэтому хост с RPA тоже находится
+    bool bondConnected(const NimBLEAddress& address) {
+        ble_gap_conn_desc desc;
+        return ble_gap_conn_find_by_addr(address.getBase(), &desc) == 0;
+    }
+
+    void promote(NimBLEAddress* list, int count, uint64_t address) {
+        for (int i = 1; i < count && address != 0; i++) {
+            if ((uint64_t)list[i] == address) {
+                NimBLEAddress first = list[i];
+                for (int j = i; j > 0; j--) {
+                    list[j] = list[j - 1];
+                }
+                list[0] = first;
+                return;
+            }
+        }
+    }
+
+    // Сопряжённые неподключённые хосты: самый свежий bond (последний у NimBLE) первым,
+    // затем вперёд ставятся последний хост и preferred
+    int pendingBonds(NimBLEAddress* out, int max, uint64_t preferred) {
+        int count = 0;
+        for (int i = NimBLEDevice::getNumBonds() - 1; i >= 0 && count < max; i--) {
+            NimBLEAddress address = NimBLEDevice::getBondedAddress(i);
+            if (!bondConnected(address)) {
+                out[count++] = address;
+            }
+        }
+        promote(out, count, lastHost);
+        promote(out, count, preferred);
+        return count;
+    }
+
+    void formatAddress(uint64_t a, char* buf, size_t size) {
+        snprintf(buf, size, "%02x:%02x:%02x:%02x:%02x:%02x",
+            (unsigned)(a >> 40) & 0xff, (unsigned)(a >> 32) & 0xff, (unsigned)(a >> 24) & 0xff,
+            (unsigned)(a >> 16) & 0xff, (unsigned)(a >> 8) & 0xff, (unsigned)a & 0xff);
+    }
+
+    void startConnection(HostTiming& t, uint16_t connHandle, unsigned long connectMs) {
+        t.connHandle = connHandle;
+        t.connectMs = connectMs;
+        t.encryptMs = 0;
+        t.hidReadyMs = 0;
+    }
+
+    // Хост готов, когда соединение зашифровано и хост подписан на отчёты (подписка bond
+    // восстанавливается стеком после шифрования)
+    void completeIfReady(HostTiming& t) {
+        if (t.encryptMs == 0 || t.hidReadyMs == 0) {
+            return;
+        }
+        unsigned long readyMs = (long)(t.hidReadyMs - t.encryptMs) > 0 ? t.hidReadyMs : t.encryptMs;
+        t.connections++;
+        t.encryptTotalMs += t.encryptMs - t.connectMs;
+        t.readyTotalMs += readyMs - t.connectMs;
+        if (!t.pending) {
+            return;
+        }
+        t.pending = false;
+
+        uint32_t elapsed = readyMs - t.sinceMs;
+        char address[18];
+        formatAddress(t.address, address, sizeof(address));
+        Serial.printf("Host %s HID ready %lu ms after %s (connect +%lu, encrypted +%lu)\n", address,
+            (unsigned long)elapsed, t.fromBoot ? "boot" : "link loss",
+            (unsigned long)(t.connectMs - t.sinceMs), (unsigned long)(t.encryptMs - t.sinceMs));
+        if (elapsed > RECONNECT_ABSENT_MS) {
+            t.absent++;
+            return;
+        }
+        t.samples++;
+        t.lastMs = elapsed;
+        t.totalMs += elapsed;
+        if (t.samples == 1 || elapsed < t.bestMs) t.bestMs = elapsed;
+        if (elapsed > t.worstMs) t.worstMs = elapsed;
+        if (elapsed <= RECONNECT_TARGET_MS) t.withinTarget++;
+    }
+} // namespace
+
+void reconnectBegin(const char* lastAddress) {
+    if (lastAddress && lastAddress[0] != '\0') {
+        lastHost = (uint64_t)NimBLEAddress(std::string(lastAddress), BLE_ADDR_PUBLIC);
+    }
+    int bonds = NimBLEDevice::getNumBonds();
+    for (int i = 0; i < bonds; i++) {
+        HostTiming* t = timingFor((uint64_t)NimBLEDevice::getBondedAddress(i), true);
+        if (t) {
+            t->pending = true;
+            t->fromBoot = true;
+            t->sinceMs = 0;   // millis() с момента загрузки
+        }
+    }
+}
+
+int reconnectAdvertise(const char* reason, uint64_t preferred, bool pairing) {
+    NimBLEAddress targets[ADV_MAX_DIRECTED_HOSTS];
+    int count = pendingBonds(targets, ADV_MAX_DIRECTED_HOSTS, preferred);
+    // Фильтр по белому списку, только если он уже совпадает с bond: иначе хост,
+    // сопряжённый последним, не смог бы подключиться
+    bool whitelistOnly = !pairing && count > 0 && scanSchedulerWhitelistCurrent();
+    advSchedulerStart(targets, count, whitelistOnly, reason);
+    return count;
+}
+
+int reconnectPendingHosts() {
+    int count = 0;
+    int bonds = NimBLEDevice::getNumBonds();
+    for (int i = 0; i < bonds; i++) {
+        if (!bondConnected(NimBLEDevice::getBondedAddress(i))) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void reconnectCheckHostSeen() {
+    if (!scanSchedulerIsScanning() || millis() - lastSeenCheck < HOST_SEEN_CHECK_MS) {
+        return;
+    }
+    lastSeenCheck = millis();
+    AdvTier tier = advSchedulerTier();
+    if (tier <= ADV_TIER_FAST || tier >= ADV_TIER_OFF) {
+        return;
+    }
+
+    NimBLEAddress targets[ADV_MAX_DIRECTED_HOSTS];
+    int count = pendingBonds(targets, ADV_MAX_DIRECTED_HOSTS, 0);
+    for (int i = 0; i < count; i++) {
+        AdvertiserRecord record;
+        uint64_t address = (uint64_t)targets[i];
+        if (advertiserTableLookup(address, record) && millis() - record.lastSeenMs < HOST_SEEN_CHECK_MS) {
+            reconnectAdvertise("host seen", address, false);
+            return;
+        }
+    }
+}
+
+void reconnectLinkLost(uint64_t address, uint16_t connHandle) {
+    PendingLink* link = linkFor(connHandle, false);
+    if (link) {
+        link->used = false;
+    }
+    HostTiming* t = timingForHandle(connHandle);
+    if (!t) {
+        t = timingFor(address, false);
+    }
+    if (!t) {
+        return;
+    }
+    t->connHandle = BLE_HS_CONN_HANDLE_NONE;
+    // Неудачная попытка (соединение разорвалось до готовности) не сбрасывает отсчёт
+    if (!t->pending) {
+        t->pending = true;
+        t->fromBoot = false;
+        t->sinceMs = millis();
+    }
+}
+
+void reconnectConnected(uint64_t address, uint16_t connHandle) {
+    HostTiming* t = isBonded(address) ? timingFor(address, true) : nullptr;
+    if (!t) {
+        // Запись появится при шифровании, если хост окажется сопряжённым
+        PendingLink* link = linkFor(connHandle, true);
+        if (link) {
+            link->connectMs = millis();
+        }
+        return;
+    }
+    startConnection(*t, connHandle, millis());
+}
+
+void reconnectEncrypted(uint16_t connHandle, uint64_t address) {
+    HostTiming* t = timingForHandle(connHandle);
+    if (!t) {
+        // Хост опознан при шифровании: учёт по идентификационному адресу
+        PendingLink* link = linkFor(connHandle, false);
+        t = isBonded(address) ? timingFor(address, true) : nullptr;
+        if (t) {
+            startConnection(*t, connHandle, link ? link->connectMs : millis());
+            t->hidReadyMs = link ? link->hidReadyMs : 0;
+        }
+        if (link) {
+            link->used = false;
+        }
+    }
+    if (t && t->encryptMs == 0) {
+        t->encryptMs = millis();
+        completeIfReady(*t);
+    }
+}
+
+void reconnectHidReady(uint16_t connHandle) {
+    HostTiming* t = timingForHandle(connHandle);
+    if (t && t->hidReadyMs == 0) {
+        t->hidReadyMs = millis();
+        completeIfReady(*t);
+        return;
+    }
+    PendingLink* link = linkFor(connHandle, false);
+    if (link && link->hidReadyMs == 0) {
+        link->hidReadyMs = millis();
+    }
+}
+
+void reconnectBondsChanged() {
+    for (int i = 0; i < RECONNECT_MAX_HOSTS; i++) {
+        if (timings[i].address != 0 && !isBonded(timings[i].address)) {
+            timings[i] = HostTiming{};
+        }
+    }
+    if (!isBonded(lastHost)) {
+        lastHost = 0;
+    }
+}
+
+void printReconnectStats() {
+    unsigned long now = millis();
+    Serial.println("\n=== Reconnect ===");
+    Serial.printf("Bonded hosts: %d, not connected: %d, target %u ms\n",
+        NimBLEDevice::getNumBonds(), reconnectPendingHosts(), (unsigned)RECONNECT_TARGET_MS);
+    Serial.println("Host               State     Reconnects  <=target  Absent  Last  Best   Avg  Worst  Enc  Ready");
+    for (int i = 0; i < RECONNECT_MAX_HOSTS; i++) {
+        const HostTiming& t = timings[i];
+        if (t.address == 0) {
+            continue;
+        }
+        char address[18];
+        formatAddress(t.address, address, sizeof(address));
+        char state[16];
+        if (t.pending) {
+            snprintf(state, sizeof(state), "wait %lus", (now - t.sinceMs) / 1000);
+        } else {
+            strlcpy(state, t.connHandle != BLE_HS_CONN_HANDLE_NONE ? "ready" : "-", sizeof(state));
+        }
+        Serial.printf("%-18s %-9s %10lu %9lu %7lu %5lu %5lu %5lu %6lu %4lu %6lu\n", address, state,
+            (unsigned long)t.samples, (unsigned long)t.withinTarget, (unsigned long)t.absent,
+            (unsigned long)t.lastMs, (unsigned long)t.bestMs,
+            (unsigned long)(t.samples ? t.totalMs / t.samples : 0), (unsigned long)t.worstMs,
+            (unsigned long)(t.connections ? t.encryptTotalMs / t.connections : 0),
+            (unsigned long)(t.connections ? t.readyTotalMs / t.connections : 0));
+    }
+    Serial.println("Times in ms; Enc/Ready - average from connection to encryption / HID subscription");
+    Serial.println("=== End Reconnect ===\n");
+}
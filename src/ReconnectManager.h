@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Быстрое переподключение сопряжённых хостов.
+// Список хостов берётся прямо из хранилища bond NimBLE (идентификационные адреса), а не из
+// адреса последнего устройства в NVS: тот только ставит свой хост первым в очереди.
+// Реклама для переподключения: всплеск направленной рекламы на каждый сопряжённый
+// неподключённый хост, затем обычная реклама, принимающая подключения только от белого
+// списка (пока он совпадает с bond). Окно сопряжения (кнопка) снимает фильтр.
+//
+// Время переподключения считается по каждому хосту: от загрузки или разрыва соединения
+// до соединения, шифрования и подписки хоста на HID-отчёты (хост готов принимать клавиши).
+// Всё вызывается из задачи опроса.
+
+#ifndef RECONNECT_MAX_HOSTS
+#define RECONNECT_MAX_HOSTS 4          // Хостов в учёте, не меньше числа bond NimBLE
+#endif
+#ifndef RECONNECT_TARGET_MS
+#define RECONNECT_TARGET_MS 1000       // Цель: от загрузки или разрыва до готовности HID
+#endif
+#ifndef RECONNECT_ABSENT_MS
+#define RECONNECT_ABSENT_MS 30000      // Дольше - хоста не было рядом, в статистику скорости не входит
+#endif
+
+/**
+ * @brief Загрузка: все сопряжённые хосты ждут переподключения с момента старта.
+ * @param lastAddress Адрес последнего хоста из NVS/RTC (первый в очереди) или пустая строка
+ */
+void reconnectBegin(const char* lastAddress);
+
+/**
+ * @brief Запускает расписание рекламы для сопряжённых неподключённых хостов.
+ * @param preferred Хост, который ставится первым (например, замеченный в эфире), или 0
+ * @param pairing Окно сопряжения: обычная реклама принимает подключения от любых устройств
+ * @return Число сопряжённых неподключённых хостов
+ */
+int reconnectAdvertise(const char* reason, uint64_t preferred, bool pairing);
+
+/**
+ * @brief Число сопряжённых хостов без соединения.
+ */
+int reconnectPendingHosts();
+
+/**
+ * @brief Сопряжённый хост снова в эфире (по таблице рекламодателей) - реклама с первой ступени,
+ * если она успела замедлиться. Проверка не чаще раза в секунду.
+ */
+void reconnectCheckHostSeen();
+
+/**
+ * @brief События соединения хоста. address - идентификационный адрес (uint64_t из NimBLEAddress).
+ * Учёт ведётся только для сопряжённых хостов: соединение с адресом не из bond (RPA до шифрования,
+ * новое устройство) получает запись при шифровании, когда известен идентификационный адрес.
+ */
+void reconnectLinkLost(uint64_t address, uint16_t connHandle);
+void reconnectConnected(uint64_t address, uint16_t connHandle);
+void reconnectEncrypted(uint16_t connHandle, uint64_t address);
+void reconnectHidReady(uint16_t connHandle);
+
+/**
+ * @brief Список bond изменился (удаление, новое сопряжение): записи хостов не из bond удаляются.
+ */
+void reconnectBondsChanged();
+
+void printReconnectStats();
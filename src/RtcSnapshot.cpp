@@ -0,0 +1,84 @@
+#include "RtcSnapshot.h"
+#include <esp_attr.h>
+#include <esp_crc.h>
+#include <esp_system.h>
+#include <sys/time.h>
+
+namespace {
+    const uint32_t RTC_SNAPSHOT_MAGIC = 0x4D35534E;  // "M5SN"
+    const uint16_t RTC_SNAPSHOT_VERSION = 2;
+
+    struct RtcRecord {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t size;
+        uint64_t savedAtMs;         // Время сохранения по часам RTC
+        RtcStateSnapshot data;
+        uint32_t crc;               // CRC32 всех полей выше
+    };
+
+    // RTC_NOINIT_ATTR, а не RTC_DATA_ATTR: секция .rtc.data перезаписывается
+    // загрузчиком при любом сбросе, кроме выхода из deep sleep
+    RTC_NOINIT_ATTR RtcRecord rtcRecord;
+
+    uint32_t recordCrc(const RtcRecord& record) {
+        return esp_crc32_le(0, reinterpret_cast<const uint8_t*>(&record), offsetof(RtcRecord, crc));
+    }
+
+    // Системное время продолжает идти через программный сброс и deep sleep
+    uint64_t rtcClockMs() {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+
+    bool resetKeepsRtcMemory(esp_reset_reason_t reason) {
+        switch (reason) {
+            case ESP_RST_SW:
+            case ESP_RST_PANIC:
+            case ESP_RST_INT_WDT:
+            case ESP_RST_TASK_WDT:
+            case ESP_RST_WDT:
+            case ESP_RST_DEEPSLEEP:
+                return true;
+            default:
+                return false;  // Включение питания, brownout, внешний сброс
+        }
+    }
+} // namespace
+
+void rtcSnapshotSave(const RtcStateSnapshot& snapshot) {
+    rtcRecord.magic = RTC_SNAPSHOT_MAGIC;
+    rtcRecord.version = RTC_SNAPSHOT_VERSION;
+    rtcRecord.size = sizeof(RtcStateSnapshot);
+    rtcRecord.savedAtMs = rtcClockMs();
+    rtcRecord.data = snapshot;
+    rtcRecord.crc = recordCrc(rtcRecord);
+}
+
+bool rtcSnapshotRestore(RtcStateSnapshot& snapshot, uint32_t& elapsedMs) {
+    if (!resetKeepsRtcMemory(esp_reset_reason())) {
+        return false;
+    }
+    if (rtcRecord.magic != RTC_SNAPSHOT_MAGIC ||
+        rtcRecord.version != RTC_SNAPSHOT_VERSION ||
+        rtcRecord.size != sizeof(RtcStateSnapshot) ||
+        rtcRecord.crc != recordCrc(rtcRecord)) {
+        return false;
+    }
+
+    uint64_t now = rtcClockMs();
+    uint64_t elapsed = now >= rtcRecord.savedAtMs ? now - rtcRecord.savedAtMs : 0;
+    elapsedMs = elapsed < RTC_TIMER_NOT_SET ? (uint32_t)elapsed : RTC_TIMER_NOT_SET - 1;
+    snapshot = rtcRecord.data;
+    snapshot.lastAddr[RTC_SNAPSHOT_ADDR_LEN - 1] = '\0';
+    for (int i = 0; i < RTC_SNAPSHOT_MAX_HOSTS; i++) {
+        snapshot.unlockLimits[i].addr[sizeof(snapshot.unlockLimits[i].addr) - 1] = '\0';
+    }
+    return true;
+}
+
+void rtcSnapshotInvalidate() {
+    rtcRecord.magic = 0;
+    rtcRecord.crc = 0;
+}
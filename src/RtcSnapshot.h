@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Снимок рабочего состояния в RTC-памяти. Переживает программный сброс,
+// срабатывание watchdog и выход из deep sleep, поэтому после таких
+// перезапусков состояние восстанавливается без чтения NVS.
+// При включении питания снимок недействителен и источником остаётся NVS.
+
+#define RTC_SNAPSHOT_RSSI_SAMPLES 10
+#define RTC_SNAPSHOT_ADDR_LEN 32
+#define RTC_SNAPSHOT_MAX_HOSTS 4
+
+// Значение возраста таймера, который не был запущен (в main.cpp это 0)
+static const uint32_t RTC_TIMER_NOT_SET = 0xFFFFFFFF;
+
+/**
+ * @brief Ограничение попыток разблокировки одного хоста.
+ */
+struct RtcUnlockLimit {
+    char addr[18];                  // Пустой - запись не используется
+    uint8_t failedAttempts;
+    uint32_t failedAgeMs;
+};
+
+/**
+ * @brief Состояние логики блокировки. Таймеры хранятся как возраст в мс на момент
+ * сохранения, т.к. millis() после сброса начинается с нуля.
+ */
+struct RtcStateSnapshot {
+    uint8_t state;                  // DeviceState
+    int32_t lockThreshold;
+    int32_t unlockThreshold;
+
+    // Состояние фильтра RSSI
+    int32_t lastAverageRssi;
+    int32_t rssiValues[RTC_SNAPSHOT_RSSI_SAMPLES];
+    uint8_t rssiIndex;
+    uint8_t validSamples;
+    float exponentialAverage;
+    bool exponentialAverageInitialized;
+    uint8_t consecutiveLockSamples;
+    uint8_t consecutiveUnlockSamples;
+
+    // Таймеры логики блокировки
+    uint32_t stateChangeAgeMs;
+    uint32_t movementAgeMs;
+    uint32_t weakSignalAgeMs;
+
+    // Ограничение попыток разблокировки, по каждому хосту
+    RtcUnlockLimit unlockLimits[RTC_SNAPSHOT_MAX_HOSTS];
+
+    char lastAddr[RTC_SNAPSHOT_ADDR_LEN];
+};
+
+/**
+ * @brief Записывает снимок в RTC-память вместе с CRC. Flash не используется.
+ */
+void rtcSnapshotSave(const RtcStateSnapshot& snapshot);
+
+/**
+ * @brief Проверяет причину сброса, заголовок и CRC снимка.
+ * @param snapshot Куда скопировать снимок
+ * @param elapsedMs Сколько времени прошло с момента сохранения (оценка по часам RTC)
+ * @return true, если снимок действителен и его можно применить
+ */
+bool rtcSnapshotRestore(RtcStateSnapshot& snapshot, uint32_t& elapsedMs);
+
+/**
+ * @brief Делает снимок недействительным (например, после очистки NVS).
+ */
+void rtcSnapshotInvalidate();
@@ -0,0 +1,328 @@
+#include "ScanScheduler.h"
+#include "TaskMonitor.h"
+#include "AdvertiserTable.h"
+#include <NimBLEDevice.h>
+
+namespace {
+    struct ClientRequest {
+        bool needed;
+        uint16_t interval;
+        uint16_t window;
+        uint32_t activations;
+    };
+
+    const char* const CLIENT_NAMES[SCAN_CLIENT_COUNT] = { "host search", "rssi fallback" };
+    // Поиску хоста достаточно одного отчёта за период; для RSSI нужен каждый пакет
+    const bool CLIENT_NEEDS_DUPLICATES[SCAN_CLIENT_COUNT] = { false, true };
+
+    enum ScanPolicy : uint8_t {
+        POLICY_WHITELIST = 0,
+        POLICY_OPEN,
+        POLICY_COUNT
+    };
+    const char* const POLICY_NAMES[POLICY_COUNT] = { "whitelist", "open" };
+
+    // Нагрузка на хост по политике фильтра. Отчёты считаются в задаче стека NimBLE
+    struct PolicyStats {
+        uint32_t onTimeMs;
+        float windowTimeMs;
+        uint32_t reports;          // Отчёты о рекламе, дошедшие до колбэка
+        uint32_t foreignReports;   // Из них от устройств не из белого списка
+        uint32_t newResults;       // Объекты NimBLEAdvertisedDevice, созданные стеком (временные: результаты не хранятся)
+        uint32_t resultBytes;      // Их размер с данными рекламы
+        uint32_t hostRunTime;      // Время задачи стека за периоды сканирования, единицы счётчика FreeRTOS
+        uint32_t runTimeTotal;
+    };
+
+    NimBLEScan* scanner = nullptr;
+    ClientRequest clients[SCAN_CLIENT_COUNT] = {};
+    uint16_t connItvl = 0;
+
+    // Белый список контроллера: сопряжённые хосты
+    bool whitelistDirty = true;
+    int whitelistBonds = -1;       // Число bond при последней сборке
+    size_t whitelistSize = 0;
+    uint32_t whitelistSyncs = 0;
+    uint32_t whitelistFailures = 0;
+    unsigned long whitelistSyncTime = 0;
+    const unsigned long WHITELIST_RETRY_MS = 1000;
+    bool openPolicy = false;
+
+    // Параметры запущенного периода
+    bool running = false;
+    uint16_t runInterval = 0;
+    uint16_t runWindow = 0;
+    unsigned long runStart = 0;
+    volatile ScanPolicy runPolicy = POLICY_OPEN;
+    bool hostRunTimeValid = false;
+    uint32_t hostRunTimeMark = 0;
+    uint32_t runTimeTotalMark = 0;
+
+    uint32_t periods = 0;
+    uint32_t deferredChanges = 0;
+    bool changeDeferred = false;
+    uint32_t startFailures = 0;
+    uint32_t onTimeMs = 0;
+    float windowTimeMs = 0;   // Время приёма: длительность * окно / интервал
+    PolicyStats policyStats[POLICY_COUNT] = {};
+
+    class ScanLoadCallbacks : public NimBLEScanCallbacks {
+        void onDiscovered(const NimBLEAdvertisedDevice* device) override {
+            PolicyStats& s = policyStats[runPolicy];
+            s.newResults++;
+            s.resultBytes += sizeof(NimBLEAdvertisedDevice) + device->getPayloadLength();
+        }
+
+        void onResult(const NimBLEAdvertisedDevice* device) override {
+            PolicyStats& s = policyStats[runPolicy];
+            s.reports++;
+            advertiserTableRecord((uint64_t)device->getAddress(), device->getRSSI());
+            if (!NimBLEDevice::onWhiteList(device->getAddress())) {
+                s.foreignReports++;
+            }
+        }
+    };
+    ScanLoadCallbacks loadCallbacks;
+
+    void accountRun(unsigned long now) {
+        if (!running) {
+            return;
+        }
+        uint32_t elapsed = now - runStart;
+        float window = elapsed * (float)runWindow / runInterval;
+        onTimeMs += elapsed;
+        windowTimeMs += window;
+        runStart = now;
+
+        PolicyStats& s = policyStats[runPolicy];
+        s.onTimeMs += elapsed;
+        s.windowTimeMs += window;
+        uint32_t runTime = 0, total = 0;
+        if (hostRunTimeValid && taskMonitorRunTimeOf(SCAN_HOST_TASK_NAME, runTime, total)) {
+            s.hostRunTime += runTime - hostRunTimeMark;
+            s.runTimeTotal += total - runTimeTotalMark;
+            hostRunTimeMark = runTime;
+            runTimeTotalMark = total;
+        }
+    }
+
+    // Белый список = bond. Вызывается, только пока сканирование остановлено.
+    // Контроллер отказывает, пока список фильтрует рекламу, - тогда повторим позже
+    void syncWhitelist() {
+        uint32_t failuresBefore = whitelistFailures;
+        whitelistSyncTime = millis();
+        for (int i = (int)NimBLEDevice::getWhiteListCount() - 1; i >= 0; i--) {
+            NimBLEAddress address = NimBLEDevice::getWhiteListAddress(i);
+            if (!NimBLEDevice::isBonded(address) && !NimBLEDevice::whiteListRemove(address)) {
+                whitelistFailures++;
+            }
+        }
+        int bonds = NimBLEDevice::getNumBonds();
+        for (int i = 0; i < bonds; i++) {
+            NimBLEAddress address = NimBLEDevice::getBondedAddress(i);
+            if (!NimBLEDevice::onWhiteList(address) && !NimBLEDevice::whiteListAdd(address)) {
+                whitelistFailures++;
+            }
+        }
+        whitelistBonds = bonds;
+        whitelistSize = NimBLEDevice::getWhiteListCount();
+        whitelistDirty = whitelistFailures != failuresBefore;
+        whitelistSyncs++;
+    }
+
+    // Самый плотный из запросов; false - сканирование никому не нужно
+    bool wantedParams(uint16_t& interval, uint16_t& window) {
+        bool any = false;
+        float bestDuty = 0;
+        for (int i = 0; i < SCAN_CLIENT_COUNT; i++) {
+            const ClientRequest& c = clients[i];
+            if (!c.needed || c.interval == 0) {
+                continue;
+            }
+            float duty = (float)c.window / c.interval;
+            if (!any || duty > bestDuty) {
+                any = true;
+                bestDuty = duty;
+                interval = c.interval;
+                window = c.window;
+            }
+        }
+        if (!any) {
+            return false;
+        }
+
+        if (connItvl > 0) {
+            // Выравнивание по соединению: интервал кратен интервалу соединения,
+            // окно короче интервала соединения на защитный зазор
+            uint16_t connUnits = connItvl * 2;  // 1.25 мс -> 0.625 мс
+            interval = ((interval + connUnits - 1) / connUnits) * connUnits;
+            uint16_t maxWindow = connUnits > SCAN_CONN_GUARD + SCAN_MIN_WINDOW
+                ? connUnits - SCAN_CONN_GUARD : SCAN_MIN_WINDOW;
+            if (window > maxWindow) window = maxWindow;
+        }
+        if (window < SCAN_MIN_WINDOW) window = SCAN_MIN_WINDOW;
+        if (window > interval) window = interval;
+        return true;
+    }
+
+    void startPeriod(uint16_t interval, uint16_t window) {
+        bool duplicates = false;
+        for (int i = 0; i < SCAN_CLIENT_COUNT; i++) {
+            duplicates |= clients[i].needed && CLIENT_NEEDS_DUPLICATES[i];
+        }
+        if (whitelistDirty || NimBLEDevice::getNumBonds() != whitelistBonds) {
+            syncWhitelist();
+        }
+        // Пустой белый список пропустил бы только направленную на нас рекламу
+        ScanPolicy policy = openPolicy || whitelistSize == 0 ? POLICY_OPEN : POLICY_WHITELIST;
+        scanner->setFilterPolicy(policy == POLICY_WHITELIST ? BLE_HCI_SCAN_FILT_USE_WL : BLE_HCI_SCAN_FILT_NO_WL);
+        scanner->setDuplicateFilter(!duplicates);
+        scanner->setInterval(interval);
+        scanner->setWindow(window);
+        advertiserTableExpire();
+        if (!scanner->start(SCAN_PERIOD_MS, true, false)) {
+            startFailures++;
+            running = false;
+            return;
+        }
+        running = true;
+        runInterval = interval;
+        runWindow = window;
+        runPolicy = policy;
+        runStart = millis();
+        hostRunTimeValid = taskMonitorRunTimeOf(SCAN_HOST_TASK_NAME, hostRunTimeMark, runTimeTotalMark);
+        periods++;
+    }
+} // namespace
+
+void scanSchedulerBegin(NimBLEScan* scan) {
+    scanner = scan;
+    scanner->setActiveScan(false);
+    // Отчёты записываются в таблицу рекламодателей, в объекте сканера ничего не накапливается
+    scanner->setMaxResults(0);
+    scanner->setScanCallbacks(&loadCallbacks, true);
+    syncWhitelist();
+}
+
+void scanSchedulerWhitelistChanged() {
+    whitelistDirty = true;
+}
+
+void scanSchedulerSetOpenPolicy(bool open) {
+    openPolicy = open;
+}
+
+bool scanSchedulerWhitelistCurrent() {
+    return !whitelistDirty && NimBLEDevice::getNumBonds() == whitelistBonds;
+}
+
+bool scanSchedulerOpenPolicy() {
+    return openPolicy;
+}
+
+void scanSchedulerRequest(ScanClient client, bool needed, uint16_t interval, uint16_t window) {
+    ClientRequest& c = clients[client];
+    if (needed && !c.needed) {
+        c.activations++;
+    }
+    c.needed = needed;
+    c.interval = interval;
+    c.window = window;
+}
+
+void scanSchedulerSetConnInterval(uint16_t itvl) {
+    connItvl = itvl;
+}
+
+void scanSchedulerUpdate() {
+    if (!scanner) {
+        return;
+    }
+    unsigned long now = millis();
+    uint16_t interval = 0, window = 0;
+    bool wanted = wantedParams(interval, window);
+
+    if (!wanted) {
+        if (running) {
+            accountRun(now);
+            scanner->stop();
+            running = false;
+        }
+        // Сканер простаивает - удобный момент пересобрать белый список после сопряжения
+        if (whitelistDirty && now - whitelistSyncTime >= WHITELIST_RETRY_MS) {
+            syncWhitelist();
+        }
+        return;
+    }
+
+    if (running && scanner->isScanning()) {
+        // Период ещё идёт; изменившиеся параметры применим на его границе
+        if ((interval != runInterval || window != runWindow) && !changeDeferred) {
+            changeDeferred = true;
+            deferredChanges++;
+        }
+        return;
+    }
+
+    // Период закончился (или сканирование не было запущено) - запускаем следующий с актуальными параметрами
+    accountRun(now);
+    changeDeferred = false;
+    startPeriod(interval, window);
+}
+
+bool scanSchedulerIsScanning() {
+    return running;
+}
+
+uint16_t scanSchedulerInterval() {
+    return running ? runInterval : 0;
+}
+
+uint16_t scanSchedulerWindow() {
+    return running ? runWindow : 0;
+}
+
+void printScanSchedulerStats() {
+    accountRun(millis());
+    Serial.println("\n=== Scan Scheduler ===");
+    Serial.printf("Scanning: %s", running ? "yes" : "no");
+    if (running) {
+        Serial.printf(", interval %.2f ms, window %.2f ms (%.1f%% duty), passive, %s filter",
+            runInterval * 0.625f, runWindow * 0.625f, 100.0f * runWindow / runInterval, POLICY_NAMES[runPolicy]);
+    }
+    Serial.println();
+    Serial.printf("Whitelist: %u bonded hosts, syncs %lu, failures %lu%s\n", (unsigned)whitelistSize,
+        (unsigned long)whitelistSyncs, (unsigned long)whitelistFailures,
+        openPolicy ? " (open policy forced)" : "");
+    if (connItvl > 0) {
+        Serial.printf("Aligned to connection interval %.2f ms\n", connItvl * 1.25f);
+    }
+    for (int i = 0; i < SCAN_CLIENT_COUNT; i++) {
+        const ClientRequest& c = clients[i];
+        Serial.printf("  %-13s: %s, %u/%u, activations %lu\n", CLIENT_NAMES[i],
+            c.needed ? "needed" : "idle", c.interval, c.window, (unsigned long)c.activations);
+    }
+    Serial.printf("Periods: %lu, deferred parameter changes: %lu, start failures: %lu\n",
+        (unsigned long)periods, (unsigned long)deferredChanges, (unsigned long)startFailures);
+    Serial.printf("Scanner on for %.1f s, receiving %.1f s\n", onTimeMs / 1000.0f, windowTimeMs / 1000.0f);
+
+    // Нагрузка на хост на секунду окна приёма: отчёты, созданные стеком объекты и время задачи стека
+    // (в нём и обработка соединений, поэтому сравнивать политики нужно при одинаковом числе хостов)
+    Serial.println("Filter     Window s  Reports  Foreign  Rep/s  New/s  Bytes/s  Host CPU %  ms/s");
+    for (int i = 0; i < POLICY_COUNT; i++) {
+        const PolicyStats& s = policyStats[i];
+        float windowS = s.windowTimeMs / 1000.0f;
+        float perWindow = windowS > 0 ? 1.0f / windowS : 0;
+        Serial.printf("%-9s %9.1f %8lu %8lu %6.1f %6.1f %8.0f", POLICY_NAMES[i], windowS,
+            (unsigned long)s.reports, (unsigned long)s.foreignReports,
+            s.reports * perWindow, s.newResults * perWindow, s.resultBytes * perWindow);
+        if (s.runTimeTotal > 0) {
+            float cpu = (float)s.hostRunTime / s.runTimeTotal;
+            Serial.printf(" %11.1f %5.1f\n", 100.0f * cpu,
+                s.windowTimeMs > 0 ? 1000.0f * cpu * s.onTimeMs / s.windowTimeMs : 0);
+        } else {
+            Serial.println("           -     -");
+        }
+    }
+    Serial.println("=== End Scan Scheduler ===\n");
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Arduino.h>
+
+class NimBLEScan;
+
+// Планировщик сканирования.
+// Сканирование включено, только пока оно нужно хотя бы одному клиенту (источнику RSSI
+// или поиску хоста); из запросов клиентов выбирается самый плотный режим.
+// Сканирование всегда пассивное: SCAN_REQ в эфир не отправляются. Фильтр дубликатов
+// в контроллере выключается, только если клиенту нужен каждый пакет (RSSI).
+//
+// Оба клиента ищут только сопряжённые хосты, поэтому их адреса из хранилища bond загружаются
+// в белый список контроллера, и сканирование идёт с политикой "только белый список": реклама
+// чужих устройств отбрасывается в контроллере, до колбэка хоста и объекта в результатах.
+// Bond хранит идентификационный адрес; хост со случайным приватным адресом (RPA) опознаётся
+// контроллером по его IRK из списка разрешения, который NimBLE заполняет из тех же bond.
+// Белый список нельзя менять во время сканирования или рекламы с ним, поэтому он обновляется,
+// пока сканер остановлен (на границе периода): после смены числа bond или по
+// scanSchedulerWhitelistChanged(); неудачная сборка повторяется. Пока bond нет, сканирование
+// открытое, как раньше. Тот же список фильтрует подключения к обычной рекламе.
+//
+// При соединении интервал сканирования округляется до кратного интервалу соединения,
+// а окно делается короче интервала соединения на защитный зазор: фаза окна относительно
+// событий соединения не "плывёт", и окно не может накрыть два события подряд.
+//
+// Сканирование запускается периодами ограниченной длительности. Новые параметры
+// применяются на границе периода, когда NimBLE и так перезапускает сканирование,
+// поэтому отдельного stop/start и пропуска в приёме нет. Выключение - сразу.
+
+#ifndef SCAN_PERIOD_MS
+#define SCAN_PERIOD_MS 10000       // Длительность одного периода сканирования
+#endif
+#ifndef SCAN_CONN_GUARD
+#define SCAN_CONN_GUARD 4          // Зазор до события соединения, 0.625 мс (2.5 мс)
+#endif
+#ifndef SCAN_MIN_WINDOW
+#define SCAN_MIN_WINDOW 4          // Минимальное окно, 0.625 мс
+#endif
+#ifndef SCAN_HOST_TASK_NAME
+#define SCAN_HOST_TASK_NAME "nimble_host"  // Задача стека, в которой разбираются отчёты о рекламе
+#endif
+
+enum ScanClient : uint8_t {
+    SCAN_CLIENT_HOST_SEARCH = 0,   // Нет соединения: ищем рекламу сопряжённого хоста
+    SCAN_CLIENT_RSSI_FALLBACK,     // Соединение есть, но RSSI соединения недоступен
+    SCAN_CLIENT_COUNT
+};
+
+/**
+ * @brief Настраивает сканер: пассивное сканирование, белый список из bond, учёт отчётов.
+ * Устанавливает свои колбэки: отчёты попадают в таблицу рекламодателей (AdvertiserTable.h),
+ * результаты в сканере не хранятся.
+ */
+void scanSchedulerBegin(NimBLEScan* scan);
+
+/**
+ * @brief Запрос клиента. Параметры учитываются, только пока needed == true.
+ * @param interval Интервал сканирования, 0.625 мс
+ * @param window Окно сканирования, 0.625 мс
+ */
+void scanSchedulerRequest(ScanClient client, bool needed, uint16_t interval, uint16_t window);
+
+/**
+ * @brief Интервал текущего соединения (1.25 мс) для выравнивания окон; 0 - соединения нет.
+ */
+void scanSchedulerSetConnInterval(uint16_t connItvl);
+
+/**
+ * @brief Вызывается из loop(): включение, выключение и применение новых параметров.
+ */
+void scanSchedulerUpdate();
+
+/**
+ * @brief Bond изменились (сопряжение, удаление): белый список пересобирается на границе периода.
+ */
+void scanSchedulerWhitelistChanged();
+
+/**
+ * @brief Белый список совпадает с bond: по нему можно фильтровать подключения к рекламе.
+ */
+bool scanSchedulerWhitelistCurrent();
+
+/**
+ * @brief Открытое сканирование без белого списка (для сравнения нагрузки); применяется
+ * на границе периода. Статистика ведётся отдельно по каждой политике.
+ */
+void scanSchedulerSetOpenPolicy(bool open);
+bool scanSchedulerOpenPolicy();
+
+bool scanSchedulerIsScanning();
+
+/**
+ * @brief Параметры, с которыми сканирование запущено сейчас (для учёта энергии).
+ */
+uint16_t scanSchedulerInterval();
+uint16_t scanSchedulerWindow();
+
+void printScanSchedulerStats();
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Схема ключей NVS. Все ключи и префиксы собраны здесь, чтобы их длина
+// проверялась на этапе компиляции: NVS допускает не более 15 символов в ключе.
+
+constexpr size_t NVS_KEY_MAX_LEN = 15;  // Без завершающего нуля
+constexpr size_t SHORT_KEY_LEN = 6;     // Последние 3 октета MAC без двоеточий
+
+// Буферы фиксированного размера для сборки ключей на стеке
+typedef char NvsKeyBuffer[NVS_KEY_MAX_LEN + 1];
+typedef char ShortKeyBuffer[SHORT_KEY_LEN + 1];
+
+constexpr size_t keyLength(const char* s) {
+    return *s ? 1 + keyLength(s + 1) : 0;
+}
+
+namespace StorageKeys {
+    constexpr const char* NAMESPACE      = "m5kb_v1";
+    constexpr const char* IS_LOCKED      = "is_locked";
+    constexpr const char* LAST_ADDR      = "last_addr";
+    constexpr const char* UI_DEPTH       = "ui_depth";
+}
+
+static_assert(keyLength(StorageKeys::NAMESPACE) <= NVS_KEY_MAX_LEN, "NVS namespace name too long");
+static_assert(keyLength(StorageKeys::IS_LOCKED) <= NVS_KEY_MAX_LEN, "NVS key too long");
+static_assert(keyLength(StorageKeys::LAST_ADDR) <= NVS_KEY_MAX_LEN, "NVS key too long");
+static_assert(keyLength(StorageKeys::UI_DEPTH) <= NVS_KEY_MAX_LEN, "NVS key too long");
+
+// Ключи, привязанные к устройству: префикс + короткий ключ MAC
+enum class DeviceKey : uint8_t {
+    Password,       // pwd_XXXXXX    - зашифрованный пароль (hex)
+    UnlockRssi,     // unlock_XXXXXX - порог разблокировки
+    LockRssi,       // lock_XXXXXX   - порог блокировки
+    LockState,      // locked_XXXXXX - состояние блокировки
+    Count
+};
+
+constexpr const char* DEVICE_KEY_PREFIXES[] = {
+    "pwd_",
+    "unlock_",
+    "lock_",
+    "locked_"
+};
+
+static_assert(sizeof(DEVICE_KEY_PREFIXES) / sizeof(DEVICE_KEY_PREFIXES[0]) == (size_t)DeviceKey::Count,
+              "DEVICE_KEY_PREFIXES must match DeviceKey");
+
+constexpr bool deviceKeysFit(size_t i = 0) {
+    return i >= (size_t)DeviceKey::Count ||
+           (keyLength(DEVICE_KEY_PREFIXES[i]) + SHORT_KEY_LEN <= NVS_KEY_MAX_LEN && deviceKeysFit(i + 1));
+}
+
+static_assert(deviceKeysFit(), "Device key prefix + short key exceed the NVS key limit");
+
+constexpr const char* deviceKeyPrefix(DeviceKey kind) {
+    return DEVICE_KEY_PREFIXES[(size_t)kind];
+}
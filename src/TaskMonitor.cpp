@@ -0,0 +1,242 @@
+#include "TaskMonitor.h"
+#include <esp_timer.h>
+#include <esp_system.h>
+
+#if (configGENERATE_RUN_TIME_STATS == 1) && (configUSE_TRACE_FACILITY == 1)
+#define TASK_MONITOR_RUN_TIME 1
+#else
+#define TASK_MONITOR_RUN_TIME 0
+#endif
+
+namespace {
+    struct MonitoredTask {
+        const char* name;
+        TaskHandle_t handle;
+        uint32_t stackBytes;
+        UBaseType_t priority;
+        BaseType_t core;
+
+        // Активность: время от получения работы до возврата к ожиданию
+        int64_t busySinceUs;
+        int64_t busyTotalUs;
+        int64_t busyMaxUs;
+        uint32_t activations;
+        uint32_t runTimeBase;   // Счётчик FreeRTOS на момент сброса статистики
+    };
+
+    struct MonitoredQueue {
+        const char* name;
+        QueueHandle_t handle;
+        uint16_t depth;
+        uint16_t maxUsed;
+        uint32_t sent;
+        uint32_t dropped;
+    };
+
+    MonitoredTask tasks[TASK_MONITOR_MAX_TASKS] = {};
+    int taskCount = 0;
+    MonitoredQueue queues[TASK_MONITOR_MAX_QUEUES] = {};
+    int queueCount = 0;
+
+    int64_t statsSinceUs = 0;
+
+#if TASK_MONITOR_RUN_TIME
+    uint32_t runTimeTotalBase = 0;
+    const int MAX_SYSTEM_TASKS = 32;
+    TaskStatus_t systemTasks[MAX_SYSTEM_TASKS];
+
+    // Счётчики времени выполнения всех задач; total - общее время счётчика
+    UBaseType_t readRunTime(uint32_t& total) {
+        return uxTaskGetSystemState(systemTasks, MAX_SYSTEM_TASKS, &total);
+    }
+
+    uint32_t runTimeOf(TaskHandle_t handle, UBaseType_t count) {
+        for (UBaseType_t i = 0; i < count; i++) {
+            if (systemTasks[i].xHandle == handle) {
+                return systemTasks[i].ulRunTimeCounter;
+            }
+        }
+        return 0;
+    }
+#endif
+
+    int addTask(const char* name, TaskHandle_t handle, uint32_t stackBytes, UBaseType_t priority, BaseType_t core) {
+        if (taskCount >= TASK_MONITOR_MAX_TASKS) {
+            Serial.printf("Task %s: task table full (TASK_MONITOR_MAX_TASKS %d)\n", name, TASK_MONITOR_MAX_TASKS);
+            return -1;
+        }
+        if (statsSinceUs == 0) {
+            statsSinceUs = esp_timer_get_time();
+        }
+        MonitoredTask& t = tasks[taskCount];
+        t.name = name;
+        t.handle = handle;
+        t.stackBytes = stackBytes;
+        t.priority = priority;
+        t.core = core;
+        return taskCount++;
+    }
+} // namespace
+
+int taskMonitorCreate(const char* name, TaskFunction_t fn, uint32_t stackBytes,
+                      UBaseType_t priority, BaseType_t core, void* arg) {
+    if (taskCount >= TASK_MONITOR_MAX_TASKS) {
+        Serial.printf("Task %s: task table full (TASK_MONITOR_MAX_TASKS %d)\n", name, TASK_MONITOR_MAX_TASKS);
+        return -1;
+    }
+    TaskHandle_t handle = nullptr;
+    if (xTaskCreatePinnedToCore(fn, name, stackBytes, arg, priority, &handle, core) != pdPASS) {
+        Serial.printf("Task %s: not enough memory for %lu byte stack\n", name, (unsigned long)stackBytes);
+        return -1;
+    }
+    return addTask(name, handle, stackBytes, priority, core);
+}
+
+int taskMonitorAdopt(const char* name, uint32_t stackBytes) {
+    return addTask(name, xTaskGetCurrentTaskHandle(), stackBytes, uxTaskPriorityGet(nullptr), xPortGetCoreID());
+}
+
+void taskMonitorBusyBegin(int task) {
+    if (task < 0 || task >= taskCount) {
+        return;
+    }
+    tasks[task].busySinceUs = esp_timer_get_time();
+}
+
+void taskMonitorBusyEnd(int task) {
+    if (task < 0 || task >= taskCount || tasks[task].busySinceUs == 0) {
+        return;
+    }
+    MonitoredTask& t = tasks[task];
+    int64_t busyUs = esp_timer_get_time() - t.busySinceUs;
+    t.busySinceUs = 0;
+    t.busyTotalUs += busyUs;
+    if (busyUs > t.busyMaxUs) t.busyMaxUs = busyUs;
+    t.activations++;
+}
+
+int taskMonitorQueueCreate(const char* name, uint16_t depth, uint16_t itemSize) {
+    if (queueCount >= TASK_MONITOR_MAX_QUEUES) {
+        Serial.printf("Queue %s: queue table full (TASK_MONITOR_MAX_QUEUES %d)\n", name, TASK_MONITOR_MAX_QUEUES);
+        return -1;
+    }
+    QueueHandle_t handle = xQueueCreate(depth, itemSize);
+    if (!handle) {
+        Serial.printf("Queue %s: not enough memory\n", name);
+        return -1;
+    }
+    MonitoredQueue& q = queues[queueCount];
+    q.name = name;
+    q.handle = handle;
+    q.depth = depth;
+    return queueCount++;
+}
+
+bool taskMonitorSend(int queue, const void* item) {
+    if (queue < 0 || queue >= queueCount) {
+        return false;
+    }
+    MonitoredQueue& q = queues[queue];
+    if (xQueueSend(q.handle, item, 0) != pdTRUE) {
+        q.dropped++;
+        return false;
+    }
+    q.sent++;
+    uint16_t used = uxQueueMessagesWaiting(q.handle);
+    if (used > q.maxUsed) q.maxUsed = used;
+    return true;
+}
+
+bool taskMonitorReceive(int queue, void* item, uint32_t waitMs) {
+    if (queue < 0 || queue >= queueCount) {
+        vTaskDelay(waitMs == TASK_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(waitMs));
+        return false;
+    }
+    TickType_t ticks = waitMs == TASK_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(waitMs);
+    return xQueueReceive(queues[queue].handle, item, ticks) == pdTRUE;
+}
+
+bool taskMonitorRunTimeOf(const char* name, uint32_t& runTime, uint32_t& total) {
+#if TASK_MONITOR_RUN_TIME
+    // Одна задача через vTaskGetInfo: общий буфер readRunTime занят командой tasks в другой задаче
+    TaskHandle_t handle = xTaskGetHandle(name);
+    if (!handle) {
+        return false;
+    }
+    TaskStatus_t status;
+    vTaskGetInfo(handle, &status, pdFALSE, eRunning);
+    runTime = status.ulRunTimeCounter;
+    total = (uint32_t)portGET_RUN_TIME_COUNTER_VALUE();
+    return true;
+#else
+    (void)name;
+    (void)runTime;
+    (void)total;
+    return false;
+#endif
+}
+
+void taskMonitorStatsReset() {
+#if TASK_MONITOR_RUN_TIME
+    uint32_t total = 0;
+    UBaseType_t count = readRunTime(total);
+    runTimeTotalBase = total;
+#endif
+    for (int i = 0; i < taskCount; i++) {
+        MonitoredTask& t = tasks[i];
+        t.busyTotalUs = 0;
+        t.busyMaxUs = 0;
+        t.activations = 0;
+#if TASK_MONITOR_RUN_TIME
+        t.runTimeBase = runTimeOf(t.handle, count);
+#endif
+    }
+    for (int i = 0; i < queueCount; i++) {
+        queues[i].maxUsed = 0;
+        queues[i].sent = 0;
+        queues[i].dropped = 0;
+    }
+    statsSinceUs = esp_timer_get_time();
+}
+
+void printTaskStats() {
+    float elapsedUs = (float)(esp_timer_get_time() - statsSinceUs);
+#if TASK_MONITOR_RUN_TIME
+    uint32_t total = 0;
+    UBaseType_t count = readRunTime(total);
+    float totalRunTime = (float)(total - runTimeTotalBase);
+#endif
+
+    Serial.println("\n=== Tasks ===");
+#if TASK_MONITOR_RUN_TIME
+    Serial.println("Task        Core Prio  Stack free/size   CPU %  Active %  Longest ms");
+#else
+    Serial.println("Task        Core Prio  Stack free/size  Active %  Longest ms  (CPU run-time stats disabled)");
+#endif
+    for (int i = 0; i < taskCount; i++) {
+        const MonitoredTask& t = tasks[i];
+        // Минимум свободного стека за всё время работы задачи, в байтах
+        uint32_t freeBytes = uxTaskGetStackHighWaterMark(t.handle);
+        float active = elapsedUs > 0 ? 100.0f * t.busyTotalUs / elapsedUs : 0;
+#if TASK_MONITOR_RUN_TIME
+        float cpu = totalRunTime > 0 ? 100.0f * (runTimeOf(t.handle, count) - t.runTimeBase) / totalRunTime : 0;
+        Serial.printf("%-10s %4d %4u  %6lu/%-6lu  %6.1f  %7.1f  %9.1f\n",
+            t.name, (int)t.core, (unsigned)t.priority, (unsigned long)freeBytes, (unsigned long)t.stackBytes,
+            cpu, active, t.busyMaxUs / 1000.0f);
+#else
+        Serial.printf("%-10s %4d %4u  %6lu/%-6lu %8.1f  %9.1f\n",
+            t.name, (int)t.core, (unsigned)t.priority, (unsigned long)freeBytes, (unsigned long)t.stackBytes,
+            active, t.busyMaxUs / 1000.0f);
+#endif
+    }
+
+    Serial.println("Queue       Depth  Max used     Sent  Dropped");
+    for (int i = 0; i < queueCount; i++) {
+        const MonitoredQueue& q = queues[i];
+        Serial.printf("%-10s %6u %9u %8lu %8lu\n", q.name, q.depth, q.maxUsed,
+            (unsigned long)q.sent, (unsigned long)q.dropped);
+    }
+    Serial.printf("Free heap: %lu bytes (min %lu)\n",
+        (unsigned long)esp_get_free_heap_size(), (unsigned long)esp_get_minimum_free_heap_size());
+    Serial.println("=== End Tasks ===\n");
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+// Задачи FreeRTOS прошивки и ограниченные очереди между ними.
+// Модуль создаёт задачи, закреплённые за ядрами, и очереди фиксированной глубины и ведёт по ним учёт:
+// минимальный запас стека за всё время, загрузка CPU, заполнение очередей и потерянные сообщения.
+// Загрузка берётся из счётчиков времени выполнения FreeRTOS, если они включены в sdkconfig;
+// иначе показывается время активности - доля времени вне ожидания очереди.
+//
+// Отправка в очередь никогда не блокирует отправителя: при переполнении сообщение
+// отбрасывается и учитывается, поэтому медленный потребитель не может остановить опрос RSSI.
+
+// Прошивке нужно HOST_MAX + 3 задачи (hid на хост, control, ui, storage) и HOST_MAX + 4 очереди
+// (hid на хост, ui, storage, conn, console); размеры ниже рассчитаны на HOST_MAX до 4,
+// main.cpp проверяет их static_assert
+#ifndef TASK_MONITOR_MAX_TASKS
+#define TASK_MONITOR_MAX_TASKS 8
+#endif
+#ifndef TASK_MONITOR_MAX_QUEUES
+#define TASK_MONITOR_MAX_QUEUES 8
+#endif
+
+#define TASK_WAIT_FOREVER UINT32_MAX
+
+/**
+ * @brief Создаёт задачу, закреплённую за ядром.
+ * @param stackBytes Размер стека в байтах (ESP-IDF считает стек в байтах)
+ * @param arg Параметр функции задачи (например, номер хоста)
+ * @return Идентификатор задачи для учёта или -1
+ */
+int taskMonitorCreate(const char* name, TaskFunction_t fn, uint32_t stackBytes,
+                      UBaseType_t priority, BaseType_t core, void* arg = nullptr);
+
+/**
+ * @brief Ставит на учёт уже работающую текущую задачу (задачу loop()).
+ */
+int taskMonitorAdopt(const char* name, uint32_t stackBytes);
+
+/**
+ * @brief Границы работы задачи для учёта активности; вызываются самой задачей.
+ */
+void taskMonitorBusyBegin(int task);
+void taskMonitorBusyEnd(int task);
+
+/**
+ * @brief RAII-обёртка над taskMonitorBusyBegin/End.
+ */
+class TaskBusyScope {
+public:
+    explicit TaskBusyScope(int task) : task(task) { taskMonitorBusyBegin(task); }
+    ~TaskBusyScope() { taskMonitorBusyEnd(task); }
+    TaskBusyScope(const TaskBusyScope&) = delete;
+    TaskBusyScope& operator=(const TaskBusyScope&) = delete;
+
+private:
+    int task;
+};
+
+/**
+ * @brief Создаёт очередь фиксированной глубины.
+ * @return Идентификатор очереди или -1
+ */
+int taskMonitorQueueCreate(const char* name, uint16_t depth, uint16_t itemSize);
+
+/**
+ * @brief Неблокирующая отправка. false - очередь переполнена (или не создана), сообщение потеряно.
+ */
+bool taskMonitorSend(int queue, const void* item);
+
+/**
+ * @brief Ожидание сообщения не дольше waitMs (TASK_WAIT_FOREVER - без ограничения).
+ */
+bool taskMonitorReceive(int queue, void* item, uint32_t waitMs);
+
+/**
+ * @brief Счётчик времени выполнения FreeRTOS для задачи не из модуля (например, задачи стека BLE).
+ * @param runTime Время задачи, total - общее время, в единицах счётчика FreeRTOS
+ * @return false - счётчики выключены в sdkconfig или задачи с таким именем нет
+ */
+bool taskMonitorRunTimeOf(const char* name, uint32_t& runTime, uint32_t& total);
+
+void taskMonitorStatsReset();
+
+void printTaskStats();
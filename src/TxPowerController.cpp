@@ -0,0 +1,182 @@
+#include "TxPowerController.h"
+#include <NimBLEDevice.h>
+#include <freertos/semphr.h>
+
+namespace {
+    const int TREND_SAMPLES = 8;               // Окно для оценки наклона RSSI
+    const float NOTIFY_EMA_ALPHA = 0.2f;
+    const int NOTIFY_FAILURE_MARGIN_DB = 10;   // Доп. запас при 100% неудачных notify
+
+    esp_power_level_t currentLevel = ESP_PWR_LVL_P9;
+    // HID-последовательности идут в задачах хостов: пока хотя бы одна держит максимум,
+    // регулятор только запоминает уровень и применит его по окончании последней.
+    // Счётчик, уровень и вызов setPower меняются под одним мьютексом: иначе задача,
+    // снявшая boost, могла бы понизить мощность после того, как другая её подняла
+    uint8_t boostCount = 0;
+    SemaphoreHandle_t powerMutex = nullptr;
+    StaticSemaphore_t powerMutexBuffer;
+
+    // Первый вызов - txPowerControllerReset() в setup(), до запуска задач
+    class PowerLock {
+    public:
+        PowerLock() {
+            if (!powerMutex) {
+                powerMutex = xSemaphoreCreateMutexStatic(&powerMutexBuffer);
+            }
+            xSemaphoreTake(powerMutex, portMAX_DELAY);
+        }
+        ~PowerLock() { xSemaphoreGive(powerMutex); }
+        PowerLock(const PowerLock&) = delete;
+        PowerLock& operator=(const PowerLock&) = delete;
+    };
+    unsigned long lastDecreaseTime = 0;
+    uint32_t levelChanges = 0;
+
+    int rssiSamples[TREND_SAMPLES];
+    unsigned long rssiTimes[TREND_SAMPLES];
+    int sampleCount = 0;
+    int sampleIndex = 0;
+
+    float notifyFailureRate = 0.0f;
+    uint32_t notifyTotal = 0;
+    uint32_t notifyFailed = 0;
+
+    // Последние расчётные значения для отчёта
+    float lastSlopeDbPerS = 0.0f;
+    int lastPredictedRssi = 0;
+    int lastMarginDb = 0;
+    int lastRequiredDbm = 0;
+
+    void applyLevel(esp_power_level_t level) {
+        PowerLock lock;
+        if (level == currentLevel) {
+            return;
+        }
+        // NimBLE-Arduino 2.x принимает мощность в dBm
+        if (boostCount == 0) {
+            NimBLEDevice::setPower(txPowerLevelToDbm(level));
+        }
+        currentLevel = level;
+        levelChanges++;
+    }
+
+    // Наклон RSSI методом наименьших квадратов, dB/с
+    float rssiSlope() {
+        if (sampleCount < 3) {
+            return 0.0f;
+        }
+        float meanT = 0, meanR = 0;
+        unsigned long t0 = rssiTimes[(sampleIndex - sampleCount + TREND_SAMPLES) % TREND_SAMPLES];
+        for (int i = 0; i < sampleCount; i++) {
+            int idx = (sampleIndex - sampleCount + i + TREND_SAMPLES) % TREND_SAMPLES;
+            meanT += (rssiTimes[idx] - t0) / 1000.0f;
+            meanR += rssiSamples[idx];
+        }
+        meanT /= sampleCount;
+        meanR /= sampleCount;
+        float num = 0, den = 0;
+        for (int i = 0; i < sampleCount; i++) {
+            int idx = (sampleIndex - sampleCount + i + TREND_SAMPLES) % TREND_SAMPLES;
+            float dt = (rssiTimes[idx] - t0) / 1000.0f - meanT;
+            num += dt * (rssiSamples[idx] - meanR);
+            den += dt * dt;
+        }
+        return den > 0 ? num / den : 0.0f;
+    }
+
+    esp_power_level_t levelForDbm(int dbm) {
+        // Округляем вверх до ближайшего уровня с шагом 3 dB
+        if (dbm <= -12) return ESP_PWR_LVL_N12;
+        int level = (dbm + 12 + 2) / 3;
+        if (level > ESP_PWR_LVL_P9) level = ESP_PWR_LVL_P9;
+        return (esp_power_level_t)level;
+    }
+} // namespace
+
+int txPowerLevelToDbm(esp_power_level_t level) {
+    return -12 + 3 * (int)level;
+}
+
+void txPowerControllerReset(esp_power_level_t initialLevel) {
+    sampleCount = 0;
+    sampleIndex = 0;
+    notifyFailureRate = 0.0f;
+    lastDecreaseTime = millis();
+    // Применяем безусловно: мощность могли изменить в обход регулятора
+    PowerLock lock;
+    if (boostCount == 0) {
+        NimBLEDevice::setPower(txPowerLevelToDbm(initialLevel));
+    }
+    currentLevel = initialLevel;
+}
+
+esp_power_level_t txPowerControllerUpdate(int rssi, esp_power_level_t floorLevel, esp_power_level_t ceilingLevel) {
+    unsigned long now = millis();
+    rssiSamples[sampleIndex] = rssi;
+    rssiTimes[sampleIndex] = now;
+    sampleIndex = (sampleIndex + 1) % TREND_SAMPLES;
+    if (sampleCount < TREND_SAMPLES) sampleCount++;
+
+    // Прогноз: учитываем только ухудшение, рост сигнала ждём подтверждения измерениями
+    lastSlopeDbPerS = rssiSlope();
+    float drop = lastSlopeDbPerS < 0 ? lastSlopeDbPerS * TX_TREND_HORIZON_MS / 1000.0f : 0.0f;
+    lastPredictedRssi = rssi + (int)drop;
+
+    // Потери пути по нашему RSSI и требуемая мощность для целевого запаса у хоста
+    int pathLoss = TX_HOST_TX_POWER_DBM - lastPredictedRssi;
+    int targetMargin = TX_TARGET_MARGIN_DB + (int)(notifyFailureRate * NOTIFY_FAILURE_MARGIN_DB + 0.5f);
+    lastRequiredDbm = TX_PEER_SENSITIVITY_DBM + targetMargin + pathLoss;
+    lastMarginDb = txPowerLevelToDbm(currentLevel) - pathLoss - TX_PEER_SENSITIVITY_DBM;
+
+    esp_power_level_t required = levelForDbm(lastRequiredDbm);
+    if (required < floorLevel) required = floorLevel;
+    if (required > ceilingLevel) required = ceilingLevel;
+
+    if (required > currentLevel) {
+        // Запаса не хватает - повышаем сразу до нужного уровня
+        applyLevel(required);
+        lastDecreaseTime = now;
+    } else if (required < currentLevel) {
+        // Понижаем на один шаг, если запас превышен с гистерезисом и прошло достаточно времени
+        int excessDb = txPowerLevelToDbm(currentLevel) - lastRequiredDbm;
+        bool ceilingForced = currentLevel > ceilingLevel;
+        if (ceilingForced ||
+            (excessDb >= 3 + TX_HYSTERESIS_DB && now - lastDecreaseTime >= TX_DECREASE_INTERVAL_MS)) {
+            applyLevel(ceilingForced ? ceilingLevel : (esp_power_level_t)(currentLevel - 1));
+            lastDecreaseTime = now;
+        }
+    }
+    return currentLevel;
+}
+
+void txPowerControllerNotifyResult(bool success) {
+    notifyTotal++;
+    if (!success) notifyFailed++;
+    notifyFailureRate = NOTIFY_EMA_ALPHA * (success ? 0.0f : 1.0f) + (1.0f - NOTIFY_EMA_ALPHA) * notifyFailureRate;
+}
+
+void txPowerBoost(bool active) {
+    PowerLock lock;
+    if (active) {
+        boostCount++;
+    } else if (boostCount > 0) {
+        boostCount--;
+    }
+    NimBLEDevice::setPower(txPowerLevelToDbm(boostCount > 0 ? ESP_PWR_LVL_P9 : currentLevel));
+}
+
+esp_power_level_t txPowerCurrentLevel() {
+    return currentLevel;
+}
+
+void printTxPowerStatus() {
+    Serial.println("\n=== TX Power Controller ===");
+    Serial.printf("Level: %d (%d dBm), changes: %lu\n",
+        currentLevel, txPowerLevelToDbm(currentLevel), (unsigned long)levelChanges);
+    Serial.printf("Estimated link margin at host: %d dB (target %d dB)\n", lastMarginDb, TX_TARGET_MARGIN_DB);
+    Serial.printf("RSSI trend: %.2f dB/s, predicted RSSI: %d dBm, required TX: %d dBm\n",
+        lastSlopeDbPerS, lastPredictedRssi, lastRequiredDbm);
+    Serial.printf("Notify failures: %lu/%lu (rate %.2f)\n",
+        (unsigned long)notifyFailed, (unsigned long)notifyTotal, notifyFailureRate);
+    Serial.println("=== End TX Power Controller ===\n");
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_bt.h>  // esp_power_level_t
+
+// Регулятор мощности передатчика по запасу линии.
+// Уровень сигнала у хоста оценивается из RSSI на нашей стороне (канал считаем симметричным):
+//   RSSI у хоста ≈ наша мощность - (мощность хоста - наш RSSI)
+// Регулятор держит RSSI у хоста на TX_TARGET_MARGIN_DB выше чувствительности приёмника,
+// учитывая тренд RSSI (прогноз на TX_TREND_HORIZON_MS вперёд) и долю неудачных notify.
+// Повышение мощности - сразу, понижение - не чаще TX_DECREASE_INTERVAL_MS и с гистерезисом.
+
+#ifndef TX_HOST_TX_POWER_DBM
+#define TX_HOST_TX_POWER_DBM 0        // Предполагаемая мощность передатчика хоста
+#endif
+#ifndef TX_PEER_SENSITIVITY_DBM
+#define TX_PEER_SENSITIVITY_DBM -90   // Чувствительность приёмника хоста (1M PHY)
+#endif
+#ifndef TX_TARGET_MARGIN_DB
+#define TX_TARGET_MARGIN_DB 20        // Требуемый запас над чувствительностью
+#endif
+#ifndef TX_HYSTERESIS_DB
+#define TX_HYSTERESIS_DB 4            // Понижаем, только если запас превышен на шаг + гистерезис
+#endif
+#ifndef TX_DECREASE_INTERVAL_MS
+#define TX_DECREASE_INTERVAL_MS 3000  // Не чаще одного шага вниз
+#endif
+#ifndef TX_TREND_HORIZON_MS
+#define TX_TREND_HORIZON_MS 2000      // На сколько вперёд экстраполируем падение RSSI
+#endif
+
+/**
+ * @brief Сбрасывает регулятор и устанавливает начальную мощность (например, максимальную при подключении).
+ */
+void txPowerControllerReset(esp_power_level_t initialLevel);
+
+/**
+ * @brief Новое измерение RSSI соединения. Пересчитывает и при необходимости применяет мощность.
+ * @param rssi Отфильтрованный RSSI, dBm
+ * @param floorLevel Минимально допустимый уровень (например, при удалении от компьютера)
+ * @param ceilingLevel Максимально допустимый уровень (ограничение профиля питания)
+ * @return Применённый уровень
+ */
+esp_power_level_t txPowerControllerUpdate(int rssi, esp_power_level_t floorLevel, esp_power_level_t ceilingLevel);
+
+/**
+ * @brief Результат отправки notify: неудачи увеличивают требуемый запас.
+ */
+void txPowerControllerNotifyResult(bool success);
+
+/**
+ * @brief Временно включает максимальную мощность на время отправки важных HID-команд
+ * (блокировка, ввод пароля). Вызовы парные: уровень регулятора возвращается,
+ * когда заканчивается последняя из одновременных последовательностей (по одной на хост).
+ */
+void txPowerBoost(bool active);
+
+/**
+ * @brief Текущий уровень, установленный регулятором.
+ */
+esp_power_level_t txPowerCurrentLevel();
+
+/**
+ * @brief Уровень ESP_PWR_LVL_* в dBm.
+ */
+int txPowerLevelToDbm(esp_power_level_t level);
+
+/**
+ * @brief Выводит состояние регулятора в Serial (команда txpower).
+ */
+void printTxPowerStatus();
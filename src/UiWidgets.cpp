@@ -0,0 +1,581 @@
+#include "UiWidgets.h"
+#include <stdarg.h>
+#include <esp_timer.h>
+
+namespace {
+    enum WidgetKind : uint8_t { WIDGET_UNUSED = 0, WIDGET_TEXT, WIDGET_VALUE, WIDGET_SCROLL };
+    const int MAX_BUFFERS = 2;
+
+    struct Widget {
+        WidgetKind kind;
+        uint8_t page;
+        int16_t x, y, w, h;
+        bool changed;           // Изменился, на панель ещё не передан
+        uint8_t stale;          // Биты буферов, в которых виджет ещё не перерисован
+        uint16_t color;
+        char text[UI_WIDGET_TEXT_LEN];
+        uint32_t value;
+        UiDrawFn draw;
+        // Прокручиваемый график: value - число отсчётов, drawnCount - сколько нарисовано в каждом буфере
+        UiColumnFn column;
+        uint32_t style;
+        uint32_t drawnCount[MAX_BUFFERS];
+    };
+
+    struct ModeStats {
+        uint32_t frames;
+        uint32_t unchanged;     // Кадры без единого изменения (в режиме грязных областей ничего не передано)
+        uint32_t rects;
+        uint64_t bytes;
+        uint32_t maxBytes;
+        uint64_t renderUs;
+        uint32_t maxRenderUs;
+    };
+
+    const char* const MODE_NAMES[2] = { "dirty", "full" };
+    const char* const PHASE_NAMES[UI_PHASE_COUNT] = { "publish", "build", "draw", "push", "frame" };
+
+    // Оверлей - служебный виджет после виджетов вызывающего кода, показывается на всех страницах
+    const int OVERLAY_SLOT = UI_MAX_WIDGETS;
+    const int WIDGET_SLOTS = UI_MAX_WIDGETS + 1;
+    const uint8_t ANY_PAGE = 0xFF;
+    const int OVERLAY_CHARS = 10;
+
+    M5Canvas* buffers[MAX_BUFFERS] = {};
+    int bufferCount = 0;
+    uint8_t allBuffers = 0;
+    int drawBuffer = 0;         // Буфер, в который рисуется следующий кадр
+    int inFlight = -1;          // Буфер, передача из которого могла не закончиться
+    bool transferOpen = false;  // Транзакция SPI удерживается между кадрами
+    uint32_t dmaWaits = 0;      // Кадр ждал окончания передачи (один буфер)
+    uint8_t colorDepth = 16;
+
+    // Палитра общая для всех буферов: цвета получают номера по мере первого использования
+    const int MAX_PALETTE = 16;
+    uint16_t palette[MAX_PALETTE];
+    int paletteUsed = 0;
+    int paletteSize = 0;        // 0 - буфер без палитры
+
+    Widget widgets[WIDGET_SLOTS] = {};
+    uint8_t activePage = 0;
+    uint8_t pageStale = 0xFF;   // Биты буферов, в которых нарисована другая страница
+    bool pushAll = true;        // Содержимое панели неизвестно: следующий кадр передаётся целиком
+    bool panelOn = true;
+    bool fullFrameMode = false;
+
+    int64_t frameStartUs = 0;
+    uint32_t idleFrames = 0;        // Нового снимка не было
+    uint32_t overBudget = 0;
+    bool overlayOn = false;
+
+    // Скользящее окно времени фаз, мкс
+    uint32_t phaseUs[UI_PHASE_COUNT][UI_TIMING_WINDOW] = {};
+    uint16_t phaseSamples[UI_PHASE_COUNT] = {};
+    uint16_t phaseNext[UI_PHASE_COUNT] = {};
+
+    struct PhaseWindow {
+        uint32_t minUs;
+        uint32_t avgUs;
+        uint32_t maxUs;
+    };
+
+    PhaseWindow phaseWindow(int phase) {
+        PhaseWindow result = { 0, 0, 0 };
+        uint16_t samples = phaseSamples[phase];
+        if (samples == 0) {
+            return result;
+        }
+        uint64_t total = 0;
+        result.minUs = UINT32_MAX;
+        for (uint16_t i = 0; i < samples; i++) {
+            uint32_t us = phaseUs[phase][i];
+            total += us;
+            if (us < result.minUs) result.minUs = us;
+            if (us > result.maxUs) result.maxUs = us;
+        }
+        result.avgUs = total / samples;
+        return result;
+    }
+
+    bool shown(const Widget& w) {
+        return w.kind != WIDGET_UNUSED && (w.page == activePage || w.page == ANY_PAGE);
+    }
+    uint32_t fullFrameBytes = 0;
+    uint32_t skippedDark = 0;
+    ModeStats stats[2] = {};
+
+    void setPaletteEntry(int index, uint16_t rgb565) {
+        uint8_t r = (rgb565 >> 11) & 0x1F;
+        uint8_t g = (rgb565 >> 5) & 0x3F;
+        uint8_t b = rgb565 & 0x1F;
+        for (int i = 0; i < bufferCount; i++) {
+            buffers[i]->setPaletteColor(index, (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+        }
+        palette[index] = rgb565;
+    }
+
+    uint32_t colorDistance(uint16_t a, uint16_t b) {
+        int dr = (int)((a >> 11) & 0x1F) - (int)((b >> 11) & 0x1F);
+        int dg = (int)((a >> 5) & 0x3F) / 2 - (int)((b >> 5) & 0x3F) / 2;
+        int db = (int)(a & 0x1F) - (int)(b & 0x1F);
+        return dr * dr + dg * dg + db * db;
+    }
+
+    lgfx::color_depth_t canvasDepth(uint8_t depth) {
+        switch (depth) {
+            case 8: return lgfx::rgb332_1Byte;
+            case 4: return lgfx::palette_4bit;
+            case 1: return lgfx::palette_1bit;
+            default: return lgfx::rgb565_2Byte;
+        }
+    }
+
+    void freeBuffers() {
+        for (int i = 0; i < bufferCount; i++) {
+            buffers[i]->deleteSprite();
+            delete buffers[i];
+            buffers[i] = nullptr;
+        }
+        bufferCount = 0;
+    }
+
+    bool createBuffers(M5GFX* panel, uint8_t depth) {
+        paletteSize = depth == 4 ? 16 : depth == 1 ? 2 : 0;
+        for (int i = 0; i < MAX_BUFFERS; i++) {
+            M5Canvas* canvas = new M5Canvas(panel);
+            canvas->setColorDepth(canvasDepth(depth));
+            if (!canvas->createSprite(panel->width(), panel->height()) ||
+                (paletteSize > 0 && !canvas->createPalette())) {
+                canvas->deleteSprite();
+                delete canvas;
+                Serial.printf("Display: no memory for frame buffer %d, using %d\n", i + 1, bufferCount);
+                break;
+            }
+            canvas->setTextSize(1);
+            buffers[bufferCount++] = canvas;
+        }
+        colorDepth = depth;
+        allBuffers = (1 << bufferCount) - 1;
+        drawBuffer = 0;
+        inFlight = -1;
+        pageStale = allBuffers;
+        pushAll = true;
+        for (int i = 0; i < WIDGET_SLOTS; i++) {
+            widgets[i].stale = allBuffers;
+            memset(widgets[i].drawnCount, 0, sizeof(widgets[i].drawnCount));
+        }
+        // Номер 0 - фон, в однобитном режиме номер 1 - всё остальное
+        paletteUsed = 0;
+        if (paletteSize > 0) {
+            setPaletteEntry(paletteUsed++, UI_BACKGROUND);
+            if (paletteSize == 2) {
+                setPaletteEntry(paletteUsed++, TFT_WHITE);
+            }
+        }
+        return bufferCount > 0;
+    }
+
+    void drawScroll(M5Canvas* canvas, Widget& w, int b, bool full) {
+        uint16_t background = uiColor(UI_BACKGROUND);
+        uint32_t drawn = w.drawnCount[b];
+        uint32_t added = w.value - drawn;
+        int16_t first = 0;
+        if (full || drawn == 0 || added >= (uint32_t)w.w) {
+            canvas->fillRect(w.x, w.y, w.w, w.h, background);
+        } else if (added == 0) {
+            return;
+        } else {
+            // Сдвиг влево на число новых отсчётов: копирование внутри буфера без отрисовки
+            canvas->copyRect(w.x, w.y, w.w - added, w.h, w.x + added, w.y);
+            first = w.w - added;
+        }
+        for (int16_t col = first; col < w.w; col++) {
+            // Столбец col показывает отсчёт value - w + col
+            canvas->fillRect(w.x + col, w.y, 1, w.h, background);
+            if (w.value + col >= (uint32_t)w.w) {
+                w.column(canvas, w.x + col, w.y, w.h, w.value + col - w.w);
+            }
+        }
+        w.drawnCount[b] = w.value;
+    }
+
+    void drawWidget(M5Canvas* canvas, Widget& w, int b, bool full) {
+        if (w.kind == WIDGET_SCROLL) {
+            drawScroll(canvas, w, b, full);
+            return;
+        }
+        canvas->fillRect(w.x, w.y, w.w, w.h, uiColor(UI_BACKGROUND));
+        if (w.kind == WIDGET_TEXT && w.text[0] != '\0') {
+            canvas->setTextSize(1);
+            canvas->setTextColor(uiColor(w.color));
+            canvas->setCursor(w.x, w.y);
+            canvas->print(w.text);
+        } else if (w.kind == WIDGET_VALUE && w.draw) {
+            w.draw(canvas, w.x, w.y, w.value);
+        }
+    }
+
+    bool validId(uint8_t id) {
+        return id < UI_MAX_WIDGETS && widgets[id].kind != WIDGET_UNUSED;
+    }
+
+    void markChanged(Widget& w) {
+        w.changed = true;
+        w.stale = allBuffers;
+    }
+
+    void setText(uint8_t id, uint16_t color, const char* text) {
+        Widget& w = widgets[id];
+        if (w.kind == WIDGET_TEXT && w.color == color && strcmp(w.text, text) == 0) {
+            return;
+        }
+        w.kind = WIDGET_TEXT;
+        w.color = color;
+        strlcpy(w.text, text, sizeof(w.text));
+        markChanged(w);
+    }
+} // namespace
+
+bool uiBegin(M5GFX* panel, uint8_t depth) {
+    if (depth != 16 && depth != 8 && depth != 4 && depth != 1) {
+        depth = UI_COLOR_DEPTH;
+    }
+    return createBuffers(panel, depth);
+}
+
+bool uiSetColorDepth(M5GFX* panel, uint8_t depth) {
+    if (depth != 16 && depth != 8 && depth != 4 && depth != 1) {
+        return false;
+    }
+    uint8_t previousDepth = colorDepth;
+    uiFlush(panel);
+    freeBuffers();
+    if (createBuffers(panel, depth)) {
+        return true;
+    }
+    // Не хватило памяти даже на один буфер: возвращаем прежнюю глубину
+    createBuffers(panel, previousDepth);
+    return false;
+}
+
+uint8_t uiColorDepth() {
+    return colorDepth;
+}
+
+uint16_t uiColor(uint16_t rgb565) {
+    if (paletteSize == 0) {
+        return rgb565;  // RGB565 и RGB332: буфер переводит цвет сам
+    }
+    if (paletteSize == 2) {
+        return rgb565 == palette[0] ? 0 : 1;
+    }
+    for (int i = 0; i < paletteUsed; i++) {
+        if (palette[i] == rgb565) {
+            return i;
+        }
+    }
+    if (paletteUsed < paletteSize) {
+        setPaletteEntry(paletteUsed, rgb565);
+        return paletteUsed++;
+    }
+    // Палитра заполнена: ближайший из уже занятых цветов
+    int best = 0;
+    for (int i = 1; i < paletteUsed; i++) {
+        if (colorDistance(palette[i], rgb565) < colorDistance(palette[best], rgb565)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void uiWidgetDefine(uint8_t id, uint8_t page, int16_t x, int16_t y, int16_t w, int16_t h) {
+    if (id >= UI_MAX_WIDGETS) {
+        return;
+    }
+    Widget& widget = widgets[id];
+    widget = Widget{};
+    widget.kind = WIDGET_TEXT;
+    widget.page = page;
+    widget.x = x;
+    widget.y = y;
+    widget.w = w;
+    widget.h = h;
+    markChanged(widget);
+}
+
+void uiWidgetPrintf(uint8_t id, uint16_t color, const char* fmt, ...) {
+    if (!validId(id)) {
+        return;
+    }
+    char text[UI_WIDGET_TEXT_LEN];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    setText(id, color, text);
+}
+
+void uiWidgetValue(uint8_t id, uint32_t value, UiDrawFn draw) {
+    if (!validId(id)) {
+        return;
+    }
+    Widget& w = widgets[id];
+    if (w.kind == WIDGET_VALUE && w.value == value && w.draw == draw) {
+        return;
+    }
+    w.kind = WIDGET_VALUE;
+    w.value = value;
+    w.draw = draw;
+    markChanged(w);
+}
+
+void uiWidgetScroll(uint8_t id, uint32_t count, uint32_t style, UiColumnFn column) {
+    if (!validId(id)) {
+        return;
+    }
+    Widget& w = widgets[id];
+    bool sameGraph = w.kind == WIDGET_SCROLL && w.style == style && w.column == column;
+    if (sameGraph && w.value == count) {
+        return;
+    }
+    if (!sameGraph) {
+        // Другой график: во всех буферах рисуется заново
+        memset(w.drawnCount, 0, sizeof(w.drawnCount));
+    }
+    w.kind = WIDGET_SCROLL;
+    w.value = count;
+    w.style = style;
+    w.column = column;
+    markChanged(w);
+}
+
+void uiWidgetClear(uint8_t id) {
+    if (validId(id)) {
+        setText(id, widgets[id].color, "");
+    }
+}
+
+void uiSetPage(uint8_t page) {
+    if (page != activePage) {
+        activePage = page;
+        pageStale = allBuffers;
+        pushAll = true;
+    }
+}
+
+uint8_t uiPage() {
+    return activePage;
+}
+
+void uiInvalidate() {
+    pushAll = true;
+}
+
+void uiSetPanelOn(bool on) {
+    if (on && !panelOn) {
+        pushAll = true;
+    }
+    panelOn = on;
+}
+
+bool uiFrameBegin(M5GFX* panel) {
+    // Выключенная панель или погашенная подсветка: ни отрисовки, ни передачи по SPI
+    if (!panelOn || bufferCount == 0 || panel->getBrightness() == 0) {
+        skippedDark++;
+        return false;
+    }
+    frameStartUs = esp_timer_get_time();
+    return true;
+}
+
+void uiFrameSkipped() {
+    idleFrames++;
+}
+
+void uiPhaseRecord(UiPhase phase, uint32_t us) {
+    if (phase >= UI_PHASE_COUNT) {
+        return;
+    }
+    phaseUs[phase][phaseNext[phase]] = us;
+    phaseNext[phase] = (phaseNext[phase] + 1) % UI_TIMING_WINDOW;
+    if (phaseSamples[phase] < UI_TIMING_WINDOW) phaseSamples[phase]++;
+}
+
+void uiSetOverlay(bool on) {
+    overlayOn = on;
+}
+
+bool uiOverlay() {
+    return overlayOn;
+}
+
+void uiFrameEnd(M5GFX* panel) {
+    int64_t drawStart = esp_timer_get_time();
+    uiPhaseRecord(UI_PHASE_BUILD, (uint32_t)(drawStart - frameStartUs));
+
+    ModeStats& s = stats[fullFrameMode ? 1 : 0];
+    int b = drawBuffer;
+    M5Canvas* canvas = buffers[b];
+    uint8_t bit = 1 << b;
+    uint32_t bytesPerPixel = ((panel->getColorDepth() & 0xFF) + 7) / 8;
+    fullFrameBytes = canvas->width() * canvas->height() * bytesPerPixel;
+
+    // Оверлей показывает окно предыдущих кадров; при выключении страница перерисовывается под ним
+    Widget& overlay = widgets[OVERLAY_SLOT];
+    if (overlayOn) {
+        if (overlay.kind == WIDGET_UNUSED) {
+            overlay.kind = WIDGET_TEXT;
+            overlay.page = ANY_PAGE;
+            overlay.w = OVERLAY_CHARS * 6;
+            overlay.h = 8;
+            overlay.x = canvas->width() - overlay.w;
+            overlay.y = canvas->height() - overlay.h;
+        }
+        PhaseWindow frame = phaseWindow(UI_PHASE_FRAME);
+        char text[UI_WIDGET_TEXT_LEN];
+        snprintf(text, sizeof(text), "%4.1f/%4.1f", frame.avgUs / 1000.0f, frame.maxUs / 1000.0f);
+        setText(OVERLAY_SLOT, frame.maxUs > UI_FRAME_BUDGET_US ? TFT_RED : TFT_YELLOW, text);
+    } else if (overlay.kind != WIDGET_UNUSED) {
+        overlay = Widget{};
+        pageStale = allBuffers;
+        pushAll = true;
+    }
+
+    // С одним буфером рисовать можно только после окончания его передачи
+    if (b == inFlight) {
+        panel->waitDMA();
+        inFlight = -1;
+        dmaWaits++;
+    }
+
+    // Буфер догоняет панель: перерисовываются виджеты, изменившиеся с его прошлого кадра
+    bool redrawBuffer = fullFrameMode || (pageStale & bit);
+    if (redrawBuffer) {
+        canvas->fillSprite(uiColor(UI_BACKGROUND));
+        pageStale &= ~bit;
+    }
+    for (int i = 0; i < WIDGET_SLOTS; i++) {
+        Widget& w = widgets[i];
+        if (shown(w) && (redrawBuffer || (w.stale & bit))) {
+            drawWidget(canvas, w, b, redrawBuffer);
+            w.stale &= ~bit;
+        }
+    }
+    int64_t pushStart = esp_timer_get_time();
+    uiPhaseRecord(UI_PHASE_DRAW, (uint32_t)(pushStart - drawStart));
+
+    // Транзакция остаётся открытой: pushSprite из буфера в DMA-памяти не ждёт конца передачи
+    if (!transferOpen) {
+        panel->startWrite();
+        transferOpen = true;
+    }
+    uint32_t bytes = 0;
+    uint32_t rects = 0;
+    if (fullFrameMode || pushAll) {
+        canvas->pushSprite(panel, 0, 0);
+        bytes = fullFrameBytes;
+        rects = 1;
+        pushAll = false;
+        for (int i = 0; i < WIDGET_SLOTS; i++) {
+            if (shown(widgets[i])) {
+                widgets[i].changed = false;
+            }
+        }
+    } else {
+        for (int i = 0; i < WIDGET_SLOTS; i++) {
+            Widget& w = widgets[i];
+            if (!shown(w) || !w.changed) {
+                continue;
+            }
+            w.changed = false;
+            // Передаётся только прямоугольник виджета: спрайт выводится через clip-область панели
+            panel->setClipRect(w.x, w.y, w.w, w.h);
+            canvas->pushSprite(panel, 0, 0);
+            panel->clearClipRect();
+            bytes += (uint32_t)w.w * w.h * bytesPerPixel;
+            rects++;
+        }
+    }
+    if (rects > 0) {
+        inFlight = b;
+        drawBuffer = (b + 1) % bufferCount;
+    }
+
+    int64_t endUs = esp_timer_get_time();
+    uiPhaseRecord(UI_PHASE_PUSH, (uint32_t)(endUs - pushStart));
+    uint32_t renderUs = (uint32_t)(endUs - frameStartUs);
+    uiPhaseRecord(UI_PHASE_FRAME, renderUs);
+    if (renderUs > UI_FRAME_BUDGET_US) overBudget++;
+    s.frames++;
+    if (rects == 0) s.unchanged++;
+    s.rects += rects;
+    s.bytes += bytes;
+    if (bytes > s.maxBytes) s.maxBytes = bytes;
+    s.renderUs += renderUs;
+    if (renderUs > s.maxRenderUs) s.maxRenderUs = renderUs;
+}
+
+void uiFlush(M5GFX* panel) {
+    if (transferOpen) {
+        panel->endWrite();
+        transferOpen = false;
+    }
+    inFlight = -1;
+}
+
+void uiSetFullFrameMode(bool full) {
+    fullFrameMode = full;
+    pushAll = true;
+}
+
+bool uiFullFrameMode() {
+    return fullFrameMode;
+}
+
+void uiStatsReset() {
+    for (int i = 0; i < 2; i++) {
+        stats[i] = ModeStats{};
+    }
+    skippedDark = 0;
+    dmaWaits = 0;
+    idleFrames = 0;
+    overBudget = 0;
+    for (int i = 0; i < UI_PHASE_COUNT; i++) {
+        phaseSamples[i] = 0;
+        phaseNext[i] = 0;
+    }
+}
+
+void printUiStats() {
+    Serial.println("\n=== Display ===");
+    Serial.printf("Mode: %s, page %u, panel %s, full frame %lu bytes\n",
+        fullFrameMode ? "full frame" : "dirty rectangles", activePage, panelOn ? "on" : "off",
+        (unsigned long)fullFrameBytes);
+    Serial.printf("Frames skipped: panel off or backlight 0 %lu, no new snapshot %lu\n",
+        (unsigned long)skippedDark, (unsigned long)idleFrames);
+    Serial.printf("Frame buffers: %d x %lu bytes, %u-bit", bufferCount,
+        (unsigned long)(bufferCount ? buffers[0]->bufferLength() : 0), colorDepth);
+    if (paletteSize > 0) {
+        Serial.printf(", palette %d/%d", paletteUsed, paletteSize);
+    }
+    Serial.printf(", waits for previous transfer: %lu\n", (unsigned long)dmaWaits);
+    Serial.println("Mode    Frames  Unchanged  Rects/frame  SPI bytes/frame (max)   Render ms/frame (max)");
+    for (int i = 0; i < 2; i++) {
+        const ModeStats& s = stats[i];
+        float frames = s.frames ? (float)s.frames : 1.0f;
+        Serial.printf("%-6s %7lu %10lu %12.1f %10.0f (%6lu) %12.2f (%.2f)\n",
+            MODE_NAMES[i], (unsigned long)s.frames, (unsigned long)s.unchanged, s.rects / frames,
+            s.bytes / frames, (unsigned long)s.maxBytes,
+            s.renderUs / frames / 1000.0f, s.maxRenderUs / 1000.0f);
+    }
+    Serial.printf("Phase times, last %d (esp_timer, CPU now %lu MHz), budget %lu us, over budget %lu frames:\n",
+        UI_TIMING_WINDOW, (unsigned long)ESP.getCpuFreqMHz(), (unsigned long)UI_FRAME_BUDGET_US,
+        (unsigned long)overBudget);
+    Serial.println("Phase      Min us   Avg us   Max us");
+    for (int i = 0; i < UI_PHASE_COUNT; i++) {
+        PhaseWindow w = phaseWindow(i);
+        Serial.printf("%-8s %8lu %8lu %8lu\n", PHASE_NAMES[i],
+            (unsigned long)w.minUs, (unsigned long)w.avgUs, (unsigned long)w.maxUs);
+    }
+    Serial.println("=== End Display ===\n");
+}
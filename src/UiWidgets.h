@@ -0,0 +1,178 @@
+#pragma once
+
+#include <Arduino.h>
+#include <M5GFX.h>
+
+// Экран в режиме удержания состояния (retained mode).
+// Экран описан набором виджетов с фиксированными прямоугольниками. Каждый кадр вызывающий код
+// задаёт виджетам текущие значения; виджет помечается грязным, только если текст, цвет или
+// значение изменились. Кадр перерисовывает в буфере и передаёт по SPI только грязные
+// прямоугольники (через clip-область панели), неизменившийся кадр не передаётся вовсе.
+// Пока панель выключена или подсветка погашена, кадр пропускается целиком.
+//
+// Режим полного кадра (как раньше: очистка и передача всего буфера) оставлен для сравнения:
+// статистика ведётся отдельно по каждому режиму.
+//
+// Буферов два: следующий кадр рисуется в один, пока предыдущий передаётся из другого по DMA.
+// Транзакция SPI остаётся открытой между кадрами, поэтому передача не ждётся; перед сном
+// панели её закрывает uiFlush(). Если памяти на второй буфер нет, работает с одним.
+// Все функции, кроме статистики, вызываются только из задачи отрисовки.
+//
+// Глубина цвета буферов: 16 бит (RGB565), 8 бит (RGB332), 4 бита с палитрой из 16 цветов
+// или 1 бит (фон и один цвет). В палитровых режимах буфер хранит номера цветов, а в RGB565
+// они переводятся при передаче на панель; поэтому рисовать в буфер нужно цветом uiColor().
+// Передача по SPI в любом режиме 16-битная, меньше только память буфера и чтение из неё.
+
+#ifndef UI_MAX_WIDGETS
+#define UI_MAX_WIDGETS 48
+#endif
+#ifndef UI_WIDGET_TEXT_LEN
+#define UI_WIDGET_TEXT_LEN 32
+#endif
+#ifndef UI_BACKGROUND
+#define UI_BACKGROUND TFT_BLACK
+#endif
+// Глубина цвета по умолчанию: 16, 8, 4 или 1
+#ifndef UI_COLOR_DEPTH
+#define UI_COLOR_DEPTH 4
+#endif
+// Время фаз кадра: min/avg/max по последним UI_TIMING_WINDOW измерениям
+#ifndef UI_TIMING_WINDOW
+#define UI_TIMING_WINDOW 64
+#endif
+// Бюджет времени кадра, мкс: превышения считаются, оверлей показывает их красным
+#ifndef UI_FRAME_BUDGET_US
+#define UI_FRAME_BUDGET_US 8000
+#endif
+
+// Фазы кадра, измеряемые по esp_timer: счётчик тактов CPU свой у каждого ядра
+// и зависит от частоты, которая меняется повышениями DFS
+enum UiPhase : uint8_t {
+    UI_PHASE_PUBLISH,   // Сборка и публикация снимка (задача управления, учитывает задача UI)
+    UI_PHASE_BUILD,     // Значения виджетов: форматирование текста (между uiFrameBegin и uiFrameEnd)
+    UI_PHASE_DRAW,      // Отрисовка изменившихся виджетов в буфер
+    UI_PHASE_PUSH,      // Запуск передачи на панель (pushSprite; сама передача идёт по DMA)
+    UI_PHASE_FRAME,     // Кадр целиком: от uiFrameBegin до конца uiFrameEnd
+    UI_PHASE_COUNT
+};
+
+/**
+ * @brief Создаёт буферы кадра размером с панель.
+ * @param depth Глубина цвета: 16, 8, 4 или 1 (иначе UI_COLOR_DEPTH)
+ * @return false - нет памяти даже на один буфер
+ */
+bool uiBegin(M5GFX* panel, uint8_t depth = UI_COLOR_DEPTH);
+
+/**
+ * @brief Пересоздаёт буферы с другой глубиной цвета; экран перерисовывается целиком.
+ * @return false - глубина не поддерживается или нет памяти (буферы остаются с прежней глубиной)
+ */
+bool uiSetColorDepth(M5GFX* panel, uint8_t depth);
+uint8_t uiColorDepth();
+
+/**
+ * @brief Цвет RGB565 в значение для рисования в буфер: номер в палитре или сам цвет.
+ */
+uint16_t uiColor(uint16_t rgb565);
+
+/**
+ * @brief Отрисовка нетекстового виджета по его значению.
+ */
+typedef void (*UiDrawFn)(M5Canvas* canvas, int16_t x, int16_t y, uint32_t value);
+
+/**
+ * @brief Отрисовка одного столбца прокручиваемого графика: отсчёт с номером sample
+ * в столбце x высотой h от y. Столбец уже очищен фоном.
+ */
+typedef void (*UiColumnFn)(M5Canvas* canvas, int16_t x, int16_t y, int16_t h, uint32_t sample);
+
+/**
+ * @brief Описывает виджет. id выбирает вызывающий код (< UI_MAX_WIDGETS).
+ * @param page Страница, на которой виджет показывается
+ * @param w,h Прямоугольник, который виджет очищает и передаёт при изменении
+ */
+void uiWidgetDefine(uint8_t id, uint8_t page, int16_t x, int16_t y, int16_t w, int16_t h);
+
+/**
+ * @brief Текст виджета шрифтом по умолчанию; пустой текст очищает виджет.
+ */
+void uiWidgetPrintf(uint8_t id, uint16_t color, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Нетекстовый виджет: перерисовывается функцией draw, когда меняется value.
+ */
+void uiWidgetValue(uint8_t id, uint32_t value, UiDrawFn draw);
+
+/**
+ * @brief Прокручиваемый график: столбец на отсчёт, последний отсчёт у правого края.
+ * Пока новых отсчётов меньше ширины, содержимое буфера сдвигается влево и рисуются
+ * только новые столбцы. Смена style (например, порогов на графике) перерисовывает график целиком.
+ * @param count Число отсчётов за всё время; отсчёты нумеруются с 0
+ */
+void uiWidgetScroll(uint8_t id, uint32_t count, uint32_t style, UiColumnFn column);
+
+/**
+ * @brief Виджет скрыт: его прямоугольник очищается.
+ */
+void uiWidgetClear(uint8_t id);
+
+/**
+ * @brief Активная страница. При смене страницы экран очищается и перерисовывается целиком.
+ */
+void uiSetPage(uint8_t page);
+uint8_t uiPage();
+
+/**
+ * @brief Следующий кадр перерисовывает страницу целиком (содержимое панели неизвестно).
+ */
+void uiInvalidate();
+
+/**
+ * @brief Панель включена/выключена (сон). Выключенная панель не перерисовывается.
+ */
+void uiSetPanelOn(bool on);
+
+/**
+ * @brief Начало кадра. false - кадр пропускается (панель выключена или подсветка погашена),
+ * значения виджетов задавать не нужно.
+ */
+bool uiFrameBegin(M5GFX* panel);
+
+/**
+ * @brief Конец кадра: отрисовка грязных виджетов в свободный буфер и запуск передачи
+ * их прямоугольников на панель.
+ */
+void uiFrameEnd(M5GFX* panel);
+
+/**
+ * @brief Дожидается передачи и закрывает транзакцию SPI (перед сном панели и другими командами).
+ */
+void uiFlush(M5GFX* panel);
+
+/**
+ * @brief Кадр не начат: нового снимка нет, рисовать нечего.
+ */
+void uiFrameSkipped();
+
+/**
+ * @brief Учитывает время фазы, измеренное вне модуля (публикация снимка).
+ * Окно не защищено блокировкой: вызывать только из задачи UI.
+ * @param us Длительность фазы по esp_timer_get_time()
+ */
+void uiPhaseRecord(UiPhase phase, uint32_t us);
+
+/**
+ * @brief Отладочный оверлей в правом нижнем углу: среднее/максимальное время кадра, мс.
+ */
+void uiSetOverlay(bool on);
+bool uiOverlay();
+
+/**
+ * @brief Включает режим полного кадра (для сравнения с передачей грязных областей).
+ */
+void uiSetFullFrameMode(bool full);
+bool uiFullFrameMode();
+
+void uiStatsReset();
+
+void printUiStats();
@@ -1,6 +1,7 @@
 #include <NimBLEDevice.h>
 #include <NimBLEHIDDevice.h>
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
 #include "esp_gap_ble_api.h"
 #include "NimBLEClient.h"
 #include <M5Unified.h>
@@ -11,6 +12,21 @@
 #include "device_utils.h" // Добавляем для функции getShortKey
 #include "password_manager.h"
 #include "DeviceLockUtils.h" // Добавляем для функций saveDeviceLockState/loadDeviceLockState
+#include "BootProfile.h"
+#include "RtcSnapshot.h"
+#include "Provisioning.h"
+#include "PowerMode.h"
+#include "EnergyMeter.h"
+#include "TxPowerController.h"
+#include "PowerManager.h"
+#include "ConnParamPolicy.h"
+#include "AdvScheduler.h"
+#include "ScanScheduler.h"
+#include "AdvertiserTable.h"
+#include "ReconnectManager.h"
+#include "JobScheduler.h"
+#include "TaskMonitor.h"
+#include "UiWidgets.h"
 
 // Глобальные определения для длительного нажатия кнопки A
 static unsigned long btnAPressStart = 0;
@@ -31,21 +47,17 @@ static RssiMeasurement rssiHistory[RSSI_HISTORY_SIZE] = {};
 static int rssiHistoryIndex = 0;
 static int lastAverageRssi = 0;
 
-// В начале файла после включений, до определения переменных
+// История среднего RSSI для графика на экране: по отсчёту на столбец
+#define RSSI_TRACE_SIZE 232
+static int8_t rssiTrace[RSSI_TRACE_SIZE] = {};
+static uint32_t rssiTraceCount = 0;
 
-// Структура для хранения настроек устройства
-struct DeviceSettings {
-    int unlockRssi;     // Минимальный RSSI для разблокировки
-    int lockRssi;       // RSSI для блокировки
-    String password;    // Пароль (зашифрованный)
-};
+// В начале файла после включений, до определения переменных
 
 void unlockComputer();
 void lockComputer();
 // String getPasswordForDevice(const String& deviceAddress);
 // void savePasswordForDevice(const String& deviceAddress, const String& password);
-DeviceSettings getDeviceSettings(const String& deviceAddress);
-void saveDeviceSettings(const String& deviceAddress, const DeviceSettings& settings);
 
 bool isRssiStable();
 void clearAllPreferences();
@@ -54,6 +66,9 @@ void temporaryScreenOn();
 void checkTemporaryScreen();
 // String getDevicePassword(const String& shortKey);
 void updateCurrentShortKey(const char* deviceAddress);
+static void updateEnergyMeter();
+static void registerJobs();
+static void startTasks();
 // Добавляем прототип новой функции
 void clearOldPasswords();
 
@@ -62,9 +77,7 @@ static const int RSSI_FAR_THRESHOLD = -65;
 
 // В начале файла после всех включений и перед функциями
 
-// Добавляем константы для RSSI по умолчанию
-#define DEFAULT_LOCK_RSSI -60    // Порог RSSI для блокировки по умолчанию
-#define DEFAULT_UNLOCK_RSSI -45  // Порог RSSI для разблокировки по умолчанию
+// Константы для RSSI по умолчанию (DEFAULT_LOCK_RSSI, DEFAULT_UNLOCK_RSSI) в DeviceSettingsUtils.h
 
 // Динамические пороги, могут обновляться при длительном нажатии кнопки A
 static int dynamicLockThreshold = DEFAULT_LOCK_RSSI;
@@ -73,27 +86,93 @@ static int dynamicUnlockThreshold = DEFAULT_UNLOCK_RSSI;
 // Добавляем глобальную переменную для управления отладочным выводом
 static bool serialOutputEnabled = true;
 
-// В начало файла после включения библиотек
-static const char* KEY_LAST_ADDR = "last_addr";
-static const char* KEY_PASSWORD = "password";  // Добавляем константу для пароля
-static const char* KEY_LOCK_STATE_PREFIX = "locked_";   // Префикс для ключей состояния блокировки по устройству
+// Ключи NVS описаны в StorageKeys.h
 
 // Добавляем прототип функции
 void lockComputer();
 
-struct {
-    bool connected = false;
-    uint16_t conn_handle = BLE_HS_CONN_HANDLE_NONE;
-    std::string address = "";
-} connection_info;
-
 static NimBLEAdvertisementData advData;
 static NimBLEServer* bleServer = nullptr;
 static NimBLEHIDDevice* hid;
 static NimBLECharacteristic* input;
 static NimBLECharacteristic* output;
 static bool connected = false;
-static M5Canvas* Disbuff = nullptr;  // Буфер для отрисовки
+
+// Задачи FreeRTOS. loop() - задача опроса: RSSI, решения, соединение, питание.
+// Остальные получают работу через ограниченные очереди и не могут остановить опрос:
+// HID (своя задача и очередь на каждый хост) - блокировка, разблокировка и ввод пароля;
+// UI - экран и подсветка; storage - запись в NVS и консоль Serial. Команды консоли, которые
+// меняют состояние задачи опроса, уходят ей через очередь console
+enum HidCommandType : uint8_t { HID_CMD_LOCK, HID_CMD_UNLOCK, HID_CMD_TYPE_PASSWORD };
+struct HidCommand {
+    HidCommandType type;
+    uint8_t host;           // Слот хоста
+    uint16_t connHandle;    // Соединение, в которое уходят отчёты
+    char address[18];       // Адрес хоста на момент решения
+};
+
+enum UiEventType : uint8_t { UI_EVENT_SLEEP, UI_EVENT_WAKE, UI_EVENT_BRIGHTNESS, UI_EVENT_MESSAGE, UI_EVENT_COLOR_DEPTH, UI_EVENT_REDRAW };
+struct UiEvent {
+    UiEventType type;
+    uint8_t value;          // Яркость или глубина цвета
+    uint16_t color;
+    const char* text;       // Только строковые литералы
+};
+
+enum StorageRequestType : uint8_t {
+    STORAGE_SAVE_LOCK_STATE, STORAGE_SAVE_THRESHOLDS, STORAGE_SAVE_COLOR_DEPTH, STORAGE_HOST_CONNECTED,
+    STORAGE_SAVE_LAST_ADDR
+};
+struct StorageRequest {
+    StorageRequestType type;
+    char address[18];
+    bool locked;
+    int16_t lockRssi;
+    int16_t unlockRssi;
+    uint8_t colorDepth;     // STORAGE_SAVE_COLOR_DEPTH: глубина, которую задача UI уже применила
+};
+
+// События GAP из задачи стека NimBLE; слоты хостов меняет только задача опроса
+enum ConnEventType : uint8_t { CONN_EVENT_CONNECT, CONN_EVENT_DISCONNECT, CONN_EVENT_ENCRYPTED, CONN_EVENT_HID_READY };
+struct ConnEvent {
+    ConnEventType type;
+    uint16_t connHandle;
+    int reason;             // Причина разрыва (код NimBLE)
+};
+
+// Команды консоли, меняющие состояние задачи опроса: задача storage только разбирает ввод
+// и читает NVS, а выполняет команду задача опроса
+enum ConsoleCommandType : uint8_t {
+    CONSOLE_CMD_SET_ADDRESS, CONSOLE_CMD_APPLY_THRESHOLDS, CONSOLE_CMD_POWER_REPORT, CONSOLE_CMD_POWER_RESET,
+    CONSOLE_CMD_SCAN_REPORT, CONSOLE_CMD_SCAN_OPEN, CONSOLE_CMD_JOBS_RESET, CONSOLE_CMD_PAIR,
+    CONSOLE_CMD_PASSWORD_CHANGED
+};
+struct ConsoleCommand {
+    ConsoleCommandType type;
+    char address[18];       // Для SET_ADDRESS, APPLY_THRESHOLDS и PASSWORD_CHANGED (пустой - все хосты)
+    int16_t lockRssi;
+    int16_t unlockRssi;
+};
+
+static int controlTaskId = -1;
+static int uiTaskId = -1;
+static int storageTaskId = -1;
+static int uiQueue = -1;
+static int storageQueue = -1;
+static int connQueue = -1;
+static int consoleQueue = -1;
+
+// Отправка HID-отчёта одному хосту с учётом в счётчике энергии. Значение характеристики
+// не меняется: задачи HID разных хостов отправляют отчёты независимо друг от друга
+static const size_t HID_REPORT_SIZE = 8;
+static bool notifyHidReport(const uint8_t* report, uint16_t connHandle) {
+    energyMeterAddHidReports(1);
+    uint32_t startUs = micros();
+    bool ok = input->notify(report, HID_REPORT_SIZE, connHandle);
+    connParamPolicyHidReport(micros() - startUs);
+    txPowerControllerNotifyResult(ok);
+    return ok;
+}
 static int16_t lastReceivedRssi = 0;
 static String lastMovement = "==";
 
@@ -124,6 +203,7 @@ static unsigned long lastStateChangeTime = 0;           // Время после
 static int consecutiveUnlockSamples = 0;                // Счетчик последовательных измерений для разблокировки
 static int consecutiveLockSamples = 0;                  // Счетчик последовательных измерений для блокировки
 static const int CONSECUTIVE_SAMPLES_NEEDED = 3;        // Сколько последовательных измерений нужно для изменения состояния
+static const uint32_t LOCK_SEND_MS = 500;               // Очередь HID, короткий интервал и отправка Win+L
 
 // Пороги для предупреждений
 static const int SIGNAL_WARNING_THRESHOLD = -65;  // Порог для предупреждения
@@ -141,95 +221,14 @@ static DeviceState currentState = NORMAL;
 static unsigned long movementStartTime = 0;
 
 // Изменяем константы для хранения паролей
-static const char* KEY_PWD_PREFIX = "pwd_";  // Префикс для ключей паролей
 static const int MAX_STORED_PASSWORDS = 5;   // Максимум сохраненных паролей
 
 // Добавим более сложный ключ шифрования (32 байта)
 
 
 // Прототипы функций
-void saveDeviceSettings(const String& deviceAddress, const DeviceSettings& settings);
 void addRssiMeasurement(const RssiMeasurement& measurement);
-void drawBatteryIndicator(int x, int y, int width, int height, float batteryLevel, bool isCharging);
-
-// Определения функций
-void saveDeviceSettings(const String& deviceAddress, const DeviceSettings& settings) {
-    Serial.println("\n=== Saving Device Settings ===");
-    Serial.printf("Device address: %s\n", deviceAddress.c_str());
-    
-    String shortKey = cleanMacAddress(deviceAddress.c_str()); // Восстанавливаем вызов
-    Serial.printf("Short key: %s\n", shortKey.c_str());
-    
-    String pwdKey = "pwd_" + shortKey;
-    String unlockKey = "unlock_" + shortKey;
-    String lockKey = "lock_" + shortKey;
-    
-    Serial.printf("Password key: %s\n", pwdKey.c_str());
-    Serial.printf("Unlock key: %s\n", unlockKey.c_str());
-    Serial.printf("Lock key: %s\n", lockKey.c_str());
-    
-    // Если под этим ключом уже записана строка, а новая короче – нужно стереть старую запись
-    esp_err_t eraseErr = nvs_erase_key(nvsHandle, pwdKey.c_str());
-    if (eraseErr != ESP_OK && eraseErr != ESP_ERR_NVS_NOT_FOUND) {
-        Serial.printf("Error erasing old password key: %d\n", eraseErr);
-    } else {
-        // Делаем коммит после стирания ключа
-        esp_err_t commitErr = nvs_commit(nvsHandle);
-        if (commitErr != ESP_OK) {
-            Serial.printf("Error committing erase: %d\n", commitErr);
-        }
-    }
-    
-    esp_err_t err = nvs_set_str(nvsHandle, pwdKey.c_str(), settings.password.c_str());
-    if (err != ESP_OK) {
-        Serial.printf("Error saving password: %d\n", err);
-        return;
-    }
-    
-    err = nvs_set_i32(nvsHandle, unlockKey.c_str(), settings.unlockRssi);
-    if (err != ESP_OK) {
-        Serial.printf("Error saving unlock RSSI: %d\n", err);
-    }
-    
-    err = nvs_set_i32(nvsHandle, lockKey.c_str(), settings.lockRssi);
-    if (err != ESP_OK) {
-        Serial.printf("Error saving lock RSSI: %d\n", err);
-    }
-    
-    err = nvs_commit(nvsHandle);
-    if (err != ESP_OK) {
-        Serial.printf("Error committing settings: %d\n", err);
-    } else {
-        Serial.println("Settings saved successfully");
-    }
-    Serial.println("=== End Saving Settings ===\n");
-}
-
-DeviceSettings getDeviceSettings(const String& deviceAddress) {
-    DeviceSettings settings;
-    settings.unlockRssi = DEFAULT_UNLOCK_RSSI;
-    settings.lockRssi = DEFAULT_LOCK_RSSI;
-    
-    String shortKey = cleanMacAddress(deviceAddress.c_str()); // Восстанавливаем вызов
-    
-    char pwd[64] = {0};
-    size_t length = sizeof(pwd);
-    
-    if (nvs_get_str(nvsHandle, ("pwd_" + shortKey).c_str(), pwd, &length) == ESP_OK) {
-        settings.password = String(pwd);
-    }
-    
-    int32_t value;
-    if (nvs_get_i32(nvsHandle, ("unlock_" + shortKey).c_str(), &value) == ESP_OK) {
-        settings.unlockRssi = value;
-    }
-    
-    if (nvs_get_i32(nvsHandle, ("lock_" + shortKey).c_str(), &value) == ESP_OK) {
-        settings.lockRssi = value;
-    }
-    
-    return settings;
-}
+void drawBatteryIndicator(M5Canvas* canvas, int x, int y, int width, int height, float batteryLevel, bool isCharging);
 
 // Стандартный дескриптор HID клавиатуры
 static const uint8_t hidReportDescriptor[] = {
@@ -266,6 +265,7 @@ static int rssiIndex = 0;
 static int validSamples = 0;  // Счетчик валидных измерений
 static float exponentialAverage = 0; // Экспоненциальное скользящее среднее
 static bool exponentialAverageInitialized = false; // Флаг инициализации
+static_assert(RSSI_SAMPLES == RTC_SNAPSHOT_RSSI_SAMPLES, "RTC snapshot must hold the whole RSSI filter");
 
 // Улучшенная функция для получения среднего RSSI с фильтрацией выбросов
 int getAverageRssi() {
@@ -333,204 +333,747 @@ void addRssiValue(int rssi) {
     
     // Обновляем глобальное значение среднего RSSI
     lastAverageRssi = getAverageRssi();
+    rssiTrace[rssiTraceCount % RSSI_TRACE_SIZE] = (int8_t)lastAverageRssi;
+    rssiTraceCount++;
+}
+
+// Несколько компьютеров одновременно: у каждого подключённого хоста свой слот с фильтром RSSI,
+// порогами, автоматом блокировки и задачей HID. Переменные выше (lastAverageRssi, currentState,
+// пороги, фильтр) - рабочий набор: в нём лежит состояние одного хоста, выбранного selectHost().
+// Задача опроса по очереди загружает в рабочий набор каждый подключённый хост, а между
+// заданиями держит в нём хост, показанный на экране. Слот хранит хост и после отключения,
+// чтобы при переподключении продолжить с его состоянием блокировки
+#ifndef HOST_MAX
+#define HOST_MAX 2
+#endif
+// Очередь и задача HID на хост плюс общие: очереди ui, storage, conn, console; задачи control, ui, storage
+static_assert(HOST_MAX + 4 <= TASK_MONITOR_MAX_QUEUES, "HOST_MAX needs HOST_MAX + 4 queues: raise TASK_MONITOR_MAX_QUEUES");
+static_assert(HOST_MAX + 3 <= TASK_MONITOR_MAX_TASKS, "HOST_MAX needs HOST_MAX + 3 tasks: raise TASK_MONITOR_MAX_TASKS");
+
+struct HostContext {
+    // Всегда актуальные поля
+    uint16_t connHandle;                // BLE_HS_CONN_HANDLE_NONE - хост не подключён
+    unsigned long lastConnRssiTime;     // Последний RSSI соединения (иначе нужен RSSI из рекламы)
+    uint64_t peerAddress;               // Идентификационный адрес: ключ таблицы рекламодателей
+    uint32_t scanReportCount;           // Отчётов рекламы на момент последнего отсчёта RSSI
+    // Учёт блокировок; первые три счётчика ведёт задача HID, остальные - задача опроса
+    uint32_t lockAttempts;
+    uint32_t locksDelivered;
+    uint32_t locksOnDeadLink;           // Соединения к моменту отправки уже нет
+    uint32_t linkLosses;
+    uint32_t linkTimeouts;              // Из них по supervision timeout
+    uint32_t lostBeforeLock;            // Разрыв до решения о блокировке: Win+L уже не отправить
+    bool hasPassword;                   // Пароль есть в NVS; читается при подключении и после setpwd/import/clear
+    // Ограничение попыток разблокировки; ведёт задача HID хоста, у каждого компьютера своё
+    uint8_t failedUnlockAttempts;
+    unsigned long lastFailedAttempt;    // Время последней неудачной попытки
+    int hidQueue;
+    int hidTaskId;
+    // Копия рабочего набора, пока хост не выбран
+    char address[18];                   // Пустой - слот свободен
+    RssiMeasurement rssiHistory[RSSI_HISTORY_SIZE];
+    int rssiHistoryIndex;
+    int rssiValues[RSSI_SAMPLES];
+    int rssiIndex;
+    int validSamples;
+    float exponentialAverage;
+    bool exponentialAverageInitialized;
+    int lastAverageRssi;
+    int8_t rssiTrace[RSSI_TRACE_SIZE];
+    uint32_t rssiTraceCount;
+    int lockThreshold;
+    int unlockThreshold;
+    DeviceState state;
+    unsigned long lastStateChangeTime;
+    int consecutiveLockSamples;
+    int consecutiveUnlockSamples;
+    unsigned long movementStartTime;
+    unsigned long weakSignalStartTime;
+};
+
+static HostContext hosts[HOST_MAX] = {};
+static int activeHost = 0;  // Хост в рабочем наборе
+static int focusHost = 0;   // Хост на основной странице экрана и для кнопок
+
+// Рабочий набор -> слот
+static void storeHost(int slot) {
+    HostContext& h = hosts[slot];
+    strlcpy(h.address, connectedDeviceAddress.c_str(), sizeof(h.address));
+    memcpy(h.rssiHistory, rssiHistory, sizeof(h.rssiHistory));
+    h.rssiHistoryIndex = rssiHistoryIndex;
+    memcpy(h.rssiValues, rssiValues, sizeof(h.rssiValues));
+    h.rssiIndex = rssiIndex;
+    h.validSamples = validSamples;
+    h.exponentialAverage = exponentialAverage;
+    h.exponentialAverageInitialized = exponentialAverageInitialized;
+    h.lastAverageRssi = lastAverageRssi;
+    memcpy(h.rssiTrace, rssiTrace, sizeof(h.rssiTrace));
+    h.rssiTraceCount = rssiTraceCount;
+    h.lockThreshold = dynamicLockThreshold;
+    h.unlockThreshold = dynamicUnlockThreshold;
+    h.state = currentState;
+    h.lastStateChangeTime = lastStateChangeTime;
+    h.consecutiveLockSamples = consecutiveLockSamples;
+    h.consecutiveUnlockSamples = consecutiveUnlockSamples;
+    h.movementStartTime = movementStartTime;
+    h.weakSignalStartTime = weakSignalStartTime;
+}
+
+// Слот -> рабочий набор
+static void loadHost(int slot) {
+    const HostContext& h = hosts[slot];
+    connectedDeviceAddress.assign(h.address);
+    memcpy(rssiHistory, h.rssiHistory, sizeof(rssiHistory));
+    rssiHistoryIndex = h.rssiHistoryIndex;
+    memcpy(rssiValues, h.rssiValues, sizeof(rssiValues));
+    rssiIndex = h.rssiIndex;
+    validSamples = h.validSamples;
+    exponentialAverage = h.exponentialAverage;
+    exponentialAverageInitialized = h.exponentialAverageInitialized;
+    lastAverageRssi = h.lastAverageRssi;
+    memcpy(rssiTrace, h.rssiTrace, sizeof(rssiTrace));
+    rssiTraceCount = h.rssiTraceCount;
+    dynamicLockThreshold = h.lockThreshold;
+    dynamicUnlockThreshold = h.unlockThreshold;
+    currentState = h.state;
+    lastStateChangeTime = h.lastStateChangeTime;
+    consecutiveLockSamples = h.consecutiveLockSamples;
+    consecutiveUnlockSamples = h.consecutiveUnlockSamples;
+    movementStartTime = h.movementStartTime;
+    weakSignalStartTime = h.weakSignalStartTime;
+}
+
+// Загружает хост в рабочий набор, сохранив предыдущий; вызывается только из задачи опроса
+static void selectHost(int slot) {
+    if (slot == activeHost) {
+        return;
+    }
+    storeHost(activeHost);
+    loadHost(slot);
+    activeHost = slot;
+}
+
+// Слоты актуальны, включая хост в рабочем наборе (перед чтением hosts[])
+static void syncHosts() {
+    storeHost(activeHost);
+}
+
+static bool hostConnected(int slot) {
+    return hosts[slot].connHandle != BLE_HS_CONN_HANDLE_NONE;
+}
+
+// Соединение ещё есть и принадлежит хосту с этим адресом (handle мог занять другой хост).
+// Хосты различаются по идентификационному адресу: RPA сопряжённого хоста меняется
+static bool hostLinkAlive(uint16_t connHandle, const char* address) {
+    ble_gap_conn_desc desc;
+    return ble_gap_conn_find(connHandle, &desc) == 0 &&
+        strcasecmp(NimBLEAddress(desc.peer_id_addr).toString().c_str(), address) == 0;
+}
+
+// Слот подключённого хоста с этим соединением; -1, если такого нет
+static int slotForConnHandle(uint16_t connHandle) {
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (hostConnected(slot) && hosts[slot].connHandle == connHandle) return slot;
+    }
+    return -1;
+}
+
+static int connectedHostCount() {
+    int count = 0;
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (hostConnected(slot)) count++;
+    }
+    return count;
+}
+
+// Следующий подключённый хост после slot (-1 - от начала); -1, если такого нет
+static int nextConnectedHost(int slot) {
+    for (int next = slot + 1; next < HOST_MAX; next++) {
+        if (hostConnected(next)) return next;
+    }
+    return -1;
+}
+
+static const char* hostAddress(int slot) {
+    return slot == activeHost ? connectedDeviceAddress.c_str() : hosts[slot].address;
+}
+
+static const char* stateShortName(DeviceState state) {
+    switch (state) {
+        case MOVING_AWAY: return "AWAY";
+        case LOCKED: return "LOCK";
+        case APPROACHING: return "APPR";
+        default: return "NORM";
+    }
+}
+
+static uint32_t connEventsMissed = 0;
+
+// Копия таблицы слотов для консоли (задача storage). Слоты и рабочий набор меняет только
+// задача опроса; она же после каждой итерации публикует копию под спинлоком
+struct HostRow {
+    char address[18];           // Пустой - слот свободен
+    bool connected;
+    uint16_t connHandle;
+    DeviceState state;
+    int lastAverageRssi;
+    int lockThreshold;
+    int unlockThreshold;
+    uint32_t lockAttempts;
+    uint32_t locksDelivered;
+    uint32_t locksOnDeadLink;
+    uint32_t linkLosses;
+    uint32_t linkTimeouts;
+    uint32_t lostBeforeLock;
+};
+struct HostTable {
+    HostRow rows[HOST_MAX];
+    int focusHost;
+    uint32_t connEventsMissed;
+};
+static HostTable publishedHosts = {};
+static portMUX_TYPE hostTableLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Хост в рабочем наборе берётся из рабочего набора, остальные - из слотов; вызывается из задачи опроса
+static void publishHostTable() {
+    HostTable table;
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        const HostContext& h = hosts[slot];
+        HostRow& row = table.rows[slot];
+        bool active = slot == activeHost;
+        strlcpy(row.address, hostAddress(slot), sizeof(row.address));
+        row.connected = hostConnected(slot);
+        row.connHandle = h.connHandle;
+        row.state = active ? currentState : h.state;
+        row.lastAverageRssi = active ? lastAverageRssi : h.lastAverageRssi;
+        row.lockThreshold = active ? dynamicLockThreshold : h.lockThreshold;
+        row.unlockThreshold = active ? dynamicUnlockThreshold : h.unlockThreshold;
+        row.lockAttempts = h.lockAttempts;
+        row.locksDelivered = h.locksDelivered;
+        row.locksOnDeadLink = h.locksOnDeadLink;
+        row.linkLosses = h.linkLosses;
+        row.linkTimeouts = h.linkTimeouts;
+        row.lostBeforeLock = h.lostBeforeLock;
+    }
+    table.focusHost = focusHost;
+    table.connEventsMissed = connEventsMissed;
+    portENTER_CRITICAL(&hostTableLock);
+    publishedHosts = table;
+    portEXIT_CRITICAL(&hostTableLock);
+}
+
+static void readHostTable(HostTable& table) {
+    portENTER_CRITICAL(&hostTableLock);
+    table = publishedHosts;
+    portEXIT_CRITICAL(&hostTableLock);
+}
+
+static void printHostStats() {
+    HostTable table;
+    readHostTable(table);
+    Serial.println("\n=== Hosts ===");
+    Serial.println("Slot Address            Conn  State  Avg RSSI  Lock  Unlock");
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        const HostRow& h = table.rows[slot];
+        if (h.address[0] == '\0') {
+            Serial.printf("%-4d (free)\n", slot + 1);
+            continue;
+        }
+        Serial.printf("%-4d %-18s %-5s %-6s %8d %5d %7d%s\n", slot + 1, h.address,
+            h.connected ? "yes" : "no", stateShortName(h.state), h.lastAverageRssi,
+            h.lockThreshold, h.unlockThreshold, slot == table.focusHost ? "  (shown)" : "");
+        Serial.printf("     Locks: %lu sent, %lu delivered, %lu on dead link; link lost %lu times "
+            "(%lu supervision timeout), %lu before lock\n",
+            (unsigned long)h.lockAttempts, (unsigned long)h.locksDelivered, (unsigned long)h.locksOnDeadLink,
+            (unsigned long)h.linkLosses, (unsigned long)h.linkTimeouts, (unsigned long)h.lostBeforeLock);
+    }
+    Serial.printf("Connection changes found by reconciliation instead of GAP events: %lu\n",
+        (unsigned long)table.connEventsMissed);
+    Serial.println("=== End Hosts ===\n");
+}
+
+// Все слоты свободны; рабочий набор (восстановленный из RTC или NVS) принадлежит
+// последнему хосту и займёт первый слот, когда этот хост подключится
+static void initHosts(const char* lastAddress) {
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        hosts[slot].connHandle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    activeHost = 0;
+    focusHost = 0;
+    connectedDeviceAddress = lastAddress;
+}
+
+// Хост на основной странице и для кнопок; остаётся в рабочем наборе между заданиями
+static void setFocusHost(int slot) {
+    focusHost = slot;
+    selectHost(slot);
 }
 
 // После других static переменных, до функции updateDisplay()
 static int lastMovementCount = 0;  // Счетчик для отслеживания движения
 
-// Добавим функцию для обновления экрана
-void updateDisplay() {
-    // При удержании кнопки A дольше LONG_PRESS_DURATION показываем сообщение и выходим
-    if (M5.BtnA.isPressed() && btnAPressStart != 0 && (millis() - btnAPressStart) >= LONG_PRESS_DURATION) {
-        Disbuff->fillSprite(BLACK);
-        Disbuff->setTextColor(GREEN);
-        Disbuff->setCursor(5, 60);
-        Disbuff->print("RSSI thresholds set");
-        Disbuff->pushSprite(0, 0);
-        return;
+// Экран описан виджетами (src/UiWidgets.h): каждый кадр задаёт им значения,
+// на панель передаются только изменившиеся прямоугольники
+// Страницы UI_PAGE_MAIN..UI_PAGE_ENERGY листаются кнопкой PWR
+enum UiPageId : uint8_t { UI_PAGE_MAIN, UI_PAGE_RSSI, UI_PAGE_LATENCY, UI_PAGE_ENERGY, UI_PAGE_MESSAGE };
+enum UiWidgetId : uint8_t {
+    WIDGET_BLE,
+    WIDGET_RSSI,
+    WIDGET_AVERAGE,
+    WIDGET_STATE_LABEL,
+    WIDGET_STATE,
+    WIDGET_MOVEMENT,
+    WIDGET_DIFF,
+    WIDGET_SIGNAL,
+    WIDGET_THRESHOLDS,
+    WIDGET_PASSWORD,
+    WIDGET_BATTERY_TEXT,
+    WIDGET_BATTERY_ICON,
+    WIDGET_HOST,                // Строка на каждый слот хоста
+    WIDGET_ENERGY_TITLE = WIDGET_HOST + HOST_MAX,
+    WIDGET_ENERGY_COMPONENT,
+    WIDGET_ENERGY_TOTAL = WIDGET_ENERGY_COMPONENT + ENERGY_COMPONENT_COUNT,
+    WIDGET_ENERGY_NOW,
+    WIDGET_ENERGY_RUNTIME,
+    WIDGET_RSSI_TITLE,
+    WIDGET_RSSI_PLOT,
+    WIDGET_RSSI_LEGEND,
+    WIDGET_LATENCY_TITLE,
+    WIDGET_LATENCY_LABEL,
+    WIDGET_LATENCY_BAR = WIDGET_LATENCY_LABEL + CONN_LATENCY_BUCKETS,
+    WIDGET_MESSAGE = WIDGET_LATENCY_BAR + CONN_LATENCY_BUCKETS,             // Сообщения задачи UI ("LOCKED!")
+    WIDGET_LONG_PRESS,          // Подтверждение долгого нажатия кнопки A
+};
+
+static const int16_t FONT_WIDTH = 6;
+static const int16_t FONT_HEIGHT = 8;
+
+// График RSSI: диапазон по вертикали, дБм
+static const int16_t RSSI_PLOT_HEIGHT = 108;
+static const int RSSI_PLOT_MIN = -100;
+static const int RSSI_PLOT_MAX = -30;
+
+static const int16_t LATENCY_BAR_X = 5 + 13 * FONT_WIDTH;
+
+// Строка хоста в правом верхнем углу основной страницы: ">1 NORM -62"
+static const int HOST_ROW_CHARS = 12;
+static const int16_t LATENCY_BAR_WIDTH = 240 - LATENCY_BAR_X - 5;
+
+// Текстовый виджет шириной в chars символов шрифта по умолчанию
+static void defineTextWidget(uint8_t id, uint8_t page, int16_t x, int16_t y, int chars) {
+    uiWidgetDefine(id, page, x, y, chars * FONT_WIDTH, FONT_HEIGHT);
+}
+
+static uint16_t batteryColorFor(float batteryLevel) {
+    if (batteryLevel > 75) {
+        return GREEN;
+    } else if (batteryLevel > 25) {
+        return YELLOW;
     }
-    int8_t isLocked = 0;
-    nvs_get_i8(nvsHandle, KEY_IS_LOCKED, &isLocked);
-    
-    // Получаем текущие данные о батарее
-    float currentBatteryLevel = M5.Power.getBatteryLevel();
-    bool isCharging = M5.Power.isCharging();
-    
-    Disbuff->fillSprite(BLACK);
-    Disbuff->setTextSize(1);
+    return RED;
+}
+
+// Значение виджета батареи: уровень в старших битах, признак зарядки в младшем
+static void drawBatteryWidget(M5Canvas* canvas, int16_t x, int16_t y, uint32_t value) {
+    drawBatteryIndicator(canvas, x, y, 30, 10, (float)(value >> 1), (value & 1) != 0);
+}
+
+static void defineDisplayWidgets() {
+    defineTextWidget(WIDGET_BLE, UI_PAGE_MAIN, 5, 0, 6);
+    defineTextWidget(WIDGET_RSSI, UI_PAGE_MAIN, 5, 12, 8);
+    defineTextWidget(WIDGET_AVERAGE, UI_PAGE_MAIN, 5, 24, 8);
+    defineTextWidget(WIDGET_STATE_LABEL, UI_PAGE_MAIN, 5, 36, 3);
+    defineTextWidget(WIDGET_STATE, UI_PAGE_MAIN, 5 + 3 * FONT_WIDTH, 36, 10);
+    defineTextWidget(WIDGET_MOVEMENT, UI_PAGE_MAIN, 5, 48, 10);
+    defineTextWidget(WIDGET_DIFF, UI_PAGE_MAIN, 5, 60, 8);
+    defineTextWidget(WIDGET_SIGNAL, UI_PAGE_MAIN, 5, 72, 10);
+    defineTextWidget(WIDGET_THRESHOLDS, UI_PAGE_MAIN, 5, 84, 16);
+    defineTextWidget(WIDGET_PASSWORD, UI_PAGE_MAIN, 5, 96, 6);
+    defineTextWidget(WIDGET_BATTERY_TEXT, UI_PAGE_MAIN, 5, 108, 9);
+    // Корпус 30 px, контакт 3 px, отступ 2 px и символ зарядки
+    uiWidgetDefine(WIDGET_BATTERY_ICON, UI_PAGE_MAIN, 5, 120, 30 + 3 + 2 + FONT_WIDTH, 10);
+    for (int i = 0; i < HOST_MAX; i++) {
+        defineTextWidget(WIDGET_HOST + i, UI_PAGE_MAIN, 240 - 5 - HOST_ROW_CHARS * FONT_WIDTH, i * 12, HOST_ROW_CHARS);
+    }
+
+    defineTextWidget(WIDGET_ENERGY_TITLE, UI_PAGE_ENERGY, 5, 0, 20);
+    for (int i = 0; i < ENERGY_COMPONENT_COUNT; i++) {
+        defineTextWidget(WIDGET_ENERGY_COMPONENT + i, UI_PAGE_ENERGY, 5, 16 + i * 12, 30);
+    }
+    defineTextWidget(WIDGET_ENERGY_TOTAL, UI_PAGE_ENERGY, 5, 84, 31);
+    defineTextWidget(WIDGET_ENERGY_NOW, UI_PAGE_ENERGY, 5, 96, 16);
+    defineTextWidget(WIDGET_ENERGY_RUNTIME, UI_PAGE_ENERGY, 5, 108, 26);
+
+    defineTextWidget(WIDGET_RSSI_TITLE, UI_PAGE_RSSI, 5, 0, 31);
+    uiWidgetDefine(WIDGET_RSSI_PLOT, UI_PAGE_RSSI, (240 - RSSI_TRACE_SIZE) / 2, 12, RSSI_TRACE_SIZE, RSSI_PLOT_HEIGHT);
+    defineTextWidget(WIDGET_RSSI_LEGEND, UI_PAGE_RSSI, 5, 14 + RSSI_PLOT_HEIGHT, 31);
+
+    defineTextWidget(WIDGET_LATENCY_TITLE, UI_PAGE_LATENCY, 5, 0, 31);
+    for (int i = 0; i < CONN_LATENCY_BUCKETS; i++) {
+        defineTextWidget(WIDGET_LATENCY_LABEL + i, UI_PAGE_LATENCY, 5, 18 + i * 18, 12);
+        uiWidgetDefine(WIDGET_LATENCY_BAR + i, UI_PAGE_LATENCY, LATENCY_BAR_X, 18 + i * 18,
+            LATENCY_BAR_WIDTH, FONT_HEIGHT);
+    }
+
+    defineTextWidget(WIDGET_MESSAGE, UI_PAGE_MESSAGE, 5, 40, 31);
+    defineTextWidget(WIDGET_LONG_PRESS, UI_PAGE_MESSAGE, 5, 60, 31);
+}
+
+// Краткое состояние хоста для строки на основной странице
+struct UiHostSummary {
+    bool known;                 // Слот занят
+    bool connected;
+    DeviceState state;
+    int rssi;
+};
+
+// Снимок состояния для экрана. Задача управления собирает его целиком и публикует,
+// задача UI копирует последний опубликованный снимок и рисует со своей частотой:
+// публикация не ждёт ни отрисовку, ни передачу на панель.
+// Поля ниже hosts относятся к хосту focusHost
+struct UiModel {
+    uint32_t sequence;
+    UiPageId page;
+    UiHostSummary hosts[HOST_MAX];
+    uint8_t focusHost;
+    bool connected;
+    int rssiRaw;                // Последнее измерение
+    int rssi;                   // Среднее, по которому принимаются решения
+    int rssiDiff;               // Изменение среднего RSSI с прошлого снимка
+    DeviceState state;
+    int awaySecondsLeft;
+    int movementCount;
+    int signalSecondsLeft;      // -1: отсчёт слабого сигнала не идёт
+    int lockThreshold;
+    int unlockThreshold;
+    bool hasPassword;
+    int batteryLevel;
+    bool charging;
+    EnergyReport energy;        // Только для страницы учёта энергии
+    ConnLatencyHistogram latency;           // Только для страницы задержек
+    uint32_t rssiTraceCount;                // Только для страницы графика RSSI
+    int8_t rssiTrace[RSSI_TRACE_SIZE];
+    uint32_t publishUs;         // Сборка снимка; в окно фаз его записывает задача UI
+};
+
+static UiModel publishedModel = {};
+static portMUX_TYPE uiModelLock = portMUX_INITIALIZER_UNLOCKED;
+static bool longPressShown = false;  // Кнопка A удерживается дольше LONG_PRESS_DURATION
+static UiPageId shownPage = UI_PAGE_MAIN;  // Страница, выбранная кнопкой PWR
+
+// Страница учёта энергии: расход по компонентам и прогноз времени работы
+static void updateEnergyPage(const EnergyReport& report) {
+    uiWidgetPrintf(WIDGET_ENERGY_TITLE, CYAN, "POWER  %.2f h", report.elapsedHours);
+    for (int i = 0; i < ENERGY_COMPONENT_COUNT; i++) {
+        uiWidgetPrintf(WIDGET_ENERGY_COMPONENT + i, WHITE, "%-8s %7.2fmAh %5.1fmA",
+            energyComponentName((EnergyComponent)i), report.componentMah[i], report.componentMa[i]);
+    }
+    uiWidgetPrintf(WIDGET_ENERGY_TOTAL, YELLOW, "Total %.2fmAh avg %.1fmA", report.totalMah, report.averageMa);
+    uiWidgetPrintf(WIDGET_ENERGY_NOW, YELLOW, "Now %.1fmA", report.currentMa);
+    uiWidgetPrintf(WIDGET_ENERGY_RUNTIME, GREEN, "Runtime left: %.1f h", report.projectedHours);
+}
+
+static uint16_t stateColor(DeviceState state) {
+    switch (state) {
+        case MOVING_AWAY: return YELLOW;
+        case LOCKED: return RED;
+        case APPROACHING: return BLUE;
+        default: return GREEN;
+    }
+}
+
+// Строки хостов: номер слота (">" - хост, показанный ниже), состояние и средний RSSI
+static void updateHostRows(const UiModel& model) {
+    for (int i = 0; i < HOST_MAX; i++) {
+        const UiHostSummary& host = model.hosts[i];
+        char marker = i == model.focusHost ? '>' : ' ';
+        if (!host.known) {
+            uiWidgetClear(WIDGET_HOST + i);
+        } else if (!host.connected) {
+            uiWidgetPrintf(WIDGET_HOST + i, WHITE, "%c%d OFF", marker, i + 1);
+        } else {
+            uiWidgetPrintf(WIDGET_HOST + i, stateColor(host.state), "%c%d %s %d",
+                marker, i + 1, stateShortName(host.state), host.rssi);
+        }
+    }
+}
+
+static void updateMainPage(const UiModel& model) {
+    updateHostRows(model);
     
     // BLE статус
-    Disbuff->setTextColor(connected ? GREEN : RED);
-    Disbuff->setCursor(5, 0);
-    Disbuff->printf("BLE:%s", connected ? "OK" : "NO");
+    uiWidgetPrintf(WIDGET_BLE, model.connected ? GREEN : RED, "BLE:%s", model.connected ? "OK" : "NO");
     
-    if (connected) {
-        // RSSI
-        Disbuff->setTextColor(WHITE);
-        Disbuff->setCursor(5, 12);
-        Disbuff->printf("RS:%d", lastAverageRssi);
-        
-        // Среднее RSSI
-        Disbuff->setCursor(5, 24);
-        Disbuff->printf("AV:%d", lastAverageRssi);
+    if (model.connected) {
+        // RSSI и среднее RSSI
+        uiWidgetPrintf(WIDGET_RSSI, WHITE, "RS:%d", model.rssiRaw);
+        uiWidgetPrintf(WIDGET_AVERAGE, WHITE, "AV:%d", model.rssi);
         
         // Состояние
-        Disbuff->setCursor(5, 36);
-        Disbuff->printf("ST:");
-        switch (currentState) {
+        uiWidgetPrintf(WIDGET_STATE_LABEL, WHITE, "ST:");
+        switch (model.state) {
             case NORMAL: 
-                Disbuff->setTextColor(GREEN);
-                Disbuff->print("NORM"); 
+                uiWidgetPrintf(WIDGET_STATE, GREEN, "NORM");
                 break;
             case MOVING_AWAY: 
-                Disbuff->setTextColor(YELLOW);
-                Disbuff->printf("AWAY:%d", 
-                    (MOVEMENT_TIME - (millis() - movementStartTime)) / 1000);
+                uiWidgetPrintf(WIDGET_STATE, YELLOW, "AWAY:%d", model.awaySecondsLeft);
                 break;
             case LOCKED: 
-                Disbuff->setTextColor(RED);
-                Disbuff->print("LOCK"); 
+                uiWidgetPrintf(WIDGET_STATE, RED, "LOCK");
                 break;
             case APPROACHING: 
-                Disbuff->setTextColor(BLUE);
-                Disbuff->print("APPR"); 
+                uiWidgetPrintf(WIDGET_STATE, BLUE, "APPR");
                 break;
         }
         
-        // Счетчик движения (65px)
-        if (currentState == MOVING_AWAY) {
-            Disbuff->setCursor(5, 48);
-            Disbuff->setTextColor(YELLOW);
-            Disbuff->printf("CNT:%d/%d", lastMovementCount, MOVEMENT_SAMPLES);
+        // Счетчик движения
+        if (model.state == MOVING_AWAY) {
+            uiWidgetPrintf(WIDGET_MOVEMENT, YELLOW, "CNT:%d/%d", model.movementCount, MOVEMENT_SAMPLES);
+        } else {
+            uiWidgetClear(WIDGET_MOVEMENT);
         }
         
-        // Разница RSSI (80px)
-        Disbuff->setCursor(5, 60);
-        Disbuff->setTextColor(WHITE);
-        static int lastRssiDiff = 0;
-        static int previousRssi = 0;
-        lastRssiDiff = lastAverageRssi - previousRssi;
-        previousRssi = lastAverageRssi;
-        if (currentState == MOVING_AWAY || currentState == NORMAL) {
-            if (lastRssiDiff < 0) {
-                Disbuff->setTextColor(RED);    // Красный для удаления
-                Disbuff->printf("<<:%d", abs(lastRssiDiff));  // Стрелки влево
-            } else if (lastRssiDiff > 0) {
-                Disbuff->setTextColor(GREEN);  // Зеленый для приближения
-                Disbuff->printf(">>:%d", lastRssiDiff);       // Стрелки вправо
+        // Разница RSSI
+        if (model.state == MOVING_AWAY || model.state == NORMAL) {
+            if (model.rssiDiff < 0) {
+                uiWidgetPrintf(WIDGET_DIFF, RED, "<<:%d", abs(model.rssiDiff));    // Удаление
+            } else if (model.rssiDiff > 0) {
+                uiWidgetPrintf(WIDGET_DIFF, GREEN, ">>:%d", model.rssiDiff);       // Приближение
             } else {
-                Disbuff->setTextColor(YELLOW); // Желтый для отсутствия движения
-                Disbuff->printf("==:%d", lastRssiDiff);       // Равно для стабильности
+                uiWidgetPrintf(WIDGET_DIFF, YELLOW, "==:%d", model.rssiDiff);      // Нет движения
             }
-        }
-        
-        // Уровень сигнала (95px)
-        Disbuff->setCursor(5, 72);
-        if (lastAverageRssi > -50) {
-            Disbuff->setTextColor(GREEN);
-            Disbuff->print("SIG:HIGH");
-        } else if (lastAverageRssi > SIGNAL_LOSS_THRESHOLD) {
-            Disbuff->setTextColor(YELLOW);
-            Disbuff->print("SIG:MID");
         } else {
-            Disbuff->setTextColor(RED);
-            if (weakSignalStartTime > 0) {
-                int timeLeft = (SIGNAL_LOSS_TIME - (millis() - weakSignalStartTime)) / 1000;
-                Disbuff->printf("SIG:%ds", timeLeft);
-            } else {
-                Disbuff->print("SIG:LOW");
-            }
+            uiWidgetClear(WIDGET_DIFF);
         }
         
-        // Динамические пороги (lock/unlock)
-        Disbuff->setTextSize(1);
-        Disbuff->setTextColor(WHITE);
-        Disbuff->setCursor(5, 84);
-        Disbuff->printf("L:%d  U:%d", dynamicLockThreshold, dynamicUnlockThreshold);
-        Disbuff->setTextSize(1);
-        
-        // Пароль (110px)
-        Disbuff->setCursor(5, 96);
-        Disbuff->setTextSize(1);
-        if (getPasswordForDevice(connectedDeviceAddress.c_str()).length() > 0) {
-            Disbuff->setTextColor(GREEN);
-            Disbuff->print("PWD:OK");
+        // Уровень сигнала
+        if (model.rssi > -50) {
+            uiWidgetPrintf(WIDGET_SIGNAL, GREEN, "SIG:HIGH");
+        } else if (model.rssi > SIGNAL_LOSS_THRESHOLD) {
+            uiWidgetPrintf(WIDGET_SIGNAL, YELLOW, "SIG:MID");
+        } else if (model.signalSecondsLeft >= 0) {
+            uiWidgetPrintf(WIDGET_SIGNAL, RED, "SIG:%ds", model.signalSecondsLeft);
         } else {
-            Disbuff->setTextColor(RED);
-            Disbuff->print("PWD:NO");
+            uiWidgetPrintf(WIDGET_SIGNAL, RED, "SIG:LOW");
         }
         
-        // Индикатор заряда батареи (122px)
-        Disbuff->setCursor(5, 108);
-        Disbuff->setTextSize(1);
+        // Динамические пороги (lock/unlock)
+        uiWidgetPrintf(WIDGET_THRESHOLDS, WHITE, "L:%d  U:%d", model.lockThreshold, model.unlockThreshold);
         
-        // Устанавливаем цвет в зависимости от уровня заряда
-        uint16_t batteryColor;
-        if (currentBatteryLevel > 75) {
-            batteryColor = GREEN;
-        } else if (currentBatteryLevel > 25) {
-            batteryColor = YELLOW;
+        // Пароль
+        if (model.hasPassword) {
+            uiWidgetPrintf(WIDGET_PASSWORD, GREEN, "PWD:OK");
         } else {
-            batteryColor = RED;
+            uiWidgetPrintf(WIDGET_PASSWORD, RED, "PWD:NO");
         }
-        Disbuff->setTextColor(batteryColor);
-        
-        // Отображаем статус зарядки и уровень заряда
-        Disbuff->printf("BAT:%d%%%s", (int)currentBatteryLevel, isCharging ? "+" : "");
-        
-        // Отображаем графический индикатор заряда
-        drawBatteryIndicator(5, 120, 30, 10, currentBatteryLevel, isCharging);
     } else {
         // Если не подключены, показываем только статус батареи
-        Disbuff->setCursor(5, 108);
-        Disbuff->setTextSize(1);
-        
-        // Устанавливаем цвет в зависимости от уровня заряда
-        uint16_t batteryColor;
-        if (currentBatteryLevel > 75) {
-            batteryColor = GREEN;
-        } else if (currentBatteryLevel > 25) {
-            batteryColor = YELLOW;
+        static const uint8_t connectedOnly[] = {
+            WIDGET_RSSI, WIDGET_AVERAGE, WIDGET_STATE_LABEL, WIDGET_STATE, WIDGET_MOVEMENT,
+            WIDGET_DIFF, WIDGET_SIGNAL, WIDGET_THRESHOLDS, WIDGET_PASSWORD
+        };
+        for (uint8_t id : connectedOnly) {
+            uiWidgetClear(id);
+        }
+    }
+    
+    // Статус зарядки, уровень заряда и графический индикатор
+    uiWidgetPrintf(WIDGET_BATTERY_TEXT, batteryColorFor(model.batteryLevel),
+        "BAT:%d%%%s", model.batteryLevel, model.charging ? "+" : "");
+    uiWidgetValue(WIDGET_BATTERY_ICON, ((uint32_t)model.batteryLevel << 1) | (model.charging ? 1 : 0),
+        drawBatteryWidget);
+}
+
+// Снимок, по которому рисуются столбцы графика RSSI
+static const UiModel* plotModel = nullptr;
+
+static int16_t rssiPlotY(int rssi, int16_t y, int16_t h) {
+    rssi = constrain(rssi, RSSI_PLOT_MIN, RSSI_PLOT_MAX);
+    return y + (int32_t)(RSSI_PLOT_MAX - rssi) * (h - 1) / (RSSI_PLOT_MAX - RSSI_PLOT_MIN);
+}
+
+// Столбец графика: пороги блокировки и разблокировки и отрезок от предыдущего отсчёта
+static void drawRssiColumn(M5Canvas* canvas, int16_t x, int16_t y, int16_t h, uint32_t sample) {
+    const UiModel& model = *plotModel;
+    if (model.rssiTraceCount - sample > RSSI_TRACE_SIZE) {
+        return;  // Отсчёт уже вытеснен из кольца
+    }
+    canvas->drawPixel(x, rssiPlotY(model.lockThreshold, y, h), uiColor(RED));
+    canvas->drawPixel(x, rssiPlotY(model.unlockThreshold, y, h), uiColor(GREEN));
+    int16_t current = rssiPlotY(model.rssiTrace[sample % RSSI_TRACE_SIZE], y, h);
+    int16_t previous = current;
+    if (sample > 0 && model.rssiTraceCount - (sample - 1) <= RSSI_TRACE_SIZE) {
+        previous = rssiPlotY(model.rssiTrace[(sample - 1) % RSSI_TRACE_SIZE], y, h);
+    }
+    canvas->drawFastVLine(x, min(previous, current), abs(current - previous) + 1, uiColor(WHITE));
+}
+
+// График среднего RSSI: за кадр дорисовываются только новые отсчёты
+static void updateRssiPage(const UiModel& model) {
+    uiWidgetPrintf(WIDGET_RSSI_TITLE, CYAN, "H%d RSSI %d dBm  L:%d U:%d",
+        model.focusHost + 1, model.rssi, model.lockThreshold, model.unlockThreshold);
+    plotModel = &model;
+    uint32_t style = ((uint32_t)(model.lockThreshold & 0xFFFF) << 16) | (model.unlockThreshold & 0xFFFF);
+    uiWidgetScroll(WIDGET_RSSI_PLOT, model.rssiTraceCount, style, drawRssiColumn);
+    uiWidgetPrintf(WIDGET_RSSI_LEGEND, WHITE, "%d..%d dBm  L red  U green",
+        RSSI_PLOT_MIN, RSSI_PLOT_MAX);
+}
+
+static void drawLatencyBar(M5Canvas* canvas, int16_t x, int16_t y, uint32_t value) {
+    if (value > 0) {
+        canvas->fillRect(x, y, value, FONT_HEIGHT, uiColor(CYAN));
+    }
+}
+
+// Гистограмма задержки HID-отчётов; полосы масштабируются по самой заполненной корзине
+static void updateLatencyPage(const ConnLatencyHistogram& histogram) {
+    uint32_t total = 0;
+    uint32_t largest = 0;
+    for (int i = 0; i < CONN_LATENCY_BUCKETS; i++) {
+        total += histogram.counts[i];
+        largest = max(largest, histogram.counts[i]);
+    }
+    uiWidgetPrintf(WIDGET_LATENCY_TITLE, CYAN, "HID LATENCY n=%lu max %.1fms",
+        (unsigned long)total, histogram.maxUs / 1000.0f);
+    for (int i = 0; i < CONN_LATENCY_BUCKETS; i++) {
+        if (i < CONN_LATENCY_BUCKETS - 1) {
+            uiWidgetPrintf(WIDGET_LATENCY_LABEL + i, WHITE, "<%-3u %6lu", CONN_LATENCY_BUCKET_MS[i],
+                (unsigned long)histogram.counts[i]);
         } else {
-            batteryColor = RED;
+            uiWidgetPrintf(WIDGET_LATENCY_LABEL + i, WHITE, ">=%-3u%6lu", CONN_LATENCY_BUCKET_MS[i - 1],
+                (unsigned long)histogram.counts[i]);
         }
-        Disbuff->setTextColor(batteryColor);
-        
-        // Отображаем статус зарядки и уровень заряда
-        Disbuff->printf("BAT:%d%%%s", (int)currentBatteryLevel, isCharging ? "+" : "");
-        
-        // Отображаем графический индикатор заряда
-        drawBatteryIndicator(5, 120, 30, 10, currentBatteryLevel, isCharging);
+        uint32_t bar = largest ? histogram.counts[i] * LATENCY_BAR_WIDTH / largest : 0;
+        uiWidgetValue(WIDGET_LATENCY_BAR + i, bar, drawLatencyBar);
+    }
+}
+
+// Отрисовка снимка; выполняется только в задаче UI
+static void renderDisplay(const UiModel& model) {
+    // Панель выключена или подсветка погашена: кадр не рисуется и не передаётся
+    if (!uiFrameBegin(&M5.Display)) {
+        return;
+    }
+    PowerBoostGuard boost(POWER_BOOST_RENDER);
+    uiSetPage(model.page);
+    switch (model.page) {
+        case UI_PAGE_MESSAGE:
+            // Кнопка A удерживается дольше LONG_PRESS_DURATION
+            uiWidgetClear(WIDGET_MESSAGE);
+            uiWidgetPrintf(WIDGET_LONG_PRESS, GREEN, "RSSI thresholds set");
+            break;
+        case UI_PAGE_ENERGY:
+            updateEnergyPage(model.energy);
+            break;
+        case UI_PAGE_RSSI:
+            updateRssiPage(model);
+            break;
+        case UI_PAGE_LATENCY:
+            updateLatencyPage(model.latency);
+            break;
+        default:
+            updateMainPage(model);
+            break;
+    }
+    uiFrameEnd(&M5.Display);
+}
+
+// Публикует новый снимок для экрана. Экраном и подсветкой управляет только задача UI:
+// она сама заберёт снимок к следующему кадру, очередь для этого не нужна
+void updateDisplay() {
+    static int previousRssi = 0;
+    int64_t startUs = esp_timer_get_time();
+    UiModel model = {};
+    model.page = longPressShown ? UI_PAGE_MESSAGE : shownPage;
+    syncHosts();
+    for (int i = 0; i < HOST_MAX; i++) {
+        const HostContext& host = hosts[i];
+        model.hosts[i] = { host.address[0] != '\0', hostConnected(i), host.state, host.lastAverageRssi };
+    }
+    model.focusHost = focusHost;
+    model.connected = hostConnected(focusHost);
+    const RssiMeasurement& lastMeasurement = rssiHistory[(rssiHistoryIndex + RSSI_HISTORY_SIZE - 1) % RSSI_HISTORY_SIZE];
+    model.rssiRaw = lastMeasurement.isValid ? lastMeasurement.value : lastAverageRssi;
+    model.rssi = lastAverageRssi;
+    model.rssiDiff = lastAverageRssi - previousRssi;
+    previousRssi = lastAverageRssi;
+    model.state = currentState;
+    model.awaySecondsLeft = (int)((MOVEMENT_TIME - (millis() - movementStartTime)) / 1000);
+    model.movementCount = lastMovementCount;
+    model.signalSecondsLeft = weakSignalStartTime > 0
+        ? (int)((SIGNAL_LOSS_TIME - (millis() - weakSignalStartTime)) / 1000) : -1;
+    model.lockThreshold = dynamicLockThreshold;
+    model.unlockThreshold = dynamicUnlockThreshold;
+    model.hasPassword = model.connected && hosts[focusHost].hasPassword;
+    // Данные о батарее из последнего опроса PMIC, без обращения к шине
+    model.batteryLevel = (int)powerManager.batteryLevel();
+    model.charging = powerManager.isCharging();
+    if (model.page == UI_PAGE_ENERGY) {
+        energyMeterReport(model.energy, powerManager.batteryLevel());
+    } else if (model.page == UI_PAGE_LATENCY) {
+        connParamPolicyLatencyHistogram(model.latency);
+    } else if (model.page == UI_PAGE_RSSI) {
+        model.rssiTraceCount = rssiTraceCount;
+        memcpy(model.rssiTrace, rssiTrace, sizeof(model.rssiTrace));
     }
     
-    Disbuff->pushSprite(0, 0);
+    model.publishUs = (uint32_t)(esp_timer_get_time() - startUs);
+    
+    portENTER_CRITICAL(&uiModelLock);
+    model.sequence = publishedModel.sequence + 1;
+    publishedModel = model;
+    portEXIT_CRITICAL(&uiModelLock);
+}
+
+static uint32_t readUiModel(UiModel& model) {
+    portENTER_CRITICAL(&uiModelLock);
+    model = publishedModel;
+    portEXIT_CRITICAL(&uiModelLock);
+    return model.sequence;
+}
+
+static void setDisplayBrightness(uint8_t brightness) {
+    UiEvent event = { UI_EVENT_BRIGHTNESS, brightness, 0, nullptr };
+    taskMonitorSend(uiQueue, &event);
+}
+
+// Кадр вне очереди из последнего снимка (рабочий набор консоль не трогает)
+static void requestRedraw() {
+    UiEvent event = { UI_EVENT_REDRAW, 0, 0, nullptr };
+    taskMonitorSend(uiQueue, &event);
+}
+
+// Панель выключается на время режима сна; при включении экран перерисовывается
+static void setDisplaySleep(bool sleep) {
+    UiEvent event = { sleep ? UI_EVENT_SLEEP : UI_EVENT_WAKE, 0, 0, nullptr };
+    taskMonitorSend(uiQueue, &event);
+}
+
+// Сообщение поверх экрана до следующей перерисовки
+static void showDisplayMessage(const char* text, uint16_t color) {
+    UiEvent event = { UI_EVENT_MESSAGE, 0, color, text };
+    taskMonitorSend(uiQueue, &event);
 }
 
 // Добавляем функцию отрисовки индикатора батареи
-void drawBatteryIndicator(int x, int y, int width, int height, float batteryLevel, bool isCharging) {
-    // Устанавливаем цвет в зависимости от уровня заряда
-    uint16_t batteryColor;
-    if (batteryLevel > 75) {
-        batteryColor = GREEN;
-    } else if (batteryLevel > 25) {
-        batteryColor = YELLOW;
-    } else {
-        batteryColor = RED;
-    }
+void drawBatteryIndicator(M5Canvas* canvas, int x, int y, int width, int height, float batteryLevel, bool isCharging) {
+    // Устанавливаем цвет в зависимости от уровня заряда (в буфере с палитрой - номер цвета)
+    uint16_t batteryColor = uiColor(batteryColorFor(batteryLevel));
+    uint16_t outlineColor = uiColor(WHITE);
     
     const int capWidth = 3;   // Ширина выступа батарейки
     const int capHeight = 4;  // Высота выступа батарейки
     
     // Рисуем основную часть батарейки (прямоугольник)
-    Disbuff->drawRect(x, y, width, height, WHITE);
+    canvas->drawRect(x, y, width, height, outlineColor);
     
     // Рисуем выступ (положительный контакт) батарейки
-    Disbuff->fillRect(
+    canvas->fillRect(
         x + width, 
         y + (height - capHeight) / 2, 
         capWidth, 
         capHeight, 
-        WHITE
+        outlineColor
     );
     
     // Вычисляем ширину заполненной части батарейки
@@ -538,19 +1081,19 @@ void drawBatteryIndicator(int x, int y, int width, int height, float batteryLeve
     
     // Заполняем внутреннюю часть батарейки
     if (fillWidth > 0) {
-        Disbuff->fillRect(x + 1, y + 1, fillWidth, height - 2, batteryColor);
+        canvas->fillRect(x + 1, y + 1, fillWidth, height - 2, batteryColor);
         
         // Рисуем деления внутри батарейки
         if (width > 10) {
             for (int i = 1; i < 5; i++) {
                 int lineX = x + i * (width / 5);
                 if (lineX < x + fillWidth) continue; // Не рисуем линии в заполненной части
-                Disbuff->drawLine(
+                canvas->drawLine(
                     lineX, 
                     y + 1, 
                     lineX, 
                     y + height - 2, 
-                    WHITE
+                    outlineColor
                 );
             }
         }
@@ -558,449 +1101,52 @@ void drawBatteryIndicator(int x, int y, int width, int height, float batteryLeve
     
     // Добавляем значок молнии если заряжается
     if (isCharging) {
-        Disbuff->setTextColor(YELLOW);
-        Disbuff->setCursor(x + width + capWidth + 2, y);
-        Disbuff->print("+"); // Используем "+", т.к. символ молнии может не поддерживаться
+        canvas->setTextColor(uiColor(YELLOW));
+        canvas->setCursor(x + width + capWidth + 2, y);
+        canvas->print("+"); // Используем "+", т.к. символ молнии может не поддерживаться
     }
 }
 
-// Сначала объявляем класс для колбэков сканирования
-class MyScanCallbacks: public NimBLEScanCallbacks {
-private:
-    NimBLEAdvertisedDevice* targetDevice = nullptr;
-    
-public:
-    void onResult(NimBLEAdvertisedDevice* advertisedDevice) {
-        if (!connected || !scanMode) return;  // Пропускаем если не подключены
-        
-        if (advertisedDevice->isAdvertisingService(NimBLEUUID("1812"))) {  // 0x1812 - HID Service
-            if (serialOutputEnabled) {
-                Serial.printf("\nFound HID device: %s, RSSI: %d\n", 
-                    advertisedDevice->getAddress().toString().c_str(),
-                    advertisedDevice->getRSSI());
-            }
-            
-            // Сохраняем устройство и останавливаем сканирование
-            if (targetDevice != nullptr) {
-                delete targetDevice;
-            }
-            targetDevice = new NimBLEAdvertisedDevice(*advertisedDevice);
-            NimBLEDevice::getScan()->stop();
-            
-            // Пытаемся подключиться
-            if (bleServer && !connected) {
-                connectedDeviceAddress = targetDevice->getAddress().toString();
-                connected = true;
-                // Загружаем сохранённые пороги для этого устройства
-                {
-                    DeviceSettings ds = getDeviceSettings(connectedDeviceAddress.c_str());
-                    dynamicLockThreshold = ds.lockRssi;
-                    dynamicUnlockThreshold = ds.unlockRssi;
-                    if (serialOutputEnabled) {
-                        Serial.printf("Scan loaded thresholds: lock=%d, unlock=%d\n", 
-                            dynamicLockThreshold, dynamicUnlockThreshold);
-                    }
-                }
-                updateDisplay();
-            }
-        }
-    }
-    
-    ~MyScanCallbacks() {
-        if (targetDevice != nullptr) {
-            delete targetDevice;
-        }
-    }
-};
-
-// Затем объявляем глобальные переменные
 static NimBLEScan* pScan = nullptr;
-static MyScanCallbacks* scanCallbacks = new MyScanCallbacks();
 
 // Переносим определения ПЕРЕД классом ServerCallbacks
 
 // Добавляем предварительное объявление для adjustBrightness
 void adjustBrightness(esp_power_level_t txPower);
-bool isUSBConnected();
 
 // Затем класс для колбэков сервера
 class ServerCallbacks : public NimBLEServerCallbacks {
-    void onConnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) {
-        if (serialOutputEnabled) {
-            Serial.println("\n=== BLE Connection Start ===");
-            Serial.printf("Device: %s\n", NimBLEAddress(desc->peer_ota_addr).toString().c_str());
-            Serial.printf("Connection Handle: %d\n", desc->conn_handle);
-            Serial.printf("Role: %d\n", desc->role);
-            Serial.printf("Connection Interval: %d\n", desc->conn_itvl);
-            Serial.printf("Latency: %d, Supervision Timeout: %d\n", desc->conn_latency, desc->supervision_timeout);
-            Serial.printf("Security State: %d\n", desc->sec_state.encrypted);
-            Serial.printf("Time: %lu ms\n", millis());
-        }
-
-        connected = true;
-        connectedDeviceAddress = NimBLEAddress(desc->peer_ota_addr).toString();
-        
-        // Обновляем короткий ключ устройства
-        updateCurrentShortKey(connectedDeviceAddress.c_str());
-        
-        if (serialOutputEnabled) {
-            Serial.println("Short key updated");
-        }
+    // Колбэки NimBLE 2.x выполняются в задаче стека: событие только ставится в очередь
+    // и будит задачу опроса
+    void onConnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo) override {
+        ConnEvent event = { CONN_EVENT_CONNECT, connInfo.getConnHandle(), 0 };
+        taskMonitorSend(connQueue, &event);
+        powerModeWake();
+    }
 
-        // Сохраняем информацию о подключении
-        connection_info.connected = true;
-        connection_info.conn_handle = desc->conn_handle;
-        connection_info.address = NimBLEAddress(desc->peer_ota_addr).toString();
-        
-        // Добавляем отладочную информацию о сохраненном адресе
-        if (serialOutputEnabled) {
-            Serial.println("\n=== Connection Info Debug ===");
-            Serial.printf("Connected: %s\n", connection_info.connected ? "Yes" : "No");
-            Serial.printf("Connection Handle: %d\n", connection_info.conn_handle);
-            Serial.printf("Device Address: '%s'\n", connection_info.address.c_str());
-            Serial.printf("Address Length: %d\n", connection_info.address.length());
-            Serial.printf("Connected Device Address: '%s'\n", connectedDeviceAddress.c_str());
-            Serial.println("=== End Connection Info Debug ===\n");
-        }
-        
-        // Проверяем, есть ли пароль для этого устройства
-        String password = getPasswordForDevice(connectedDeviceAddress.c_str());
-        if (password.length() == 0) {
-            // Если пароля нет, сохраняем пароль по умолчанию
-            if (serialOutputEnabled) {
-                Serial.println("No password found for this device. Saving default password.");
-            }
-            // Вместо вызова savePasswordForDevice используем прямой вызов функций
-            DeviceSettings settings = getDeviceSettings(connectedDeviceAddress.c_str());
-            settings.password = encryptPassword("12345");
-            saveDeviceSettings(connectedDeviceAddress.c_str(), settings);
-            
-            if (serialOutputEnabled) {
-                Serial.printf("Saving password for device: %s\n", connectedDeviceAddress.c_str());
-                Serial.printf("Password length: %d\n", 5);
-                Serial.printf("Encrypted length: %d\n", settings.password.length());
-            }
+    void onDisconnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo, int reason) override {
+        ConnEvent event = { CONN_EVENT_DISCONNECT, connInfo.getConnHandle(), reason };
+        taskMonitorSend(connQueue, &event);
+        powerModeWake();
+    }
+
+    // Шифрование завершено: при переподключении ключи взяты из bond, при сопряжении bond только что записан
+    void onAuthenticationComplete(NimBLEConnInfo& connInfo) override {
+        if (connInfo.isEncrypted()) {
+            ConnEvent event = { CONN_EVENT_ENCRYPTED, connInfo.getConnHandle(), 0 };
+            taskMonitorSend(connQueue, &event);
         }
-        
-        // Сохраняем адрес устройства в NVS для восстановления после перезагрузки
-        if (serialOutputEnabled) {
-            Serial.println("Saving device address to NVS...");
+    }
+};
+
+// Хост подписался на отчёты клавиатуры (у сопряжённого хоста подписку восстанавливает стек
+// после шифрования) - с этого момента нажатия доходят до компьютера
+class InputReportCallbacks : public NimBLECharacteristicCallbacks {
+    void onSubscribe(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& connInfo, uint16_t subValue) override {
+        if (subValue & 0x0001) {
+            ConnEvent event = { CONN_EVENT_HID_READY, connInfo.getConnHandle(), 0 };
+            taskMonitorSend(connQueue, &event);
         }
-        
-        // Сохраняем адрес устройства
-        esp_err_t err = nvs_set_str(nvsHandle, KEY_LAST_ADDR, connectedDeviceAddress.c_str());
-        if (err != ESP_OK) {
-            if (serialOutputEnabled) {
-                Serial.printf("Error saving device address: %d\n", err);
-            }
-        } else {
-            // Сохраняем флаг, что устройство было сопряжено
-            err = nvs_set_u8(nvsHandle, "paired", 1);
-            if (err != ESP_OK) {
-                if (serialOutputEnabled) {
-                    Serial.printf("Error saving paired flag: %d\n", err);
-                }
-            } else {
-                // Сохраняем дополнительную информацию о подключении
-                err = nvs_set_u16(nvsHandle, "conn_handle", desc->conn_handle);
-                if (err != ESP_OK && serialOutputEnabled) {
-                    Serial.printf("Error saving connection handle: %d\n", err);
-                }
-                
-                // Сохраняем время последнего подключения
-                err = nvs_set_u32(nvsHandle, "last_conn_time", millis());
-                if (err != ESP_OK && serialOutputEnabled) {
-                    Serial.printf("Error saving connection time: %d\n", err);
-                }
-                
-                // Фиксируем изменения
-                err = nvs_commit(nvsHandle);
-                if (err != ESP_OK) {
-                    if (serialOutputEnabled) {
-                        Serial.printf("Error committing pairing info: %d\n", err);
-                    }
-                } else if (serialOutputEnabled) {
-                    Serial.println("Pairing information saved to NVS successfully");
-                }
-            }
-        }
-
-        // Приостанавливаем сканирование на время подключения
-        if (pScan->isScanning()) {
-            if (serialOutputEnabled) {
-                Serial.println("Stopping scan during connection...");
-            }
-            pScan->stop();
-        }
-
-        if (serialOutputEnabled) {
-            Serial.println("=== BLE Connection Complete ===\n");
-        }
-        
-        // Проверяем, было ли устройство заблокировано
-        bool wasLocked = loadDeviceLockState(connectedDeviceAddress.c_str()); // Проверяем состояние блокировки для этого устройства
-        if (wasLocked) {
-            // Устанавливаем состояние LOCKED
-            currentState = LOCKED;
-            lastStateChangeTime = millis() - STATE_CHANGE_DELAY / 2;
-            consecutiveLockSamples = 0;
-            consecutiveUnlockSamples = 0;
-            if (serialOutputEnabled) {
-                Serial.println("Device was locked before reconnection.");
-                Serial.printf("Current RSSI: %d, unlock threshold: %d\n", lastAverageRssi, dynamicUnlockThreshold);
-                Serial.println("Will monitor signal strength and unlock when stable.");
-            }
-            // Автоматически разблокируем, если уже рядом
-            if (lastAverageRssi > dynamicUnlockThreshold) {
-                if (serialOutputEnabled) {
-                    Serial.println("Auto-unlock on reconnect as device is in range");
-                }
-                unlockComputer();
-                currentState = NORMAL;
-            }
-        } else {
-            // Убедимся, что состояние точно 0, если ключ был найден, но значение было не 1
-             int8_t lockedCheckValue; // Используем временную переменную
-             if (nvs_get_i8(nvsHandle, KEY_IS_LOCKED, &lockedCheckValue) == ESP_OK && lockedCheckValue != 0) {
-                 saveGlobalLockState(false); // Теперь должно быть видно
-             }
-        }
-        // Загружаем сохраненные пороги для этого устройства и применяем их
-        {
-            DeviceSettings devSettings = getDeviceSettings(connectedDeviceAddress.c_str());
-            dynamicLockThreshold = devSettings.lockRssi;
-            dynamicUnlockThreshold = devSettings.unlockRssi;
-            if (serialOutputEnabled) {
-                Serial.printf("Loaded thresholds: lock=%d, unlock=%d\n",
-                    dynamicLockThreshold, dynamicUnlockThreshold);
-            }
-        }
-    }
-
-    void onDisconnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) {
-        if (serialOutputEnabled) {
-            Serial.println("\n=== BLE Device Disconnected ===");
-            Serial.printf("Device: %s\n", NimBLEAddress(desc->peer_ota_addr).toString().c_str());
-            Serial.printf("Connection Handle: %d\n", desc->conn_handle);
-            Serial.printf("Security State: %d\n", desc->sec_state.encrypted);
-            Serial.printf("Time: %lu ms\n", millis());
-            
-            // Добавляем отладочную информацию о текущем состоянии connection_info
-            Serial.println("\n=== Connection Info Before Disconnect ===");
-            Serial.printf("Connected: %s\n", connection_info.connected ? "Yes" : "No");
-            Serial.printf("Connection Handle: %d\n", connection_info.conn_handle);
-            Serial.printf("Device Address: '%s'\n", connection_info.address.c_str());
-            Serial.printf("Address Length: %d\n", connection_info.address.length());
-            Serial.printf("Connected Device Address: '%s'\n", connectedDeviceAddress.c_str());
-            Serial.println("=== End Connection Info ===\n");
-        }
-        
-        // Сохраняем адрес устройства перед отключением
-        std::string lastAddress = connection_info.address;
-        
-        connected = false;
-        
-        // Обновляем информацию о подключении, но сохраняем адрес
-        connection_info.connected = false;
-        connection_info.conn_handle = BLE_HS_CONN_HANDLE_NONE;
-        // НЕ сбрасываем адрес, чтобы его можно было использовать для получения пароля
-        // connection_info.address = "";
-        
-        // Сохраняем адрес устройства при отключении, если компьютер заблокирован
-        if (currentState == LOCKED) {
-            if (serialOutputEnabled) {
-                Serial.println("Device disconnected while locked. Saving last address...");
-            }
-            
-            // Сохраняем адрес последнего подключенного устройства
-            esp_err_t err = nvs_set_str(nvsHandle, KEY_LAST_ADDR, connectedDeviceAddress.c_str());
-            if (err != ESP_OK) {
-                if (serialOutputEnabled) {
-                    Serial.printf("Error saving last address: %d\n", err);
-                }
-            } else {
-                // Фиксируем изменения
-                err = nvs_commit(nvsHandle);
-                if (err != ESP_OK) {
-                    if (serialOutputEnabled) {
-                        Serial.printf("Error committing last address: %d\n", err);
-                    }
-                } else if (serialOutputEnabled) {
-                    Serial.println("Last address saved successfully");
-                }
-            }
-        }
-        
-        if (serialOutputEnabled) {
-            // Добавляем отладочную информацию о текущем состоянии connection_info после обновления
-            Serial.println("\n=== Connection Info After Disconnect ===");
-            Serial.printf("Connected: %s\n", connection_info.connected ? "Yes" : "No");
-            Serial.printf("Connection Handle: %d\n", connection_info.conn_handle);
-            Serial.printf("Device Address: '%s'\n", connection_info.address.c_str());
-            Serial.printf("Address Length: %d\n", connection_info.address.length());
-            Serial.printf("Connected Device Address: '%s'\n", connectedDeviceAddress.c_str());
-            Serial.printf("Last Address: '%s'\n", lastAddress.c_str());
-            Serial.println("=== End Connection Info ===\n");
-        }
-        
-        // Перезапускаем рекламу при отключении
-        if (serialOutputEnabled) {
-            Serial.println("Restarting advertising after disconnect...");
-        }
-        
-        // Добавляем задержку перед перезапуском рекламы
-        delay(100);
-        
-        // Перезапускаем рекламу с отладочной информацией
-        int rc = pServer->getAdvertising()->start();
-        if (serialOutputEnabled) {
-            Serial.printf("Restart advertising result: %d\n", rc);
-            if (rc != 0) {
-                Serial.println("Error restarting advertising after disconnect.");
-            }
-        }
-    }
-
-    // Добавляем колбэк для RSSI
-    void onRssiUpdate(NimBLEServer* pServer, int rssi) {
-        lastAverageRssi = rssi;
-        Serial.printf("RSSI Update: %d dBm\n", rssi);
-    }
-
-    // Добавляем методы безопасности
-    uint32_t onPassKeyRequest() {
-        Serial.println("=== Security: PassKey Request ===");
-        return 123456;
-    }
-
-    void onAuthenticationComplete(uint16_t conn_handle) {
-        Serial.println("=== Security: Authentication Complete ===");
-        Serial.printf("Connection handle: %d\n", conn_handle);
-    }
-
-    bool onConfirmPIN(uint32_t pin) {
-        Serial.printf("=== Security: Confirm PIN: %d ===\n", pin);
-        return true;
-    }
-
-    // Функция для адаптивного управления мощностью
-    void adjustTransmitPower(DeviceState state, int rssi) {
-        esp_power_level_t newPower;
-        static unsigned long lastPowerChangeTime = 0;
-        static esp_power_level_t lastPower = ESP_PWR_LVL_P9;
-        static bool isPowerGraduallyReducing = false;
-        
-        // Получаем настройки для подключенного устройства
-        DeviceSettings settings;
-        bool hasCustomSettings = false;
-        
-        if (connected && connectedDeviceAddress.length() > 0) {
-            settings = getDeviceSettings(connectedDeviceAddress.c_str());
-            hasCustomSettings = true;
-        }
-        
-        // Рассчитываем пороги RSSI на основе пользовательских настроек
-        int veryCloseThreshold = -35;  // По умолчанию
-        int closeThreshold = -45;
-        int mediumThreshold = -55;
-        int farThreshold = -65;
-        
-        if (hasCustomSettings) {
-            // Настраиваем пороги относительно значений lock/unlock
-            // Используем более щадящие пороги для обеспечения стабильной связи
-            int range = settings.unlockRssi - settings.lockRssi;
-            
-            if (range > 5) {
-                veryCloseThreshold = settings.unlockRssi;
-                closeThreshold = settings.unlockRssi - (range / 4);
-                mediumThreshold = settings.unlockRssi - (range / 2);
-                farThreshold = settings.lockRssi + 5; // Чуть лучше чем порог блокировки
-            }
-        }
-        
-        // Определяем базовую мощность на основе RSSI
-        esp_power_level_t basePower;
-        if (rssi > veryCloseThreshold) {
-            basePower = ESP_PWR_LVL_N9;  // Не используем самую низкую мощность N12 для надежности
-        } else if (rssi > closeThreshold) {
-            basePower = ESP_PWR_LVL_N6;
-        } else if (rssi > mediumThreshold) {
-            basePower = ESP_PWR_LVL_N3;
-        } else if (rssi > farThreshold) {
-            basePower = ESP_PWR_LVL_P3;
-        } else {
-            basePower = ESP_PWR_LVL_P9;  // Максимальная мощность
-        }
-        
-        // Если находимся в состоянии блокировки или удаления, нужно обеспечить надежный сигнал
-        if (state == MOVING_AWAY || state == LOCKED) {
-            // Для состояния MOVING_AWAY используем повышенную мощность
-            if (basePower < ESP_PWR_LVL_P3) {
-                basePower = ESP_PWR_LVL_P3;
-            }
-        }
-        
-        // Учитываем состояние зарядки
-        bool isUSB = isUSBConnected();
-        
-        if (!isUSB) {
-            // При работе от батареи постепенно снижаем мощность, не делая резких скачков
-            if (!isPowerGraduallyReducing && lastPower > basePower) {
-                isPowerGraduallyReducing = true;
-                lastPowerChangeTime = millis();
-            } else if (isPowerGraduallyReducing) {
-                // Проверяем, прошло ли достаточно времени для снижения мощности
-                unsigned long currentTime = millis();
-                if (currentTime - lastPowerChangeTime > 5000) { // 5 секунд между шагами снижения
-                    if (lastPower > basePower) {
-                        // Снижаем мощность на один шаг
-                        esp_power_level_t nextPower;
-                        switch (lastPower) {
-                            case ESP_PWR_LVL_P9: nextPower = ESP_PWR_LVL_P6; break;
-                            case ESP_PWR_LVL_P6: nextPower = ESP_PWR_LVL_P3; break;
-                            case ESP_PWR_LVL_P3: nextPower = ESP_PWR_LVL_N0; break;
-                            case ESP_PWR_LVL_N0: nextPower = ESP_PWR_LVL_N3; break;
-                            case ESP_PWR_LVL_N3: nextPower = ESP_PWR_LVL_N6; break;
-                            case ESP_PWR_LVL_N6: nextPower = ESP_PWR_LVL_N9; break;
-                            default: nextPower = basePower;
-                        }
-                        basePower = nextPower;
-                        lastPowerChangeTime = currentTime;
-                    } else {
-                        isPowerGraduallyReducing = false;
-                    }
-                } else {
-                    // Пока не прошло достаточно времени, используем предыдущую мощность
-                    basePower = lastPower;
-                }
-            }
-        } else {
-            // При работе от USB можем сразу использовать рассчитанную мощность
-            isPowerGraduallyReducing = false;
-        }
-        
-        // Применяем рассчитанную мощность
-        newPower = basePower;
-        
-        // Предотвращаем слишком низкую мощность при удалении
-        if (state == MOVING_AWAY && rssi < settings.lockRssi + 5) {
-            // Когда мы приближаемся к порогу блокировки, используем максимальную мощность
-            // чтобы гарантировать отправку команды блокировки
-            newPower = ESP_PWR_LVL_P9;
-        }
-        
-        // Применяем новую мощность, если она изменилась
-        if (newPower != lastPower) {
-            if (serialOutputEnabled) {
-                Serial.printf("Adjusting TX power: %d -> %d (RSSI: %d, State: %d, USB: %d)\n",
-                    lastPower, newPower, rssi, state, isUSB);
-            }
-            NimBLEDevice::setPower(newPower);
-            lastPower = newPower;
-        }
-        
-        // Регулируем яркость дисплея
-        adjustBrightness(newPower);
     }
 };
 
@@ -1054,6 +1200,7 @@ bool shouldLockComputer(int avgRssi) {
 String encryptPassword(const String& password);
 String decryptPassword(const String& encrypted);
 void clearAllPasswords();
+static void processConsoleCommands();
 
 // Определяем функции
 
@@ -1061,7 +1208,7 @@ void clearAllPasswords() {
     Serial.println("\n=== Clearing passwords ===");
     
     // Получаем список всех ключей
-    nvs_iterator_t it = nvs_entry_find("nvs", "m5kb_v1", NVS_TYPE_STR);
+    nvs_iterator_t it = nvs_entry_find("nvs", NVS_NAMESPACE, NVS_TYPE_STR);
     while (it != NULL) {
         nvs_entry_info_t info;
         nvs_entry_info(it, &info);
@@ -1141,10 +1288,9 @@ void listStoredDevices() {
     // Показываем последнее заблокированное устройство
     Serial.println("\nChecking last locked device:");
     char lastAddr[32] = {0};
-    size_t length = sizeof(lastAddr);
     String lastShortKey = "";
     
-    if (nvs_get_str(nvsHandle, KEY_LAST_ADDR, lastAddr, &length) == ESP_OK) {
+    if (loadLastAddress(lastAddr, sizeof(lastAddr))) {
         Serial.printf("  Last locked device: %s\n", lastAddr);
         if (strlen(lastAddr) > 0) {
             lastShortKey = cleanMacAddress(lastAddr); // Восстанавливаем вызов
@@ -1172,7 +1318,7 @@ void listStoredDevices() {
     
     // Показываем все сохраненные устройства
     Serial.println("\nChecking saved devices:");
-    nvs_iterator_t it = nvs_entry_find("nvs", "m5kb_v1", NVS_TYPE_STR);
+    nvs_iterator_t it = nvs_entry_find("nvs", NVS_NAMESPACE, NVS_TYPE_STR);
     while (it != NULL) {
         nvs_entry_info_t info;
         nvs_entry_info(it, &info);
@@ -1189,9 +1335,13 @@ void listStoredDevices() {
             size_t pwdLen = sizeof(pwd);
             if (nvs_get_str(nvsHandle, key.c_str(), pwd, &pwdLen) == ESP_OK && strlen(pwd) > 0) {
                 // Получаем RSSI пороги
+                NvsKeyBuffer unlockKey;
+                NvsKeyBuffer lockKey;
+                makeDeviceKey(DeviceKey::UnlockRssi, shortKey.c_str(), unlockKey);
+                makeDeviceKey(DeviceKey::LockRssi, shortKey.c_str(), lockKey);
                 int32_t unlockRssi, lockRssi;
-                if (nvs_get_i32(nvsHandle, ("unlock_" + shortKey).c_str(), &unlockRssi) == ESP_OK &&
-                    nvs_get_i32(nvsHandle, ("lock_" + shortKey).c_str(), &lockRssi) == ESP_OK) {
+                if (nvs_get_i32(nvsHandle, unlockKey, &unlockRssi) == ESP_OK &&
+                    nvs_get_i32(nvsHandle, lockKey, &lockRssi) == ESP_OK) {
                     
                     String status = "(SAVED)";
                     if (shortKey == currentShortKey) status = "(CURRENT)";
@@ -1211,8 +1361,8 @@ void listStoredDevices() {
     Serial.println("\n=== End Debug Info ===");
 }
 
-// Функция отправки одного символа
-void sendKey(char key) {
+// Функция отправки одного символа в соединение connHandle
+void sendKey(char key, uint16_t connHandle) {
     uint8_t keyCode = 0;
     uint8_t modifiers = 0;  // Используем отдельную переменную для модификаторов
     
@@ -1284,19 +1434,19 @@ void sendKey(char key) {
         }
         
         uint8_t msg[8] = {modifiers, 0, keyCode, 0, 0, 0, 0, 0};  // Используем modifiers напрямую
-        input->setValue(msg, sizeof(msg));
-        input->notify();
+        notifyHidReport(msg, connHandle);
         delay(50);
         
         // Отпускаем клавишу
         uint8_t release[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-        input->setValue(release, sizeof(release));
-        input->notify();
+        notifyHidReport(release, connHandle);
     }
 }
 
-// Функция ввода пароля
-void typePassword(const String& password) {
+// Функция ввода пароля в соединение connHandle
+void typePassword(const String& password, uint16_t connHandle) {
+    PowerBoostGuard boost(POWER_BOOST_HID);
+    connParamPolicyBeginHid(connHandle);
     if (serialOutputEnabled) {
         Serial.println("=== Typing password ===");
         Serial.printf("Password length: %d\n", password.length());
@@ -1313,7 +1463,7 @@ void typePassword(const String& password) {
     
     for (int i = 0; i < password.length(); i++) {
         char c = password[i];
-        sendKey(c);
+        sendKey(c, connHandle);
         // Добавляем задержку между символами для надежности
         delay(100);
     }
@@ -1327,14 +1477,12 @@ void typePassword(const String& password) {
     
     // Отправляем Enter
     uint8_t enter[8] = {0, 0, 0x28, 0, 0, 0, 0, 0};
-    input->setValue(enter, sizeof(enter));
-    input->notify();
+    notifyHidReport(enter, connHandle);
     delay(50);
     
     // Отпускаем Enter
     uint8_t release[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-    input->setValue(release, sizeof(release));
-    input->notify();
+    notifyHidReport(release, connHandle);
     
     if (serialOutputEnabled) {
         Serial.println("=== Password entry complete ===");
@@ -1344,36 +1492,72 @@ void typePassword(const String& password) {
 // Добавим константы для пароля по умолчанию
 static const char* DEFAULT_PASSWORD = "12345";  // Пример пароля
 
+// Команда консоли задаче опроса; задача опроса может спать до ближайшего задания - будим её
+static void postConsoleCommand(ConsoleCommandType type, const char* address = nullptr) {
+    ConsoleCommand cmd = {};
+    cmd.type = type;
+    if (address) {
+        strlcpy(cmd.address, address, sizeof(cmd.address));
+    }
+    if (!taskMonitorSend(consoleQueue, &cmd)) {
+        Serial.println("Console: control task queue full, command dropped");
+        return;
+    }
+    powerModeWake();
+}
+
+static void postConsoleThresholds(const char* address, int lockRssi, int unlockRssi) {
+    ConsoleCommand cmd = {};
+    cmd.type = CONSOLE_CMD_APPLY_THRESHOLDS;
+    strlcpy(cmd.address, address, sizeof(cmd.address));
+    cmd.lockRssi = lockRssi;
+    cmd.unlockRssi = unlockRssi;
+    if (taskMonitorSend(consoleQueue, &cmd)) {
+        powerModeWake();
+    }
+}
+
+// Хост на экране по копии таблицы слотов: консоль не читает рабочий набор задачи опроса
+static HostRow consoleHost() {
+    HostTable table;
+    readHostTable(table);
+    return table.rows[table.focusHost];
+}
+
+// Ввод пароля setpwd принимается по частям при каждом опросе консоли, как кадр импорта:
+// задача storage не ждёт ввода и продолжает обрабатывать запросы записи
+static const unsigned long PASSWORD_INPUT_TIMEOUT_MS = 60000;  // Пауза ввода, после которой setpwd отменяется
+
+struct PasswordInput {
+    bool active;
+    HostRow host;                   // Хост на момент команды: пароль и пороги - для него
+    String password;
+    unsigned long lastInputTime;
+};
+static PasswordInput passwordInput = {};
+
 // Добавляем функцию для ввода пароля через Serial
 void setPasswordFromSerial() {
+    HostRow host = consoleHost();
     Serial.println("\n=== Password Setup ===");
-    Serial.printf("Current device: %s\n", connectedDeviceAddress.c_str());
-    Serial.printf("Current RSSI: %d (Make sure you're at your normal working position)\n", lastAverageRssi);
+    Serial.printf("Current device: %s\n", host.address);
+    Serial.printf("Current RSSI: %d (Make sure you're at your normal working position)\n", host.lastAverageRssi);
     Serial.println("Enter new password (end with newline):");
     
-    String password = "";
-    while (true) {
-        if (Serial.available()) {
-            char c = Serial.read();
-            if (c == '\n' || c == '\r') {
-                if (password.length() > 0) {
-                    break;
-                }
-            } else {
-                password += c;
-                Serial.print("*");  // Маскируем ввод звездочками
-            }
-        }
-        delay(10);
-    }
-    Serial.println();
-    
+    passwordInput.active = true;
+    passwordInput.host = host;
+    passwordInput.password = "";
+    passwordInput.lastInputTime = millis();
+}
+
+// Пароль введён: сохраняем его и пороги относительно текущего уровня
+static void savePasswordFromSerial(const HostRow& host, const String& password) {
     // Сохраняем пароль и настройки RSSI
     DeviceSettings settings;
     settings.password = encryptPassword(password);
     
     // Устанавливаем пороги RSSI относительно текущего уровня
-    int baseRssi = lastAverageRssi;
+    int baseRssi = host.lastAverageRssi;
     settings.unlockRssi = baseRssi + 10;
     settings.lockRssi = baseRssi - 10;
     
@@ -1383,10 +1567,10 @@ void setPasswordFromSerial() {
         Serial.printf("Password length after encryption: %d\n", settings.password.length());
     }
     
-    saveDeviceSettings(connectedDeviceAddress.c_str(), settings);
+    saveDeviceSettings(host.address, settings);
     
     // Проверяем сохранение
-    DeviceSettings checkSettings = getDeviceSettings(connectedDeviceAddress.c_str());
+    DeviceSettings checkSettings = getDeviceSettings(host.address);
     if (checkSettings.password.length() == 0) {
         Serial.println("ERROR: Password was not saved correctly!");
         return;
@@ -1398,19 +1582,68 @@ void setPasswordFromSerial() {
     Serial.printf("Lock RSSI     : %d (-10 from base)\n", settings.lockRssi);
     Serial.printf("Critical level: %d (-35 from base)\n", baseRssi - 35);
     
-    // Обновляем динамические пороги после установки пароля и RSSI порогов
-    dynamicLockThreshold = settings.lockRssi;
-    dynamicUnlockThreshold = settings.unlockRssi;
-    if (serialOutputEnabled) {
-        Serial.printf("Dynamic thresholds updated via setpwd: lock=%d, unlock=%d\n",
-            dynamicLockThreshold, dynamicUnlockThreshold);
+    // Динамические пороги и признак пароля хоста обновит задача опроса
+    postConsoleThresholds(host.address, settings.lockRssi, settings.unlockRssi);
+    postConsoleCommand(CONSOLE_CMD_PASSWORD_CHANGED, host.address);
+}
+
+// Забирает уже пришедшие символы пароля, не дожидаясь остальных
+static void pollPasswordInput() {
+    while (Serial.available()) {
+        char c = Serial.read();
+        passwordInput.lastInputTime = millis();
+        if (c == '\n' || c == '\r') {
+            // Пустая строка (остаток "\r\n" после команды) пароль не завершает
+            if (passwordInput.password.length() > 0) {
+                Serial.println();
+                passwordInput.active = false;
+                savePasswordFromSerial(passwordInput.host, passwordInput.password);
+                passwordInput.password = "";
+                return;
+            }
+        } else {
+            passwordInput.password += c;
+            Serial.print("*");  // Маскируем ввод звездочками
+        }
+    }
+    if (millis() - passwordInput.lastInputTime > PASSWORD_INPUT_TIMEOUT_MS) {
+        passwordInput.active = false;
+        passwordInput.password = "";
+        Serial.println("\nPassword input timed out, password not changed");
     }
 }
 
+// Применяем импортированные пороги к хостам в слотах сразу
+static void applyImportedSettings() {
+    HostTable table;
+    readHostTable(table);
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (table.rows[slot].address[0] != '\0') {
+            int lockRssi, unlockRssi;
+            loadDeviceThresholds(table.rows[slot].address, lockRssi, unlockRssi);
+            postConsoleThresholds(table.rows[slot].address, lockRssi, unlockRssi);
+        }
+    }
+    postConsoleCommand(CONSOLE_CMD_PASSWORD_CHANGED);
+}
+
 // Добавим функцию для эхо ввода
 void echoSerialInput() {
     static String inputBuffer = "";
     
+    // Во время setpwd байты Serial - пароль, а не команды
+    if (passwordInput.active) {
+        pollPasswordInput();
+        return;
+    }
+    // Во время импорта байты Serial - кадр настроек, а не команды
+    if (importSettingsReceiving()) {
+        if (importSettingsPoll()) {
+            applyImportedSettings();
+        }
+        return;
+    }
+    
     while (Serial.available()) {
         char c = Serial.read();
         if (c == '\n' || c == '\r') {
@@ -1434,53 +1667,34 @@ void echoSerialInput() {
                     Serial.println("unlock  - Clear lock state");
                     Serial.println("clear   - Clear all stored preferences");
                     Serial.println("pair    - Enter BLE pairing mode");
+                    Serial.println("boot    - Show boot time breakdown");
+                    Serial.println("export  - Dump all device settings as a binary frame");
+                    Serial.println("import  - Load device settings from a binary frame");
+                    Serial.println("sleep   - Show light sleep duty-cycle budget");
+                    Serial.println("cpu     - Show CPU frequency scaling, loop latency and modelled current");
+                    Serial.println("conn    - Show connection parameter policy, renegotiations and HID latency");
+                    Serial.println("hosts   - Show connected hosts, their state and thresholds");
+                    Serial.println("adv     - Show advertising tiers, time and modelled current");
+                    Serial.println("reconnect - Show per-host reconnect time (connect, encrypt, HID ready)");
+                    Serial.println("scan    - Show scan scheduler clients, duty cycle, filter, host load and advertisers");
+                    Serial.println("scan open - Toggle open scanning without whitelist (for load comparison)");
+                    Serial.println("jobs    - Show loop job periods, jitter and overruns");
+                    Serial.println("jobs reset - Restart job statistics");
+                    Serial.println("tasks   - Show task stack high-water marks, CPU load and queues");
+                    Serial.println("tasks reset - Restart task statistics");
+                    Serial.println("ui      - Show display frames, SPI bytes and per-phase frame times");
+                    Serial.println("ui full - Toggle full-frame rendering (for comparison with dirty rectangles)");
+                    Serial.println("ui reset - Restart display statistics");
+                    Serial.println("ui depth <16|8|4|1> - Set and save frame buffer color depth");
+                    Serial.println("ui overlay - Toggle on-screen frame time overlay (avg/max ms)");
+                    Serial.println("power   - Show energy per component and projected runtime");
+                    Serial.println("power reset - Restart energy accounting");
+                    Serial.println("power profile - Show power source and active power profile");
+                    Serial.println("txpower - Show TX power controller state");
                     Serial.println("help    - Show this help");
                 }
                 else if (inputBuffer == "pair") {
-                    if (serialOutputEnabled) {
-                        Serial.println("\n=== Starting Pairing Mode ===");
-                    }
-                    
-                    // Если устройство подключено, отключаем его
-                    if (connected) {
-                        if (serialOutputEnabled) {
-                            Serial.println("Disconnecting current device...");
-                        }
-                        NimBLEDevice::getServer()->disconnect(0);
-                        delay(500);
-                    }
-                    
-                    // Очищаем все соединения
-                    if (bleServer != nullptr) {
-                        bleServer->disconnect(0);
-                        delay(100);
-                    }
-                    
-                    // Останавливаем текущую рекламу если есть
-                    NimBLEAdvertising* pAdvertising = bleServer->getAdvertising();
-                    if(pAdvertising->isAdvertising()) {
-                        pAdvertising->stop();
-                        delay(100);
-                    }
-                    
-                    // Очищаем сохраненные ключи перед перезапуском
-                    NimBLEDevice::deleteAllBonds();
-                    delay(100);
-                    
-                    // Перезапускаем BLE стек
-                    NimBLEDevice::deinit(true);
-                    delay(100);
-                    
-                    // Инициализируем с новыми настройками
-                    NimBLEDevice::init("M5 BLE HID");
-                    NimBLEDevice::setPower(ESP_PWR_LVL_P9);
-                    
-                    if (serialOutputEnabled) {
-                        Serial.println("Restarting device for pairing...");
-                    }
-                    
-                    delay(1000);  // Даем время на вывод сообщения
-                    ESP.restart();  // Перезагружаем устройство
+                    postConsoleCommand(CONSOLE_CMD_PAIR);
                 }
                 // Восстанавливаем все остальные существующие команды
                 else if (inputBuffer == "setpwd") {
@@ -1493,7 +1707,7 @@ void echoSerialInput() {
                 else if (inputBuffer == "getpwd") {
                     // Выводим текущий пароль для подключенного устройства
                     if (connected) {
-                        String deviceAddress = String(connection_info.address.c_str());
+                        String deviceAddress = String(consoleHost().address);
                         
                         Serial.println("\n=== Password Information ===");
                         Serial.printf("Device: %s\n", deviceAddress.c_str());
@@ -1527,24 +1741,20 @@ void echoSerialInput() {
                                 Serial.printf("Short key: %s\n", shortKey.c_str());
                                 Serial.printf("Password key: pwd_%s\n", shortKey.c_str());
                                 
-                                // Проверяем наличие записи в NVS
-                                nvs_handle_t nvsHandle;
-                                esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+                                // Проверяем наличие записи в NVS (через общий handle NVS_NAMESPACE)
+                                NvsKeyBuffer pwdKey;
+                                makeDeviceKey(DeviceKey::Password, deviceAddress.c_str(), pwdKey);
+                                size_t required_size;
+                                esp_err_t err = nvs_get_str(nvsHandle, pwdKey, NULL, &required_size);
                                 if (err == ESP_OK) {
-                                    String pwdKey = "pwd_" + shortKey;
-                                    size_t required_size;
-                                    err = nvs_get_str(nvsHandle, pwdKey.c_str(), NULL, &required_size);
-                                    if (err == ESP_OK) {
-                                        Serial.printf("Password exists in NVS, size: %d bytes\n", required_size);
-                                    } else {
-                                        Serial.printf("Password not found in NVS, error: %d\n", err);
-                                    }
-                                    nvs_close(nvsHandle);
+                                    Serial.printf("Password exists in NVS, size: %d bytes\n", required_size);
+                                } else {
+                                    Serial.printf("Password not found in NVS, error: %d\n", err);
                                 }
                             }
                         } else {
                             Serial.println("Error: Device address is empty!");
-                            Serial.printf("Connection info address: '%s'\n", connection_info.address.c_str());
+                            Serial.printf("Connection info address: '%s'\n", deviceAddress.c_str());
                             
                             // Попробуем получить список всех устройств
                             Serial.println("\nListing all stored devices:");
@@ -1561,11 +1771,12 @@ void echoSerialInput() {
                 else if (inputBuffer == "getaddr") {
                     // Выводим текущий адрес подключенного устройства
                     if (connected) {
+                        HostRow host = consoleHost();
                         Serial.println("\n=== Device Address Information ===");
                         Serial.printf("Connected: %s\n", connected ? "Yes" : "No");
-                        Serial.printf("Connection Handle: %d\n", connection_info.conn_handle);
-                        Serial.printf("Device Address: %s\n", connection_info.address.c_str());
-                        Serial.printf("Address Length: %d\n", connection_info.address.length());
+                        Serial.printf("Connection Handle: %u\n", host.connHandle);
+                        Serial.printf("Device Address: %s\n", host.address);
+                        Serial.printf("Address Length: %d\n", strlen(host.address));
                         Serial.println("=== End Device Address Information ===");
                     } else {
                         Serial.println("Error: No device connected!");
@@ -1575,17 +1786,14 @@ void echoSerialInput() {
                     // Выводим список всех сохраненных паролей
                     Serial.println("\n=== Stored Passwords ===");
                     
-                    nvs_handle_t localNvsHandle;
-                    esp_err_t err = nvs_open("m5kb_v1", NVS_READWRITE, &localNvsHandle);
-                    if (err != ESP_OK) {
-                        Serial.printf("Error opening NVS: %d\n", err);
-                        Serial.println("=== End Stored Passwords ===");
-                        return;
-                    }
+                    // Используем общий handle, открытый в initializeNvs()
+                    nvs_handle_t localNvsHandle = nvsHandle;
+                    esp_err_t err = ESP_OK;
                     
                     // Проверяем наличие пароля для текущего устройства
-                    if (connected && connection_info.address.length() > 0) {
-                        String deviceAddress = String(connection_info.address.c_str());
+                    HostRow host = consoleHost();
+                    if (connected && host.address[0] != '\0') {
+                        String deviceAddress = String(host.address);
                         String shortKey = getShortKey(deviceAddress.c_str());
                         String pwdKey = "pwd_" + shortKey;
                         
@@ -1653,11 +1861,8 @@ void echoSerialInput() {
                     
                     // Проверяем несколько известных ключей напрямую
                     const char* knownKeys[] = {
-                        "paired",
-                        "conn_handle",
-                        "last_conn_time",
-                        "device_addr",
-                        "is_locked"
+                        StorageKeys::LAST_ADDR,
+                        StorageKeys::IS_LOCKED
                     };
                     
                     Serial.println("\nChecking known keys in NVS:");
@@ -1759,8 +1964,6 @@ void echoSerialInput() {
                         }
                     }
                     
-                    nvs_close(localNvsHandle);
-                    
                     Serial.println("=== End Stored Passwords ===");
                 }
                 else if (inputBuffer.startsWith("getpwdmac ")) {
@@ -1795,9 +1998,9 @@ void echoSerialInput() {
                         Serial.println("No password found for this MAC address!");
                         
                         // Проверяем наличие записи в NVS
-                        nvs_handle_t localNvsHandle;
-                        esp_err_t err = nvs_open("m5kb_v1", NVS_READWRITE, &localNvsHandle);
-                        if (err == ESP_OK) {
+                        nvs_handle_t localNvsHandle = nvsHandle;
+                        esp_err_t err = ESP_OK;
+                        {
                             String pwdKey = "pwd_" + shortKey;
                             size_t required_size;
                             err = nvs_get_str(localNvsHandle, pwdKey.c_str(), NULL, &required_size);
@@ -1822,7 +2025,6 @@ void echoSerialInput() {
                             } else {
                                 Serial.printf("Password not found in NVS, error: %d\n", err);
                             }
-                            nvs_close(localNvsHandle);
                         }
                     }
                     
@@ -1832,24 +2034,7 @@ void echoSerialInput() {
                     // Получаем MAC-адрес из команды
                     String mac = inputBuffer.substring(8);
                     mac.trim();
-                    
-                    Serial.println("\n=== Setting Device Address ===");
-                    Serial.printf("MAC address: %s\n", mac.c_str());
-                    
-                    // Устанавливаем адрес устройства
-                    connection_info.address = mac.c_str();
-                    connectedDeviceAddress = mac.c_str();
-                    
-                    Serial.println("\n=== Connection Info After Setting Address ===");
-                    Serial.printf("Connected: %s\n", connection_info.connected ? "Yes" : "No");
-                    Serial.printf("Connection Handle: %d\n", connection_info.conn_handle);
-                    Serial.printf("Device Address: '%s'\n", connection_info.address.c_str());
-                    Serial.printf("Address Length: %d\n", connection_info.address.length());
-                    Serial.printf("Connected Device Address: '%s'\n", connectedDeviceAddress.c_str());
-                    Serial.println("=== End Connection Info ===\n");
-                    
-                    Serial.println("Device address set successfully");
-                    Serial.println("=== End Setting Device Address ===");
+                    postConsoleCommand(CONSOLE_CMD_SET_ADDRESS, mac.c_str());
                 }
                 else if (inputBuffer.startsWith("getpwdkey ")) {
                     // Получаем ключ из команды
@@ -1866,9 +2051,9 @@ void echoSerialInput() {
                     }
                     
                     // Получаем пароль напрямую из NVS
-                    nvs_handle_t localNvsHandle;
-                    esp_err_t err = nvs_open("m5kb_v1", NVS_READWRITE, &localNvsHandle);
-                    if (err == ESP_OK) {
+                    nvs_handle_t localNvsHandle = nvsHandle;
+                    esp_err_t err = ESP_OK;
+                    {
                         size_t required_size;
                         err = nvs_get_str(localNvsHandle, key.c_str(), NULL, &required_size);
                         if (err == ESP_OK) {
@@ -1892,9 +2077,6 @@ void echoSerialInput() {
                         } else {
                             Serial.printf("Password not found in NVS, error: %d\n", err);
                         }
-                        nvs_close(localNvsHandle);
-                    } else {
-                        Serial.printf("Error opening NVS: %d\n", err);
                     }
                     
                     Serial.println("=== End Password by Key ===");
@@ -1904,14 +2086,105 @@ void echoSerialInput() {
                     Serial.printf("Serial output %s\n", 
                         serialOutputEnabled ? "enabled" : "disabled");
                 }
+                else if (inputBuffer == "boot") {
+                    printBootProfile();
+                }
+                else if (inputBuffer == "power") {
+                    postConsoleCommand(CONSOLE_CMD_POWER_REPORT);
+                }
+                else if (inputBuffer == "txpower") {
+                    printTxPowerStatus();
+                }
+                else if (inputBuffer == "power profile") {
+                    powerManager.printStatus();
+                }
+                else if (inputBuffer == "power reset") {
+                    postConsoleCommand(CONSOLE_CMD_POWER_RESET);
+                }
+                else if (inputBuffer == "sleep") {
+                    printPowerBudget();
+                }
+                else if (inputBuffer == "cpu") {
+                    printCpuFreqReport();
+                }
+                else if (inputBuffer == "conn") {
+                    printConnParamStats();
+                }
+                else if (inputBuffer == "hosts") {
+                    printHostStats();
+                }
+                else if (inputBuffer == "adv") {
+                    printAdvSchedulerStats();
+                }
+                else if (inputBuffer == "reconnect") {
+                    printReconnectStats();
+                }
+                else if (inputBuffer == "scan") {
+                    postConsoleCommand(CONSOLE_CMD_SCAN_REPORT);
+                }
+                else if (inputBuffer == "scan open") {
+                    postConsoleCommand(CONSOLE_CMD_SCAN_OPEN);
+                }
+                else if (inputBuffer == "jobs") {
+                    printJobStats();
+                }
+                else if (inputBuffer == "jobs reset") {
+                    postConsoleCommand(CONSOLE_CMD_JOBS_RESET);
+                }
+                else if (inputBuffer == "tasks") {
+                    printTaskStats();
+                }
+                else if (inputBuffer == "tasks reset") {
+                    taskMonitorStatsReset();
+                    Serial.println("Task statistics restarted");
+                }
+                else if (inputBuffer == "ui") {
+                    printUiStats();
+                }
+                else if (inputBuffer == "ui full") {
+                    // Режим переключает задача консоли; кадр, идущий в задаче UI, лишь дорисуется целиком
+                    uiSetFullFrameMode(!uiFullFrameMode());
+                    Serial.printf("Display rendering: %s\n", uiFullFrameMode() ? "full frame" : "dirty rectangles");
+                    requestRedraw();
+                }
+                else if (inputBuffer == "ui reset") {
+                    uiStatsReset();
+                    Serial.println("Display statistics restarted");
+                }
+                else if (inputBuffer == "ui overlay") {
+                    uiSetOverlay(!uiOverlay());
+                    Serial.printf("Frame time overlay %s\n", uiOverlay() ? "on" : "off");
+                    requestRedraw();
+                }
+                else if (inputBuffer.startsWith("ui depth ")) {
+                    int depth = inputBuffer.substring(9).toInt();
+                    if (depth == 16 || depth == 8 || depth == 4 || depth == 1) {
+                        // Буферы пересоздаёт задача UI; сохранить настройку она попросит, только если буферы созданы
+                        UiEvent event = { UI_EVENT_COLOR_DEPTH, (uint8_t)depth, 0, nullptr };
+                        taskMonitorSend(uiQueue, &event);
+                    } else {
+                        Serial.println("Usage: ui depth <16|8|4|1>");
+                    }
+                }
+                else if (inputBuffer == "export") {
+                    exportSettingsToSerial();
+                }
+                else if (inputBuffer == "import") {
+                    // Кадр принимается при следующих опросах консоли (echoSerialInput)
+                    importSettingsBegin();
+                }
                 else if (inputBuffer == "clear") {
                     clearAllPasswords();
+                    postConsoleCommand(CONSOLE_CMD_PASSWORD_CHANGED);
                     Serial.println("Old passwords cleared. Please set new password if needed.");
                 }
                 // ... все остальные существующие команды ...
                 
                 Serial.println("=== End of command ===\n");
                 inputBuffer = "";
+                if (importSettingsReceiving() || passwordInput.active) {
+                    return;  // Дальше в Serial идёт кадр импорта или пароль
+                }
             }
         } else {
             inputBuffer += c;
@@ -1924,43 +2197,14 @@ void echoSerialInput() {
 static const unsigned long UNLOCK_ATTEMPT_INTERVAL = 5000;  // 5 секунд
 static unsigned long lastUnlockAttempt = 0;
 
-// Добавим счетчик неудачных попыток
-static int failedUnlockAttempts = 0;        // Счетчик неудачных попыток
-static unsigned long lastFailedAttempt = 0;  // Время последней неудачной попытки
-
-// Добавим константы для управления мощностью
-static const esp_power_level_t POWER_NEAR_PC = ESP_PWR_LVL_N12;    // -12dBm минимальная
-static const esp_power_level_t POWER_LOCKED = ESP_PWR_LVL_N12;     // Меняем на минимальную в блоке
-static const esp_power_level_t POWER_RETURNING = ESP_PWR_LVL_P9;   // +9dBm максимальная
-
-// Оставляем новые константы для интервалов сканирования
-static const uint16_t SCAN_INTERVAL_NORMAL = 40;     // 25ms (40 * 0.625ms)
-static const uint16_t SCAN_WINDOW_NORMAL = 20;       // 12.5ms
-static const uint16_t SCAN_INTERVAL_LOCKED = 320;    // 200ms - сканируем реже
-static const uint16_t SCAN_WINDOW_LOCKED = 16;       // 10ms - меньше слушаем
-
-// Добавим константы для яркости
-static const uint8_t BRIGHTNESS_MAX = 100;    // Максимальная яркость
-static const uint8_t BRIGHTNESS_NORMAL = 50;  // Нормальная яркость
-static const uint8_t BRIGHTNESS_LOW = 20;     // Пониженная яркость
-static const uint8_t BRIGHTNESS_MIN = 0;      // Выключенный экран
-static const uint8_t BRIGHTNESS_MEDIUM = 70;  // Средняя яркость для временного включения экрана
-
-// Добавляем константы для яркости в начало файла
-static const uint8_t BRIGHTNESS_USB = 100;     // Яркость при USB питании
-static const uint8_t BRIGHTNESS_BATTERY = 30;  // Яркость от батареи
-
-// Добавляем после других static переменных
-static float batteryVoltage = 0;
-static float batteryLevel = 0;
-static const float VOLTAGE_THRESHOLD = -15.0;     // Допустимое падение напряжения
-static const float DISCONNECT_THRESHOLD = -25.0;   // Порог для определения отключения
-static const int VOLTAGE_HISTORY_SIZE = 10;
-static float voltageHistory[VOLTAGE_HISTORY_SIZE] = {0};
-static int historyIndex = 0;
-static bool historyFilled = false;
-static float maxAverageVoltage = 0;
-static bool wasConnected = true;
+// Неудачные попытки считаются по хосту (HostContext::failedUnlockAttempts)
+static const unsigned long UNLOCK_LOCKOUT_MS = 300000;  // Запрет разблокировки после 3 неудач (5 минут)
+
+// RSSI соединения недоступен дольше этого времени - нужен RSSI из рекламы хоста
+static const unsigned long RSSI_SCAN_FALLBACK_MS = 3000;
+
+// Яркость временного включения экрана; остальные уровни задаёт профиль питания
+static const uint8_t BRIGHTNESS_MEDIUM = 70;
 
 // После других static переменных
 static String currentShortKey = "";
@@ -1969,305 +2213,137 @@ static String currentShortKey = "";
 static unsigned long screenOnTime = 0;
 static bool screenTemporaryOn = false;
 
-// Функция обновления состояния питания
-void updatePowerStatus() {
-    // Обновляем базовые параметры
-    batteryVoltage = M5.Power.getBatteryVoltage();
-    batteryLevel = M5.Power.getBatteryLevel();
-    
-    // Обновляем историю измерений напряжения
-    voltageHistory[historyIndex] = batteryVoltage;
-    historyIndex = (historyIndex + 1) % VOLTAGE_HISTORY_SIZE;
-    if (historyIndex == 0) historyFilled = true;
-    
-    static bool wasUSB = true;
-    bool isUSB = M5.Power.isCharging();
-    
-    // Добавим защиту от частых изменений
-    static unsigned long lastChange = 0;
-    if (millis() - lastChange < 1000) {  // Минимум 1 секунда между изменениями
-        return;
-    }
-    
-    if (wasUSB != isUSB) {
-        lastChange = millis();
-        wasUSB = isUSB;
-        
-        // Устанавливаем яркость с задержкой
-        delay(10);
-        M5.Display.setBrightness(isUSB ? BRIGHTNESS_USB : BRIGHTNESS_BATTERY);
-        delay(10);
-        
-        if (serialOutputEnabled) {
-            Serial.printf("Power source changed: %s, brightness: %d\n",
-                isUSB ? "USB" : "Battery",
-                isUSB ? BRIGHTNESS_USB : BRIGHTNESS_BATTERY);
-        }
-    }
-}
+// Режим пониженного потребления в состоянии LOCKED
+static const unsigned long LOCKED_IDLE_DELAY_MS = 10000;  // Сколько ждать после последнего нажатия кнопки
+static const uint32_t LOCKED_IDLE_LOOP_MS = 100;          // Период опроса кнопок в режиме сна
+static const int NOBODY_NEAR_MARGIN = 5;                  // dBm ниже порога разблокировки - рядом никого
+static unsigned long lastUserActivity = 0;
 
-float calculateAverageVoltage() {
-    float sum = 0;
-    int count = historyFilled ? VOLTAGE_HISTORY_SIZE : historyIndex;
-    if (count == 0) return 0;
-    
-    for (int i = 0; i < count; i++) {
-        sum += voltageHistory[i];
+// Все компьютеры заблокированы, пользователь не трогал кнопки и не приближается ни к одному
+static bool isLockedIdle() {
+    if (screenTemporaryOn || btnAPressStart != 0) {
+        return false;
     }
-    return sum / count;
-}
-
-bool isUSBConnected() {
-    if (!historyFilled && historyIndex < 3) return true;
-    
-    float avgVoltage = calculateAverageVoltage();
-    if (avgVoltage > maxAverageVoltage) {
-        maxAverageVoltage = avgVoltage;
+    if (millis() - lastUserActivity < LOCKED_IDLE_DELAY_MS) {
+        return false;
     }
-    
-    float voltageDrop = avgVoltage - maxAverageVoltage;
-    
-    if (wasConnected) {
-        if (voltageDrop < DISCONNECT_THRESHOLD) {
-            wasConnected = false;
+    // Без соединения рядом точно никого
+    if (!connected) {
+        return currentState == LOCKED;
+    }
+    // Иначе у каждого подключённого хоста сигнал должен быть заметно ниже порога разблокировки
+    syncHosts();
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        const HostContext& h = hosts[slot];
+        if (hostConnected(slot) &&
+            (h.state != LOCKED || h.lastAverageRssi >= h.unlockThreshold - NOBODY_NEAR_MARGIN)) {
             return false;
         }
-        return true;
-    } else {
-        if (voltageDrop > VOLTAGE_THRESHOLD) {
-            wasConnected = true;
-            return true;
-        }
-        return false;
     }
+    return true;
 }
 
 // Функция для управления яркостью в зависимости от мощности передатчика
+// Уровни яркости берутся из профиля питания (от USB экран не гасится)
 void adjustBrightness(esp_power_level_t txPower) {
-    static uint8_t currentBrightness = BRIGHTNESS_NORMAL;
-    uint8_t newBrightness;
-    
-    // Если подключен USB - не выключаем экран
-    if (isUSBConnected()) {
-        switch (txPower) {
-            case ESP_PWR_LVL_N12:  // Минимальная мощность
-                newBrightness = BRIGHTNESS_LOW;  // Минимальная, но не выключаем
-                break;
-            case ESP_PWR_LVL_N9:
-            case ESP_PWR_LVL_N6:
-                newBrightness = BRIGHTNESS_LOW;
-                break;
-            default:
-                newBrightness = BRIGHTNESS_NORMAL;
-        }
-    } else {
-        // Обычная логика для работы от батареи
-        switch (txPower) {
-            case ESP_PWR_LVL_N12:  // Минимальная мощность
-                newBrightness = BRIGHTNESS_MIN;  // Выключаем экран
-                break;
-            case ESP_PWR_LVL_N9:
-            case ESP_PWR_LVL_N6:
-                newBrightness = BRIGHTNESS_LOW;
-                break;
-            default:
-                newBrightness = BRIGHTNESS_NORMAL;
-        }
-    }
+    static uint8_t currentBrightness = 0xFF;
+    uint8_t newBrightness = powerManager.brightnessFor(txPower);
 
     if (newBrightness != currentBrightness) {
         if (serialOutputEnabled) {
-            Serial.printf("Adjusting brightness: %d -> %d (TX Power: %d, USB: %d)\n", 
-                currentBrightness, newBrightness, txPower, isUSBConnected());
+            Serial.printf("Adjusting brightness: %d -> %d (TX Power: %d, profile: %s)\n", 
+                currentBrightness, newBrightness, txPower, powerManager.profile().name);
         }
-        M5.Display.setBrightness(newBrightness);
+        setDisplayBrightness(newBrightness);
         currentBrightness = newBrightness;
     }
 }
 
-// Функция для настройки параметров сканирования
-void adjustScanParameters(DeviceState state) {
-    if (!pScan) return;
-    
-    if (state == LOCKED) {
-        pScan->setInterval(SCAN_INTERVAL_LOCKED);
-        pScan->setWindow(SCAN_WINDOW_LOCKED);
-    } else {
-        pScan->setInterval(SCAN_INTERVAL_NORMAL);
-        pScan->setWindow(SCAN_WINDOW_NORMAL);
-    }
-    
-    if (pScan->isScanning()) {
-        pScan->stop();
+// Кому нужно сканирование и с какими параметрами профиля питания.
+// RSSI берётся из соединения; сканирование - только запасной источник и поиск хоста без соединения
+static void updateScanRequests(bool lowPower) {
+    const PowerProfile& profile = powerManager.profile();
+    AdvTier tier = advSchedulerTier();
+    bool hostSearch = !connected && tier >= ADV_TIER_MEDIUM && tier < ADV_TIER_OFF;
+    bool rssiFallback = false;
+    for (int slot = 0; slot < HOST_MAX && scanMode && !lowPower; slot++) {
+        rssiFallback |= hostConnected(slot) && millis() - hosts[slot].lastConnRssiTime > RSSI_SCAN_FALLBACK_MS;
     }
-    pScan->start(0, false);
+
+    scanSchedulerRequest(SCAN_CLIENT_HOST_SEARCH, hostSearch,
+        profile.scanIntervalSearch, profile.scanWindowSearch);
+    scanSchedulerRequest(SCAN_CLIENT_RSSI_FALLBACK, rssiFallback,
+        profile.scanInterval, profile.scanWindow);
+    scanSchedulerSetConnInterval(connected ? connParamPolicyInterval() : 0);
+    scanSchedulerUpdate();
 }
 
-// Функция для адаптивного управления мощностью
-void adjustTransmitPower(DeviceState state, int rssi) {
-    esp_power_level_t newPower;
-    static unsigned long lastPowerChangeTime = 0;
-    static esp_power_level_t lastPower = ESP_PWR_LVL_P9;
-    static bool isPowerGraduallyReducing = false;
-    
-    // Получаем настройки для подключенного устройства
-    DeviceSettings settings;
-    bool hasCustomSettings = false;
-    
-    if (connected && connectedDeviceAddress.length() > 0) {
-        settings = getDeviceSettings(connectedDeviceAddress.c_str());
-        hasCustomSettings = true;
+// RSSI хоста по его рекламе, если он рекламируется во время соединения.
+// Отсчёт новый, только если с прошлого отсчёта пришёл хотя бы один отчёт
+static bool scanRssiForHost(int slot, int8_t& rssi) {
+    if (!scanSchedulerIsScanning()) {
+        return false;
     }
-    
-    // Рассчитываем пороги RSSI на основе пользовательских настроек
-    int veryCloseThreshold = -35;  // По умолчанию
-    int closeThreshold = -45;
-    int mediumThreshold = -55;
-    int farThreshold = -65;
-    
-    if (hasCustomSettings) {
-        // Настраиваем пороги относительно значений lock/unlock
-        // Используем более щадящие пороги для обеспечения стабильной связи
-        int range = settings.unlockRssi - settings.lockRssi;
-        
-        if (range > 5) {
-            veryCloseThreshold = settings.unlockRssi;
-            closeThreshold = settings.unlockRssi - (range / 4);
-            mediumThreshold = settings.unlockRssi - (range / 2);
-            farThreshold = settings.lockRssi + 5; // Чуть лучше чем порог блокировки
-        }
-    }
-    
-    // Определяем базовую мощность на основе RSSI
-    esp_power_level_t basePower;
-    if (rssi > veryCloseThreshold) {
-        basePower = ESP_PWR_LVL_N9;  // Не используем самую низкую мощность N12 для надежности
-    } else if (rssi > closeThreshold) {
-        basePower = ESP_PWR_LVL_N6;
-    } else if (rssi > mediumThreshold) {
-        basePower = ESP_PWR_LVL_N3;
-    } else if (rssi > farThreshold) {
-        basePower = ESP_PWR_LVL_P3;
-    } else {
-        basePower = ESP_PWR_LVL_P9;  // Максимальная мощность
-    }
-    
-    // Если находимся в состоянии блокировки или удаления, нужно обеспечить надежный сигнал
-    if (state == MOVING_AWAY || state == LOCKED) {
-        // Для состояния MOVING_AWAY используем повышенную мощность
-        if (basePower < ESP_PWR_LVL_P3) {
-            basePower = ESP_PWR_LVL_P3;
-        }
-    }
-    
-    // Учитываем состояние зарядки
-    bool isUSB = isUSBConnected();
-    
-    if (!isUSB) {
-        // При работе от батареи постепенно снижаем мощность, не делая резких скачков
-        if (!isPowerGraduallyReducing && lastPower > basePower) {
-            isPowerGraduallyReducing = true;
-            lastPowerChangeTime = millis();
-        } else if (isPowerGraduallyReducing) {
-            // Проверяем, прошло ли достаточно времени для снижения мощности
-            unsigned long currentTime = millis();
-            if (currentTime - lastPowerChangeTime > 5000) { // 5 секунд между шагами снижения
-                if (lastPower > basePower) {
-                    // Снижаем мощность на один шаг
-                    esp_power_level_t nextPower;
-                    switch (lastPower) {
-                        case ESP_PWR_LVL_P9: nextPower = ESP_PWR_LVL_P6; break;
-                        case ESP_PWR_LVL_P6: nextPower = ESP_PWR_LVL_P3; break;
-                        case ESP_PWR_LVL_P3: nextPower = ESP_PWR_LVL_N0; break;
-                        case ESP_PWR_LVL_N0: nextPower = ESP_PWR_LVL_N3; break;
-                        case ESP_PWR_LVL_N3: nextPower = ESP_PWR_LVL_N6; break;
-                        case ESP_PWR_LVL_N6: nextPower = ESP_PWR_LVL_N9; break;
-                        default: nextPower = basePower;
-                    }
-                    basePower = nextPower;
-                    lastPowerChangeTime = currentTime;
-                } else {
-                    isPowerGraduallyReducing = false;
-                }
-            } else {
-                // Пока не прошло достаточно времени, используем предыдущую мощность
-                basePower = lastPower;
-            }
-        }
-    } else {
-        // При работе от USB можем сразу использовать рассчитанную мощность
-        isPowerGraduallyReducing = false;
-    }
-    
-    // Применяем рассчитанную мощность
-    newPower = basePower;
-    
-    // Предотвращаем слишком низкую мощность при удалении
-    if (state == MOVING_AWAY && rssi < settings.lockRssi + 5) {
-        // Когда мы приближаемся к порогу блокировки, используем максимальную мощность
-        // чтобы гарантировать отправку команды блокировки
-        newPower = ESP_PWR_LVL_P9;
-    }
-    
-    // Применяем новую мощность, если она изменилась
-    if (newPower != lastPower) {
-        if (serialOutputEnabled) {
-            Serial.printf("Adjusting TX power: %d -> %d (RSSI: %d, State: %d, USB: %d)\n",
-                lastPower, newPower, rssi, state, isUSB);
-        }
-        NimBLEDevice::setPower(newPower);
-        lastPower = newPower;
+    HostContext& host = hosts[slot];
+    AdvertiserRecord record;
+    if (!advertiserTableLookup(host.peerAddress, record) || record.count == host.scanReportCount) {
+        return false;
     }
-    
-    // Регулируем яркость дисплея
-    adjustBrightness(newPower);
+    host.scanReportCount = record.count;
+    rssi = record.rssi;
+    return true;
 }
 
-// В начале файла после определений
+// Задачи планировщика, чьи периоды задаёт профиль питания
+static int inputJobId = -1;
+static int displayJobId = -1;
+static int rssiJobId = -1;
+
+// Применяет профиль питания: частота CPU, яркость, периоды перерисовки и опроса RSSI.
+// Границы мощности передатчика и параметры сканирования читаются из профиля на месте использования
+static void applyPowerProfile() {
+    const PowerProfile& profile = powerManager.profile();
+    setPowerModeMaxFreq(profile.cpuFreqMhz);
+    adjustBrightness(txPowerCurrentLevel());
+    jobSetPeriod(displayJobId, profile.displayUpdateMs);
+    jobSetPeriod(rssiJobId, profile.rssiSampleMs);
+    // Блокировка требует CONSECUTIVE_SAMPLES_NEEDED + 1 отсчётов ниже порога и отправки Win+L:
+    // supervision timeout должен быть длиннее, чтобы разрыв не опередил решение
+    connParamPolicySetLockWindow((CONSECUTIVE_SAMPLES_NEEDED + 1) * profile.rssiSampleMs + LOCK_SEND_MS);
+    if (serialOutputEnabled) {
+        Serial.printf("Power profile: %s (USB: %d, battery: %d%%)\n",
+            profile.name, powerManager.isUsbPowered(), powerManager.batteryLevel());
+    }
+}
 
+// Передаёт счётчику энергии текущее состояние потребителей
+static void updateEnergyMeter() {
+    EnergySample sample;
+    sample.connected = connected;
+    sample.txPower = txPowerCurrentLevel();
+    sample.scanning = scanSchedulerIsScanning();
+    sample.scanInterval = scanSchedulerInterval();
+    sample.scanWindow = scanSchedulerWindow();
+    sample.brightness = M5.Display.getBrightness();
+    sample.displayOn = !isLightSleepEnabled();  // В режиме сна панель выключена
+    sample.cpuMhz = getCpuFrequencyMhz();
+    sample.lightSleep = isLightSleepEnabled() && isLightSleepSupported();
+    energyMeterUpdate(sample);
+}
 
 void initStorage() {
     Serial.println("Initializing storage...");
-    // Инициализация NVS Flash
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        nvs_flash_erase();
-        err = nvs_flash_init();
-    }
-    if (err != ESP_OK) {
-        Serial.printf("Error init NVS flash: %d\n", err);
-    }
-    // Открываем NVS namespace
-    err = nvs_open("m5kb_v1", NVS_READWRITE, &nvsHandle);
-    if (err != ESP_OK) {
-        Serial.printf("Error opening NVS handle: %d\n", err);
-        return;
-    }
+    // Инициализация NVS и единственного handle пространства имён
+    initializeNvs();
     
-    // Проверяем есть ли начальные значения
-    int8_t isLocked;
-    err = nvs_get_i8(nvsHandle, "is_locked", &isLocked);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        // Устанавливаем начальные значения
-        nvs_set_i8(nvsHandle, "is_locked", 0);
-        nvs_set_str(nvsHandle, "last_addr", "");
-        nvs_commit(nvsHandle);
-        Serial.println("Initial values set");
-    }
-    
-    Serial.println("Storage initialized successfully");
     // Загружаем пороги для последнего устройства при инициализации NVS
     {
         char lastDev[32] = {0};
-        size_t len = sizeof(lastDev);
-        if (nvs_get_str(nvsHandle, KEY_LAST_ADDR, lastDev, &len) == ESP_OK && strlen(lastDev) > 0) {
-            String lastAddr = String(lastDev);
-            DeviceSettings ds = getDeviceSettings(lastAddr);
-            dynamicLockThreshold = ds.lockRssi;
-            dynamicUnlockThreshold = ds.unlockRssi;
+        if (loadLastAddress(lastDev, sizeof(lastDev))) {
+            loadDeviceThresholds(lastDev, dynamicLockThreshold, dynamicUnlockThreshold);
             if (serialOutputEnabled) {
                 Serial.printf("initStorage loaded thresholds for %s: lock=%d, unlock=%d\n",
-                    lastAddr.c_str(), dynamicLockThreshold, dynamicUnlockThreshold);
+                    lastDev, dynamicLockThreshold, dynamicUnlockThreshold);
             }
         }
     }
@@ -2280,13 +2356,13 @@ void checkLockState() {
     char lastAddr[32] = {0};
     size_t length = sizeof(lastAddr);
     
-    esp_err_t err = nvs_get_i8(nvsHandle, "is_locked", &isLocked);
+    esp_err_t err = nvs_get_i8(nvsHandle, StorageKeys::IS_LOCKED, &isLocked);
     if (err != ESP_OK) {
         Serial.printf("Error reading lock state: %d\n", err);
         return;
     }
     
-    err = nvs_get_str(nvsHandle, "last_addr", lastAddr, &length);
+    err = nvs_get_str(nvsHandle, StorageKeys::LAST_ADDR, lastAddr, &length);
     if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
         Serial.printf("Error reading last address: %d\n", err);
         return;
@@ -2297,25 +2373,196 @@ void checkLockState() {
         lastAddr);
 }
 
+// Результат загрузки хранилища в параллельной задаче
+static SemaphoreHandle_t storageReadySem = nullptr;
+static char bootLastAddr[RTC_SNAPSHOT_ADDR_LEN] = {0};
+static bool bootWasLocked = false;
+
+// Снимок состояния в RTC-памяти обновляется с этим периодом (запись в RAM, flash не трогаем)
+static const unsigned long RTC_SNAPSHOT_PERIOD_MS = 500;
+// Фильтр RSSI восстанавливаем только из свежего снимка: после долгого сна измерения устарели
+static const uint32_t RTC_FILTER_MAX_AGE_MS = 30000;
+static bool rtcStateRestored = false;
+
+static uint32_t timerAge(unsigned long startTime) {
+    return startTime == 0 ? RTC_TIMER_NOT_SET : millis() - startTime;
+}
+
+// Обратное преобразование: разность millis() - start останется верной
+// и при переходе через ноль, т.к. вычисления беззнаковые
+static unsigned long timerFromAge(uint32_t ageMs, uint32_t elapsedMs) {
+    if (ageMs == RTC_TIMER_NOT_SET) {
+        return 0;
+    }
+    unsigned long start = millis() - (ageMs + elapsedMs);
+    return start == 0 ? 1 : start;
+}
+
+// Ограничения попыток разблокировки из снимка RTC до подключения своих хостов
+struct RestoredUnlockLimit {
+    char address[18];
+    uint8_t failedAttempts;
+    unsigned long lastFailedAttempt;
+};
+static RestoredUnlockLimit restoredUnlockLimits[RTC_SNAPSHOT_MAX_HOSTS] = {};
+
+// Хост занял слот: ограничение из снимка RTC (если было) переходит в слот, иначе счётчик с нуля
+static void takeRestoredUnlockLimit(HostContext& host, const char* address, bool newHost) {
+    if (newHost) {
+        host.failedUnlockAttempts = 0;
+        host.lastFailedAttempt = 0;
+    }
+    for (int i = 0; i < RTC_SNAPSHOT_MAX_HOSTS; i++) {
+        RestoredUnlockLimit& limit = restoredUnlockLimits[i];
+        if (limit.address[0] != '\0' && strcasecmp(limit.address, address) == 0) {
+            host.failedUnlockAttempts = limit.failedAttempts;
+            host.lastFailedAttempt = limit.lastFailedAttempt;
+            limit.address[0] = '\0';
+        }
+    }
+}
+
+// Сохраняет текущее состояние логики блокировки в RTC-память
+void saveRtcSnapshot() {
+    RtcStateSnapshot snapshot = {};
+    snapshot.state = (uint8_t)currentState;
+    snapshot.lockThreshold = dynamicLockThreshold;
+    snapshot.unlockThreshold = dynamicUnlockThreshold;
+
+    snapshot.lastAverageRssi = lastAverageRssi;
+    for (int i = 0; i < RSSI_SAMPLES; i++) {
+        snapshot.rssiValues[i] = rssiValues[i];
+    }
+    snapshot.rssiIndex = (uint8_t)rssiIndex;
+    snapshot.validSamples = (uint8_t)validSamples;
+    snapshot.exponentialAverage = exponentialAverage;
+    snapshot.exponentialAverageInitialized = exponentialAverageInitialized;
+    snapshot.consecutiveLockSamples = (uint8_t)consecutiveLockSamples;
+    snapshot.consecutiveUnlockSamples = (uint8_t)consecutiveUnlockSamples;
+
+    snapshot.stateChangeAgeMs = timerAge(lastStateChangeTime);
+    snapshot.movementAgeMs = timerAge(movementStartTime);
+    snapshot.weakSignalAgeMs = timerAge(weakSignalStartTime);
+
+    int limits = 0;
+    for (int slot = 0; slot < HOST_MAX && limits < RTC_SNAPSHOT_MAX_HOSTS; slot++) {
+        const HostContext& h = hosts[slot];
+        if (h.failedUnlockAttempts > 0 && hostAddress(slot)[0] != '\0') {
+            RtcUnlockLimit& limit = snapshot.unlockLimits[limits++];
+            strlcpy(limit.addr, hostAddress(slot), sizeof(limit.addr));
+            limit.failedAttempts = h.failedUnlockAttempts;
+            limit.failedAgeMs = timerAge(h.lastFailedAttempt);
+        }
+    }
+    // Хосты, которые после прошлого сброса ещё не подключались
+    for (int i = 0; i < RTC_SNAPSHOT_MAX_HOSTS && limits < RTC_SNAPSHOT_MAX_HOSTS; i++) {
+        const RestoredUnlockLimit& restored = restoredUnlockLimits[i];
+        if (restored.address[0] != '\0') {
+            RtcUnlockLimit& limit = snapshot.unlockLimits[limits++];
+            strlcpy(limit.addr, restored.address, sizeof(limit.addr));
+            limit.failedAttempts = restored.failedAttempts;
+            limit.failedAgeMs = timerAge(restored.lastFailedAttempt);
+        }
+    }
+
+    // Адрес подключенного хоста, иначе - последний известный
+    const char* addr = connectedDeviceAddress.empty() ? bootLastAddr : connectedDeviceAddress.c_str();
+    strncpy(snapshot.lastAddr, addr, RTC_SNAPSHOT_ADDR_LEN - 1);
+
+    rtcSnapshotSave(snapshot);
+}
+
+// Применяет снимок из RTC-памяти, если он действителен
+static bool restoreRtcSnapshot() {
+    RtcStateSnapshot snapshot;
+    uint32_t elapsedMs = 0;
+    if (!rtcSnapshotRestore(snapshot, elapsedMs)) {
+        return false;
+    }
+
+    currentState = (DeviceState)snapshot.state;
+    dynamicLockThreshold = snapshot.lockThreshold;
+    dynamicUnlockThreshold = snapshot.unlockThreshold;
+
+    if (elapsedMs <= RTC_FILTER_MAX_AGE_MS) {
+        lastAverageRssi = snapshot.lastAverageRssi;
+        for (int i = 0; i < RSSI_SAMPLES; i++) {
+            rssiValues[i] = snapshot.rssiValues[i];
+        }
+        rssiIndex = snapshot.rssiIndex % RSSI_SAMPLES;
+        validSamples = snapshot.validSamples;
+        exponentialAverage = snapshot.exponentialAverage;
+        exponentialAverageInitialized = snapshot.exponentialAverageInitialized;
+        consecutiveLockSamples = snapshot.consecutiveLockSamples;
+        consecutiveUnlockSamples = snapshot.consecutiveUnlockSamples;
+    }
+
+    lastStateChangeTime = timerFromAge(snapshot.stateChangeAgeMs, elapsedMs);
+    movementStartTime = timerFromAge(snapshot.movementAgeMs, elapsedMs);
+    weakSignalStartTime = timerFromAge(snapshot.weakSignalAgeMs, elapsedMs);
+
+    // Слоты хостов после сброса пусты: ограничения применятся при подключении хоста
+    for (int i = 0; i < RTC_SNAPSHOT_MAX_HOSTS; i++) {
+        const RtcUnlockLimit& limit = snapshot.unlockLimits[i];
+        strlcpy(restoredUnlockLimits[i].address, limit.addr, sizeof(restoredUnlockLimits[i].address));
+        restoredUnlockLimits[i].failedAttempts = limit.failedAttempts;
+        restoredUnlockLimits[i].lastFailedAttempt = timerFromAge(limit.failedAgeMs, elapsedMs);
+    }
+
+    strncpy(bootLastAddr, snapshot.lastAddr, sizeof(bootLastAddr) - 1);
+    bootWasLocked = (currentState == LOCKED);
+
+    if (serialOutputEnabled) {
+        Serial.printf("RTC snapshot restored: state=%d, lock=%d, unlock=%d, age=%lu ms, filter %s\n",
+            currentState, dynamicLockThreshold, dynamicUnlockThreshold, (unsigned long)elapsedMs,
+            elapsedMs <= RTC_FILTER_MAX_AGE_MS ? "restored" : "stale");
+    }
+    return true;
+}
+
+// Загружает NVS, пороги и состояние блокировки и отпускает storageReadySem
+static void loadBootStorage() {
+    if (rtcStateRestored) {
+        // Пороги, адрес и состояние уже восстановлены из RTC - нужен только handle NVS
+        initializeNvs();
+    } else {
+        initStorage();
+        if (loadLastAddress(bootLastAddr, sizeof(bootLastAddr))) {
+            bootWasLocked = loadDeviceLockState(bootLastAddr);
+        }
+    }
+    bootMark("storage_loaded");
+    xSemaphoreGive(storageReadySem);
+}
+
+// Загрузка хранилища, пока основная задача инициализирует дисплей
+static void storageBootTask(void* param) {
+    loadBootStorage();
+    vTaskDelete(NULL);
+}
+
 void setup() {
+    bootMark("app_start");
+    Serial.begin(115200);
+
+    // После программного сброса или выхода из сна состояние берём из RTC-памяти, NVS - только при холодном старте
+    rtcStateRestored = restoreRtcSnapshot();
+    bootMark("rtc_restore");
+
+    // Хранилище загружается параллельно с инициализацией дисплея в M5.begin()
+    storageReadySem = xSemaphoreCreateBinary();
+    if (xTaskCreatePinnedToCore(storageBootTask, "boot_storage", 4096, NULL, 1, NULL, 0) != pdPASS) {
+        // Не удалось создать задачу - грузим хранилище последовательно
+        loadBootStorage();
+    }
+
     auto cfg = M5.config();
     M5.begin(cfg);
-    
-    Serial.begin(115200);
-    delay(100);
-    
-    Serial.println("\nStarting BLE Keyboard Test");
-    
-    // Инициализация дисплея для M5StickC Plus 2
     M5.Display.setRotation(3);
-    Disbuff = new M5Canvas(&M5.Display);
-    Disbuff->createSprite(M5.Display.width(), M5.Display.height());
-    Disbuff->setTextSize(1);
+    powerManager.begin();
+    bootMark("display_init");
     
-    Serial.println("=== Initial NVS Setup ===");
-    
-    // Инициализируем NVS
-    initStorage(); // Вызываем нашу функцию
+    Serial.println("\nStarting BLE Keyboard Test");
     
     // Восстанавливаем проверку кнопки для очистки NVS
     bool clearNVS = false;  // По умолчанию не очищаем
@@ -2327,29 +2574,60 @@ void setup() {
         }
     }
     
-    // Очищаем NVS только если это явно запрошено
+    xSemaphoreTake(storageReadySem, portMAX_DELAY);
+    vSemaphoreDelete(storageReadySem);
+    storageReadySem = nullptr;
+    bootMark("storage_joined");
+    
+    // Очищаем NVS только если это явно запрошено (до запуска BLE, т.к. стираются и bond)
     if (clearNVS) {
         if (serialOutputEnabled) {
             Serial.println("Clearing NVS...");
         }
-        nvs_flash_erase();
-        nvs_flash_init();
+        // Стираем раздел и переоткрываем NVS handle
+        resetNvs();
+        initStorage();
+        bootLastAddr[0] = '\0';
+        bootWasLocked = false;
         
-        // Переоткрываем NVS handle после очистки
-        initStorage(); 
+        // Снимок RTC тоже сбрасываем, иначе после сброса вернутся старые пороги
+        rtcSnapshotInvalidate();
+        if (rtcStateRestored) {
+            rtcStateRestored = false;
+            dynamicLockThreshold = DEFAULT_LOCK_RSSI;
+            dynamicUnlockThreshold = DEFAULT_UNLOCK_RSSI;
+            memset(rssiValues, 0, sizeof(rssiValues));
+            rssiIndex = 0;
+            validSamples = 0;
+            exponentialAverageInitialized = false;
+            consecutiveLockSamples = 0;
+            consecutiveUnlockSamples = 0;
+            memset(restoredUnlockLimits, 0, sizeof(restoredUnlockLimits));
+        }
+        bootMark("nvs_cleared");
     }
     
-    // Перезапускаем BLE стек
-    NimBLEDevice::deinit(true);
-    delay(100);
+    // Восстанавливаем состояние блокировки при запуске по последнему устройству
+    // (при восстановлении из RTC состояние уже применено, включая промежуточные)
+    if (!rtcStateRestored) {
+        currentState = bootWasLocked ? LOCKED : NORMAL;
+        if (bootWasLocked && serialOutputEnabled) {
+            Serial.printf("Restored lock state for %s: LOCKED\n", bootLastAddr);
+        }
+    }
+    initHosts(bootLastAddr);
     
-    // Инициализация BLE
+    // Инициализация BLE. Стек ещё не запускался, поэтому deinit не нужен
     if (serialOutputEnabled) {
         Serial.println("Initializing BLE...");
     }
     NimBLEDevice::init("M5Locker");
     NimBLEDevice::setSecurityAuth(true, true, true);
-    NimBLEDevice::setPower(ESP_PWR_LVL_P9); // Устанавливаем макс мощность для сопряжения
+    // Обмен IRK при сопряжении: хост с RPA опознаётся контроллером по белому списку сканирования
+    NimBLEDevice::setSecurityInitKey(BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID);
+    NimBLEDevice::setSecurityRespKey(BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID);
+    txPowerControllerReset(ESP_PWR_LVL_P9); // Устанавливаем макс мощность для сопряжения
+    bootMark("ble_init");
 
     bleServer = NimBLEDevice::createServer();
     bleServer->setCallbacks(new ServerCallbacks());
@@ -2357,77 +2635,105 @@ void setup() {
     hid = new NimBLEHIDDevice(bleServer);
     input = hid->getInputReport(1); // Исправляем
     output = hid->getOutputReport(1); // Исправляем
+    input->setCallbacks(new InputReportCallbacks());
 
     hid->setManufacturer("M5Stack"); // Исправляем
     // hid->pnp(0x02, 0xe502, 0xa111, 0x0210); // Удаляем
     hid->setHidInfo(0x00, 0x01); // Исправляем
     hid->setReportMap((uint8_t*)hidReportDescriptor, sizeof(hidReportDescriptor)); // Исправляем
     hid->startServices();
+    bootMark("hid_services");
 
     NimBLEAdvertising* pAdvertising; // Объявляем
     pAdvertising = bleServer->getAdvertising();
     pAdvertising->setAppearance(HID_KEYBOARD);
     pAdvertising->addServiceUUID(hid->getHidService()->getUUID()); // Исправляем
     // pAdvertising->setScanResponse(true); // Комментируем, т.к. метод setScanResponseData ожидает данные
-    pAdvertising->start();
+
+    // Сканер до рекламы: белый список собирается из bond, пока контроллер им ещё не пользуется
+    // Колбэки сканирования ставит планировщик: он считает отчёты и нагрузку на стек
+    pScan = NimBLEDevice::getScan();
+    scanSchedulerBegin(pScan);
+
+    // Рекламой управляет менеджер переподключения: сначала направленная на сопряжённые хосты
+    bleServer->advertiseOnDisconnect(false);
+    advSchedulerBegin(pAdvertising);
+    reconnectBegin(bootLastAddr);
+    reconnectAdvertise("boot", 0, false);
+    bootMark("advertising");
 
     Serial.println("Advertising started...");
 
-    // Восстанавливаем состояние блокировки при запуске по последнему устройству
-    {
-        char lastAddrBuf[32] = {0};
-        size_t lastLen = sizeof(lastAddrBuf);
-        if (nvs_get_str(nvsHandle, KEY_LAST_ADDR, lastAddrBuf, &lastLen) == ESP_OK
-            && strlen(lastAddrBuf) > 0) {
-            String lastAddr = String(lastAddrBuf);
-            bool wasLocked = loadDeviceLockState(lastAddr);
-            currentState = wasLocked ? LOCKED : NORMAL;
-            if (wasLocked && serialOutputEnabled) {
-                Serial.printf("Restored lock state for %s: LOCKED\n", lastAddr.c_str());
-            }
-        } else {
-            currentState = NORMAL;
-        }
+    // Два буфера кадра для задачи UI, создаём их после запуска рекламы
+    if (!uiBegin(&M5.Display, loadDisplayColorDepth(UI_COLOR_DEPTH))) {
+        Serial.println("Display: no memory for frame buffer, screen disabled");
     }
+    defineDisplayWidgets();
+    bootMark("canvas");
 
-    // Инициализация сканера
-    pScan = NimBLEDevice::getScan();
-    pScan->setScanCallbacks(scanCallbacks); // Исправляем
-    pScan->setActiveScan(true);
-    pScan->setInterval(SCAN_INTERVAL_NORMAL);
-    pScan->setWindow(SCAN_WINDOW_NORMAL);
-    pScan->setDuplicateFilter(false);
+    // esp_pm и пробуждение от кнопок; light sleep включается из loop() в состоянии LOCKED
+    initPowerMode();
+    startTasks();
+    registerJobs();
+    applyPowerProfile();
+    updateEnergyMeter();
+    bootMark("setup_done");
 
+    // Пороги последнего устройства уже загружены в initStorage()
     Serial.println("Setup complete");
+    if (serialOutputEnabled) {
+        printBootProfile();
+    }
+}
 
-    // Загружаем пороги для последнего устройства, если оно было спарено
-    {
-        char lastDev[32] = {0};
-        size_t len = sizeof(lastDev);
-        if (nvs_get_str(nvsHandle, KEY_LAST_ADDR, lastDev, &len) == ESP_OK && strlen(lastDev) > 0) {
-            String lastAddr = String(lastDev);
-            DeviceSettings ds = getDeviceSettings(lastAddr);
-            dynamicLockThreshold = ds.lockRssi;
-            dynamicUnlockThreshold = ds.unlockRssi;
-            if (serialOutputEnabled) {
-                Serial.printf("Setup loaded thresholds for %s: lock=%d, unlock=%d\n",
-                    lastAddr.c_str(), dynamicLockThreshold, dynamicUnlockThreshold);
-            }
-        }
+// HID-команды и запись в NVS выполняются в своих задачах; задача опроса только ставит их в очередь.
+// Команда уходит в очередь хоста из рабочего набора и отправляется только в его соединение
+static void postHidCommand(HidCommandType type) {
+    const HostContext& host = hosts[activeHost];
+    HidCommand cmd = { type, (uint8_t)activeHost, host.connHandle, {} };
+    strlcpy(cmd.address, connectedDeviceAddress.c_str(), sizeof(cmd.address));
+    if (!taskMonitorSend(host.hidQueue, &cmd)) {
+        Serial.printf("HID queue %d full, command %d dropped\n", activeHost + 1, type);
     }
-    // Перезапускаем BLE стек
 }
 
-void loop() {
-    static unsigned long lastUpdate = 0;
-    static unsigned long lastCheck = 0;
-    static unsigned long lastRssiCheck = 0;
-    static bool lastRealState = false;
-    static unsigned long lastDebugCheck = 0;
-    static unsigned long lastVoltageCheck = 0;
-    static unsigned long lastReconnectCheck = 0;
-    static bool reconnectAttempted = false;
-    
+static void postStorageRequest(const StorageRequest& request) {
+    if (!taskMonitorSend(storageQueue, &request)) {
+        Serial.printf("Storage queue full, request %d dropped\n", request.type);
+    }
+}
+
+static void saveLockStateAsync(const char* address, bool locked) {
+    StorageRequest request = { STORAGE_SAVE_LOCK_STATE, {}, locked, 0, 0 };
+    strlcpy(request.address, address, sizeof(request.address));
+    postStorageRequest(request);
+}
+
+// Хост сопряжён и соединение зашифровано: последнее устройство и пароль по умолчанию
+static void hostConnectedAsync(const char* address) {
+    StorageRequest request = { STORAGE_HOST_CONNECTED, {}, false, 0, 0 };
+    strlcpy(request.address, address, sizeof(request.address));
+    postStorageRequest(request);
+}
+
+static void saveLastAddressAsync(const char* address) {
+    StorageRequest request = { STORAGE_SAVE_LAST_ADDR, {}, false, 0, 0 };
+    strlcpy(request.address, address, sizeof(request.address));
+    postStorageRequest(request);
+}
+
+static void saveThresholdsAsync(int lockRssi, int unlockRssi) {
+    StorageRequest request = { STORAGE_SAVE_THRESHOLDS, {}, false, (int16_t)lockRssi, (int16_t)unlockRssi };
+    strlcpy(request.address, connectedDeviceAddress.c_str(), sizeof(request.address));
+    postStorageRequest(request);
+}
+
+// Периодические задачи loop(), зарегистрированные в registerJobs()
+static const uint32_t INPUT_POLL_MS = 20;     // Опрос кнопок вне режима сна
+static const uint32_t CONNECTION_RECONCILE_MS = 5000;  // Сверка слотов со стеком; события GAP - сразу
+
+// Кнопки
+static void inputJob() {
     M5.update();
     
     // Обработка нажатий кнопок
@@ -2435,42 +2741,30 @@ void loop() {
         if (btnAPressStart == 0) {
             btnAPressStart = millis();
         }
+        lastUserActivity = millis();
+        // Пока кнопка удерживается дольше LONG_PRESS_DURATION, на экране подтверждение
+        if (!longPressShown && millis() - btnAPressStart >= LONG_PRESS_DURATION) {
+            longPressShown = true;
+            updateDisplay();
+        }
     } else {
         if (btnAPressStart != 0) {
             unsigned long pressDuration = millis() - btnAPressStart;
             if (pressDuration >= LONG_PRESS_DURATION) {
                 // Длительное нажатие: если сигнал достаточно слабый (устройство удалено), обновляем уровни
                 if (lastAverageRssi <= -70) {
-                    DeviceSettings settings = getDeviceSettings(connectedDeviceAddress.c_str());
                     int baseRssi = lastAverageRssi;
-                    settings.unlockRssi = baseRssi + 10;
-                    settings.lockRssi = baseRssi - 10;
-                    saveDeviceSettings(connectedDeviceAddress.c_str(), settings);
+                    saveThresholdsAsync(baseRssi - 10, baseRssi + 10);
                     Serial.println("Thresholds updated via long press on button A");
-                    // Показываем сообщение на экране, пока кнопка A удерживается
-                    while (M5.BtnA.isPressed()) {
-                        Disbuff->fillSprite(BLACK);
-                        Disbuff->setTextColor(GREEN);
-                        Disbuff->setCursor(5, 60);
-                        Disbuff->print("RSSI thresholds set");
-                        Disbuff->pushSprite(0, 0);
-                        delay(100);
-                        M5.update();
-                    }
                     // Обновляем динамические пороги
-                    dynamicLockThreshold = settings.lockRssi;
-                    dynamicUnlockThreshold = settings.unlockRssi;
+                    dynamicLockThreshold = baseRssi - 10;
+                    dynamicUnlockThreshold = baseRssi + 10;
                     if (serialOutputEnabled) {
                         Serial.printf("Dynamic thresholds updated via long press: lock=%d, unlock=%d\n",
                             dynamicLockThreshold, dynamicUnlockThreshold);
                     }
-                    // Сохраняем адрес устройства и commit, чтобы thresholds применялись после перезагрузки
-                    if (!connectedDeviceAddress.empty()) {
-                        esp_err_t errAddr = nvs_set_str(nvsHandle, KEY_LAST_ADDR, connectedDeviceAddress.c_str());
-                        if (errAddr == ESP_OK) {
-                            nvs_commit(nvsHandle);
-                        }
-                    }
+                    // Пороги сохраняются по адресу хоста: после перезагрузки они загрузятся
+                    // при его подключении, а для последнего устройства - уже при старте (initStorage)
                 } else {
                     Serial.println("Not far enough to update thresholds");
                 }
@@ -2479,386 +2773,803 @@ void loop() {
                 temporaryScreenOn();
             }
             btnAPressStart = 0;
+            if (longPressShown) {
+                longPressShown = false;
+                updateDisplay();
+            }
         }
     }
     
+    // Кнопка питания листает страницы: основная (по одной на каждый подключённый хост),
+    // график RSSI и задержки HID показанного хоста, энергия
+    if (M5.BtnPWR.wasClicked()) {
+        lastUserActivity = millis();
+        int nextHost = shownPage == UI_PAGE_MAIN ? nextConnectedHost(focusHost) : -1;
+        if (nextHost >= 0) {
+            setFocusHost(nextHost);
+        } else if (shownPage == UI_PAGE_ENERGY) {
+            shownPage = UI_PAGE_MAIN;
+            int firstHost = nextConnectedHost(-1);
+            if (firstHost >= 0) {
+                setFocusHost(firstHost);
+            }
+        } else {
+            shownPage = (UiPageId)(shownPage + 1);
+        }
+        updateDisplay();
+    }
+    
+    // Пользователь у устройства - хост, вероятно, рядом: ускоряем рекламу и открываем окно
+    // сопряжения ещё одного хоста, пока есть свободный слот
+    if (connectedHostCount() < HOST_MAX &&
+        (M5.BtnA.wasPressed() || M5.BtnB.wasPressed() || M5.BtnPWR.wasClicked())) {
+        reconnectAdvertise("button", 0, true);
+    }
+    
     if (M5.BtnB.wasPressed()) {
+        lastUserActivity = millis();
         if (serialOutputEnabled) {
             Serial.println("Button B pressed - typing password");
         }
-        
-        // Обновляем короткий ключ на случай, если он не был установлен
-        if (currentShortKey.length() == 0 && connectedDeviceAddress.length() > 0) {
-            currentShortKey = cleanMacAddress(connectedDeviceAddress.c_str()); // Восстанавливаем вызов
-            if (serialOutputEnabled) {
-                Serial.printf("Updated current short key: %s\n", currentShortKey.c_str());
-            }
+        postHidCommand(HID_CMD_TYPE_PASSWORD);
+    }
+    
+    // Проверяем, не пора ли выключить временно включенный экран
+    checkTemporaryScreen();
+}
+
+// Питание, яркость и учёт энергии
+static void powerJob() {
+    if (powerManager.update()) {
+        applyPowerProfile();
+    }
+    
+    // Регулируем яркость в зависимости от мощности передатчика
+    adjustBrightness(txPowerCurrentLevel());
+    
+    updateEnergyMeter();
+}
+
+// Снимок состояния в RTC-память, чтобы сброс не обнулял логику блокировки
+static void rtcSnapshotJob() {
+    saveRtcSnapshot();
+}
+
+// Выбор слота для нового соединения: тот же хост, свободный слот или отключённый хост.
+// -1 - все слоты заняты подключёнными хостами
+static int slotForHost(const char* address) {
+    int freeSlot = -1;
+    int idleSlot = -1;
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (hostConnected(slot)) {
+            continue;
         }
-        
+        const char* slotAddress = hostAddress(slot);
+        if (strcasecmp(slotAddress, address) == 0) {
+            return slot;
+        }
+        if (slotAddress[0] == '\0') {
+            if (freeSlot < 0) freeSlot = slot;
+        } else if (idleSlot < 0) {
+            idleSlot = slot;
+        }
+    }
+    return freeSlot >= 0 ? freeSlot : idleSlot;
+}
+
+// Рабочий набор для хоста, впервые занявшего слот: пустой фильтр, пороги и состояние блокировки из NVS
+static void resetActiveHost(const char* address) {
+    connectedDeviceAddress = address;
+    memset(rssiHistory, 0, sizeof(rssiHistory));
+    rssiHistoryIndex = 0;
+    memset(rssiValues, 0, sizeof(rssiValues));
+    rssiIndex = 0;
+    validSamples = 0;
+    exponentialAverage = 0;
+    exponentialAverageInitialized = false;
+    lastAverageRssi = 0;
+    rssiTraceCount = 0;
+    loadDeviceThresholds(address, dynamicLockThreshold, dynamicUnlockThreshold);
+    currentState = loadDeviceLockState(address) ? LOCKED : NORMAL;
+    lastStateChangeTime = 0;
+    consecutiveLockSamples = 0;
+    consecutiveUnlockSamples = 0;
+    movementStartTime = 0;
+    weakSignalStartTime = 0;
+}
+
+static int connParamHost = -1;          // Хост, соединение которого ведёт политика параметров
+static bool otherBondedHosts = false;   // Есть сопряжённые хосты, которые ещё не подключены
+
+// Хост подключился с RPA до сопряжения: шифрование открыло его идентификационный адрес.
+// Слот и настройки NVS переходят на этот адрес, иначе с каждой сменой RPA хост получал бы
+// новый слот, пороги по умолчанию и терял пароль
+static void rekeyHost(int slot, const char* address) {
+    if (strcasecmp(hostAddress(slot), address) == 0) {
+        return;
+    }
+    selectHost(slot);
+    HostContext& host = hosts[slot];
+    if (serialOutputEnabled) {
+        Serial.printf("Host %d: identity address %s (connected as %s)\n", slot + 1, address,
+            connectedDeviceAddress.c_str());
+    }
+    // Отключённый слот с прошлым соединением этого хоста больше не нужен
+    for (int other = 0; other < HOST_MAX; other++) {
+        HostContext& old = hosts[other];
+        if (other != slot && !hostConnected(other) && strcasecmp(old.address, address) == 0) {
+            host.failedUnlockAttempts = old.failedUnlockAttempts;
+            host.lastFailedAttempt = old.lastFailedAttempt;
+            old.address[0] = '\0';
+        }
+    }
+    resetActiveHost(address);
+    updateCurrentShortKey(address);
+    takeRestoredUnlockLimit(host, address, false);
+    host.hasPassword = hasDevicePassword(address);
+}
+
+static void onHostConnected(const NimBLEConnInfo& connInfo) {
+    // Слоты, пороги и пароли - по идентификационному адресу: у сопряжённого хоста стек
+    // разрешает RPA при подключении, у нового он станет известен после шифрования (rekeyHost)
+    std::string address = connInfo.getIdAddress().toString();
+    int slot = slotForHost(address.c_str());
+    if (slot < 0) {
+        Serial.printf("No free host slot (%d max), disconnecting %s\n", HOST_MAX, address.c_str());
+        bleServer->disconnect(connInfo.getConnHandle());
+        return;
+    }
+    bool firstHost = connectedHostCount() == 0;
+    selectHost(slot);
+    bool newHost = strcasecmp(connectedDeviceAddress.c_str(), address.c_str()) != 0;
+    if (newHost) {
+        resetActiveHost(address.c_str());
+    }
+    updateCurrentShortKey(address.c_str());
+    HostContext& host = hosts[slot];
+    takeRestoredUnlockLimit(host, address.c_str(), newHost);
+    // Экран показывает признак пароля на каждом снимке: NVS читается только при подключении
+    host.hasPassword = hasDevicePassword(address.c_str());
+    host.connHandle = connInfo.getConnHandle();
+    host.peerAddress = (uint64_t)connInfo.getIdAddress();
+    host.scanReportCount = 0;
+    reconnectConnected(host.peerAddress, host.connHandle);
+    // Хост мог быть сопряжён впервые: белый список сканирования пересоберётся из bond
+    scanSchedulerWhitelistChanged();
+    // RSSI берётся из соединения; сканирование включит планировщик, если этот источник пропадёт
+    host.lastConnRssiTime = millis();
+    
+    if (firstHost) {
+        // Новое соединение начинаем с максимальной мощности, регулятор снизит её по RSSI
+        txPowerControllerReset(ESP_PWR_LVL_P9);
+        scanMode = true;
+    }
+    // Политика параметров ведёт одно соединение - первого подключившегося хоста
+    if (connParamHost < 0) {
+        connParamHost = slot;
+        connParamPolicyReset(host.connHandle);
+    }
+    if (!hostConnected(focusHost) || firstHost) {
+        focusHost = slot;
+    }
+    
+    if (serialOutputEnabled) {
+        Serial.printf("Host %d connected: %s (handle %d, state %s)\n", slot + 1, address.c_str(),
+            host.connHandle, stateShortName(currentState));
+    }
+}
+
+static void onHostDisconnected(int slot, int reason) {
+    selectHost(slot);
+    HostContext& host = hosts[slot];
+    host.linkLosses++;
+    if (reason == BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_SPVN_TMO) {
+        host.linkTimeouts++;
+    }
+    // Соединения уже нет, Win+L не отправить: блокировка должна была сработать раньше,
+    // пока шёл supervision timeout. Считаем такие случаи; при возвращении хост будет
+    // разблокирован как заблокированный, поэтому состояние всё равно LOCKED
+    if (currentState != LOCKED) {
+        host.lostBeforeLock++;
         if (serialOutputEnabled) {
-            Serial.printf("Current short key: %s\n", currentShortKey.c_str());
+            Serial.printf("Host %d: Bluetooth connection lost before lock (reason 0x%x)\n", slot + 1, reason);
         }
-        
-        // Получаем пароль для текущего устройства
-        String password = getPasswordForDevice(currentShortKey);
-        if (password.length() > 0) {
-            if (serialOutputEnabled) {
-                Serial.printf("Password found, length: %d\n", password.length());
+        currentState = LOCKED;
+        lastStateChangeTime = millis();
+    }
+    // Хост отключён заблокированным: при холодном старте его состояние восстановится первым
+    saveLastAddressAsync(connectedDeviceAddress.c_str());
+    connParamPolicyLinkClosed(host.connHandle);
+    reconnectLinkLost(host.peerAddress, host.connHandle);
+    host.connHandle = BLE_HS_CONN_HANDLE_NONE;
+    
+    if (slot == connParamHost) {
+        connParamPolicyDisconnected();
+        connParamHost = nextConnectedHost(-1);
+        if (connParamHost >= 0) {
+            connParamPolicyReset(hosts[connParamHost].connHandle);
+        }
+    }
+    if (slot == focusHost && nextConnectedHost(-1) >= 0) {
+        focusHost = nextConnectedHost(-1);
+    }
+    
+    if (serialOutputEnabled) {
+        Serial.printf("Host %d disconnected: %s\n", slot + 1, connectedDeviceAddress.c_str());
+    }
+}
+
+// Слоты изменились: реклама при свободном слоте и экран
+static void onConnectionsChanged(bool hostLost) {
+    int hostCount = connectedHostCount();
+    connected = hostCount > 0;
+    selectHost(focusHost);
+    
+    // Реклама, пока есть свободный слот: после потери соединения - короткая направленная
+    // на сопряжённые хосты, затем ступенчатое замедление; при подключённых хостах - только
+    // для других сопряжённых хостов, чтобы время радио оставалось соединениям
+    otherBondedHosts = reconnectPendingHosts() > 0;
+    if (hostCount >= HOST_MAX) {
+        advSchedulerStop();
+    } else if (hostLost) {
+        reconnectAdvertise("disconnect", 0, false);
+    } else if (otherBondedHosts) {
+        reconnectAdvertise("next host", 0, false);
+    } else {
+        advSchedulerStop();
+    }
+    
+    if (serialOutputEnabled) {
+        Serial.printf("\n=== Connection state changed: %d/%d hosts ===\n", hostCount, HOST_MAX);
+        Serial.printf("Connected count: %d\n", bleServer->getConnectedCount());
+        Serial.printf("Advertising active: %s\n",
+            bleServer->getAdvertising()->isAdvertising() ? "Yes" : "No");
+    }
+    updateDisplay();
+}
+
+// События GAP из очереди: подключение и разрыв обрабатываются в той же итерации loop(),
+// в которой пришли, а не при следующем опросе
+static void processConnectionEvents() {
+    bool hostLost = false;
+    bool changed = false;
+    ConnEvent event;
+    while (taskMonitorReceive(connQueue, &event, 0)) {
+        int slot = slotForConnHandle(event.connHandle);
+        if (event.type == CONN_EVENT_ENCRYPTED) {
+            // После шифрования известен идентификационный адрес хоста (до него мог быть RPA)
+            NimBLEAddress identity = bleServer->getPeerInfoByHandle(event.connHandle).getIdAddress();
+            uint64_t idAddress = (uint64_t)identity;
+            if (slot >= 0 && idAddress != 0) {
+                hosts[slot].peerAddress = idAddress;
+                rekeyHost(slot, identity.toString().c_str());
+                hostConnectedAsync(hostAddress(slot));
             }
-            typePassword(password);
-        } else {
-            if (serialOutputEnabled) {
-                Serial.println("No password stored for current device");
+            // Новый bond записан при шифровании (и мог вытеснить старый): белый список
+            // и учёт переподключений пересоберутся из bond
+            reconnectBondsChanged();
+            reconnectEncrypted(event.connHandle, idAddress);
+            scanSchedulerWhitelistChanged();
+        } else if (event.type == CONN_EVENT_HID_READY) {
+            reconnectHidReady(event.connHandle);
+        } else if (event.type == CONN_EVENT_DISCONNECT) {
+            // Устаревшее событие: handle уже занят новым живым соединением хоста этого слота
+            // (сверка успела подключить его раньше), такой хост не разрывался
+            if (slot >= 0 && hostLinkAlive(event.connHandle, hostAddress(slot))) {
+                if (serialOutputEnabled) {
+                    Serial.printf("Host %d: stale disconnect of handle %u ignored\n", slot + 1, event.connHandle);
+                }
+            } else if (slot >= 0) {
+                onHostDisconnected(slot, event.reason);
+                hostLost = true;
+                changed = true;
             }
+        } else if (slot < 0 && ble_gap_conn_find(event.connHandle, nullptr) == 0) {
+            // Соединение могло разорваться, пока событие ждало в очереди
+            onHostConnected(bleServer->getPeerInfoByHandle(event.connHandle));
+            changed = true;
+        }
+    }
+    if (changed) {
+        onConnectionsChanged(hostLost);
+    }
+}
+
+// Сверка слотов со списком соединений NimBLE: страховка на случай потерянного события
+// (очередь переполнена или соединение пришло до создания очереди)
+static void connectionJob() {
+    bool hostLost = false;
+    bool hostFound = false;
+    
+    // Пропавшие соединения (или handle уже занят другим хостом)
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (hostConnected(slot) && !hostLinkAlive(hosts[slot].connHandle, hostAddress(slot))) {
+            onHostDisconnected(slot, 0);
+            hostLost = true;
         }
     }
     
-    // Проверяем, не пора ли выключить временно включенный экран
-    checkTemporaryScreen();
-    
-    // Проверяем питание и яркость каждые 500мс
-    if (millis() - lastVoltageCheck >= 500) {
-        lastVoltageCheck = millis();
-        updatePowerStatus();  // Обновляем данные о питании
-        
-        // Регулируем яркость в зависимости от питания
-        esp_power_level_t currentPower = (esp_power_level_t)NimBLEDevice::getPower();
-        adjustBrightness(currentPower);
+    // Новые соединения
+    int peerCount = bleServer->getConnectedCount();
+    for (int i = 0; i < peerCount; i++) {
+        NimBLEConnInfo connInfo = bleServer->getPeerInfo(i);
+        if (slotForConnHandle(connInfo.getConnHandle()) < 0) {
+            onHostConnected(connInfo);
+            hostFound = true;
+        }
     }
     
-    // Проверка подключения
-    if (millis() - lastCheck >= 500) {
-        lastCheck = millis();
-        bool realConnected = bleServer->getConnectedCount() > 0;
-        
-        if (realConnected != lastRealState) {
-            lastRealState = realConnected;
-            connected = realConnected;
-            
+    if (hostLost || hostFound) {
+        connEventsMissed++;
+        onConnectionsChanged(hostLost);
+    }
+}
+
+// Реклама при свободном слоте: переход по ступеням и ускорение, если хост снова в эфире.
+// При подключённом хосте и без других сопряжённых хостов реклама идёт только на быстрой
+// ступени после нажатия кнопки (окно для сопряжения ещё одного компьютера)
+static void radioJob() {
+    if (connectedHostCount() < HOST_MAX) {
+        advSchedulerUpdate();
+        AdvTier tier = advSchedulerTier();
+        if (connected && !otherBondedHosts && tier >= ADV_TIER_MEDIUM && tier < ADV_TIER_OFF) {
+            advSchedulerStop();
+        }
+    }
+    if (connectedHostCount() < HOST_MAX) {
+        reconnectCheckHostSeen();
+    }
+    updateScanRequests(isLightSleepEnabled());
+}
+
+// Обновление экрана (в режиме сна экран выключен и не перерисовывается)
+static void displayJob() {
+    if (!isLightSleepEnabled()) {
+        updateDisplay();
+    }
+}
+
+// Измерение RSSI хоста из рабочего набора: RSSI соединения, иначе реклама хоста
+static bool sampleHostRssi(int slot) {
+    HostContext& host = hosts[slot];
+    int8_t rssi;
+    bool rssiValid = ble_gap_conn_rssi(host.connHandle, &rssi) == 0 && rssi != 0 && rssi != 127;
+    if (rssiValid) {
+        host.lastConnRssiTime = millis();
+    } else {
+        // Запасной источник: реклама хоста, пока планировщик держит сканирование
+        rssiValid = scanRssiForHost(slot, rssi);
+    }
+    if (!rssiValid) {
+        return false;
+    }
+    // Создаем измерение
+    RssiMeasurement measurement = {
+        .value = rssi,
+        .timestamp = millis(),
+        .isValid = true
+    };
+    addRssiMeasurement(measurement);
+    return true;
+}
+
+// Автомат блокировки/разблокировки хоста из рабочего набора
+static void runLockDecision() {
+    // Проверяем, прошло ли достаточно времени с момента последнего изменения состояния
+    bool canChangeState = (millis() - lastStateChangeTime) > STATE_CHANGE_DELAY;
+    
+    // Проверяем стабильность сигнала
+    bool stable = isRssiStable();
+    
+    // Логика блокировки компьютера
+    if (currentState != LOCKED) {
+        // Проверяем на очень слабый сигнал, который может привести к потере соединения
+        if (lastAverageRssi < SIGNAL_CRITICAL_THRESHOLD) {
             if (serialOutputEnabled) {
-                Serial.printf("\n=== Connection state changed: %s ===\n", 
-                    connected ? "Connected" : "Disconnected");
-                Serial.printf("Connected count: %d\n", bleServer->getConnectedCount());
-                Serial.printf("Advertising active: %s\n", 
-                    bleServer->getAdvertising()->isAdvertising() ? "Yes" : "No");
-                
-                // Добавляем отладочную информацию о текущем состоянии connection_info
-                Serial.println("\n=== Connection Info Debug ===");
-                Serial.printf("Connected: %s\n", connection_info.connected ? "Yes" : "No");
-                Serial.printf("Connection Handle: %d\n", connection_info.conn_handle);
-                Serial.printf("Device Address: '%s'\n", connection_info.address.c_str());
-                Serial.printf("Address Length: %d\n", connection_info.address.length());
-                Serial.printf("Connected Device Address: '%s'\n", connectedDeviceAddress.c_str());
-                Serial.println("=== End Connection Info Debug ===\n");
+                Serial.printf("Signal critically low (%d < %d), locking immediately...\n", 
+                    lastAverageRssi, SIGNAL_CRITICAL_THRESHOLD);
+            }
+            lockComputer();
+            currentState = LOCKED;
+            lastStateChangeTime = millis();
+            consecutiveLockSamples = 0;
+            consecutiveUnlockSamples = 0;
+        }
+        // Обычная логика блокировки при удалении
+        else if (lastAverageRssi < dynamicLockThreshold) {
+            consecutiveLockSamples++;
+            if (serialOutputEnabled) {
+                Serial.printf("Signal below lock threshold (%d < %d), sample %d/%d, stable=%s\n", 
+                    lastAverageRssi, dynamicLockThreshold, consecutiveLockSamples, 
+                    CONSECUTIVE_SAMPLES_NEEDED, stable ? "YES" : "NO");
             }
             
-            if (connected) {
-                // Сбрасываем флаг попытки переподключения
-                reconnectAttempted = false;
-                
-                NimBLEConnInfo connInfo = bleServer->getPeerInfo(0);
-                connectedDeviceAddress = connInfo.getAddress().toString();
-                
+            // Для блокировки требуем больше последовательных измерений
+            // Это предотвратит ложные блокировки из-за временных колебаний сигнала
+            int requiredSamples = CONSECUTIVE_SAMPLES_NEEDED + 1; // Увеличиваем количество требуемых измерений
+            
+            // Если достаточно последовательных измерений и прошло достаточно времени
+            // Для блокировки не требуем стабильности сигнала, так как при удалении сигнал становится нестабильным
+            if (consecutiveLockSamples >= requiredSamples && canChangeState) {
                 if (serialOutputEnabled) {
-                    Serial.printf("Connected device: %s\n", connectedDeviceAddress.c_str());
-                }
-                
-                pScan = NimBLEDevice::getScan();
-                pScan->stop();
-                delay(100);
-                
-                pScan->setActiveScan(true);
-                pScan->setInterval(40);
-                pScan->setWindow(20);
-                pScan->setScanCallbacks(scanCallbacks, true);
-                pScan->clearResults();
-                pScan->setFilterPolicy(BLE_HCI_SCAN_FILT_NO_WL);
-                pScan->setDuplicateFilter(false);
-                
-                if(pScan->start(0, false)) {
-                    scanMode = true;
-                    if (serialOutputEnabled) {
-                        Serial.println("Scan started successfully");
-                    }
-                } else {
-                    if (serialOutputEnabled) {
-                        Serial.println("Failed to start scan");
-                    }
-                }
-            } else {
-                // Если отключились, блокируем компьютер, если он еще не заблокирован
-                if (currentState != LOCKED) {
-                    if (serialOutputEnabled) {
-                        Serial.println("Bluetooth connection lost. Locking computer...");
-                    }
-                    lockComputer();
-                    currentState = LOCKED;
-                    lastStateChangeTime = millis();
-                }
-                
-                // Если отключились, проверяем состояние рекламы
-                if (!bleServer->getAdvertising()->isAdvertising()) {
-                    if (serialOutputEnabled) {
-                        Serial.println("Advertising not active, restarting...");
-                    }
-                    
-                    // Перезапускаем рекламу
-                    int rc = bleServer->getAdvertising()->start();
-                    if (serialOutputEnabled) {
-                        Serial.printf("Restart advertising result: %d\n", rc);
-                    }
+                    Serial.printf("Signal consistently below threshold for %d samples, locking...\n", 
+                        consecutiveLockSamples);
                 }
+                lockComputer();
+                currentState = LOCKED;
+                lastStateChangeTime = millis();
+                consecutiveLockSamples = 0;
+                consecutiveUnlockSamples = 0;
+            }
+        } else {
+            // Не сбрасываем счетчик полностью при небольших колебаниях сигнала
+            if (lastAverageRssi > dynamicLockThreshold + 5) {
+                // Сбрасываем счетчик только если сигнал значительно улучшился
+                consecutiveLockSamples = 0;
+            } else if (consecutiveLockSamples > 0) {
+                // Уменьшаем счетчик, но не сбрасываем полностью при небольших колебаниях
+                consecutiveLockSamples--;
             }
-        updateDisplay();
         }
     }
     
-    // Проверка необходимости переподключения
-    if (!connected && !reconnectAttempted) {
-        // Проверяем, было ли устройство сопряжено ранее
-        uint8_t isPaired = 0;
-        if (nvs_get_u8(nvsHandle, "paired", &isPaired) == ESP_OK && isPaired) {
-            // Если прошло 5 секунд с момента запуска и устройство не подключено,
-            // пробуем перезапустить рекламу с другими параметрами
-            if (millis() - lastReconnectCheck >= 5000) {
-                lastReconnectCheck = millis();
-                
-                if (serialOutputEnabled) {
-                    Serial.println("\n=== Attempting reconnection ===");
-                }
-                
-                // Останавливаем текущую рекламу
-                bleServer->getAdvertising()->stop();
-                delay(100);
-                
-                // Настраиваем рекламу для переподключения
-                NimBLEAdvertising* pAdvertising = bleServer->getAdvertising();
-                pAdvertising->clearData();
-                
-                // Создаем новые объекты для рекламных данных
-                NimBLEAdvertisementData advData;
-                
-                // Настраиваем рекламу для переподключения
-                advData.setFlags(BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP);
-                advData.setAppearance(0x03C1);  // Keyboard appearance
-                advData.setCompleteServices(NimBLEUUID("1812"));  // HID Service
-                
-                // Устанавливаем данные рекламы
-                int rc = pAdvertising->setAdvertisementData(advData);
-                
-                // Настраиваем данные сканирования
-                NimBLEAdvertisementData scanResponse;
-                scanResponse.setName("M5 HID");
-                rc = pAdvertising->setScanResponseData(scanResponse);
-                
-                // Устанавливаем более короткие интервалы рекламы для быстрого переподключения
-                pAdvertising->setMinInterval(0x06);  // 3.75ms
-                pAdvertising->setMaxInterval(0x0C);  // 7.5ms
-                
-                // Запускаем рекламу
-                rc = pAdvertising->start();
+    // Логика разблокировки компьютера
+    if (currentState == LOCKED) {
+        // Используем скользящее среднее для разблокировки, чтобы избежать ложных срабатываний
+        if (lastAverageRssi > dynamicUnlockThreshold) {
+            consecutiveUnlockSamples++;
+            if (serialOutputEnabled) {
+                Serial.printf("Signal above unlock threshold (%d > %d), sample %d/%d, stable=%s\n", 
+                    lastAverageRssi, dynamicUnlockThreshold, consecutiveUnlockSamples, 
+                    CONSECUTIVE_SAMPLES_NEEDED, stable ? "YES" : "NO");
+            }
+            
+            // Для разблокировки требуем больше последовательных измерений и более длительное время
+            // Это предотвратит ложные разблокировки из-за временных колебаний сигнала
+            int requiredSamples = CONSECUTIVE_SAMPLES_NEEDED + 2; // Увеличиваем количество требуемых измерений
+            
+            // Если достаточно последовательных измерений, прошло достаточно времени и сигнал относительно стабилен
+            if (consecutiveUnlockSamples >= requiredSamples && canChangeState) {
                 if (serialOutputEnabled) {
-                    Serial.printf("Reconnection advertising result: %d\n", rc);
+                    Serial.printf("Signal consistently above threshold for %d samples, unlocking...\n", 
+                        consecutiveUnlockSamples);
                 }
-                
-                // Устанавливаем флаг, что попытка переподключения была сделана
-                reconnectAttempted = true;
+                unlockComputer();
+                currentState = NORMAL;
+                lastStateChangeTime = millis();
+                consecutiveLockSamples = 0;
+                consecutiveUnlockSamples = 0;
+            }
+        } else {
+            // Не сбрасываем счетчик полностью при небольших колебаниях сигнала
+            // Это позволит разблокировать устройство даже при небольших колебаниях сигнала
+            if (lastAverageRssi < dynamicUnlockThreshold - 5) {
+                // Сбрасываем счетчик только если сигнал значительно ухудшился
+                consecutiveUnlockSamples = 0;
+            } else if (consecutiveUnlockSamples > 0) {
+                // Уменьшаем счетчик, но не сбрасываем полностью при небольших колебаниях
+                consecutiveUnlockSamples--;
             }
         }
     }
-    
-    // Обновление экрана
-    if (millis() - lastUpdate >= 100) {
-        lastUpdate = millis();
-        updateDisplay();
+}
+
+// Измерение RSSI, регулятор мощности и логика блокировки/разблокировки каждого подключённого хоста.
+// Время радио делят соединения: RSSI читается из событий соединений, которые идут и так,
+// сканирование общее для всех хостов, а мощность передатчика одна - по самому слабому хосту
+static void rssiJob() {
+    static unsigned long lastRssiPrint = 0;
+    if (!scanMode) {
+        return;
     }
     
-    // Сканирование и проверка RSSI
-    if (scanMode) {
-        static unsigned long lastRssiCheck = 0;
-        static unsigned long lastRssiPrint = 0;
-        
-        if (millis() - lastRssiCheck >= 500) {  // Каждые 500мс
-            lastRssiCheck = millis();
+    bool measured = false;
+    int weakestRssi = 0;
+    bool lockCritical = false;
+    bool printRssi = serialOutputEnabled && millis() - lastRssiPrint >= 1000;
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (!hostConnected(slot)) {
+            continue;
+        }
+        selectHost(slot);
+        if (sampleHostRssi(slot)) {
+            weakestRssi = measured ? min(weakestRssi, lastAverageRssi) : lastAverageRssi;
+            measured = true;
+            // У порога блокировки при удалении - максимум, чтобы команда блокировки гарантированно дошла
+            lockCritical |= currentState == MOVING_AWAY && lastAverageRssi < dynamicLockThreshold + 5;
             
-            if (connected && bleServer && bleServer->getConnectedCount() > 0) {
-                NimBLEConnInfo connInfo = bleServer->getPeerInfo(0);
-                int8_t rssi;
-                if (ble_gap_conn_rssi(connInfo.getConnHandle(), &rssi) == 0) {
-                    if (rssi != 0 && rssi != 127) {
-                        // Создаем измерение
-                        RssiMeasurement measurement = {
-                            .value = rssi,
-                            .timestamp = millis(),
-                            .isValid = true
-                        };
-                        addRssiMeasurement(measurement);
-                        
-                        // Выводим в Serial реже
-                        if (serialOutputEnabled && millis() - lastRssiPrint >= 1000) {
-                            lastRssiPrint = millis();
-                            Serial.printf("\nRSSI: %d dBm (avg: %d)\n", rssi, lastAverageRssi);
-                        }
-                    }
-                }
+            // Выводим в Serial реже
+            if (printRssi) {
+                lastRssiPrint = millis();
+                Serial.printf("\nRSSI host %d: %d dBm (avg: %d)\n", slot + 1,
+                    rssiHistory[(rssiHistoryIndex + RSSI_HISTORY_SIZE - 1) % RSSI_HISTORY_SIZE].value,
+                    lastAverageRssi);
             }
         }
+        runLockDecision();
+    }
+    selectHost(focusHost);
+    
+    if (measured) {
+        // Мощность по запасу линии в границах профиля питания
+        const PowerProfile& profile = powerManager.profile();
+        txPowerControllerUpdate(weakestRssi,
+            lockCritical ? ESP_PWR_LVL_P9 : profile.txFloor,
+            lockCritical ? ESP_PWR_LVL_P9 : profile.txCeiling);
+    }
+}
+
+// Отладочная информация о RSSI хоста из рабочего набора
+static void printRssiDebug(int slot) {
+    Serial.printf("\n=== RSSI Debug Info: host %d (%s) ===\n", slot + 1, connectedDeviceAddress.c_str());
+    Serial.printf("Current state: %s\n", 
+        currentState == NORMAL ? "NORMAL" : 
+        currentState == MOVING_AWAY ? "MOVING_AWAY" : 
+        currentState == LOCKED ? "LOCKED" : "APPROACHING");
+    Serial.printf("Current RSSI: %d dBm (filtered)\n", lastAverageRssi);
+    Serial.printf("Lock threshold: %d dBm\n", dynamicLockThreshold);
+    Serial.printf("Unlock threshold: %d dBm\n", dynamicUnlockThreshold);
+    Serial.printf("Consecutive lock samples: %d/%d\n", consecutiveLockSamples, CONSECUTIVE_SAMPLES_NEEDED);
+    Serial.printf("Consecutive unlock samples: %d/%d\n", consecutiveUnlockSamples, CONSECUTIVE_SAMPLES_NEEDED);
+    Serial.printf("Time since last state change: %lu ms\n", millis() - lastStateChangeTime);
+    Serial.printf("Signal stability: %s\n", isRssiStable() ? "STABLE" : "UNSTABLE");
+    Serial.println("=== End RSSI Debug ===\n");
+}
+
+// Периодически выводим отладочную информацию о RSSI каждого подключённого хоста
+static void rssiDebugJob() {
+    if (!scanMode || !serialOutputEnabled) {
+        return;
+    }
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (hostConnected(slot)) {
+            selectHost(slot);
+            printRssiDebug(slot);
+        }
+    }
+    selectHost(focusHost);
+}
+
+// Режим питания и параметры соединения по состоянию
+static void powerStateJob() {
+    bool lowPower = isLockedIdle();
+    if (lowPower != isLightSleepEnabled()) {
+        bool applied = setLightSleepEnabled(lowPower);
+        if (serialOutputEnabled) {
+            Serial.printf("Low power mode %s (light sleep %s)\n",
+                lowPower ? "entered" : "left", applied ? "applied" : "not supported");
+        }
+        // Панель и подсветка выключены, пока экран не перерисовывается
+        setDisplaySleep(lowPower);
+    }
+    
+    // Частота CPU и интервал соединения: в NORMAL и LOCKED хватает экономных,
+    // при удалении/приближении (от любого из хостов) решение и HID-команда нужны быстрее
+    bool userMoving = false;
+    syncHosts();
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        userMoving |= hostConnected(slot) &&
+            (hosts[slot].state == MOVING_AWAY || hosts[slot].state == APPROACHING);
+    }
+    powerModeSetStateBoost(userMoving);
+    if (connected) {
+        connParamPolicyUpdate(userMoving ? CONN_PARAM_ACTIVE : CONN_PARAM_IDLE);
+    }
+    // Остальным хостам нужен тот же supervision timeout, иначе Win+L не успеет до разрыва
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (slot != connParamHost && hostConnected(slot)) {
+            connParamPolicyGuardTimeout(hosts[slot].connHandle);
+        }
     }
     
-    // Обработка Serial
-    echoSerialInput();
+    // В режиме сна кнопки опрашиваются реже, чип спит между опросами
+    jobSetPeriod(inputJobId, lowPower ? LOCKED_IDLE_LOOP_MS : INPUT_POLL_MS);
+}
+
+static void registerJobs() {
+    const PowerProfile& profile = powerManager.profile();
+    inputJobId = jobAdd("input", inputJob, INPUT_POLL_MS);
+    jobAdd("power", powerJob, 500);
+    jobAdd("rtc", rtcSnapshotJob, RTC_SNAPSHOT_PERIOD_MS);
+    jobAdd("connection", connectionJob, CONNECTION_RECONCILE_MS);
+    jobAdd("radio", radioJob, 100);
+    displayJobId = jobAdd("display", displayJob, profile.displayUpdateMs);
+    rssiJobId = jobAdd("rssi", rssiJob, profile.rssiSampleMs);
+    jobAdd("rssi debug", rssiDebugJob, 10000);
+    jobAdd("power state", powerStateJob, 100);
+}
+
+void loop() {
+    powerModeLoopStart();
+    {
+        TaskBusyScope busy(controlTaskId);
+        processConnectionEvents();
+        processConsoleCommands();
+        jobSchedulerRun();
+        publishHostTable();
+    }
     
-    delay(1);
+    // Сон до ближайшего дедлайна: вместо пробуждения каждую миллисекунду
+    powerModeIdle(jobSchedulerMsUntilNext());
+}
+
+// Команда pair: удаление bond и перезагрузка; выполняется задачей опроса
+static void enterPairingMode() {
+    if (serialOutputEnabled) {
+        Serial.println("\n=== Starting Pairing Mode ===");
+    }
     
-    if (scanMode) {
-        static unsigned long lastRssiCheck = 0;
-        static unsigned long lastRssiDebug = 0;
-        
-        // Периодически выводим отладочную информацию о RSSI
-        if (serialOutputEnabled && millis() - lastRssiDebug >= 10000) {  // Каждые 10 секунд
-            lastRssiDebug = millis();
-            Serial.println("\n=== RSSI Debug Info ===");
-            Serial.printf("Current state: %s\n", 
-                currentState == NORMAL ? "NORMAL" : 
-                currentState == MOVING_AWAY ? "MOVING_AWAY" : 
-                currentState == LOCKED ? "LOCKED" : "APPROACHING");
-            Serial.printf("Current RSSI: %d dBm (filtered)\n", lastAverageRssi);
-            Serial.printf("Lock threshold: %d dBm\n", dynamicLockThreshold);
-            Serial.printf("Unlock threshold: %d dBm\n", dynamicUnlockThreshold);
-            Serial.printf("Consecutive lock samples: %d/%d\n", consecutiveLockSamples, CONSECUTIVE_SAMPLES_NEEDED);
-            Serial.printf("Consecutive unlock samples: %d/%d\n", consecutiveUnlockSamples, CONSECUTIVE_SAMPLES_NEEDED);
-            Serial.printf("Time since last state change: %lu ms\n", millis() - lastStateChangeTime);
-            Serial.printf("Signal stability: %s\n", isRssiStable() ? "STABLE" : "UNSTABLE");
-            Serial.println("=== End RSSI Debug ===\n");
+    // Если устройство подключено, отключаем его
+    if (connected) {
+        if (serialOutputEnabled) {
+            Serial.println("Disconnecting current device...");
         }
-        
-        if (millis() - lastRssiCheck >= 500) {  // Каждые 500мс
-            lastRssiCheck = millis();
-            
-            // Проверяем, прошло ли достаточно времени с момента последнего изменения состояния
-            bool canChangeState = (millis() - lastStateChangeTime) > STATE_CHANGE_DELAY;
-            
-            // Проверяем стабильность сигнала
-            bool stable = isRssiStable();
-            
-            // Логика блокировки компьютера
-            if (currentState != LOCKED) {
-                // Проверяем на очень слабый сигнал, который может привести к потере соединения
-                if (lastAverageRssi < SIGNAL_CRITICAL_THRESHOLD) {
-                    if (serialOutputEnabled) {
-                        Serial.printf("Signal critically low (%d < %d), locking immediately...\n", 
-                            lastAverageRssi, SIGNAL_CRITICAL_THRESHOLD);
-                    }
-                    lockComputer();
-                    currentState = LOCKED;
-                    lastStateChangeTime = millis();
-                    consecutiveLockSamples = 0;
-                    consecutiveUnlockSamples = 0;
-                }
-                // Обычная логика блокировки при удалении
-                else if (lastAverageRssi < dynamicLockThreshold) {
-                    consecutiveLockSamples++;
-                    if (serialOutputEnabled) {
-                        Serial.printf("Signal below lock threshold (%d < %d), sample %d/%d, stable=%s\n", 
-                            lastAverageRssi, dynamicLockThreshold, consecutiveLockSamples, 
-                            CONSECUTIVE_SAMPLES_NEEDED, stable ? "YES" : "NO");
-                    }
-                    
-                    // Для блокировки требуем больше последовательных измерений
-                    // Это предотвратит ложные блокировки из-за временных колебаний сигнала
-                    int requiredSamples = CONSECUTIVE_SAMPLES_NEEDED + 1; // Увеличиваем количество требуемых измерений
-                    
-                    // Если достаточно последовательных измерений и прошло достаточно времени
-                    // Для блокировки не требуем стабильности сигнала, так как при удалении сигнал становится нестабильным
-                    if (consecutiveLockSamples >= requiredSamples && canChangeState) {
-                        if (serialOutputEnabled) {
-                            Serial.printf("Signal consistently below threshold for %d samples, locking...\n", 
-                                consecutiveLockSamples);
-                        }
-                lockComputer();
-                currentState = LOCKED;
-                        lastStateChangeTime = millis();
-                        consecutiveLockSamples = 0;
-                        consecutiveUnlockSamples = 0;
-                    }
-                } else {
-                    // Не сбрасываем счетчик полностью при небольших колебаниях сигнала
-                    if (lastAverageRssi > dynamicLockThreshold + 5) {
-                        // Сбрасываем счетчик только если сигнал значительно улучшился
-                        consecutiveLockSamples = 0;
-                    } else if (consecutiveLockSamples > 0) {
-                        // Уменьшаем счетчик, но не сбрасываем полностью при небольших колебаниях
-                        consecutiveLockSamples--;
-                    }
-                }
-            }
-            
-            // Логика разблокировки компьютера
-    if (currentState == LOCKED) {
-                // Используем скользящее среднее для разблокировки, чтобы избежать ложных срабатываний
-                if (lastAverageRssi > dynamicUnlockThreshold) {
-                    consecutiveUnlockSamples++;
-                    if (serialOutputEnabled) {
-                        Serial.printf("Signal above unlock threshold (%d > %d), sample %d/%d, stable=%s\n", 
-                            lastAverageRssi, dynamicUnlockThreshold, consecutiveUnlockSamples, 
-                            CONSECUTIVE_SAMPLES_NEEDED, stable ? "YES" : "NO");
-                    }
-                    
-                    // Для разблокировки требуем больше последовательных измерений и более длительное время
-                    // Это предотвратит ложные разблокировки из-за временных колебаний сигнала
-                    int requiredSamples = CONSECUTIVE_SAMPLES_NEEDED + 2; // Увеличиваем количество требуемых измерений
-                    
-                    // Если достаточно последовательных измерений, прошло достаточно времени и сигнал относительно стабилен
-                    if (consecutiveUnlockSamples >= requiredSamples && canChangeState) {
-                        if (serialOutputEnabled) {
-                            Serial.printf("Signal consistently above threshold for %d samples, unlocking...\n", 
-                                consecutiveUnlockSamples);
-                        }
-                    unlockComputer();
-                        currentState = NORMAL;
-                        lastStateChangeTime = millis();
-                        consecutiveLockSamples = 0;
-                        consecutiveUnlockSamples = 0;
-                    }
-                } else {
-                    // Не сбрасываем счетчик полностью при небольших колебаниях сигнала
-                    // Это позволит разблокировать устройство даже при небольших колебаниях сигнала
-                    if (lastAverageRssi < dynamicUnlockThreshold - 5) {
-                        // Сбрасываем счетчик только если сигнал значительно ухудшился
-                        consecutiveUnlockSamples = 0;
-                    } else if (consecutiveUnlockSamples > 0) {
-                        // Уменьшаем счетчик, но не сбрасываем полностью при небольших колебаниях
-                        consecutiveUnlockSamples--;
-                    }
-                }
+        NimBLEDevice::getServer()->disconnect(0);
+        delay(500);
+    }
+    
+    // Очищаем все соединения
+    if (bleServer != nullptr) {
+        bleServer->disconnect(0);
+        delay(100);
+    }
+    
+    // Останавливаем текущую рекламу если есть
+    NimBLEAdvertising* pAdvertising = bleServer->getAdvertising();
+    if(pAdvertising->isAdvertising()) {
+        pAdvertising->stop();
+        delay(100);
+    }
+    
+    // Очищаем сохраненные ключи перед перезапуском
+    NimBLEDevice::deleteAllBonds();
+    scanSchedulerWhitelistChanged();
+    reconnectBondsChanged();
+    delay(100);
+    
+    // Перезапускаем BLE стек
+    NimBLEDevice::deinit(true);
+    delay(100);
+    
+    // Инициализируем с новыми настройками
+    NimBLEDevice::init("M5 BLE HID");
+    txPowerControllerReset(ESP_PWR_LVL_P9);
+    
+    if (serialOutputEnabled) {
+        Serial.println("Restarting device for pairing...");
+    }
+    
+    delay(1000);  // Даем время на вывод сообщения
+    ESP.restart();  // Перезагружаем устройство
+}
+
+// Команда setaddr: адрес хоста на экране; выполняется задачей опроса
+static void setDeviceAddressFromConsole(const char* mac) {
+    Serial.println("\n=== Setting Device Address ===");
+    Serial.printf("MAC address: %s\n", mac);
+    
+    // Устанавливаем адрес устройства
+    selectHost(focusHost);
+    connectedDeviceAddress = mac;
+    updateCurrentShortKey(mac);
+    hosts[focusHost].hasPassword = hasDevicePassword(mac);
+    
+    Serial.println("\n=== Connection Info After Setting Address ===");
+    Serial.printf("Connected: %s\n", hostConnected(focusHost) ? "Yes" : "No");
+    Serial.printf("Connection Handle: %u\n", hosts[focusHost].connHandle);
+    Serial.printf("Connected Device Address: '%s'\n", connectedDeviceAddress.c_str());
+    Serial.println("=== End Connection Info ===\n");
+    
+    Serial.println("Device address set successfully");
+    Serial.println("=== End Setting Device Address ===");
+}
+
+// Пороги из консоли (setpwd, import) - хосту с этим адресом, если он есть в слотах
+static void applyThresholdsFromConsole(const char* address, int lockRssi, int unlockRssi) {
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        if (strcasecmp(hostAddress(slot), address) == 0) {
+            selectHost(slot);
+            dynamicLockThreshold = lockRssi;
+            dynamicUnlockThreshold = unlockRssi;
+            if (serialOutputEnabled) {
+                Serial.printf("Dynamic thresholds updated from console for host %d: lock=%d, unlock=%d\n",
+                    slot + 1, dynamicLockThreshold, dynamicUnlockThreshold);
             }
+            return;
+        }
+    }
+}
+
+// Пароль записан или стёрт из консоли: признак пароля перечитывается один раз, а не на каждом снимке экрана
+static void refreshPasswordFlags(const char* address) {
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        const char* hostAddr = hostAddress(slot);
+        if (hostAddr[0] != '\0' && (address[0] == '\0' || strcasecmp(hostAddr, address) == 0)) {
+            hosts[slot].hasPassword = hasDevicePassword(hostAddr);
+        }
+    }
+}
+
+static void processConsoleCommands() {
+    ConsoleCommand cmd;
+    while (taskMonitorReceive(consoleQueue, &cmd, 0)) {
+        switch (cmd.type) {
+            case CONSOLE_CMD_SET_ADDRESS:
+                setDeviceAddressFromConsole(cmd.address);
+                break;
+            case CONSOLE_CMD_APPLY_THRESHOLDS:
+                applyThresholdsFromConsole(cmd.address, cmd.lockRssi, cmd.unlockRssi);
+                break;
+            case CONSOLE_CMD_POWER_REPORT:
+                updateEnergyMeter();
+                printEnergyReport(powerManager.batteryLevel());
+                break;
+            case CONSOLE_CMD_POWER_RESET:
+                energyMeterReset();
+                Serial.println("Energy accounting restarted");
+                break;
+            case CONSOLE_CMD_SCAN_REPORT:
+                printScanSchedulerStats();
+                printAdvertiserTableStats();
+                break;
+            case CONSOLE_CMD_SCAN_OPEN:
+                scanSchedulerSetOpenPolicy(!scanSchedulerOpenPolicy());
+                Serial.printf("Scan filter: %s (from next scan period)\n",
+                    scanSchedulerOpenPolicy() ? "open" : "bonded hosts whitelist");
+                break;
+            case CONSOLE_CMD_JOBS_RESET:
+                jobStatsReset();
+                Serial.println("Job statistics restarted");
+                break;
+            case CONSOLE_CMD_PAIR:
+                enterPairingMode();
+                break;
+            case CONSOLE_CMD_PASSWORD_CHANGED:
+                refreshPasswordFlags(cmd.address);
+                break;
         }
     }
 }
 
 void lockComputer() {
+    postHidCommand(HID_CMD_LOCK);
+}
+
+void unlockComputer() {
+    postHidCommand(HID_CMD_UNLOCK);
+}
+
+// Win+L; выполняется в задаче HID хоста
+static void sendLockCommand(const HidCommand& cmd) {
+    HostContext& host = hosts[cmd.host];
+    host.lockAttempts++;
+    if (!hostLinkAlive(cmd.connHandle, cmd.address)) {
+        // Решение опоздало: соединение разорвано, пока команда ждала в очереди
+        host.locksOnDeadLink++;
+        Serial.printf("Host %d: lock skipped, connection already lost\n", cmd.host + 1);
+        return;
+    }
+    PowerBoostGuard boost(POWER_BOOST_HID);
+    connParamPolicyBeginHid(cmd.connHandle);
     // Временно увеличиваем мощность для надежной отправки команды
-    esp_power_level_t savedPower = (esp_power_level_t)NimBLEDevice::getPower();
-    NimBLEDevice::setPower(ESP_PWR_LVL_P9);
+    txPowerBoost(true);
     delay(100);
     
     // Пытаемся отправить команду несколько раз
     bool success = false;
     for(int attempt = 0; attempt < 3 && !success; attempt++) {
-        Serial.printf("Lock attempt %d, Power: %d, RSSI: %d\n", 
-            attempt + 1, NimBLEDevice::getPower(), lastAverageRssi);
+        Serial.printf("Host %d lock attempt %d, Power: %d dBm\n",
+            cmd.host + 1, attempt + 1, NimBLEDevice::getPower());
         
         // Отправляем Win+L
         uint8_t msg[] = {0x08, 0, 0x0F, 0, 0, 0, 0, 0};
-        input->setValue(msg, sizeof(msg));
-        success = input->notify();
+        success = notifyHidReport(msg, cmd.connHandle);
         
         if (success) {
             delay(50);
             // Отпускаем клавиши
             uint8_t release[] = {0, 0, 0, 0, 0, 0, 0, 0};
-            input->setValue(release, sizeof(release));
-            input->notify();
+            notifyHidReport(release, cmd.connHandle);
             
             Serial.println("Lock command sent successfully!");
             break;
@@ -2867,40 +3578,55 @@ void lockComputer() {
         delay(100);
     }
     
-    // После блокировки устанавливаем экономичную мощность
+    // После блокировки мощность снова определяет регулятор по запасу линии
     delay(100);
-    NimBLEDevice::setPower(POWER_LOCKED);
+    txPowerBoost(false);
     
     if (success) {
+        host.locksDelivered++;
         // Сохраняем состояние блокировки и адрес устройства
-        saveDeviceLockState(connectedDeviceAddress.c_str(), true); // Сохраняем блокировку для текущего устройства
-        Serial.println("Lock state saved to NVS");
+        saveLockStateAsync(cmd.address, true);
+        Serial.println("Lock state queued for NVS");
     }
     
     if (!success) {
+        if (!hostLinkAlive(cmd.connHandle, cmd.address)) {
+            host.locksOnDeadLink++;
+        }
         Serial.println("Failed to send lock command!");
     }
 }
 
-// Добавляем функцию разблокировки
-void unlockComputer() {
-    static unsigned long lastCheck = 0;
+// Ctrl+Alt+Del и ввод пароля; выполняется в задаче HID хоста
+static void sendUnlockCommand(const HidCommand& cmd) {
+    PowerBoostGuard boost(POWER_BOOST_HID);
+    connParamPolicyBeginHid(cmd.connHandle);
+    const char* address = cmd.address;
+    static unsigned long lastCheck[HOST_MAX] = {};
     const unsigned long CHECK_INTERVAL = 1000; // Проверяем раз в секунду
     
-    if (millis() - lastCheck < CHECK_INTERVAL) {
+    if (millis() - lastCheck[cmd.host] < CHECK_INTERVAL) {
         return;  // Выходим если прошло мало времени
     }
-    lastCheck = millis();
+    lastCheck[cmd.host] = millis();
+    
+    // После трёх неудачных попыток разблокировка этого хоста запрещена на UNLOCK_LOCKOUT_MS.
+    // Таймер не блокирует loop() и сохраняется в снимке RTC, поэтому перезагрузка его не сбрасывает
+    HostContext& host = hosts[cmd.host];
+    if (host.failedUnlockAttempts >= 3) {
+        if (millis() - host.lastFailedAttempt < UNLOCK_LOCKOUT_MS) {
+            return;
+        }
+        host.failedUnlockAttempts = 0;
+    }
     
     // Добавляем отладочную информацию
     if (serialOutputEnabled) {
         Serial.println("\n=== Attempting to unlock computer ===");
-        Serial.printf("Connected device address: %s\n", connectedDeviceAddress.c_str());
-        Serial.printf("Current RSSI: %d\n", lastAverageRssi);
-        Serial.printf("Current state: %d\n", currentState);
+        Serial.printf("Host %d, device address: %s\n", cmd.host + 1, address);
     }
     
-    String password = getPasswordForDevice(connectedDeviceAddress.c_str());
+    String password = getPasswordForDevice(address);
     
     // Добавляем отладочную информацию о пароле
     if (serialOutputEnabled) {
@@ -2909,23 +3635,23 @@ void unlockComputer() {
             Serial.println("No password found using getPasswordForDevice!");
             
             // Пробуем получить пароль напрямую из NVS
-            String shortKey = getShortKey(connectedDeviceAddress.c_str());
+            String shortKey = getShortKey(address);
             Serial.printf("Short key: %s\n", shortKey.c_str());
             
-            nvs_handle_t nvsHandle;
-            esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
-            if (err == ESP_OK) {
-                String pwdKey = "pwd_" + shortKey;
-                Serial.printf("Password key: %s\n", pwdKey.c_str());
+            // Раньше здесь открывалось чужое пространство имён "storage"
+            {
+                NvsKeyBuffer pwdKey;
+                makeDeviceKey(DeviceKey::Password, shortKey.c_str(), pwdKey);
+                Serial.printf("Password key: %s\n", pwdKey);
                 
                 size_t required_size;
-                err = nvs_get_str(nvsHandle, pwdKey.c_str(), NULL, &required_size);
+                esp_err_t err = nvs_get_str(nvsHandle, pwdKey, NULL, &required_size);
                 if (err == ESP_OK) {
                     Serial.printf("Password exists in NVS, size: %d bytes\n", required_size);
                     
                     // Получаем пароль напрямую
                     char* encrypted = new char[required_size];
-                    err = nvs_get_str(nvsHandle, pwdKey.c_str(), encrypted, &required_size);
+                    err = nvs_get_str(nvsHandle, pwdKey, encrypted, &required_size);
                     if (err == ESP_OK) {
                         password = decryptPassword(String(encrypted));
                         Serial.printf("Direct password from NVS: %s\n", password.c_str());
@@ -2941,7 +3667,6 @@ void unlockComputer() {
                 } else {
                     Serial.printf("Password not found in NVS, error: %d\n", err);
                 }
-                nvs_close(nvsHandle);
             }
             
             // Проверяем, есть ли сохраненные пароли
@@ -2973,8 +3698,7 @@ void unlockComputer() {
     }
     
     // Сохраняем текущую мощность
-    int8_t currentPower = NimBLEDevice::getPower();
-    NimBLEDevice::setPower(ESP_PWR_LVL_P9);
+    txPowerBoost(true);
     delay(100);
     
     bool success = false;
@@ -2983,18 +3707,17 @@ void unlockComputer() {
         
         // 1. Отправляем Ctrl+Alt+Del
         uint8_t ctrlAltDel[8] = {0x05, 0, 0x4C, 0, 0, 0, 0, 0};
-        input->setValue(ctrlAltDel, sizeof(ctrlAltDel));
-        success = input->notify();
+        success = notifyHidReport(ctrlAltDel, cmd.connHandle);
         
         if (success) {
             delay(2000);  // Ждем появления экрана входа
             
             // 2. Вводим пароль
-            typePassword(password);
+            typePassword(password, cmd.connHandle);
             
             // 3. Сбрасываем состояние блокировки
-            saveDeviceLockState(connectedDeviceAddress.c_str(), false); // Сохраняем разблокировку для текущего устройства
-            currentState = NORMAL;
+            // Состояние автомата уже переключила задача опроса
+            saveLockStateAsync(address, false);
             
             Serial.println("Computer unlocked successfully!");
             break;
@@ -3003,96 +3726,239 @@ void unlockComputer() {
     }
     
     // Возвращаем исходную мощность
-    NimBLEDevice::setPower((esp_power_level_t)currentPower);
+    txPowerBoost(false);
     
     if (!success) {
-        failedUnlockAttempts++;
-        lastFailedAttempt = millis();
+        host.failedUnlockAttempts++;
+        host.lastFailedAttempt = millis();
         
-        if (failedUnlockAttempts >= 3) {
-            Serial.println("Too many failed attempts. Locked for 5 minutes");
-            Disbuff->fillSprite(BLACK);
-            Disbuff->setTextColor(RED);
-            Disbuff->setCursor(5, 40);
-            Disbuff->print("LOCKED!");
-            Disbuff->pushSprite(0, 0);
-            
-            delay(300000);  // Блокируем на 5 минут (300000 мс)
-            failedUnlockAttempts = 0;  // Сбрасываем счетчик
+        if (host.failedUnlockAttempts >= 3) {
+            Serial.printf("Host %d: too many failed attempts. Locked for 5 minutes\n", cmd.host + 1);
+            showDisplayMessage("LOCKED!", RED);
+            // Счетчик сбросится в начале sendUnlockCommand() по истечении UNLOCK_LOCKOUT_MS
         }
     } else {
-        failedUnlockAttempts = 0;  // При успешной разблокировке сбрасываем счетчик
+        host.failedUnlockAttempts = 0;  // При успешной разблокировке сбрасываем счетчик
     }
 }
 
-void saveDeviceSettings(const char* deviceAddress, const DeviceSettings& settings) {
-    Serial.println("\n=== Saving Device Settings ===");
-    Serial.printf("Device address: %s\n", deviceAddress);
-    
-    esp_err_t err = nvs_set_str(nvsHandle, "last_addr", deviceAddress);
-    if (err != ESP_OK) {
-        Serial.printf("Error saving device address: %d\n", err);
-        return;
-    }
-    
-    // Сохраняем настройки с коротким ключом
-    String shortKey = String(deviceAddress).substring(String(deviceAddress).length() - 8);
-    Serial.printf("Short key: %s\n", shortKey.c_str());
+// Ввод сохранённого пароля по кнопке B; выполняется в задаче HID хоста
+static void typeStoredPassword(const HidCommand& cmd) {
+    const char* address = cmd.address;
+    // Пароль ищется по хосту команды: у каждого компьютера свой
+    String shortKey = address[0] != '\0' ? cleanMacAddress(address) : currentShortKey;
     
-    String pwdKey = "pwd_" + shortKey;
-    Serial.printf("Password key: %s\n", pwdKey.c_str());
-    
-    err = nvs_set_str(nvsHandle, pwdKey.c_str(), settings.password.c_str());
-    if (err != ESP_OK) {
-        Serial.printf("Error saving password: %d\n", err);
-        return;
+    if (serialOutputEnabled) {
+        Serial.printf("Host %d short key: %s\n", cmd.host + 1, shortKey.c_str());
     }
     
-    String unlockKey = "unlock_" + shortKey;
-    String lockKey = "lock_" + shortKey;
-    Serial.printf("Unlock key: %s\n", unlockKey.c_str());
-    Serial.printf("Lock key: %s\n", lockKey.c_str());
-    
-    err = nvs_set_i32(nvsHandle, unlockKey.c_str(), settings.unlockRssi);
-    err |= nvs_set_i32(nvsHandle, lockKey.c_str(), settings.lockRssi);
-    
-    err = nvs_commit(nvsHandle);
-    if (err != ESP_OK) {
-        Serial.printf("Error committing settings: %d\n", err);
+    // Получаем пароль для текущего устройства
+    String password = getPasswordForDevice(shortKey);
+    if (password.length() > 0) {
+        if (serialOutputEnabled) {
+            Serial.printf("Password found, length: %d\n", password.length());
+        }
+        typePassword(password, cmd.connHandle);
     } else {
-        Serial.println("Settings saved successfully");
+        if (serialOutputEnabled) {
+            Serial.println("No password stored for current device");
+        }
     }
-    Serial.println("=== End Saving Settings ===\n");
 }
 
-DeviceSettings getDeviceSettings(const char* deviceAddress) {
-    DeviceSettings settings;
-    String shortKey = String(deviceAddress).substring(String(deviceAddress).length() - 8);
-    
-    char pwd[64] = {0};
-    size_t length = sizeof(pwd);
-    esp_err_t err = nvs_get_str(nvsHandle, ("pwd_" + shortKey).c_str(), pwd, &length);
-    if (err == ESP_OK) {
-        settings.password = String(pwd);
+// Задачи FreeRTOS. HID выше задачи опроса: команда блокировки уходит сразу после решения,
+// а её задержки между отчётами не останавливают опрос. UI и storage - на ядре 0
+// ниже стека BLE, запись во flash и вывод в Serial не задерживают ядро с опросом и HID.
+// Отрисовка - самая низкая: экран получает только оставшееся время
+static const UBaseType_t CONTROL_TASK_PRIORITY = 3;
+static const UBaseType_t HID_TASK_PRIORITY = 4;
+static const UBaseType_t UI_TASK_PRIORITY = 1;
+static const UBaseType_t STORAGE_TASK_PRIORITY = 2;
+static const BaseType_t BACKGROUND_CORE = 0;
+static const uint32_t HID_TASK_STACK = 4096;
+static const uint32_t UI_TASK_STACK = 4096;
+static const uint32_t STORAGE_TASK_STACK = 6144;
+static const uint16_t HID_QUEUE_DEPTH = 4;
+static const uint16_t UI_QUEUE_DEPTH = 8;
+static const uint16_t STORAGE_QUEUE_DEPTH = 8;
+static const uint16_t CONN_QUEUE_DEPTH = 8;
+static const uint16_t CONSOLE_QUEUE_DEPTH = 4;
+static const uint32_t CONSOLE_POLL_MS = 20;     // Опрос Serial вне режима сна
+static const char* const DEFAULT_HOST_PASSWORD = "12345";  // Пароль нового хоста до команды setpwd
+static const uint32_t UI_FRAME_MS = 50;         // Наибольшая частота кадров задачи UI
+
+// Задача HID одного хоста: ввод пароля в один компьютер не задерживает блокировку другого
+static void hidTask(void* arg) {
+    const HostContext& host = hosts[(int)(intptr_t)arg];
+    HidCommand cmd;
+    for (;;) {
+        if (!taskMonitorReceive(host.hidQueue, &cmd, TASK_WAIT_FOREVER)) {
+            continue;
+        }
+        TaskBusyScope busy(host.hidTaskId);
+        switch (cmd.type) {
+            case HID_CMD_LOCK:
+                sendLockCommand(cmd);
+                break;
+            case HID_CMD_UNLOCK:
+                sendUnlockCommand(cmd);
+                break;
+            case HID_CMD_TYPE_PASSWORD:
+                typeStoredPassword(cmd);
+                break;
+        }
     }
-    
-    int32_t value;
-    err = nvs_get_i32(nvsHandle, ("unlock_" + shortKey).c_str(), &value);
-    if (err == ESP_OK) {
-        settings.unlockRssi = value;
+}
+
+// Возвращает true, если после события нужен кадр вне очереди
+static bool handleUiEvent(const UiEvent& event) {
+    switch (event.type) {
+        case UI_EVENT_SLEEP:
+            uiFlush(&M5.Display);
+            M5.Display.sleep();
+            uiSetPanelOn(false);
+            return false;
+        case UI_EVENT_WAKE:
+            M5.Display.wakeup();
+            uiSetPanelOn(true);
+            return true;
+        case UI_EVENT_BRIGHTNESS:
+            M5.Display.setBrightness(event.value);
+            // Пока подсветка была погашена, кадры пропускались
+            return event.value > 0;
+        case UI_EVENT_MESSAGE:
+            if (uiFrameBegin(&M5.Display)) {
+                uiSetPage(UI_PAGE_MESSAGE);
+                uiWidgetClear(WIDGET_LONG_PRESS);
+                uiWidgetPrintf(WIDGET_MESSAGE, event.color, "%s", event.text);
+                uiFrameEnd(&M5.Display);
+            }
+            return false;
+        case UI_EVENT_COLOR_DEPTH:
+            if (uiSetColorDepth(&M5.Display, event.value)) {
+                StorageRequest request = {};
+                request.type = STORAGE_SAVE_COLOR_DEPTH;
+                request.colorDepth = event.value;
+                taskMonitorSend(storageQueue, &request);
+            } else {
+                Serial.printf("Display: %u-bit buffers not available, setting not saved\n", event.value);
+            }
+            Serial.printf("Display buffers: %u-bit, free heap %lu bytes\n",
+                uiColorDepth(), (unsigned long)esp_get_free_heap_size());
+            return true;
+        case UI_EVENT_REDRAW:
+            return true;
     }
-    
-    err = nvs_get_i32(nvsHandle, ("lock_" + shortKey).c_str(), &value);
-    if (err == ESP_OK) {
-        settings.lockRssi = value;
+    return false;
+}
+
+// Задача отрисовки: кадр не чаще UI_FRAME_MS и только если опубликован новый снимок.
+// Пока панель спит, задача ждёт только событий и не просыпается по таймеру
+static void uiTask(void*) {
+    UiEvent event;
+    UiModel model;
+    uint32_t renderedSequence = 0;
+    uint32_t lastFrameMs = 0;
+    bool panelAwake = true;
+    bool frameRequested = true;
+    for (;;) {
+        uint32_t waitMs = TASK_WAIT_FOREVER;
+        if (panelAwake) {
+            uint32_t sinceFrame = millis() - lastFrameMs;
+            waitMs = sinceFrame >= UI_FRAME_MS ? 0 : UI_FRAME_MS - sinceFrame;
+        }
+        if (taskMonitorReceive(uiQueue, &event, waitMs)) {
+            TaskBusyScope busy(uiTaskId);
+            if (event.type == UI_EVENT_SLEEP || event.type == UI_EVENT_WAKE) {
+                panelAwake = event.type == UI_EVENT_WAKE;
+            }
+            if (handleUiEvent(event)) {
+                frameRequested = true;
+            }
+            continue;
+        }
+        lastFrameMs = millis();
+        if (readUiModel(model) == renderedSequence && !frameRequested) {
+            uiFrameSkipped();
+            continue;
+        }
+        TaskBusyScope busy(uiTaskId);
+        if (model.sequence != renderedSequence) {
+            uiPhaseRecord(UI_PHASE_PUBLISH, model.publishUs);
+        }
+        renderedSequence = model.sequence;
+        frameRequested = false;
+        renderDisplay(model);
     }
-    
-    return settings;
+}
+
+static void handleStorageRequest(const StorageRequest& request) {
+    switch (request.type) {
+        case STORAGE_SAVE_LOCK_STATE:
+            saveDeviceLockState(request.address, request.locked);
+            break;
+        case STORAGE_SAVE_THRESHOLDS: {
+            DeviceSettings settings = getDeviceSettings(request.address);
+            settings.lockRssi = request.lockRssi;
+            settings.unlockRssi = request.unlockRssi;
+            saveDeviceSettings(request.address, settings);
+            break;
+        }
+        case STORAGE_SAVE_COLOR_DEPTH:
+            saveDisplayColorDepth(request.colorDepth);
+            break;
+        case STORAGE_HOST_CONNECTED:
+            // Первое сопряжение: пароль по умолчанию, пока его не заменит setpwd
+            if (saveHostConnected(request.address, DEFAULT_HOST_PASSWORD)) {
+                postConsoleCommand(CONSOLE_CMD_PASSWORD_CHANGED, request.address);
+            }
+            break;
+        case STORAGE_SAVE_LAST_ADDR:
+            saveLastAddress(request.address);
+            break;
+    }
+}
+
+// Запись в NVS и консоль Serial: ввод setpwd и кадр import принимаются между запросами, не блокируя их
+static void storageTask(void*) {
+    StorageRequest request;
+    for (;;) {
+        uint32_t waitMs = importSettingsReceiving() ? PROV_IMPORT_POLL_MS :
+            (isLightSleepEnabled() ? LOCKED_IDLE_LOOP_MS : CONSOLE_POLL_MS);
+        bool received = taskMonitorReceive(storageQueue, &request, waitMs);
+        TaskBusyScope busy(storageTaskId);
+        if (received) {
+            handleStorageRequest(request);
+        }
+        echoSerialInput();
+    }
+}
+
+static void startTasks() {
+    // Очередь и задача HID на каждый слот хоста: "hid1", "hid2", ...
+    static char hidNames[HOST_MAX][8];
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        snprintf(hidNames[slot], sizeof(hidNames[slot]), "hid%d", slot + 1);
+        hosts[slot].hidQueue = taskMonitorQueueCreate(hidNames[slot], HID_QUEUE_DEPTH, sizeof(HidCommand));
+    }
+    uiQueue = taskMonitorQueueCreate("ui", UI_QUEUE_DEPTH, sizeof(UiEvent));
+    storageQueue = taskMonitorQueueCreate("storage", STORAGE_QUEUE_DEPTH, sizeof(StorageRequest));
+    connQueue = taskMonitorQueueCreate("conn", CONN_QUEUE_DEPTH, sizeof(ConnEvent));
+    consoleQueue = taskMonitorQueueCreate("console", CONSOLE_QUEUE_DEPTH, sizeof(ConsoleCommand));
+
+    // setup() и loop() выполняются в задаче Arduino, она и становится задачей опроса
+    vTaskPrioritySet(nullptr, CONTROL_TASK_PRIORITY);
+    controlTaskId = taskMonitorAdopt("control", getArduinoLoopTaskStackSize());
+    for (int slot = 0; slot < HOST_MAX; slot++) {
+        hosts[slot].hidTaskId = taskMonitorCreate(hidNames[slot], hidTask, HID_TASK_STACK, HID_TASK_PRIORITY,
+            xPortGetCoreID(), (void*)(intptr_t)slot);
+    }
+    uiTaskId = taskMonitorCreate("ui", uiTask, UI_TASK_STACK, UI_TASK_PRIORITY, BACKGROUND_CORE);
+    storageTaskId = taskMonitorCreate("storage", storageTask, STORAGE_TASK_STACK, STORAGE_TASK_PRIORITY, BACKGROUND_CORE);
 }
 
 void clearAllPreferences() {
-    nvs_erase_all(nvsHandle);
-    nvs_commit(nvsHandle);
+    eraseAllSettings();
     Serial.println("All preferences cleared");
 } 
 
@@ -3104,27 +3970,22 @@ RssiMeasurement getMeasuredRssi() {
         Serial.println("\n=== RSSI Measurement Start ===");
     }
     
-    // Метод 1: Через активное сканирование
-    if (pScan) {
+    // Метод 1: Через таблицу рекламодателей сканирования
+    {
         if (serialOutputEnabled) Serial.println("Trying scan method...");
-        NimBLEScanResults results = pScan->getResults();
-        if (serialOutputEnabled) Serial.printf("Found devices: %d\n", results.getCount());
-        
-        for (int i = 0; i < results.getCount(); i++) {
-            const NimBLEAdvertisedDevice* device = results.getDevice(i);
-            if (device->getAddress().toString() == connectedDeviceAddress) {
-                int rssi = device->getRSSI();
+        AdvertiserRecord record;
+        if (advertiserTableLookup(hosts[activeHost].peerAddress, record)) {
+            int rssi = record.rssi;
+            if (serialOutputEnabled) {
+                Serial.printf("Device found, RSSI: %d\n", rssi);
+            }
+            if (rssi != 0 && rssi < 0) {
+                measurement.value = rssi;
+                measurement.isValid = true;
                 if (serialOutputEnabled) {
-                    Serial.printf("Device found, RSSI: %d\n", rssi);
-                }
-                if (rssi != 0 && rssi < 0) {
-                    measurement.value = rssi;
-                    measurement.isValid = true;
-                    if (serialOutputEnabled) {
-                        Serial.println("✓ Valid RSSI from scan");
-                    }
-                    return measurement;
+                    Serial.println("✓ Valid RSSI from scan");
                 }
+                return measurement;
             }
         }
         if (serialOutputEnabled) Serial.println("✗ Scan method failed");
@@ -3236,7 +4097,7 @@ bool isRssiStable() {
 // Функция для временного включения экрана на среднюю яркость
 void temporaryScreenOn() {
     // Включаем экран на среднюю яркость
-    M5.Display.setBrightness(BRIGHTNESS_MEDIUM);
+    setDisplayBrightness(BRIGHTNESS_MEDIUM);
     screenOnTime = millis();
     screenTemporaryOn = true;
     
@@ -3257,18 +4118,12 @@ void checkTemporaryScreen() {
         
         screenTemporaryOn = false;
         
-        // Возвращаем яркость в зависимости от текущего состояния
-        esp_power_level_t currentPower = (esp_power_level_t)NimBLEDevice::getPower();
-        
-        // Принудительно устанавливаем яркость в зависимости от питания
-        if (isUSBConnected()) {
-            M5.Display.setBrightness(BRIGHTNESS_USB);
-            if (serialOutputEnabled) {
-                Serial.printf("Forced brightness to USB level: %d\n", BRIGHTNESS_USB);
-            }
-        } else {
-            // Используем adjustBrightness для установки яркости в зависимости от мощности передатчика
-            adjustBrightness(currentPower);
+        // Возвращаем яркость профиля питания. Экран мог быть включён в обход adjustBrightness,
+        // поэтому устанавливаем её явно
+        uint8_t brightness = powerManager.brightnessFor(txPowerCurrentLevel());
+        setDisplayBrightness(brightness);
+        if (serialOutputEnabled) {
+            Serial.printf("Brightness restored to %d (%s)\n", brightness, powerManager.profile().name);
         }
         
         if (serialOutputEnabled) {
@@ -3277,85 +4132,6 @@ void checkTemporaryScreen() {
     }
 }
 
-// Функция для получения пароля устройства из NVS
-String getDevicePassword(const String& shortKey) {
-    if (shortKey.length() == 0) {
-        if (serialOutputEnabled) {
-            Serial.println("Error: Empty device key");
-        }
-        return "";
-    }
-    
-    if (serialOutputEnabled) {
-        Serial.printf("Getting password for device with short key: %s\n", shortKey.c_str());
-    }
-    
-    // Открываем хранилище
-    nvs_handle_t nvsHandle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvsHandle);
-    if (err != ESP_OK) {
-        if (serialOutputEnabled) {
-            Serial.printf("Error opening NVS: %s\n", esp_err_to_name(err));
-        }
-        return "";
-    }
-    
-    // Формируем ключ для пароля
-    String passwordKey = "pwd_" + shortKey;
-    
-    if (serialOutputEnabled) {
-        Serial.printf("Looking for password with key: %s\n", passwordKey.c_str());
-    }
-    
-    // Получаем размер строки
-    size_t required_size = 0;
-    err = nvs_get_str(nvsHandle, passwordKey.c_str(), NULL, &required_size);
-    if (err != ESP_OK) {
-        if (serialOutputEnabled) {
-            Serial.printf("Error getting password size: %s\n", esp_err_to_name(err));
-        }
-        nvs_close(nvsHandle);
-        return "";
-    }
-    
-    // Выделяем буфер и получаем строку
-    char* buffer = (char*)malloc(required_size);
-    if (buffer == NULL) {
-        if (serialOutputEnabled) {
-            Serial.println("Memory allocation failed");
-        }
-        nvs_close(nvsHandle);
-        return "";
-    }
-    
-    err = nvs_get_str(nvsHandle, passwordKey.c_str(), buffer, &required_size);
-    if (err != ESP_OK) {
-        if (serialOutputEnabled) {
-            Serial.printf("Error getting password: %s\n", esp_err_to_name(err));
-        }
-        free(buffer);
-        nvs_close(nvsHandle);
-        return "";
-    }
-    
-    String encryptedPassword = String(buffer);
-    free(buffer);
-    nvs_close(nvsHandle);
-    
-    if (serialOutputEnabled) {
-        Serial.printf("Encrypted password retrieved, length: %d\n", encryptedPassword.length());
-    }
-    
-    // Расшифровываем пароль
-    String password = decryptPassword(encryptedPassword);
-    
-    if (serialOutputEnabled) {
-        Serial.printf("Decrypted password, length: %d\n", password.length());
-    }
-    
-    return password;
-}
-
 // Функция для обновления короткого ключа устройства
 void updateCurrentShortKey(const char* deviceAddress) {
     currentShortKey = cleanMacAddress(deviceAddress); // Восстанавливаем вызов
@@ -3364,9 +4140,6 @@ void updateCurrentShortKey(const char* deviceAddress) {
     }
 }
 
-// Глобальный экземпляр колбэков сканирования
-// static MyScanCallbacks* scanCallbacks = new MyScanCallbacks(); // <-- Comment out this line temporarily
-
 // Инициализация BLE
 void initBLE() {
     NimBLEDevice::init("");
@@ -3379,22 +4152,3 @@ void initBLE() {
 #ifndef LONG_PRESS_DURATION
 #define LONG_PRESS_DURATION 2000
 #endif
-
-// Сохраняет состояние блокировки для указанного устройства
-static void saveDeviceLockState(const String& deviceAddress, bool locked) {
-    String sk = cleanMacAddress(deviceAddress.c_str());
-    String key = String(KEY_LOCK_STATE_PREFIX) + sk;
-    nvs_set_i8(nvsHandle, key.c_str(), locked ? 1 : 0);
-    nvs_commit(nvsHandle);
-}
-
-// Загружает состояние блокировки для указанного устройства
-static bool loadDeviceLockState(const String& deviceAddress) {
-    String sk = cleanMacAddress(deviceAddress.c_str());
-    String key = String(KEY_LOCK_STATE_PREFIX) + sk;
-    int8_t flag = 0;
-    if (nvs_get_i8(nvsHandle, key.c_str(), &flag) == ESP_OK) {
-        return flag != 0;
-    }
-    return false;
-}
\ No newline at end of file
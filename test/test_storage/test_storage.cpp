@@ -0,0 +1,226 @@
+// Модули хранилища поверх эмулятора NVS: pio test -e native
+#include <unity.h>
+#include <Arduino.h>
+#include "nvs_emulator.h"
+#include "NvsUtils.h"
+#include "DeviceSettingsUtils.h"
+
+namespace {
+    const char* const HOST_A = "AA:BB:CC:DD:EE:01";
+    const char* const HOST_B = "AA:BB:CC:DD:EE:02";
+
+    // Бюджет commit одной записи настроек: без стирания страницы
+    const uint32_t SETTINGS_COMMIT_BUDGET_US = 2000;
+
+    DeviceSettings makeSettings(const char* password, int lockRssi, int unlockRssi) {
+        DeviceSettings settings;
+        settings.password = encryptPassword(password);
+        settings.lockRssi = lockRssi;
+        settings.unlockRssi = unlockRssi;
+        return settings;
+    }
+
+    // Перезагрузка после потери питания: раздел не стирается, handle открывается заново
+    void reboot() {
+        TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+        TEST_ASSERT_EQUAL(ESP_OK, nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvsHandle));
+    }
+} // namespace
+
+void setUp() {
+    nvsEmuReset();
+    resetNvs();
+    nvsEmuResetStats();
+}
+
+void tearDown() {}
+
+void test_settings_round_trip() {
+    saveDeviceSettings(HOST_A, makeSettings("secret", -70, -50));
+
+    DeviceSettings loaded = getDeviceSettings(HOST_A);
+    TEST_ASSERT_EQUAL_STRING("secret", decryptPassword(loaded.password).c_str());
+    TEST_ASSERT_EQUAL(-70, loaded.lockRssi);
+    TEST_ASSERT_EQUAL(-50, loaded.unlockRssi);
+    TEST_ASSERT_TRUE(hasDevicePassword(HOST_A));
+    TEST_ASSERT_EQUAL_STRING("secret", getDevicePasswordFromNVS(cleanMacAddress(HOST_A)).c_str());
+}
+
+void test_unknown_device_gets_defaults() {
+    saveDeviceSettings(HOST_A, makeSettings("secret", -70, -50));
+
+    DeviceSettings loaded = getDeviceSettings(HOST_B);
+    TEST_ASSERT_EQUAL(0, loaded.password.length());
+    TEST_ASSERT_EQUAL(DEFAULT_LOCK_RSSI, loaded.lockRssi);
+    TEST_ASSERT_EQUAL(DEFAULT_UNLOCK_RSSI, loaded.unlockRssi);
+    TEST_ASSERT_FALSE(hasDevicePassword(HOST_B));
+    TEST_ASSERT_FALSE(hasDevicePassword(""));
+}
+
+void test_shorter_password_replaces_longer() {
+    saveDeviceSettings(HOST_A, makeSettings("a-much-longer-password", -70, -50));
+    saveDeviceSettings(HOST_A, makeSettings("pin", -70, -50));
+
+    TEST_ASSERT_EQUAL_STRING("pin", decryptPassword(getDeviceSettings(HOST_A).password).c_str());
+}
+
+void test_thresholds_without_password_load() {
+    int lockRssi = DEFAULT_LOCK_RSSI;
+    int unlockRssi = DEFAULT_UNLOCK_RSSI;
+    saveDeviceSettings(HOST_A, makeSettings("", -80, -40));
+
+    loadDeviceThresholds(HOST_A, lockRssi, unlockRssi);
+    TEST_ASSERT_EQUAL(-80, lockRssi);
+    TEST_ASSERT_EQUAL(-40, unlockRssi);
+    TEST_ASSERT_FALSE(hasDevicePassword(HOST_A));
+}
+
+void test_save_settings_is_one_commit_within_budget() {
+    saveDeviceSettings(HOST_A, makeSettings("secret", -70, -50));
+
+    const NvsEmuStats& stats = nvsEmuGetStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.commits);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.pageErases);
+    TEST_ASSERT_TRUE(stats.lastCommitUs > 0);
+    TEST_ASSERT_TRUE(stats.lastCommitUs <= SETTINGS_COMMIT_BUDGET_US);
+}
+
+void test_repeated_saves_collect_garbage_and_keep_data() {
+    NvsEmuConfig config;
+    char password[16];
+    for (int i = 0; i < 300; i++) {
+        snprintf(password, sizeof(password), "secret-%d", i);
+        saveDeviceSettings(HOST_A, makeSettings(password, -60 - i % 20, -45));
+    }
+
+    const NvsEmuStats& stats = nvsEmuGetStats();
+    TEST_ASSERT_TRUE(stats.gcRuns > 0);
+    // Худший commit - сборка мусора: не больше стирания одной страницы сверх записи настроек
+    TEST_ASSERT_TRUE(stats.maxCommitUs <= config.pageEraseUs + SETTINGS_COMMIT_BUDGET_US);
+    DeviceSettings loaded = getDeviceSettings(HOST_A);
+    TEST_ASSERT_EQUAL_STRING("secret-299", decryptPassword(loaded.password).c_str());
+    TEST_ASSERT_EQUAL(-60 - 299 % 20, loaded.lockRssi);
+}
+
+void test_init_recovers_from_no_free_pages() {
+    saveDeviceSettings(HOST_A, makeSettings("secret", -70, -50));
+    nvsEmuInjectFault(NvsEmuFault::InitNoFreePages);
+
+    // initializeNvs() стирает раздел и инициализирует его заново
+    resetNvs();
+    TEST_ASSERT_FALSE(hasDevicePassword(HOST_A));
+    saveDeviceSettings(HOST_A, makeSettings("again", -70, -50));
+    TEST_ASSERT_EQUAL_STRING("again", decryptPassword(getDeviceSettings(HOST_A).password).c_str());
+}
+
+void test_power_loss_during_save_keeps_each_value_whole() {
+    // Потеря питания на каждой записи commit: каждое значение - старое или новое целиком
+    for (uint32_t writes = 0; writes < 8; writes++) {
+        setUp();
+        saveDeviceSettings(HOST_A, makeSettings("old-password", -70, -50));
+        nvsEmuSchedulePowerLoss(writes);
+        saveDeviceSettings(HOST_A, makeSettings("new-password", -90, -30));
+        if (!nvsEmuIsPoweredOff()) {
+            break;
+        }
+        reboot();
+
+        DeviceSettings loaded = getDeviceSettings(HOST_A);
+        String password = decryptPassword(loaded.password);
+        TEST_ASSERT_TRUE(password == "old-password" || password == "new-password");
+        TEST_ASSERT_TRUE(loaded.lockRssi == -70 || loaded.lockRssi == -90);
+        TEST_ASSERT_TRUE(loaded.unlockRssi == -50 || loaded.unlockRssi == -30);
+    }
+}
+
+void test_corrupt_password_entry_is_dropped() {
+    saveDeviceSettings(HOST_A, makeSettings("secret", -70, -50));
+    NvsKeyBuffer key;
+    makeDeviceKey(DeviceKey::Password, HOST_A, key);
+    TEST_ASSERT_TRUE(nvsEmuCorruptEntry(NVS_NAMESPACE, key));
+
+    TEST_ASSERT_FALSE(hasDevicePassword(HOST_A));
+    DeviceSettings loaded = getDeviceSettings(HOST_A);
+    TEST_ASSERT_EQUAL(0, loaded.password.length());
+    TEST_ASSERT_EQUAL(-70, loaded.lockRssi);
+}
+
+void test_reset_clears_last_address() {
+    saveHostConnected(HOST_A, "12345");
+    char address[18];
+    TEST_ASSERT_TRUE(loadLastAddress(address, sizeof(address)));
+
+    resetNvs();
+    TEST_ASSERT_FALSE(loadLastAddress(address, sizeof(address)));
+    TEST_ASSERT_FALSE(hasDevicePassword(HOST_A));
+}
+
+void test_host_connection_records_last_address() {
+    char address[18];
+    TEST_ASSERT_FALSE(loadLastAddress(address, sizeof(address)));
+
+    // Первое подключение: пароль по умолчанию и последнее устройство одним commit
+    TEST_ASSERT_TRUE(saveHostConnected(HOST_A, "12345"));
+    TEST_ASSERT_EQUAL_UINT32(1, nvsEmuGetStats().commits);
+    TEST_ASSERT_TRUE(loadLastAddress(address, sizeof(address)));
+    TEST_ASSERT_EQUAL_STRING(HOST_A, address);
+    TEST_ASSERT_EQUAL_STRING("12345", decryptPassword(getDeviceSettings(HOST_A).password).c_str());
+
+    // Настройки другого хоста последнее устройство не меняют, его подключение - меняет
+    saveDeviceSettings(HOST_B, makeSettings("secret", -70, -50));
+    TEST_ASSERT_TRUE(loadLastAddress(address, sizeof(address)));
+    TEST_ASSERT_EQUAL_STRING(HOST_A, address);
+    TEST_ASSERT_FALSE(saveHostConnected(HOST_B, "12345"));
+    TEST_ASSERT_TRUE(loadLastAddress(address, sizeof(address)));
+    TEST_ASSERT_EQUAL_STRING(HOST_B, address);
+    TEST_ASSERT_EQUAL_STRING("secret", decryptPassword(getDeviceSettings(HOST_B).password).c_str());
+
+    // Повторное подключение того же хоста NVS не пишет
+    nvsEmuResetStats();
+    TEST_ASSERT_FALSE(saveHostConnected(HOST_B, "12345"));
+    TEST_ASSERT_EQUAL_UINT32(0, nvsEmuGetStats().commits);
+}
+
+void test_erase_settings_survives_reboot() {
+    saveHostConnected(HOST_A, "12345");
+    saveDeviceSettings(HOST_A, makeSettings("secret", -70, -50));
+
+    eraseAllSettings();
+    reboot();
+    char address[18];
+    TEST_ASSERT_FALSE(loadLastAddress(address, sizeof(address)));
+    TEST_ASSERT_FALSE(hasDevicePassword(HOST_A));
+}
+
+void test_device_keys_fit_nvs_limit() {
+    NvsKeyBuffer key;
+    makeDeviceKey(DeviceKey::LockState, "aa:bb:cc:dd:ee:ff", key);
+    TEST_ASSERT_EQUAL_STRING("locked_DDEEFF", key);
+    makeDeviceKey(DeviceKey::Password, "DDEEFF", key);
+    TEST_ASSERT_EQUAL_STRING("pwd_DDEEFF", key);
+}
+
+void test_erase_of_legacy_long_key_reports_too_long() {
+    // Ключ старого формата с полным MAC длиннее лимита NVS: ошибка, как в ESP-IDF, а не "нет ключа"
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_KEY_TOO_LONG, nvs_erase_key(nvsHandle, "unlock_aabbccddeeff"));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_erase_key(nvsHandle, "unlock_41024dac"));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_settings_round_trip);
+    RUN_TEST(test_unknown_device_gets_defaults);
+    RUN_TEST(test_shorter_password_replaces_longer);
+    RUN_TEST(test_thresholds_without_password_load);
+    RUN_TEST(test_save_settings_is_one_commit_within_budget);
+    RUN_TEST(test_repeated_saves_collect_garbage_and_keep_data);
+    RUN_TEST(test_init_recovers_from_no_free_pages);
+    RUN_TEST(test_power_loss_during_save_keeps_each_value_whole);
+    RUN_TEST(test_corrupt_password_entry_is_dropped);
+    RUN_TEST(test_reset_clears_last_address);
+    RUN_TEST(test_host_connection_records_last_address);
+    RUN_TEST(test_erase_settings_survives_reboot);
+    RUN_TEST(test_device_keys_fit_nvs_limit);
+    RUN_TEST(test_erase_of_legacy_long_key_reports_too_long);
+    return UNITY_END();
+}
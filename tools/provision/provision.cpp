@@ -0,0 +1,326 @@
+// Утилита для пакетов настроек M5 (команды export/import прошивки).
+//
+// Сборка (Linux/macOS):
+//   g++ -std=c++17 -O2 -I src tools/provision/provision.cpp -o provision
+//
+// Использование:
+//   provision dump   <frame.bin>               - проверить пакет и вывести его в текстовом виде
+//   provision build  <settings.txt> <out.bin>  - собрать пакет из текстового описания
+//   provision export <port> <out.bin>          - снять пакет с устройства по USB-Serial
+//   provision import <port> <frame.bin>        - загрузить пакет в устройство
+//
+// Текстовый формат (вывод dump читается build без изменений):
+//   last_addr aa:bb:cc:dd:ee:ff
+//   device 41024D unlock=-45 lock=-60 locked=0 pwd=<зашифрованный пароль в hex>
+
+#include "ProvisioningFormat.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+const int SERIAL_TIMEOUT_MS = 5000;
+
+bool readFile(const char* path, std::vector<uint8_t>& data) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Cannot open " << path << "\n";
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+bool writeFile(const char* path, const uint8_t* data, size_t len) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out || !out.write(reinterpret_cast<const char*>(data), len)) {
+        std::cerr << "Cannot write " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+std::string valueString(const uint8_t* value, uint8_t len) {
+    return std::string(reinterpret_cast<const char*>(value), len);
+}
+
+int dumpFrame(const std::vector<uint8_t>& frame) {
+    ProvStatus status = provValidate(frame.data(), frame.size());
+    if (status != PROV_OK) {
+        std::cerr << "Invalid frame: " << provStatusName(status) << "\n";
+        return 1;
+    }
+
+    std::printf("# version %u, %zu bytes\n", frame[4], frame.size());
+    ProvReader reader(frame.data());
+    uint8_t tag;
+    const uint8_t* value;
+    uint8_t len;
+    bool deviceOpen = false;
+    while (reader.next(tag, value, len)) {
+        switch (tag) {
+            case PROV_TAG_LAST_ADDR:
+                if (deviceOpen) { std::printf("\n"); deviceOpen = false; }
+                std::printf("last_addr %s\n", valueString(value, len).c_str());
+                break;
+            case PROV_TAG_DEVICE:
+                if (deviceOpen) std::printf("\n");
+                std::printf("device %s", valueString(value, len).c_str());
+                deviceOpen = true;
+                break;
+            case PROV_TAG_UNLOCK_RSSI:
+                std::printf(" unlock=%d", (int8_t)value[0]);
+                break;
+            case PROV_TAG_LOCK_RSSI:
+                std::printf(" lock=%d", (int8_t)value[0]);
+                break;
+            case PROV_TAG_LOCK_STATE:
+                std::printf(" locked=%u", value[0]);
+                break;
+            case PROV_TAG_PASSWORD:
+                std::printf(" pwd=%s", valueString(value, len).c_str());
+                break;
+            default:
+                std::printf(" # unknown tag 0x%02X (%u bytes)", tag, len);
+                break;
+        }
+    }
+    if (deviceOpen) std::printf("\n");
+    return 0;
+}
+
+// Порог RSSI: целое число без лишних символов в диапазоне PROV_RSSI_MIN..PROV_RSSI_MAX
+bool parseRssi(const std::string& value, int8_t& out) {
+    char* end = nullptr;
+    errno = 0;
+    long parsed = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || errno != 0 || !provRssiValid(parsed)) {
+        return false;
+    }
+    out = (int8_t)parsed;
+    return true;
+}
+
+int buildFrame(const char* textPath, const char* outPath) {
+    std::ifstream in(textPath);
+    if (!in) {
+        std::cerr << "Cannot open " << textPath << "\n";
+        return 1;
+    }
+
+    uint8_t frame[PROV_MAX_FRAME];
+    ProvWriter writer(frame, sizeof(frame));
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        std::istringstream words(line);
+        std::string kind;
+        if (!(words >> kind)) continue;
+
+        if (kind == "last_addr") {
+            std::string addr;
+            words >> addr;
+            writer.addString(PROV_TAG_LAST_ADDR, addr.c_str());
+        } else if (kind == "device") {
+            std::string shortKey;
+            words >> shortKey;
+            if (shortKey.size() != PROV_SHORT_KEY_LEN) {
+                std::cerr << textPath << ":" << lineNo << ": short key must be " << PROV_SHORT_KEY_LEN << " chars\n";
+                return 1;
+            }
+            writer.add(PROV_TAG_DEVICE, shortKey.data(), shortKey.size());
+            std::string attr;
+            while (words >> attr) {
+                size_t eq = attr.find('=');
+                std::string name = attr.substr(0, eq);
+                std::string value = eq == std::string::npos ? "" : attr.substr(eq + 1);
+                int8_t rssi;
+                if (name == "unlock" || name == "lock") {
+                    if (!parseRssi(value, rssi)) {
+                        std::cerr << textPath << ":" << lineNo << ": " << name << " must be an integer from "
+                                  << PROV_RSSI_MIN << " to " << PROV_RSSI_MAX << "\n";
+                        return 1;
+                    }
+                    writer.addI8(name == "unlock" ? PROV_TAG_UNLOCK_RSSI : PROV_TAG_LOCK_RSSI, rssi);
+                } else if (name == "locked") {
+                    writer.addU8(PROV_TAG_LOCK_STATE, std::atoi(value.c_str()) ? 1 : 0);
+                } else if (name == "pwd") {
+                    writer.addString(PROV_TAG_PASSWORD, value.c_str());
+                } else {
+                    std::cerr << textPath << ":" << lineNo << ": unknown attribute " << name << "\n";
+                    return 1;
+                }
+            }
+        } else {
+            std::cerr << textPath << ":" << lineNo << ": unknown record " << kind << "\n";
+            return 1;
+        }
+    }
+
+    size_t frameLen = writer.finish();
+    if (frameLen == 0) {
+        std::cerr << "Settings exceed " << PROV_MAX_PAYLOAD << " bytes of payload\n";
+        return 1;
+    }
+    return writeFile(outPath, frame, frameLen) ? 0 : 1;
+}
+
+int openSerial(const char* port) {
+    int fd = open(port, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        std::cerr << "Cannot open " << port << ": " << std::strerror(errno) << "\n";
+        return -1;
+    }
+    termios tty {};
+    tcgetattr(fd, &tty);
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, B115200);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 1;  // 100 мс на read()
+    tcsetattr(fd, TCSANOW, &tty);
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+// Читает байты, пока в накопленном потоке не встретится marker
+bool readUntil(int fd, const std::string& marker, std::string& seen) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SERIAL_TIMEOUT_MS);
+    char c;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (read(fd, &c, 1) == 1) {
+            seen.push_back(c);
+            if (seen.size() >= marker.size() &&
+                seen.compare(seen.size() - marker.size(), marker.size(), marker) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool readExact(int fd, uint8_t* out, size_t len) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SERIAL_TIMEOUT_MS);
+    size_t got = 0;
+    while (got < len && std::chrono::steady_clock::now() < deadline) {
+        ssize_t n = read(fd, out + got, len - got);
+        if (n > 0) got += n;
+    }
+    return got == len;
+}
+
+int exportFromDevice(const char* port, const char* outPath) {
+    int fd = openSerial(port);
+    if (fd < 0) return 1;
+
+    const char cmd[] = "export\n";
+    write(fd, cmd, sizeof(cmd) - 1);
+
+    // Отладочный вывод прошивки пропускаем до сигнатуры кадра
+    std::string seen;
+    std::vector<uint8_t> frame(PROV_HEADER_SIZE);
+    if (!readUntil(fd, PROV_MAGIC, seen) || !readExact(fd, frame.data() + 4, PROV_HEADER_SIZE - 4)) {
+        std::cerr << "No export frame received\n";
+        close(fd);
+        return 1;
+    }
+    std::memcpy(frame.data(), PROV_MAGIC, 4);
+    size_t warning = seen.find("EXPORT WARNING:");
+    if (warning != std::string::npos) {
+        std::cerr << seen.substr(warning, seen.find('\n', warning) - warning) << "\n";
+    }
+    size_t rest = provPayloadLength(frame.data()) + PROV_CRC_SIZE;
+    frame.resize(PROV_HEADER_SIZE + rest);
+    bool complete = readExact(fd, frame.data() + PROV_HEADER_SIZE, rest);
+    close(fd);
+
+    ProvStatus status = complete ? provValidate(frame.data(), frame.size()) : PROV_ERR_SHORT;
+    if (status != PROV_OK) {
+        std::cerr << "Export failed: " << provStatusName(status) << "\n";
+        return 1;
+    }
+    std::cout << "Received " << frame.size() << " bytes\n";
+    return writeFile(outPath, frame.data(), frame.size()) ? 0 : 1;
+}
+
+int importToDevice(const char* port, const char* framePath) {
+    std::vector<uint8_t> frame;
+    if (!readFile(framePath, frame)) return 1;
+    ProvStatus status = provValidate(frame.data(), frame.size());
+    if (status != PROV_OK) {
+        std::cerr << "Refusing to send invalid frame: " << provStatusName(status) << "\n";
+        return 1;
+    }
+
+    int fd = openSerial(port);
+    if (fd < 0) return 1;
+
+    const char cmd[] = "import\n";
+    write(fd, cmd, sizeof(cmd) - 1);
+    std::string seen;
+    if (!readUntil(fd, "READY", seen) || !readUntil(fd, "\n", seen)) {
+        std::cerr << "Device did not enter import mode\n";
+        close(fd);
+        return 1;
+    }
+    write(fd, frame.data(), frame.size());
+
+    seen.clear();
+    bool answered = readUntil(fd, "IMPORT ", seen) && readUntil(fd, "\n", seen);
+    close(fd);
+    if (!answered) {
+        std::cerr << "No answer from device\n";
+        return 1;
+    }
+    std::string result = seen.substr(seen.rfind("IMPORT "));
+    std::cout << result;
+    return result.compare(0, 9, "IMPORT OK") == 0 ? 0 : 1;
+}
+
+void usage() {
+    std::cerr << "Usage:\n"
+                 "  provision dump   <frame.bin>\n"
+                 "  provision build  <settings.txt> <out.bin>\n"
+                 "  provision export <port> <out.bin>\n"
+                 "  provision import <port> <frame.bin>\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        usage();
+        return 2;
+    }
+    std::string cmd = argv[1];
+    if (cmd == "dump") {
+        std::vector<uint8_t> frame;
+        return readFile(argv[2], frame) ? dumpFrame(frame) : 1;
+    }
+    if (argc < 4) {
+        usage();
+        return 2;
+    }
+    if (cmd == "build") return buildFrame(argv[2], argv[3]);
+    if (cmd == "export") return exportFromDevice(argv[2], argv[3]);
+    if (cmd == "import") return importToDevice(argv[2], argv[3]);
+    usage();
+    return 2;
+}